@@ -0,0 +1,105 @@
+/**
+ * @file crc32c_bench.cc
+ * @author Derek Huang
+ * @brief CRC32C throughput benchmark
+ * @copyright MIT License
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#define PDNNET_HAS_PROGRAM_USAGE
+
+#include "pdnnet/cliopt.h"
+#include "pdnnet/crc32c.hh"
+
+PDNNET_PROGRAM_USAGE_DEF
+(
+  "Benchmark CRC32C throughput of the table-driven, serial hardware, and\n"
+  "3-way interleaved hardware implementations across several input sizes.\n"
+  "\n"
+  "Throughput is reported in GiB/s. Hardware columns are only printed if the\n"
+  "CPU supports hardware CRC32C instructions."
+)
+
+namespace {
+
+/**
+ * Return throughput in GiB/s of a CRC32C implementation.
+ *
+ * Each call continues from the previous CRC so calls cannot be elided.
+ *
+ * @tparam Func Callable with signature
+ *  `std::uint32_t(const unsigned char*, std::size_t, std::uint32_t)`
+ *
+ * @param func CRC32C implementation
+ * @param data Input bytes
+ * @param size Number of input bytes
+ * @param checksum Running checksum
+ */
+template <typename Func>
+double throughput(
+  Func func, const unsigned char* data, std::size_t size, std::uint32_t& checksum)
+{
+  // run for roughly 256 MiB total, at least 16 iterations
+  std::size_t n_iter = (std::max)(std::size_t{16U}, (std::size_t{1U} << 28) / size);
+  auto start = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < n_iter; i++)
+    checksum = func(data, size, checksum);
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  return static_cast<double>(n_iter * size) / elapsed.count() / (1U << 30);
+}
+
+}  // namespace
+
+PDNNET_ARG_MAIN
+{
+  PDNNET_CLIOPT_PARSE_OPTIONS();
+  // random input large enough for the largest size
+  std::vector<std::size_t> sizes{64U, 512U, 4096U, 16384U, 65536U, 1U << 20};
+  std::vector<unsigned char> data(sizes.back());
+  std::mt19937 gen{8888};
+  std::uniform_int_distribution<int> dist{0, 255};
+  for (auto& value : data)
+    value = static_cast<unsigned char>(dist(gen));
+  // implementations
+  auto table = [](const unsigned char* p, std::size_t n, std::uint32_t crc)
+  {
+    return pdnnet::crc32c_table(p, n, crc);
+  };
+  std::uint32_t checksum = 0;
+  auto hardware = pdnnet::crc32c_hardware();
+  std::cout << std::setw(10) << "size" << std::setw(12) << "table";
+  if (hardware)
+    std::cout << std::setw(12) << "serial" << std::setw(12) << "3-way";
+  std::cout << "\n" << std::fixed << std::setprecision(2);
+  for (auto size : sizes) {
+    std::cout << std::setw(10) << size <<
+      std::setw(12) << throughput(table, data.data(), size, checksum);
+#if defined(PDNNET_HAS_SSE42_CRC32C) || defined(PDNNET_HAS_ARM_CRC32C)
+    if (hardware) {
+      auto serial = [](const unsigned char* p, std::size_t n, std::uint32_t crc)
+      {
+        return ~pdnnet::detail::crc32c_update_hw_serial(~crc, p, n);
+      };
+      auto interleaved = [](const unsigned char* p, std::size_t n, std::uint32_t crc)
+      {
+        return pdnnet::crc32c(p, n, crc);
+      };
+      std::cout <<
+        std::setw(12) << throughput(serial, data.data(), size, checksum) <<
+        std::setw(12) << throughput(interleaved, data.data(), size, checksum);
+    }
+#endif  // defined(PDNNET_HAS_SSE42_CRC32C) || defined(PDNNET_HAS_ARM_CRC32C)
+    std::cout << "\n";
+  }
+  std::cout << "checksum: " << std::hex << checksum << std::endl;
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,481 @@
+/**
+ * @file soakbench.cc
+ * @author Derek Huang
+ * @brief Long-running soak benchmark for resource growth and latency drift
+ * @copyright MIT License
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstddef>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#define PDNNET_HAS_PROGRAM_USAGE
+#define PDNNET_ADD_CLIOPT_MAX_CONNECT
+#define PDNNET_ADD_CLIOPT_MESSAGE_BYTES
+#define PDNNET_ADD_CLIOPT_TIMEOUT
+#define PDNNET_CLIOPT_MAX_CONNECT_DEFAULT 8
+#define PDNNET_CLIOPT_MESSAGE_BYTES_DEFAULT 4096
+#define PDNNET_CLIOPT_TIMEOUT_DEFAULT 60000
+
+#include "pdnnet/cliopt.h"
+#include "pdnnet/echoserver.hh"
+#include "pdnnet/platform.h"
+#include "pdnnet/server.hh"
+#include "pdnnet/socket.hh"
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif  // defined(__GLIBC__)
+
+PDNNET_PROGRAM_USAGE_DEF
+(
+  "Soak an in-process echoserver with a mixed workload and track resource\n"
+  "usage and latency over time.\n"
+  "\n"
+  "MAX_CONNECT client threads each open a new connection per request, i.e.\n"
+  "connections churn constantly, and send a message with a log-uniform random\n"
+  "size of up to MESSAGE_BYTES bytes, with occasional think time between\n"
+  "requests. Every fifth sample interval all clients go idle. The timeout gives\n"
+  "the total soak duration, e.g. 14400000 for four hours.\n"
+  "\n"
+  "Each sample reports RSS, glibc heap usage and fragmentation, open file\n"
+  "descriptors, threads, request rate, and p50/p99 latency for the interval.\n"
+  "At the end, each metric is flagged if it grew monotonically after warmup,\n"
+  "in which case the exit status is nonzero.\n"
+  "\n"
+  "Only supported on Linux, where /proc provides process statistics."
+)
+
+#ifdef PDNNET_LINUX
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+/**
+ * Process resource usage and request statistics at one point in time.
+ */
+struct soak_sample {
+  double elapsed_s{};
+  double rss_kib{};
+  double heap_used_kib{};
+  double heap_free_kib{};
+  double fragmentation{};  // free heap as a fraction of heap obtained
+  double n_fds{};
+  double n_threads{};
+  double request_rate{};
+  double p50_us{};
+  double p99_us{};
+  std::size_t n_errors{};
+  bool idle{};
+};
+
+/**
+ * Read RSS and thread count from `/proc/self/status`.
+ *
+ * @param sample Sample to update
+ */
+void read_status(soak_sample& sample)
+{
+  std::ifstream in{"/proc/self/status"};
+  std::string line;
+  while (std::getline(in, line)) {
+    std::istringstream fields{line};
+    std::string key;
+    double value;
+    if (!(fields >> key >> value))
+      continue;
+    if (key == "VmRSS:")
+      sample.rss_kib = value;
+    else if (key == "Threads:")
+      sample.n_threads = value;
+  }
+}
+
+/**
+ * Return number of open file descriptors.
+ */
+std::size_t count_fds()
+{
+  std::size_t n = 0;
+  for ([[maybe_unused]] const auto& entry :
+    std::filesystem::directory_iterator{"/proc/self/fd"})
+    n++;
+  // the directory iterator's own descriptor is not counted
+  return (n) ? n - 1 : 0;
+}
+
+/**
+ * Read allocator statistics, if available.
+ *
+ * Uses `mallinfo2` on glibc 2.33 or newer. Heap usage counts both the main
+ * arena and thread arenas, and `mmap`-backed chunks count as used.
+ *
+ * @param sample Sample to update
+ */
+void read_heap(soak_sample& sample)
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+  auto info = mallinfo2();
+  sample.heap_used_kib = (info.uordblks + info.hblkhd) / 1024.;
+  sample.heap_free_kib = info.fordblks / 1024.;
+  if (info.arena)
+    sample.fragmentation = static_cast<double>(info.fordblks) / info.arena;
+#else
+  (void) sample;
+#endif  // !defined(__GLIBC__) || (__GLIBC__ <= 2 && __GLIBC_MINOR__ < 33)
+}
+
+/**
+ * Return the given percentile of a nonempty set of values.
+ *
+ * @param values Values, which are partially reordered
+ * @param q Percentile in `[0, 1]`
+ */
+double percentile(std::vector<double>& values, double q)
+{
+  auto nth = values.begin() +
+    static_cast<std::ptrdiff_t>(q * static_cast<double>(values.size() - 1));
+  std::nth_element(values.begin(), nth, values.end());
+  return *nth;
+}
+
+/**
+ * Workload state shared by the client threads and the sampler.
+ */
+class soak_state {
+public:
+  /**
+   * Return `true` if clients should stop.
+   */
+  bool stopped() const noexcept { return stop_; }
+
+  /**
+   * Tell clients to stop.
+   */
+  void stop() noexcept { stop_ = true; }
+
+  /**
+   * Return `true` if clients should stay idle.
+   */
+  bool idle() const noexcept { return idle_; }
+
+  /**
+   * Set whether clients should stay idle.
+   *
+   * @param idle `true` to idle clients
+   */
+  void idle(bool idle) noexcept { idle_ = idle; }
+
+  /**
+   * Record a successful request.
+   *
+   * @param latency Request latency
+   */
+  void success(clock_type::duration latency)
+  {
+    std::chrono::duration<double, std::micro> us = latency;
+    std::lock_guard lock{mutex_};
+    latencies_.push_back(us.count());
+  }
+
+  /**
+   * Record a failed request.
+   */
+  void failure() noexcept { n_errors_++; }
+
+  /**
+   * Return number of failed requests.
+   */
+  auto n_errors() const noexcept { return n_errors_.load(); }
+
+  /**
+   * Return and clear latencies in microseconds recorded since the last call.
+   */
+  auto take_latencies()
+  {
+    std::vector<double> latencies;
+    std::lock_guard lock{mutex_};
+    latencies.swap(latencies_);
+    return latencies;
+  }
+
+private:
+  std::atomic<bool> stop_{};
+  std::atomic<bool> idle_{};
+  std::atomic<std::size_t> n_errors_{};
+  std::mutex mutex_;
+  std::vector<double> latencies_;
+};
+
+/**
+ * Client loop sending echo requests until stopped.
+ *
+ * Each request uses a new connection and a message of log-uniform random size
+ * so that small requests dominate while large ones still occur regularly.
+ *
+ * @param addr Server address
+ * @param max_bytes Maximum message size
+ * @param state Shared workload state
+ * @param seed Random seed
+ */
+void client(
+  const sockaddr_in& addr,
+  std::size_t max_bytes,
+  soak_state& state,
+  unsigned int seed)
+{
+  std::mt19937 rng{seed};
+  std::uniform_real_distribution<double> log_size{0., std::log(max_bytes + 1.)};
+  std::uniform_int_distribution<int> percent{0, 99};
+  std::string message;
+  while (!state.stopped()) {
+    if (state.idle()) {
+      std::this_thread::sleep_for(std::chrono::milliseconds{10});
+      continue;
+    }
+    auto size = std::clamp<std::size_t>(
+      static_cast<std::size_t>(std::exp(log_size(rng))), 1U, max_bytes
+    );
+    message.assign(size, static_cast<char>('a' + size % 26));
+    auto start = clock_type::now();
+    try {
+      pdnnet::unique_socket socket{AF_INET, SOCK_STREAM};
+      if (!pdnnet::connect(socket, addr))
+        throw std::runtime_error{pdnnet::socket_error("Could not connect")};
+      pdnnet::socket_writer{socket, true}(message).throw_on_error();
+      if (pdnnet::read(socket, std::chrono::milliseconds{1000}) == message)
+        state.success(clock_type::now() - start);
+      else
+        state.failure();
+    }
+    catch (const std::runtime_error&) {
+      state.failure();
+    }
+    // occasional think time between requests
+    if (percent(rng) < 5)
+      std::this_thread::sleep_for(std::chrono::milliseconds{percent(rng)});
+  }
+}
+
+/**
+ * Take a sample, consuming the latencies recorded since the last sample.
+ *
+ * @param state Shared workload state
+ * @param start Time the soak started
+ * @param interval Sample interval
+ * @param idle `true` if the interval was idle
+ */
+soak_sample take_sample(
+  soak_state& state,
+  clock_type::time_point start,
+  clock_type::duration interval,
+  bool idle)
+{
+  soak_sample sample;
+  std::chrono::duration<double> elapsed = clock_type::now() - start;
+  std::chrono::duration<double> interval_s = interval;
+  sample.elapsed_s = elapsed.count();
+  sample.idle = idle;
+  read_status(sample);
+  read_heap(sample);
+  sample.n_fds = static_cast<double>(count_fds());
+  auto latencies = state.take_latencies();
+  sample.request_rate = latencies.size() / interval_s.count();
+  if (latencies.size()) {
+    sample.p50_us = percentile(latencies, 0.5);
+    sample.p99_us = percentile(latencies, 0.99);
+  }
+  sample.n_errors = state.n_errors();
+  return sample;
+}
+
+/**
+ * Print a sample table row.
+ *
+ * @param sample Sample to print
+ */
+void print_sample(const soak_sample& sample)
+{
+  std::cout << std::setprecision(1) <<
+    std::setw(10) << sample.elapsed_s <<
+    std::setw(12) << sample.rss_kib <<
+    std::setw(12) << sample.heap_used_kib <<
+    std::setw(12) << sample.heap_free_kib <<
+    std::setw(8) << 100 * sample.fragmentation <<
+    std::setw(6) << sample.n_fds <<
+    std::setw(8) << sample.n_threads <<
+    std::setw(10) << sample.request_rate <<
+    std::setw(10) << sample.p50_us <<
+    std::setw(10) << sample.p99_us <<
+    std::setw(8) << sample.n_errors <<
+    ((sample.idle) ? "  idle" : "") << std::endl;
+}
+
+/**
+ * Growth of a metric over the soak.
+ */
+struct growth {
+  double first;     // mean of the first window after warmup
+  double last;      // mean of the last window
+  bool monotonic;   // window means strictly increased
+};
+
+/**
+ * Number of windows the post-warmup samples are split into.
+ */
+constexpr std::size_t growth_windows = 4U;
+
+/**
+ * Return the growth of a metric, ignoring the first quarter as warmup.
+ *
+ * The remaining values are split into `growth_windows` windows and growth is
+ * monotonic if each window's mean exceeds the previous one's. Comparing
+ * window means rather than consecutive samples tolerates noise and plateaus,
+ * e.g. an allocator caching freed memory, while still catching a leak.
+ *
+ * @param values Metric values in sample order
+ */
+growth detect_growth(const std::vector<double>& values)
+{
+  auto begin = values.size() / 4;
+  auto window = (values.size() - begin) / growth_windows;
+  if (!window)
+    return {0., 0., false};
+  std::vector<double> means;
+  for (std::size_t i = 0; i < growth_windows; i++) {
+    auto first = values.begin() + static_cast<std::ptrdiff_t>(begin + i * window);
+    double sum = 0.;
+    for (auto it = first; it != first + static_cast<std::ptrdiff_t>(window); ++it)
+      sum += *it;
+    means.push_back(sum / window);
+  }
+  auto monotonic = std::adjacent_find(
+    means.begin(), means.end(), [](double a, double b) { return b <= a; }
+  ) == means.end();
+  return {means.front(), means.back(), monotonic};
+}
+
+/**
+ * Minimum relative growth between the first and last window to flag.
+ */
+constexpr double growth_threshold = 0.05;
+
+/**
+ * Print the growth summary of a metric and return `true` if flagged.
+ *
+ * @param name Metric name
+ * @param values Metric values in sample order
+ */
+bool print_growth(const char* name, const std::vector<double>& values)
+{
+  auto g = detect_growth(values);
+  auto relative = (g.first) ? g.last / g.first - 1. : 0.;
+  auto flagged = g.monotonic && relative >= growth_threshold;
+  std::cout << std::left << std::setw(12) << name << std::right <<
+    std::setprecision(1) << std::setw(12) << g.first << std::setw(12) <<
+    g.last << std::setw(9) << 100 * relative << "%" <<
+    ((flagged) ? "  GROWING" : "") << "\n";
+  return flagged;
+}
+
+}  // namespace
+#endif  // PDNNET_LINUX
+
+PDNNET_ARG_MAIN
+{
+  PDNNET_CLIOPT_PARSE_OPTIONS();
+#ifdef PDNNET_LINUX
+  // clients may close while the server is still writing
+  std::signal(SIGPIPE, SIG_IGN);
+  std::chrono::milliseconds duration{PDNNET_CLIOPT(timeout)};
+  auto n_clients = PDNNET_CLIOPT(max_connect);
+  // about 40 samples, at least every minute for long soaks
+  auto interval = std::clamp<std::chrono::milliseconds>(
+    duration / 40,
+    std::chrono::milliseconds{250},
+    std::chrono::milliseconds{60000}
+  );
+  // thread-per-connection server under test
+  pdnnet::echoserver server;
+  std::thread server_thread{
+    [&server, n_clients]
+    {
+      server.start(
+        pdnnet::server_params{}.max_pending(64U).max_concurrency(n_clients)
+      );
+    }
+  };
+  while (!server.running())
+    std::this_thread::yield();
+  auto addr = pdnnet::make_sockaddr_in(INADDR_LOOPBACK, server.port());
+  soak_state state;
+  std::vector<std::thread> clients;
+  for (unsigned int i = 0; i < n_clients; i++)
+    clients.emplace_back(
+      [&, i] { client(addr, PDNNET_CLIOPT(message_bytes), state, i + 1); }
+    );
+  std::cout << "soak " << duration.count() << " ms, " << n_clients <<
+    " clients, up to " << PDNNET_CLIOPT(message_bytes) << " bytes, sample every " <<
+    interval.count() << " ms\n" << std::fixed <<
+    std::setw(10) << "elapsed_s" << std::setw(12) << "rss_kib" <<
+    std::setw(12) << "heap_kib" << std::setw(12) << "free_kib" <<
+    std::setw(8) << "frag%" << std::setw(6) << "fds" <<
+    std::setw(8) << "threads" << std::setw(10) << "req/s" <<
+    std::setw(10) << "p50_us" << std::setw(10) << "p99_us" <<
+    std::setw(8) << "errors" << "\n";
+  std::vector<soak_sample> samples;
+  auto start = clock_type::now();
+  for (std::size_t i = 0; clock_type::now() - start < duration; i++) {
+    // every fifth interval is idle to expose memory not returned when quiet
+    auto idle = i % 5 == 4;
+    state.idle(idle);
+    std::this_thread::sleep_for(interval);
+    samples.push_back(take_sample(state, start, interval, idle));
+    print_sample(samples.back());
+  }
+  state.stop();
+  for (auto& thread : clients)
+    thread.join();
+  server.stop();
+  server_thread.join();
+  // memory and descriptor metrics use all samples, latency only busy ones
+  std::vector<double> rss, heap, fds, threads, p99;
+  for (const auto& sample : samples) {
+    rss.push_back(sample.rss_kib);
+    heap.push_back(sample.heap_used_kib);
+    fds.push_back(sample.n_fds);
+    threads.push_back(sample.n_threads);
+    if (!sample.idle && sample.request_rate)
+      p99.push_back(sample.p99_us);
+  }
+  std::cout << "\n" << std::left << std::setw(12) << "metric" << std::right <<
+    std::setw(12) << "first" << std::setw(12) << "last" << std::setw(10) <<
+    "growth" << "\n";
+  auto flagged = print_growth("rss_kib", rss);
+  flagged = print_growth("heap_kib", heap) || flagged;
+  flagged = print_growth("fds", fds) || flagged;
+  flagged = print_growth("threads", threads) || flagged;
+  flagged = print_growth("p99_us", p99) || flagged;
+  std::cout << std::flush;
+  return (flagged) ? EXIT_FAILURE : EXIT_SUCCESS;
+#else
+  std::cerr << PDNNET_PROGRAM_NAME << ": Only supported on Linux" << std::endl;
+  return EXIT_FAILURE;
+#endif  // !PDNNET_LINUX
+}
@@ -0,0 +1,546 @@
+/**
+ * @file tlsbench.cc
+ * @author Derek Huang
+ * @brief TLS handshake rate and bulk throughput benchmark
+ * @copyright MIT License
+ */
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstddef>
+#include <cstdlib>
+#include <exception>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define PDNNET_HAS_PROGRAM_USAGE
+#define PDNNET_ADD_CLIOPT_MAX_CONNECT
+#define PDNNET_ADD_CLIOPT_TIMEOUT
+#define PDNNET_CLIOPT_MAX_CONNECT_DEFAULT 4
+#define PDNNET_CLIOPT_TIMEOUT_DEFAULT 200
+
+#include "pdnnet/cliopt.h"
+#include "pdnnet/platform.h"
+#include "pdnnet/socket.hh"
+
+#ifdef PDNNET_UNIX
+#include <openssl/evp.h>
+#include <openssl/obj_mac.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+#endif  // PDNNET_UNIX
+
+#include "pdnnet/tls.hh"
+
+PDNNET_PROGRAM_USAGE_DEF
+(
+  "Benchmark TLS performance of unique_tls_layer, tls_reader, and tls_writer\n"
+  "over loopback using generated self-signed certificates.\n"
+  "\n"
+  "For each cipher suite, full and resumed handshakes per second are reported\n"
+  "followed by bulk throughput in MiB/s for several record sizes. Each value is\n"
+  "measured with one connection at a time and with MAX_CONNECT concurrent\n"
+  "connections, each with its own client and server thread. The timeout gives\n"
+  "the duration of each measurement.\n"
+  "\n"
+  "Only supported on *nix systems, where OpenSSL provides TLS."
+)
+
+#ifdef PDNNET_UNIX
+namespace {
+
+using pkey_ptr = std::unique_ptr<EVP_PKEY, decltype(&EVP_PKEY_free)>;
+using x509_ptr = std::unique_ptr<X509, decltype(&X509_free)>;
+
+/**
+ * Generate a private key.
+ *
+ * @param ec `true` for a P-256 ECDSA key, `false` for a 2048-bit RSA key
+ */
+pkey_ptr make_key(bool ec)
+{
+  std::unique_ptr<EVP_PKEY_CTX, decltype(&EVP_PKEY_CTX_free)> ctx{
+    EVP_PKEY_CTX_new_id((ec) ? EVP_PKEY_EC : EVP_PKEY_RSA, nullptr),
+    EVP_PKEY_CTX_free
+  };
+  if (!ctx || EVP_PKEY_keygen_init(ctx.get()) <= 0)
+    throw std::runtime_error{pdnnet::openssl_error_string("Key init failed")};
+  auto status = (ec) ?
+    EVP_PKEY_CTX_set_ec_paramgen_curve_nid(ctx.get(), NID_X9_62_prime256v1) :
+    EVP_PKEY_CTX_set_rsa_keygen_bits(ctx.get(), 2048);
+  EVP_PKEY* key = nullptr;
+  if (status <= 0 || EVP_PKEY_keygen(ctx.get(), &key) <= 0)
+    throw std::runtime_error{pdnnet::openssl_error_string("Key generation failed")};
+  return {key, EVP_PKEY_free};
+}
+
+/**
+ * Generate a self-signed certificate for `localhost` valid for one day.
+ *
+ * @param key Private key to sign with
+ */
+x509_ptr make_cert(EVP_PKEY* key)
+{
+  x509_ptr cert{X509_new(), X509_free};
+  if (!cert)
+    throw std::runtime_error{pdnnet::openssl_error_string("X509_new() failed")};
+  auto name = X509_get_subject_name(cert.get());
+  auto cn = reinterpret_cast<const unsigned char*>("localhost");
+  if (
+    !X509_set_version(cert.get(), 2) ||
+    !ASN1_INTEGER_set(X509_get_serialNumber(cert.get()), 1) ||
+    !X509_gmtime_adj(X509_getm_notBefore(cert.get()), 0) ||
+    !X509_gmtime_adj(X509_getm_notAfter(cert.get()), 86400) ||
+    !X509_set_pubkey(cert.get(), key) ||
+    !X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, cn, -1, -1, 0) ||
+    !X509_set_issuer_name(cert.get(), name) ||
+    !X509_sign(cert.get(), key, EVP_sha256())
+  )
+    throw std::runtime_error{
+      pdnnet::openssl_error_string("Certificate generation failed")
+    };
+  return cert;
+}
+
+/**
+ * Self-signed certificate and its private key.
+ */
+struct credentials {
+  pkey_ptr key;
+  x509_ptr cert;
+  const char* name;
+};
+
+/**
+ * Return self-signed credentials.
+ *
+ * @param ec `true` for a P-256 ECDSA key, `false` for a 2048-bit RSA key
+ */
+credentials make_credentials(bool ec)
+{
+  auto key = make_key(ec);
+  auto cert = make_cert(key.get());
+  return {std::move(key), std::move(cert), (ec) ? "p256" : "rsa2048"};
+}
+
+/**
+ * Cipher suite configuration benchmarked.
+ */
+struct suite {
+  int version;            // TLS1_2_VERSION or TLS1_3_VERSION
+  const char* name;       // OpenSSL cipher suite name
+  const credentials* creds;
+};
+
+/**
+ * Client and server TLS contexts restricted to a single cipher suite.
+ */
+struct suite_contexts {
+  pdnnet::unique_tls_context client;
+  pdnnet::unique_tls_context server;
+};
+
+/**
+ * Restrict a TLS context to a single protocol version and cipher suite.
+ *
+ * @param ctx TLS context
+ * @param config Cipher suite configuration
+ */
+void restrict_context(SSL_CTX* ctx, const suite& config)
+{
+  auto ok = SSL_CTX_set_min_proto_version(ctx, config.version) &&
+    SSL_CTX_set_max_proto_version(ctx, config.version) &&
+    ((config.version == TLS1_3_VERSION) ?
+      SSL_CTX_set_ciphersuites(ctx, config.name) :
+      SSL_CTX_set_cipher_list(ctx, config.name));
+  if (!ok)
+    throw std::runtime_error{
+      pdnnet::openssl_error_string(std::string{"Cannot use "} + config.name)
+    };
+}
+
+/**
+ * Create client and server contexts for a cipher suite.
+ *
+ * The server uses the suite's certificate and a session cache so that clients
+ * can resume sessions. The client does not verify the self-signed certificate.
+ *
+ * @param config Cipher suite configuration
+ */
+suite_contexts make_contexts(const suite& config)
+{
+  suite_contexts ctxs;
+  restrict_context(ctxs.client, config);
+  restrict_context(ctxs.server, config);
+  static const unsigned char session_id[] = "tlsbench";
+  if (
+    !SSL_CTX_use_certificate(ctxs.server, config.creds->cert.get()) ||
+    !SSL_CTX_use_PrivateKey(ctxs.server, config.creds->key.get()) ||
+    !SSL_CTX_set_session_id_context(ctxs.server, session_id, sizeof session_id - 1)
+  )
+    throw std::runtime_error{
+      pdnnet::openssl_error_string("Cannot set server credentials")
+    };
+  SSL_CTX_set_session_cache_mode(ctxs.server, SSL_SESS_CACHE_SERVER);
+  return ctxs;
+}
+
+/**
+ * Stream buffer that discards output and counts the bytes written.
+ */
+class counting_buf : public std::streambuf {
+public:
+  /**
+   * Return number of bytes written.
+   */
+  auto count() const noexcept { return count_; }
+
+protected:
+  std::streamsize xsputn(const char* /*s*/, std::streamsize n) override
+  {
+    count_ += static_cast<std::size_t>(n);
+    return n;
+  }
+
+  int_type overflow(int_type c) override
+  {
+    if (!traits_type::eq_int_type(c, traits_type::eof()))
+      count_++;
+    return traits_type::not_eof(c);
+  }
+
+private:
+  std::size_t count_{};
+};
+
+/**
+ * Loopback listener accepting connections on the next free port.
+ */
+class loopback_listener {
+public:
+  /**
+   * Ctor.
+   */
+  loopback_listener()
+    : socket_{AF_INET, SOCK_STREAM},
+      address_{pdnnet::make_sockaddr_in(INADDR_LOOPBACK, 0)}
+  {
+    if (!pdnnet::bind(socket_, address_) ||
+      !pdnnet::getsockname(socket_, address_) ||
+      !pdnnet::listen(socket_, 64U))
+      throw std::runtime_error{pdnnet::socket_error("Cannot start listener")};
+  }
+
+  /**
+   * Return listening socket.
+   */
+  const auto& socket() const noexcept { return socket_; }
+
+  /**
+   * Return a new socket connected to the listener.
+   */
+  auto connect() const
+  {
+    pdnnet::unique_socket socket{AF_INET, SOCK_STREAM};
+    if (!pdnnet::connect(socket, address_))
+      throw std::runtime_error{pdnnet::socket_error("Cannot connect")};
+    return socket;
+  }
+
+private:
+  pdnnet::unique_socket socket_;
+  sockaddr_in address_;
+};
+
+/**
+ * Run a function on the given number of threads and rethrow the first error.
+ *
+ * @tparam Func Callable with signature `void(unsigned int)`
+ *
+ * @param n_threads Number of threads
+ * @param func Function passed the thread index
+ */
+template <typename Func>
+void run_threads(unsigned int n_threads, Func func)
+{
+  std::exception_ptr error;
+  std::mutex error_mutex;
+  std::vector<std::thread> threads;
+  for (unsigned int i = 0; i < n_threads; i++)
+    threads.emplace_back(
+      [&, i]
+      {
+        try { func(i); }
+        catch (...) {
+          std::lock_guard lock{error_mutex};
+          if (!error)
+            error = std::current_exception();
+        }
+      }
+    );
+  for (auto& thread : threads)
+    thread.join();
+  if (error)
+    std::rethrow_exception(error);
+}
+
+/**
+ * Server loop accepting TLS connections until stopped.
+ *
+ * Each connection is sent a single byte after the handshake so that TLS 1.3
+ * session tickets are received by the client before it closes.
+ *
+ * @param listener Loopback listener
+ * @param ctx Server TLS context
+ * @param stop Flag set when the client is done
+ */
+void handshake_server(
+  const loopback_listener& listener,
+  const pdnnet::unique_tls_context& ctx,
+  const std::atomic<bool>& stop)
+{
+  while (!stop) {
+    if (!pdnnet::wait_pollin(listener.socket(), 10))
+      continue;
+    auto socket = pdnnet::accept(listener.socket());
+    pdnnet::unique_tls_layer layer{ctx};
+    // client may close early if it is stopped mid-handshake
+    if (layer.accept_handshake(socket))
+      continue;
+    if (pdnnet::tls_writer{layer}(std::string{"x"}))
+      continue;
+    SSL_shutdown(layer);
+  }
+}
+
+/**
+ * Return handshakes per second against a server on another thread.
+ *
+ * @param ctxs Client and server contexts
+ * @param resume `true` to resume a session from the first handshake
+ * @param duration Measurement duration
+ * @param n_reused Incremented for each handshake that reused a session
+ */
+double handshake_rate(
+  const suite_contexts& ctxs,
+  bool resume,
+  std::chrono::milliseconds duration,
+  std::atomic<std::size_t>& n_reused)
+{
+  loopback_listener listener;
+  std::atomic<bool> stop{};
+  std::thread server{[&] { handshake_server(listener, ctxs.server, stop); }};
+  std::unique_ptr<SSL_SESSION, decltype(&SSL_SESSION_free)> session{
+    nullptr, SSL_SESSION_free
+  };
+  std::size_t n_handshakes = 0;
+  std::chrono::steady_clock::time_point start;
+  std::exception_ptr error;
+  try {
+    // first handshake is not measured and provides the session to resume
+    for (bool warmup = true; ; warmup = false) {
+      if (!warmup && std::chrono::steady_clock::now() - start >= duration)
+        break;
+      auto socket = listener.connect();
+      pdnnet::unique_tls_layer layer{ctxs.client};
+      if (resume && session && !SSL_set_session(layer, session.get()))
+        throw std::runtime_error{pdnnet::openssl_error_string("SSL_set_session failed")};
+      layer.handshake(socket).throw_on_error();
+      std::stringstream byte;
+      pdnnet::tls_reader{layer, 1U}(byte).throw_on_error();
+      if (warmup) {
+        session.reset(SSL_get1_session(layer));
+        start = std::chrono::steady_clock::now();
+      }
+      else {
+        n_handshakes++;
+        if (layer.session_reused())
+          n_reused++;
+      }
+      SSL_shutdown(layer);
+    }
+  }
+  catch (...) {
+    error = std::current_exception();
+  }
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  stop = true;
+  server.join();
+  if (error)
+    std::rethrow_exception(error);
+  return n_handshakes / elapsed.count();
+}
+
+/**
+ * Return bulk throughput in MiB/s from a server writing on another thread.
+ *
+ * @param ctxs Client and server contexts
+ * @param record_size Bytes per server write, i.e. per TLS record
+ * @param duration Measurement duration
+ */
+double bulk_rate(
+  const suite_contexts& ctxs,
+  std::size_t record_size,
+  std::chrono::milliseconds duration)
+{
+  loopback_listener listener;
+  std::atomic<bool> stop{};
+  std::exception_ptr server_error;
+  // server writes records until stopped then closes
+  std::thread server{
+    [&]
+    {
+      try {
+        auto socket = pdnnet::accept(listener.socket());
+        pdnnet::unique_tls_layer layer{ctxs.server};
+        layer.accept_handshake(socket).throw_on_error();
+        pdnnet::tls_writer writer{layer};
+        std::string record(record_size, 'x');
+        while (!stop)
+          writer(record).throw_on_error();
+        SSL_shutdown(layer);
+      }
+      catch (...) {
+        server_error = std::current_exception();
+        stop = true;
+      }
+    }
+  };
+  counting_buf buf;
+  std::ostream out{&buf};
+  std::size_t n_bytes = 0;
+  std::chrono::duration<double> elapsed{};
+  {
+    auto socket = listener.connect();
+    pdnnet::unique_tls_layer layer{ctxs.client};
+    layer.handshake(socket).throw_on_error();
+    pdnnet::tls_reader reader{layer, pdnnet::tls_record_size_limit};
+    auto start = std::chrono::steady_clock::now();
+    // read until told to stop, then drain until server closes
+    while (!reader(out)) {
+      if (stop)
+        continue;
+      elapsed = std::chrono::steady_clock::now() - start;
+      if (elapsed >= duration) {
+        n_bytes = buf.count();
+        stop = true;
+      }
+    }
+  }
+  server.join();
+  if (server_error)
+    std::rethrow_exception(server_error);
+  return n_bytes / elapsed.count() / (1U << 20);
+}
+
+/**
+ * Return the sum of a rate measured concurrently on several threads.
+ *
+ * @tparam Func Callable with signature `double()`
+ *
+ * @param n_threads Number of threads
+ * @param func Function measuring a rate
+ */
+template <typename Func>
+double total_rate(unsigned int n_threads, Func func)
+{
+  std::vector<double> rates(n_threads);
+  run_threads(n_threads, [&](unsigned int i) { rates[i] = func(); });
+  double total = 0.;
+  for (auto rate : rates)
+    total += rate;
+  return total;
+}
+
+/**
+ * Print a table row label.
+ *
+ * @param config Cipher suite configuration
+ */
+void print_label(const suite& config)
+{
+  std::cout << std::left <<
+    std::setw(8) << ((config.version == TLS1_3_VERSION) ? "TLSv1.3" : "TLSv1.2") <<
+    std::setw(32) << config.name << std::setw(9) << config.creds->name <<
+    std::right;
+}
+
+}  // namespace
+#endif  // PDNNET_UNIX
+
+PDNNET_ARG_MAIN
+{
+  PDNNET_CLIOPT_PARSE_OPTIONS();
+#ifdef PDNNET_UNIX
+  // peers may close while the other end is still writing
+  std::signal(SIGPIPE, SIG_IGN);
+  std::chrono::milliseconds duration{PDNNET_CLIOPT(timeout)};
+  auto n_threads = PDNNET_CLIOPT(max_connect);
+  auto rsa = make_credentials(false);
+  auto ec = make_credentials(true);
+  std::vector<suite> suites{
+    {TLS1_3_VERSION, "TLS_AES_128_GCM_SHA256", &rsa},
+    {TLS1_3_VERSION, "TLS_AES_128_GCM_SHA256", &ec},
+    {TLS1_3_VERSION, "TLS_AES_256_GCM_SHA384", &ec},
+    {TLS1_3_VERSION, "TLS_CHACHA20_POLY1305_SHA256", &ec},
+    {TLS1_2_VERSION, "ECDHE-RSA-AES128-GCM-SHA256", &rsa},
+    {TLS1_2_VERSION, "ECDHE-ECDSA-AES128-GCM-SHA256", &ec},
+    {TLS1_2_VERSION, "ECDHE-ECDSA-CHACHA20-POLY1305", &ec}
+  };
+  std::vector<std::size_t> record_sizes{1024U, 4096U, 16384U};
+  // handshakes per second
+  std::cout << "handshakes/s, " << n_threads << " threads in || columns\n" <<
+    std::left << std::setw(49) << "suite" << std::right <<
+    std::setw(10) << "full" << std::setw(10) << "full||" <<
+    std::setw(10) << "resumed" << std::setw(10) << "resumed||" << "\n" <<
+    std::fixed << std::setprecision(0);
+  for (const auto& config : suites) {
+    auto ctxs = make_contexts(config);
+    print_label(config);
+    for (auto resume : {false, true}) {
+      std::atomic<std::size_t> n_reused{};
+      std::cout << std::setw(10) << handshake_rate(ctxs, resume, duration, n_reused);
+      std::cout << std::setw(10) << total_rate(
+        n_threads,
+        [&] { return handshake_rate(ctxs, resume, duration, n_reused); }
+      );
+      // resumed rates are meaningless if the server did not resume sessions
+      if (resume && !n_reused)
+        throw std::runtime_error{std::string{config.name} + ": Sessions not resumed"};
+    }
+    std::cout << "\n" << std::flush;
+  }
+  // bulk throughput
+  std::cout << "\nbulk MiB/s by record size, " << n_threads <<
+    " threads in || columns\n" << std::left << std::setw(49) << "suite" <<
+    std::right;
+  for (auto size : record_sizes)
+    std::cout << std::setw(10) << size << std::setw(10) << (std::to_string(size) + "||");
+  std::cout << "\n" << std::setprecision(1);
+  for (const auto& config : suites) {
+    auto ctxs = make_contexts(config);
+    print_label(config);
+    for (auto size : record_sizes) {
+      std::cout << std::setw(10) << bulk_rate(ctxs, size, duration);
+      std::cout << std::setw(10) << total_rate(
+        n_threads, [&] { return bulk_rate(ctxs, size, duration); }
+      );
+    }
+    std::cout << "\n" << std::flush;
+  }
+  return EXIT_SUCCESS;
+#else
+  std::cerr << PDNNET_PROGRAM_NAME << ": Only supported on *nix systems" <<
+    std::endl;
+  return EXIT_FAILURE;
+#endif  // !PDNNET_UNIX
+}
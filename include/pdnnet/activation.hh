@@ -0,0 +1,167 @@
+/**
+ * @file activation.hh
+ * @author Derek Huang
+ * @brief C++ header for socket activation via `LISTEN_FDS`
+ * @copyright MIT License
+ */
+
+#ifndef PDNNET_ACTIVATION_HH_
+#define PDNNET_ACTIVATION_HH_
+
+#include <cerrno>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "pdnnet/error.hh"
+#include "pdnnet/platform.h"
+#include "pdnnet/socket.hh"
+
+#ifdef PDNNET_UNIX
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif  // PDNNET_UNIX
+
+/**
+ * First file descriptor passed by socket activation.
+ */
+#ifndef PDNNET_LISTEN_FDS_START
+#define PDNNET_LISTEN_FDS_START 3
+#endif  // PDNNET_LISTEN_FDS_START
+
+namespace pdnnet {
+
+/**
+ * First file descriptor passed by socket activation.
+ */
+inline constexpr int listen_fds_start = PDNNET_LISTEN_FDS_START;
+
+namespace detail {
+
+/**
+ * Parse a non-negative decimal environment variable value.
+ *
+ * Throws `std::runtime_error` if the value is malformed.
+ *
+ * @param name Variable name used in error messages
+ * @param value Variable value
+ */
+inline unsigned long parse_listen_env(std::string_view name, const char* value)
+{
+  char* end;
+  errno = 0;
+  auto res = std::strtoul(value, &end, 10);
+  if (!*value || *end || *value == '-' || errno)
+    throw std::runtime_error{
+      "Malformed " + std::string{name} + " value \"" + value + "\""
+    };
+  return res;
+}
+
+}  // namespace detail
+
+/**
+ * Return listening sockets passed by a supervisor using socket activation.
+ *
+ * Follows the `LISTEN_FDS` convention used by systemd and other supervisors:
+ * `LISTEN_PID` holds the pid the sockets are meant for and `LISTEN_FDS` the
+ * number of sockets, which are open starting at descriptor `listen_fds_start`.
+ * The descriptors are marked close-on-exec. No supervisor daemon is needed, so
+ * a parent process or test can pass sockets itself. On Windows, or if the
+ * variables are unset or meant for another process, no sockets are returned.
+ *
+ * The supervisor keeps its own copies of the sockets, so connections queue in
+ * the kernel while the process is starting or restarting instead of being
+ * refused. Throws `std::runtime_error` if the variables are malformed.
+ *
+ * @param unset_environment `true` to unset the variables so child processes
+ *  do not also try to take the sockets
+ */
+inline std::vector<socket_handle> listen_fds(bool unset_environment = false)
+{
+  std::vector<socket_handle> handles;
+#if defined(PDNNET_UNIX)
+  auto pid_value = std::getenv("LISTEN_PID");
+  auto fds_value = std::getenv("LISTEN_FDS");
+  if (pid_value && fds_value) {
+    auto pid = detail::parse_listen_env("LISTEN_PID", pid_value);
+    auto n_fds = detail::parse_listen_env("LISTEN_FDS", fds_value);
+    if (pid == static_cast<unsigned long>(getpid())) {
+      for (unsigned long i = 0; i < n_fds; i++) {
+        auto fd = listen_fds_start + static_cast<int>(i);
+        auto flags = fcntl(fd, F_GETFD);
+        if (flags < 0 || fcntl(fd, F_SETFD, flags | FD_CLOEXEC) < 0)
+          throw std::runtime_error{
+            errno_error("Invalid LISTEN_FDS descriptor " + std::to_string(fd))
+          };
+        handles.push_back(fd);
+      }
+    }
+  }
+  if (unset_environment) {
+    unsetenv("LISTEN_PID");
+    unsetenv("LISTEN_FDS");
+    unsetenv("LISTEN_FDNAMES");
+  }
+#else
+  (void) unset_environment;
+#endif  // !defined(PDNNET_UNIX)
+  return handles;
+}
+
+/**
+ * Return a socket owning a duplicate of a pre-opened IPv4 listening socket.
+ *
+ * The caller, e.g. a supervisor or `listen_fds`, keeps the original handle
+ * open, so closing the returned socket does not stop the kernel from queuing
+ * connections on the listening socket. Throws `std::runtime_error` if the
+ * handle is not a listening IPv4 stream socket or on Windows, where handles
+ * cannot be duplicated this way.
+ *
+ * @param handle Listening socket handle
+ * @param address Address struct to write the socket's bound address to
+ */
+inline unique_socket adopt_listener(socket_handle handle, sockaddr_in& address)
+{
+#if defined(PDNNET_UNIX)
+  int type;
+  socklen_t len = sizeof type;
+  if (::getsockopt(handle, SOL_SOCKET, SO_TYPE, &type, &len))
+    throw std::runtime_error{socket_error("Could not get inherited socket type")};
+  if (type != SOCK_STREAM)
+    throw std::runtime_error{"Inherited socket is not a stream socket"};
+#ifdef SO_ACCEPTCONN
+  int listening;
+  len = sizeof listening;
+  if (::getsockopt(handle, SOL_SOCKET, SO_ACCEPTCONN, &listening, &len))
+    throw std::runtime_error{socket_error("Could not get inherited socket state")};
+  if (!listening)
+    throw std::runtime_error{"Inherited socket is not listening"};
+#endif  // SO_ACCEPTCONN
+  sockaddr_storage storage{};
+  len = sizeof storage;
+  if (::getsockname(handle, reinterpret_cast<sockaddr*>(&storage), &len))
+    throw std::runtime_error{
+      socket_error("Could not retrieve inherited socket address")
+    };
+  if (storage.ss_family != AF_INET)
+    throw std::runtime_error{"Inherited socket is not an IPv4 socket"};
+  address = *reinterpret_cast<const sockaddr_in*>(&storage);
+  unique_socket socket{fcntl(handle, F_DUPFD_CLOEXEC, 0)};
+  if (!socket.valid())
+    throw std::runtime_error{errno_error("Could not duplicate inherited socket")};
+  return socket;
+#else
+  (void) handle;
+  (void) address;
+  throw std::runtime_error{"Adopting inherited sockets is not supported"};
+#endif  // !defined(PDNNET_UNIX)
+}
+
+}  // namespace pdnnet
+
+#endif  // PDNNET_ACTIVATION_HH_
@@ -0,0 +1,425 @@
+/**
+ * @file bdp_tuner.hh
+ * @author Derek Huang
+ * @brief C++ header for bandwidth-delay product socket buffer sizing
+ * @copyright MIT License
+ */
+
+#ifndef PDNNET_BDP_TUNER_HH_
+#define PDNNET_BDP_TUNER_HH_
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+
+#include "pdnnet/error.hh"
+#include "pdnnet/platform.h"
+#include "pdnnet/socket.hh"
+
+namespace pdnnet {
+
+/**
+ * TCP connection statistics relevant for buffer sizing.
+ *
+ * Rates are in bytes per second and times in microseconds. Fields the
+ * running kernel does not report are left zero.
+ */
+struct tcp_stats {
+  std::chrono::microseconds rtt{};
+  std::chrono::microseconds min_rtt{};
+  std::uint32_t mss{};
+  std::uint32_t cwnd{};
+  std::uint32_t notsent_bytes{};
+  std::uint64_t bytes_acked{};
+  std::uint64_t bytes_received{};
+  std::uint64_t delivery_rate{};
+};
+
+#ifdef PDNNET_LINUX
+namespace detail {
+
+/**
+ * Kernel `struct tcp_info` offsets of fields newer than the glibc definition.
+ *
+ * The kernel ABI only ever appends fields and `getsockopt` reports how many
+ * bytes were filled, so fields are read at fixed offsets when present.
+ */
+inline constexpr std::size_t tcp_info_bytes_acked_offset = 120U;
+inline constexpr std::size_t tcp_info_bytes_received_offset = 128U;
+inline constexpr std::size_t tcp_info_notsent_bytes_offset = 144U;
+inline constexpr std::size_t tcp_info_min_rtt_offset = 148U;
+inline constexpr std::size_t tcp_info_delivery_rate_offset = 160U;
+
+/**
+ * Read a kernel `struct tcp_info` field if it was filled by `getsockopt`.
+ *
+ * @tparam T Field type
+ *
+ * @param buf Buffer filled by `getsockopt`
+ * @param len Number of bytes filled
+ * @param offset Field offset
+ * @param value Value to update if the field is present
+ */
+template <typename T>
+inline void read_tcp_info_field(
+  const unsigned char* buf, socklen_t len, std::size_t offset, T& value) noexcept
+{
+  if (offset + sizeof(T) <= static_cast<std::size_t>(len))
+    std::memcpy(&value, buf + offset, sizeof(T));
+}
+
+}  // namespace detail
+#endif  // PDNNET_LINUX
+
+/**
+ * Read TCP connection statistics of a connected socket.
+ *
+ * Uses `TCP_INFO` on Linux. On other platforms this returns an error.
+ *
+ * @param handle Connected TCP socket handle
+ * @param stats Statistics to update on success
+ * @returns Optional empty on success, with error message on failure
+ */
+inline optional_error read_tcp_stats(socket_handle handle, tcp_stats& stats)
+{
+#if defined(PDNNET_LINUX)
+  // large enough for every field currently defined by the kernel
+  alignas(8) unsigned char buf[256]{};
+  socklen_t len = sizeof buf;
+  if (::getsockopt(handle, IPPROTO_TCP, TCP_INFO, buf, &len) < 0)
+    return errno_error("getsockopt() TCP_INFO failure");
+  ::tcp_info info{};
+  std::memcpy(&info, buf, (std::min)(sizeof info, static_cast<std::size_t>(len)));
+  stats = {};
+  // rtt is only sampled by the sender, so fall back to receiver estimate
+  stats.rtt = std::chrono::microseconds{
+    info.tcpi_rtt ? info.tcpi_rtt : info.tcpi_rcv_rtt
+  };
+  stats.mss = info.tcpi_snd_mss;
+  stats.cwnd = info.tcpi_snd_cwnd;
+  std::uint32_t min_rtt = 0;
+  detail::read_tcp_info_field(
+    buf, len, detail::tcp_info_bytes_acked_offset, stats.bytes_acked
+  );
+  detail::read_tcp_info_field(
+    buf, len, detail::tcp_info_bytes_received_offset, stats.bytes_received
+  );
+  detail::read_tcp_info_field(
+    buf, len, detail::tcp_info_notsent_bytes_offset, stats.notsent_bytes
+  );
+  detail::read_tcp_info_field(buf, len, detail::tcp_info_min_rtt_offset, min_rtt);
+  detail::read_tcp_info_field(
+    buf, len, detail::tcp_info_delivery_rate_offset, stats.delivery_rate
+  );
+  // kernel reports ~0U before any sample is taken
+  if (min_rtt != (std::numeric_limits<std::uint32_t>::max)())
+    stats.min_rtt = std::chrono::microseconds{min_rtt};
+  return {};
+#else
+  (void) handle;
+  (void) stats;
+  return "TCP_INFO not supported on this platform";
+#endif  // !defined(PDNNET_LINUX)
+}
+
+/**
+ * Socket buffer tuner sizing buffers to the bandwidth-delay product.
+ *
+ * Each call to `sample` reads the connection RTT and achieved throughput,
+ * estimates the bandwidth-delay product (BDP), and sets the send and receive
+ * buffers to the BDP times a gain factor clamped to the configured caps.
+ * Buffers are only changed when the target differs from the current size by
+ * more than the hysteresis fraction to avoid needless `setsockopt` calls.
+ *
+ * Throughput is limited by the current buffer size, so a gain above one is
+ * needed for buffers to grow towards the path BDP. Note that on Linux setting
+ * a socket buffer size disables kernel autotuning for that buffer and that
+ * sizes are capped by `net.core.wmem_max` and `net.core.rmem_max`.
+ *
+ * @code{.cc}
+ * pdnnet::bdp_tuner tuner;
+ * pdnnet::client_reader reader{client};
+ * // periodically, e.g. between bulk transfers
+ * tuner.sample(client.socket()).throw_on_error();
+ * reader.buf_size(tuner.read_size());
+ * @endcode
+ */
+class bdp_tuner {
+public:
+  /**
+   * Default ctor.
+   *
+   * Uses a 64 KiB minimum buffer, 16 MiB maximum buffer, 1 MiB maximum read
+   * size, a gain of 2, and 25% hysteresis.
+   */
+  bdp_tuner() noexcept
+    : min_buffer_{64U * 1024U},
+      max_buffer_{16U * 1024U * 1024U},
+      max_read_size_{1024U * 1024U},
+      gain_{2.},
+      hysteresis_{0.25},
+      tune_send_{true},
+      tune_recv_{true},
+      last_bytes_{},
+      rtt_{},
+      throughput_{},
+      bdp_{},
+      send_buffer_{},
+      recv_buffer_{},
+      n_samples_{},
+      n_adjustments_{}
+  {}
+
+  /**
+   * Return the minimum buffer size in bytes.
+   */
+  auto min_buffer() const noexcept { return min_buffer_; }
+
+  /**
+   * Set the minimum buffer size in bytes.
+   *
+   * @param size New minimum buffer size
+   */
+  auto& min_buffer(std::size_t size) noexcept
+  {
+    min_buffer_ = size;
+    return *this;
+  }
+
+  /**
+   * Return the maximum buffer size in bytes.
+   */
+  auto max_buffer() const noexcept { return max_buffer_; }
+
+  /**
+   * Set the maximum buffer size in bytes.
+   *
+   * @param size New maximum buffer size, at most `INT_MAX`
+   */
+  auto& max_buffer(std::size_t size) noexcept
+  {
+    max_buffer_ = size;
+    return *this;
+  }
+
+  /**
+   * Return the maximum read size in bytes returned by `read_size`.
+   */
+  auto max_read_size() const noexcept { return max_read_size_; }
+
+  /**
+   * Set the maximum read size in bytes returned by `read_size`.
+   *
+   * @param size New maximum read size
+   */
+  auto& max_read_size(std::size_t size) noexcept
+  {
+    max_read_size_ = size;
+    return *this;
+  }
+
+  /**
+   * Return the factor the BDP is multiplied by to get the buffer size.
+   */
+  auto gain() const noexcept { return gain_; }
+
+  /**
+   * Set the factor the BDP is multiplied by to get the buffer size.
+   *
+   * @param value New gain, should be greater than one
+   */
+  auto& gain(double value) noexcept
+  {
+    gain_ = value;
+    return *this;
+  }
+
+  /**
+   * Return the fraction the target must differ by to change buffer sizes.
+   */
+  auto hysteresis() const noexcept { return hysteresis_; }
+
+  /**
+   * Set the fraction the target must differ by to change buffer sizes.
+   *
+   * @param value New hysteresis fraction, e.g. `0.25` for 25%
+   */
+  auto& hysteresis(double value) noexcept
+  {
+    hysteresis_ = value;
+    return *this;
+  }
+
+  /**
+   * Return `true` if the send buffer is tuned.
+   */
+  auto tune_send() const noexcept { return tune_send_; }
+
+  /**
+   * Indicate whether the send buffer should be tuned.
+   *
+   * @param enable `true` to tune the send buffer
+   */
+  auto& tune_send(bool enable) noexcept
+  {
+    tune_send_ = enable;
+    return *this;
+  }
+
+  /**
+   * Return `true` if the receive buffer is tuned.
+   */
+  auto tune_recv() const noexcept { return tune_recv_; }
+
+  /**
+   * Indicate whether the receive buffer should be tuned.
+   *
+   * @param enable `true` to tune the receive buffer
+   */
+  auto& tune_recv(bool enable) noexcept
+  {
+    tune_recv_ = enable;
+    return *this;
+  }
+
+  /**
+   * Sample connection statistics and resize buffers if needed.
+   *
+   * The first sample only records a throughput baseline unless the kernel
+   * reports a delivery rate. A tuner should only be used with one connection.
+   *
+   * @param handle Connected TCP socket handle
+   * @returns Optional empty on success, with error message on failure
+   */
+  optional_error sample(socket_handle handle)
+  {
+    tcp_stats stats;
+    auto now = std::chrono::steady_clock::now();
+    if (auto err = read_tcp_stats(handle, stats))
+      return err;
+    // achieved throughput since last sample in either direction
+    double rate = static_cast<double>(stats.delivery_rate);
+    auto bytes = stats.bytes_acked + stats.bytes_received;
+    if (n_samples_) {
+      std::chrono::duration<double> elapsed = now - last_time_;
+      if (elapsed.count() > 0. && bytes >= last_bytes_)
+        rate = (std::max)(rate, (bytes - last_bytes_) / elapsed.count());
+    }
+    last_time_ = now;
+    last_bytes_ = bytes;
+    n_samples_++;
+    rtt_ = stats.min_rtt.count() ? stats.min_rtt : stats.rtt;
+    throughput_ = rate;
+    // no estimate possible yet
+    if (!rtt_.count() || rate <= 0.)
+      return {};
+    bdp_ = static_cast<std::size_t>(rate * rtt_.count() / 1e6);
+    auto target = std::clamp(
+      static_cast<std::size_t>(gain_ * bdp_),
+      min_buffer_,
+      (std::min)(max_buffer_, static_cast<std::size_t>(INT_MAX))
+    );
+    bool adjusted = false;
+    if (tune_send_ && needs_resize(send_buffer_, target)) {
+      if (!set_send_buffer_size(handle, static_cast<int>(target)))
+        return socket_error("setsockopt() SO_SNDBUF failure");
+      send_buffer_ = target;
+      adjusted = true;
+    }
+    if (tune_recv_ && needs_resize(recv_buffer_, target)) {
+      if (!set_recv_buffer_size(handle, static_cast<int>(target)))
+        return socket_error("setsockopt() SO_RCVBUF failure");
+      recv_buffer_ = target;
+      adjusted = true;
+    }
+    if (adjusted)
+      n_adjustments_++;
+    return {};
+  }
+
+  /**
+   * Return the last RTT estimate, preferring the minimum RTT if known.
+   */
+  auto rtt() const noexcept { return rtt_; }
+
+  /**
+   * Return the last throughput estimate in bytes per second.
+   */
+  auto throughput() const noexcept { return throughput_; }
+
+  /**
+   * Return the last bandwidth-delay product estimate in bytes.
+   */
+  auto bdp() const noexcept { return bdp_; }
+
+  /**
+   * Return the send buffer size last set or zero if never set.
+   */
+  auto send_buffer() const noexcept { return send_buffer_; }
+
+  /**
+   * Return the receive buffer size last set or zero if never set.
+   */
+  auto recv_buffer() const noexcept { return recv_buffer_; }
+
+  /**
+   * Return the number of samples taken.
+   */
+  auto n_samples() const noexcept { return n_samples_; }
+
+  /**
+   * Return the number of samples that resulted in a buffer size change.
+   */
+  auto n_adjustments() const noexcept { return n_adjustments_; }
+
+  /**
+   * Return the suggested read chunk size in bytes.
+   *
+   * This is the receive buffer size capped by `max_read_size`, or the minimum
+   * buffer size if the receive buffer has not been set yet.
+   */
+  std::size_t read_size() const noexcept
+  {
+    return (std::min)(recv_buffer_ ? recv_buffer_ : min_buffer_, max_read_size_);
+  }
+
+private:
+  std::size_t min_buffer_;
+  std::size_t max_buffer_;
+  std::size_t max_read_size_;
+  double gain_;
+  double hysteresis_;
+  bool tune_send_;
+  bool tune_recv_;
+  std::chrono::steady_clock::time_point last_time_;
+  std::uint64_t last_bytes_;
+  std::chrono::microseconds rtt_;
+  double throughput_;
+  std::size_t bdp_;
+  std::size_t send_buffer_;
+  std::size_t recv_buffer_;
+  std::size_t n_samples_;
+  std::size_t n_adjustments_;
+
+  /**
+   * Return `true` if the buffer size differs enough from the target.
+   *
+   * @param current Current buffer size, zero if never set
+   * @param target Target buffer size
+   */
+  bool needs_resize(std::size_t current, std::size_t target) const noexcept
+  {
+    if (!current)
+      return true;
+    auto diff = (current > target) ? current - target : target - current;
+    return diff > hysteresis_ * current;
+  }
+};
+
+}  // namespace pdnnet
+
+#endif  // PDNNET_BDP_TUNER_HH_
@@ -0,0 +1,358 @@
+/**
+ * @file buffered_writer.hh
+ * @author Derek Huang
+ * @brief C++ header for buffered socket writes
+ * @copyright MIT License
+ */
+
+#ifndef PDNNET_BUFFERED_WRITER_HH_
+#define PDNNET_BUFFERED_WRITER_HH_
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif  // WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#include <WinSock2.h>
+#else
+#include <sys/socket.h>
+#include <sys/types.h>
+#endif  // !defined(_WIN32)
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+#include "pdnnet/error.hh"
+#include "pdnnet/memory.hh"
+#include "pdnnet/socket.hh"
+
+namespace pdnnet {
+
+/**
+ * Buffered socket writer that coalesces small writes.
+ *
+ * Output is accumulated in a buffer acquired from a `buffer_pool` and is only
+ * sent when `flush()` is called, when the flush threshold is reached, or when
+ * the writer is destroyed. Creating the writer inside a single iteration of an
+ * event loop, e.g. inside `ipv4_server::serve`, therefore means that all the
+ * output for that iteration is sent at the end with as few syscalls as
+ * possible. Messages larger than the buffer are written directly.
+ *
+ * @code{.cc}
+ * pdnnet::buffered_writer writer{socket};
+ * writer("HTTP/1.1 200 OK\r\n").throw_on_error();
+ * writer("Content-Length: 5\r\n\r\n").throw_on_error();
+ * writer("hello").throw_on_error();
+ * writer.flush().throw_on_error();
+ * @endcode
+ *
+ * When corking is enabled, `TCP_CORK` (or `TCP_NOPUSH`) is set on the socket
+ * for the writer's lifetime and toggled on each explicit `flush()` so that
+ * partial segments are pushed out. Threshold-triggered flushes on Linux use
+ * `MSG_MORE` to hint that more data will follow.
+ */
+class buffered_writer {
+public:
+  /**
+   * Ctor.
+   *
+   * The flush threshold is the size of the pool's buffers.
+   *
+   * @param handle Socket handle
+   * @param pool Buffer pool to acquire the write buffer from
+   */
+  buffered_writer(socket_handle handle, buffer_pool& pool = default_buffer_pool())
+    : buffered_writer{handle, pool.buf_size(), pool}
+  {}
+
+  /**
+   * Ctor.
+   *
+   * @param handle Socket handle
+   * @param flush_threshold Number of buffered bytes that triggers a flush,
+   *  capped at the size of the pool's buffers
+   * @param pool Buffer pool to acquire the write buffer from
+   * @param cork `true` to cork the socket while the writer is alive
+   *
+   * Throws `std::invalid_argument` if the capped flush threshold is zero.
+   */
+  buffered_writer(
+    socket_handle handle,
+    std::size_t flush_threshold,
+    buffer_pool& pool = default_buffer_pool(),
+    bool cork = false)
+    : handle_{handle},
+      pool_{pool},
+      flush_threshold_{checked_threshold(flush_threshold, pool)},
+      buf_{pool.acquire()},
+      n_buffered_{},
+      cork_{cork && set_tcp_cork(handle, true)},
+      more_held_{},
+      n_writes_{}
+  {}
+
+  /**
+   * Deleted copy ctor.
+   */
+  buffered_writer(const buffered_writer&) = delete;
+
+  /**
+   * Dtor.
+   *
+   * Flushes any remaining buffered bytes, uncorks, and returns the buffer to
+   * the pool. Errors are ignored, so call `flush()` first to check for them.
+   */
+  ~buffered_writer()
+  {
+    flush();
+    if (cork_)
+      set_tcp_cork(handle_, false);
+    pool_.release(std::move(buf_));
+  }
+
+  /**
+   * Return the socket handle.
+   */
+  auto handle() const noexcept { return handle_; }
+
+  /**
+   * Return number of bytes currently buffered.
+   */
+  auto pending() const noexcept { return n_buffered_; }
+
+  /**
+   * Return the number of buffered bytes that triggers a flush.
+   */
+  auto flush_threshold() const noexcept { return flush_threshold_; }
+
+  /**
+   * Return `true` if the socket is corked by the writer.
+   */
+  auto corked() const noexcept { return cork_; }
+
+  /**
+   * Return number of write syscalls made by the writer so far.
+   */
+  auto n_writes() const noexcept { return n_writes_; }
+
+  /**
+   * Buffer string view contents, flushing if the threshold is reached.
+   *
+   * @tparam CharT Char type
+   * @tparam Traits Char traits
+   *
+   * @param text String view to read input from
+   * @returns Optional empty on success, with error message on failure
+   */
+  template <typename CharT, typename Traits>
+  optional_error operator()(std::basic_string_view<CharT, Traits> text)
+  {
+    return append(text.data(), sizeof(CharT) * text.size());
+  }
+
+  /**
+   * Buffer string contents, flushing if the threshold is reached.
+   *
+   * @note Overload necessary since implicit conversions are not deduced.
+   *
+   * @tparam CharT Char type
+   * @tparam Traits Char traits
+   *
+   * @param text String to read input from
+   * @returns Optional empty on success, with error message on failure
+   */
+  template <typename CharT, typename Traits>
+  auto operator()(const std::basic_string<CharT, Traits>& text)
+  {
+    return (*this)(static_cast<std::basic_string_view<CharT, Traits>>(text));
+  }
+
+  /**
+   * Buffer null-terminated string contents, flushing if needed.
+   *
+   * @tparam CharT Char type
+   *
+   * @param text String literal or other null-terminated string to read from
+   * @returns Optional empty on success, with error message on failure
+   */
+  template <typename CharT>
+  auto operator()(const CharT* text)
+  {
+    return (*this)(std::basic_string_view{text});
+  }
+
+  /**
+   * Buffer a buffer of characters, flushing if the threshold is reached.
+   *
+   * @tparam CharT Char type
+   *
+   * @param buf Pointer to buffer of characters
+   * @param size Number of characters in the buffer
+   * @returns Optional empty on success, with error message on failure
+   */
+  template <typename CharT>
+  auto operator()(const CharT* buf, std::size_t size)
+  {
+    // handle void buffers by treating them as const char buffers
+    using char_type = std::conditional_t<std::is_same_v<CharT, void>, char, CharT>;
+    return append(buf, sizeof(char_type) * size);
+  }
+
+  /**
+   * Send all buffered bytes.
+   *
+   * If the socket is corked, it is briefly uncorked so that any partial
+   * segment is pushed out to the peer immediately.
+   *
+   * @returns Optional empty on success, with error message on failure
+   */
+  optional_error flush()
+  {
+    if (auto err = send_buffered(false))
+      return err;
+    // uncorking pushes out any partial segment, including one held back by a
+    // previous MSG_MORE send that was not followed by a normal send
+    if (cork_) {
+      set_tcp_cork(handle_, false);
+      set_tcp_cork(handle_, true);
+    }
+    else if (more_held_)
+      set_tcp_cork(handle_, false);
+    more_held_ = false;
+    return {};
+  }
+
+private:
+  socket_handle handle_;
+  buffer_pool& pool_;
+  std::size_t flush_threshold_;
+  byte_buffer<> buf_;
+  std::size_t n_buffered_;
+  bool cork_;
+  bool more_held_;
+  std::size_t n_writes_;
+
+  /**
+   * Return the flush threshold capped at the size of the pool's buffers.
+   *
+   * This runs before the buffer is acquired and the socket is corked, so an
+   * invalid threshold throws without leaving anything to undo.
+   *
+   * @param flush_threshold Requested flush threshold
+   * @param pool Buffer pool the write buffer will be acquired from
+   */
+  static std::size_t checked_threshold(
+    std::size_t flush_threshold, const buffer_pool& pool)
+  {
+    auto threshold = (std::min)(flush_threshold, pool.buf_size());
+    if (!threshold)
+      throw std::invalid_argument{"flush_threshold must be positive"};
+    return threshold;
+  }
+
+  /**
+   * Copy bytes into the buffer, sending when the flush threshold is reached.
+   *
+   * @param data Bytes to write
+   * @param size Number of bytes to write
+   * @returns Optional empty on success, with error message on failure
+   */
+  optional_error append(const void* data, std::size_t size)
+  {
+    auto bytes = static_cast<const byte*>(data);
+    // too large to ever fit, so send what's buffered and then send directly
+    if (size > buf_.size()) {
+      if (auto err = send_buffered(true))
+        return err;
+      return send_all(bytes, size, false);
+    }
+    // copy into buffer, sending as we hit the threshold
+    while (size) {
+      auto n_copy = (std::min)(size, flush_threshold_ - n_buffered_);
+      std::memcpy(buf_.get() + n_buffered_, bytes, n_copy);
+      n_buffered_ += n_copy;
+      bytes += n_copy;
+      size -= n_copy;
+      if (n_buffered_ == flush_threshold_) {
+        if (auto err = send_buffered(true))
+          return err;
+      }
+    }
+    return {};
+  }
+
+  /**
+   * Send and clear all buffered bytes.
+   *
+   * @param more `true` to hint that more data will follow shortly
+   * @returns Optional empty on success, with error message on failure
+   */
+  optional_error send_buffered(bool more)
+  {
+    if (!n_buffered_)
+      return {};
+    auto err = send_all(buf_.get(), n_buffered_, more);
+    n_buffered_ = 0;
+    return err;
+  }
+
+  /**
+   * Perform the standard send loop for a buffer of bytes.
+   *
+   * @param data Bytes to send
+   * @param size Number of bytes to send
+   * @param more `true` to hint that more data will follow shortly
+   * @returns Optional empty on success, with error message on failure
+   */
+  optional_error send_all(const byte* data, std::size_t size, bool more)
+  {
+#ifdef _WIN32
+    // since buffer length is int, throw error if message too long
+    if (size > INT_MAX)
+      return "Message length " + std::to_string(size) +
+        " exceeds max allowed length " + std::to_string(INT_MAX);
+#endif  // _WIN32
+    // MSG_MORE is Linux-only. elsewhere, corking is the only coalescing hint
+#if defined(MSG_MORE)
+    int flags = (more) ? MSG_MORE : 0;
+#else
+    (void) more;
+    int flags = 0;
+#endif  // !defined(MSG_MORE)
+    // don't raise SIGPIPE if the peer has gone away
+#if defined(MSG_NOSIGNAL)
+    flags |= MSG_NOSIGNAL;
+#endif  // defined(MSG_NOSIGNAL)
+    while (size) {
+#if defined(_WIN32)
+      auto n_last = ::send(
+        handle_,
+        reinterpret_cast<const char*>(data),
+        static_cast<int>(size),
+        flags
+      );
+      if (n_last == SOCKET_ERROR)
+        return winsock_error("send() failure");
+#else
+      auto n_last = ::send(handle_, data, size, flags);
+      if (n_last < 0)
+        return errno_error("send() failure");
+#endif  // !defined(_WIN32)
+      n_writes_++;
+      more_held_ = more;
+      data += n_last;
+      size -= static_cast<std::size_t>(n_last);
+    }
+    return {};
+  }
+};
+
+}  // namespace pdnnet
+
+#endif  // PDNNET_BUFFERED_WRITER_HH_
@@ -23,15 +23,22 @@
 #include <cerrno>
 #endif  // !defined(_WIN32)
 
+#include <algorithm>
 #include <chrono>
+#include <cstddef>
 #include <cstdio>
 #include <cstring>
+#include <mutex>
 #include <optional>
 #include <string>
+#include <utility>
+#include <vector>
 
+#include "pdnnet/deadline.hh"
 #include "pdnnet/error.hh"
 #include "pdnnet/features.h"
 #include "pdnnet/socket.hh"
+#include "pdnnet/source_address.hh"
 
 namespace pdnnet {
 
@@ -144,6 +151,69 @@ public:
     return {};
   }
 
+  /**
+   * Connect to the specified TCP/IP endpoint before a deadline.
+   *
+   * @note Host name resolution is not bounded by the deadline, so for a hard
+   *  latency bound `host` should be a numeric address.
+   *
+   * @param host IPv4 host name or address
+   * @param port Port number in local byte order
+   * @param deadline Deadline bounding the connection attempt
+   * @returns Error wrapper empty on success, with error message on failure
+   */
+  optional_error connect(
+    const std::string& host, inet_port_type port, const deadline& deadline)
+  {
+    unique_addrinfo addrs;
+    try {
+      addrs = getaddrinfo(host, port);
+    }
+    catch (const std::runtime_error& exc) {
+      return exc.what();
+    }
+    auto serv_addr = addrs.addr_in();
+    if (auto err = pdnnet::connect(socket_, serv_addr, deadline))
+      return err;
+    host_addr_ = serv_addr;
+    connected_ = true;
+    return {};
+  }
+
+  /**
+   * Connect to the specified TCP/IP endpoint from a pooled source address.
+   *
+   * The socket is bound to the next source address and port in `sources`
+   * before connecting, which is how clients making many short connections to
+   * the same endpoint avoid running out of ephemeral ports.
+   *
+   * @param host IPv4 host name or address
+   * @param port Port number in local byte order
+   * @param deadline Deadline bounding the connection attempt
+   * @param sources Source addresses to bind to
+   * @returns Error wrapper empty on success, with error message on failure
+   */
+  optional_error connect(
+    const std::string& host,
+    inet_port_type port,
+    const deadline& deadline,
+    source_address_pool& sources)
+  {
+    unique_addrinfo addrs;
+    try {
+      addrs = getaddrinfo(host, port);
+    }
+    catch (const std::runtime_error& exc) {
+      return exc.what();
+    }
+    auto serv_addr = addrs.addr_in();
+    if (auto err = sources.connect(socket_, serv_addr, deadline))
+      return err;
+    host_addr_ = serv_addr;
+    connected_ = true;
+    return {};
+  }
+
 private:
   unique_socket socket_;
   int type_;
@@ -152,6 +222,234 @@ private:
   sockaddr_in host_addr_;
 };
 
+/**
+ * Thread-safe pool of idle pre-connected sockets for a set of backends.
+ *
+ * Backend host names are resolved once when added. `acquire` hands out an idle
+ * connection if one is available, skipping any the backend has since closed,
+ * and otherwise connects a new socket, so connection setup can be taken off
+ * the request path by calling `prefill` ahead of time. Connections that were
+ * acquired but not used can be given back with `release`.
+ */
+class connection_pool {
+public:
+  /**
+   * Ctor.
+   *
+   * @param max_idle Maximum number of idle connections kept per backend
+   */
+  connection_pool(std::size_t max_idle = 4U) noexcept
+    : max_idle_{max_idle}, sources_{}, n_connects_{}, n_reused_{}
+  {}
+
+  /**
+   * Deleted copy ctor.
+   */
+  connection_pool(const connection_pool&) = delete;
+
+  /**
+   * Add a backend, returning an error if its host cannot be resolved.
+   *
+   * The new backend's index is `n_backends() - 1` on success.
+   *
+   * @param host IPv4 host name or address
+   * @param port Port number in local byte order
+   * @returns Error wrapper empty on success, with error message on failure
+   */
+  optional_error add(const std::string& host, inet_port_type port)
+  {
+    unique_addrinfo addrs;
+    try {
+      addrs = getaddrinfo(host, port);
+    }
+    catch (const std::runtime_error& exc) {
+      return exc.what();
+    }
+    std::lock_guard lock{mutex_};
+    backends_.push_back({addrs.addr_in(), {}});
+    return {};
+  }
+
+  /**
+   * Return number of backends.
+   */
+  auto n_backends() const
+  {
+    std::lock_guard lock{mutex_};
+    return backends_.size();
+  }
+
+  /**
+   * Return the resolved address of a backend.
+   *
+   * @param i Backend index
+   */
+  auto backend(std::size_t i) const
+  {
+    std::lock_guard lock{mutex_};
+    return backends_.at(i).addr;
+  }
+
+  /**
+   * Return maximum number of idle connections kept per backend.
+   */
+  auto max_idle() const noexcept { return max_idle_; }
+
+  /**
+   * Set the source addresses new connections are bound to.
+   *
+   * @param sources Source address pool, `nullptr` to let the kernel choose
+   */
+  auto& sources(source_address_pool* sources) noexcept
+  {
+    sources_ = sources;
+    return *this;
+  }
+
+  /**
+   * Return the source addresses new connections are bound to.
+   */
+  auto sources() const noexcept { return sources_; }
+
+  /**
+   * Return number of idle connections to a backend.
+   *
+   * @param i Backend index
+   */
+  auto n_idle(std::size_t i) const
+  {
+    std::lock_guard lock{mutex_};
+    return backends_.at(i).idle.size();
+  }
+
+  /**
+   * Return number of new connections made by the pool.
+   */
+  auto n_connects() const
+  {
+    std::lock_guard lock{mutex_};
+    return n_connects_;
+  }
+
+  /**
+   * Return number of idle connections handed out by `acquire`.
+   */
+  auto n_reused() const
+  {
+    std::lock_guard lock{mutex_};
+    return n_reused_;
+  }
+
+  /**
+   * Acquire a connection to a backend before a deadline.
+   *
+   * The mutex is not held while connecting.
+   *
+   * @param i Backend index
+   * @param socket Socket to move the connection into
+   * @param deadline Deadline bounding a new connection attempt
+   * @returns Error wrapper empty on success, with error message on failure
+   */
+  optional_error acquire(
+    std::size_t i, unique_socket& socket, const deadline& deadline)
+  {
+    sockaddr_in addr;
+    {
+      std::lock_guard lock{mutex_};
+      auto& idle = backends_.at(i).idle;
+      while (idle.size()) {
+        auto candidate = std::move(idle.back());
+        idle.pop_back();
+        // readable means the backend closed or sent unexpected data
+        if (poll(candidate, POLLIN, 0))
+          continue;
+        socket = std::move(candidate);
+        n_reused_++;
+        return {};
+      }
+      addr = backends_[i].addr;
+      n_connects_++;
+    }
+    unique_socket fresh{AF_INET, SOCK_STREAM};
+    if (auto err = connect(fresh, addr, deadline))
+      return err;
+    socket = std::move(fresh);
+    return {};
+  }
+
+  /**
+   * Return an unused connection to the pool.
+   *
+   * The connection is closed if the backend already has `max_idle()` idle
+   * connections.
+   *
+   * @param i Backend index
+   * @param socket Connected socket that has not been written to
+   */
+  void release(std::size_t i, unique_socket&& socket)
+  {
+    std::lock_guard lock{mutex_};
+    auto& idle = backends_.at(i).idle;
+    if (socket.valid() && idle.size() < max_idle_)
+      idle.push_back(std::move(socket));
+  }
+
+  /**
+   * Open connections to a backend until it has `n` idle connections.
+   *
+   * @param i Backend index
+   * @param n Number of idle connections, capped at `max_idle()`
+   * @param deadline Deadline bounding all the connection attempts
+   * @returns Error wrapper empty on success, with error message on failure
+   */
+  optional_error prefill(std::size_t i, std::size_t n, const deadline& deadline)
+  {
+    n = (std::min)(n, max_idle_);
+    auto addr = backend(i);
+    while (n_idle(i) < n) {
+      unique_socket socket{AF_INET, SOCK_STREAM};
+      if (auto err = connect(socket, addr, deadline))
+        return err;
+      std::lock_guard lock{mutex_};
+      n_connects_++;
+      backends_[i].idle.push_back(std::move(socket));
+    }
+    return {};
+  }
+
+private:
+  /**
+   * Connect a new socket, binding it to a source address if set.
+   *
+   * @param handle Unbound socket handle
+   * @param addr Backend address
+   * @param deadline Deadline bounding the connection attempt
+   * @returns Error wrapper empty on success, with error message on failure
+   */
+  optional_error connect(
+    socket_handle handle, const sockaddr_in& addr, const deadline& deadline)
+  {
+    if (sources_)
+      return sources_->connect(handle, addr, deadline);
+    return pdnnet::connect(handle, addr, deadline);
+  }
+
+  /**
+   * Backend address and its idle connections.
+   */
+  struct backend_state {
+    sockaddr_in addr;
+    std::vector<unique_socket> idle;
+  };
+
+  mutable std::mutex mutex_;
+  std::size_t max_idle_;
+  source_address_pool* sources_;
+  std::vector<backend_state> backends_;
+  std::size_t n_connects_;
+  std::size_t n_reused_;
+};
+
 /**
  * Client writer class for abstracting raw socket writes.
  *
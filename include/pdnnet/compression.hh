@@ -0,0 +1,596 @@
+/**
+ * @file compression.hh
+ * @author Derek Huang
+ * @brief C++ header for the framed connection compression stage
+ * @copyright MIT License
+ */
+
+#ifndef PDNNET_COMPRESSION_HH_
+#define PDNNET_COMPRESSION_HH_
+
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "pdnnet/endian.hh"
+#include "pdnnet/error.hh"
+#include "pdnnet/memory.hh"
+#include "pdnnet/socket.hh"
+
+// LZ4 and zstd are optional. the ENABLE_LZ4 and ENABLE_ZSTD CMake options find
+// liblz4 and libzstd, link them into pdnnet++ consumers, and define
+// PDNNET_HAS_LZ4 and PDNNET_HAS_ZSTD respectively. builds not using CMake must
+// define these macros themselves and link against the corresponding library.
+#ifdef PDNNET_HAS_LZ4
+#include <lz4.h>
+#endif  // PDNNET_HAS_LZ4
+#ifdef PDNNET_HAS_ZSTD
+#include <zstd.h>
+#endif  // PDNNET_HAS_ZSTD
+
+namespace pdnnet {
+
+/**
+ * Enum class for the compression algorithms a connection can negotiate.
+ *
+ * Values are bit flags so a set of supported algorithms fits in a byte.
+ */
+enum class compression_type : std::uint8_t { none = 0, lz4 = 1, zstd = 2 };
+
+/**
+ * Return the bitmask of compression algorithms compiled into the library.
+ */
+constexpr std::uint8_t supported_compression() noexcept
+{
+  std::uint8_t mask = 0;
+#ifdef PDNNET_HAS_LZ4
+  mask |= static_cast<std::uint8_t>(compression_type::lz4);
+#endif  // PDNNET_HAS_LZ4
+#ifdef PDNNET_HAS_ZSTD
+  mask |= static_cast<std::uint8_t>(compression_type::zstd);
+#endif  // PDNNET_HAS_ZSTD
+  return mask;
+}
+
+/**
+ * Return the string name of a compression algorithm.
+ *
+ * @param type Compression algorithm
+ */
+inline std::string compression_name(compression_type type)
+{
+  switch (type) {
+    case compression_type::none:
+      return "none";
+    case compression_type::lz4:
+      return "lz4";
+    case compression_type::zstd:
+      return "zstd";
+    default:
+      return "unknown";
+  }
+}
+
+/**
+ * Abstract block compression codec.
+ *
+ * A codec instance is used by a single connection and need not be thread-safe
+ * except that compression and decompression may run concurrently.
+ */
+class compression_codec {
+public:
+  /**
+   * Virtual dtor.
+   */
+  virtual ~compression_codec() = default;
+
+  /**
+   * Return the max compressed size of an input of the given size.
+   *
+   * @param size Input size in bytes
+   */
+  virtual std::size_t bound(std::size_t size) const noexcept = 0;
+
+  /**
+   * Compress a block of bytes.
+   *
+   * @param src Input bytes
+   * @param size Number of input bytes
+   * @param dst Output buffer with at least `bound(size)` bytes
+   * @param capacity Output buffer size
+   * @returns Number of compressed bytes written, zero on failure
+   */
+  virtual std::size_t compress(
+    const byte* src, std::size_t size, byte* dst, std::size_t capacity) = 0;
+
+  /**
+   * Decompress a block of bytes.
+   *
+   * @param src Compressed bytes
+   * @param size Number of compressed bytes
+   * @param dst Output buffer
+   * @param original Original uncompressed size, i.e. size of `dst`
+   * @returns `true` on success, `false` if the input is corrupt
+   */
+  virtual bool decompress(
+    const byte* src, std::size_t size, byte* dst, std::size_t original) = 0;
+};
+
+#ifdef PDNNET_HAS_LZ4
+/**
+ * LZ4 block compression codec.
+ *
+ * LZ4 trades compression ratio for very cheap compression and decompression.
+ */
+class lz4_codec : public compression_codec {
+public:
+  std::size_t bound(std::size_t size) const noexcept override
+  {
+    if (size > LZ4_MAX_INPUT_SIZE)
+      return 0;
+    return static_cast<std::size_t>(LZ4_compressBound(static_cast<int>(size)));
+  }
+
+  std::size_t compress(
+    const byte* src, std::size_t size, byte* dst, std::size_t capacity) override
+  {
+    if (size > LZ4_MAX_INPUT_SIZE || capacity > INT_MAX)
+      return 0;
+    auto n = LZ4_compress_default(
+      reinterpret_cast<const char*>(src),
+      reinterpret_cast<char*>(dst),
+      static_cast<int>(size),
+      static_cast<int>(capacity)
+    );
+    return (n > 0) ? static_cast<std::size_t>(n) : 0;
+  }
+
+  bool decompress(
+    const byte* src, std::size_t size, byte* dst, std::size_t original) override
+  {
+    if (size > INT_MAX || original > INT_MAX)
+      return false;
+    auto n = LZ4_decompress_safe(
+      reinterpret_cast<const char*>(src),
+      reinterpret_cast<char*>(dst),
+      static_cast<int>(size),
+      static_cast<int>(original)
+    );
+    return n >= 0 && static_cast<std::size_t>(n) == original;
+  }
+};
+#endif  // PDNNET_HAS_LZ4
+
+// declared in all builds so make_compression_codec has one signature, but only
+// defined when zstd is available
+class zstd_dictionary;
+
+#ifdef PDNNET_HAS_ZSTD
+/**
+ * Shared zstd dictionary.
+ *
+ * Digested compression and decompression dictionaries are read-only once
+ * created so a single instance can be shared by all connections. Small
+ * repetitive messages compress far better with a dictionary trained on
+ * representative payloads, e.g. with `zstd --train`.
+ */
+class zstd_dictionary {
+public:
+  /**
+   * Ctor.
+   *
+   * @param dict Dictionary contents
+   * @param size Dictionary size in bytes
+   * @param level zstd compression level
+   */
+  zstd_dictionary(const void* dict, std::size_t size, int level = 3)
+    : cdict_{ZSTD_createCDict(dict, size, level), ZSTD_freeCDict},
+      ddict_{ZSTD_createDDict(dict, size), ZSTD_freeDDict},
+      id_{ZSTD_getDictID_fromDict(dict, size)}
+  {
+    if (!cdict_ || !ddict_)
+      throw std::runtime_error{"Failed to create zstd dictionary"};
+  }
+
+  /**
+   * Return the digested compression dictionary.
+   */
+  auto cdict() const noexcept { return cdict_.get(); }
+
+  /**
+   * Return the digested decompression dictionary.
+   */
+  auto ddict() const noexcept { return ddict_.get(); }
+
+  /**
+   * Return the dictionary ID, zero if the dictionary has no ID.
+   */
+  auto id() const noexcept { return id_; }
+
+private:
+  std::unique_ptr<ZSTD_CDict, decltype(&ZSTD_freeCDict)> cdict_;
+  std::unique_ptr<ZSTD_DDict, decltype(&ZSTD_freeDDict)> ddict_;
+  std::uint32_t id_;
+};
+
+/**
+ * zstd block compression codec with optional shared dictionary.
+ */
+class zstd_codec : public compression_codec {
+public:
+  /**
+   * Ctor.
+   *
+   * @param dict Shared dictionary, `nullptr` for no dictionary
+   * @param level zstd compression level, ignored if a dictionary is used
+   */
+  zstd_codec(std::shared_ptr<const zstd_dictionary> dict = {}, int level = 3)
+    : dict_{std::move(dict)},
+      level_{level},
+      cctx_{ZSTD_createCCtx(), ZSTD_freeCCtx},
+      dctx_{ZSTD_createDCtx(), ZSTD_freeDCtx}
+  {
+    if (!cctx_ || !dctx_)
+      throw std::runtime_error{"Failed to create zstd contexts"};
+  }
+
+  std::size_t bound(std::size_t size) const noexcept override
+  {
+    return ZSTD_compressBound(size);
+  }
+
+  std::size_t compress(
+    const byte* src, std::size_t size, byte* dst, std::size_t capacity) override
+  {
+    auto n = (dict_) ?
+      ZSTD_compress_usingCDict(cctx_.get(), dst, capacity, src, size, dict_->cdict()) :
+      ZSTD_compressCCtx(cctx_.get(), dst, capacity, src, size, level_);
+    return (ZSTD_isError(n)) ? 0 : n;
+  }
+
+  bool decompress(
+    const byte* src, std::size_t size, byte* dst, std::size_t original) override
+  {
+    auto n = (dict_) ?
+      ZSTD_decompress_usingDDict(dctx_.get(), dst, original, src, size, dict_->ddict()) :
+      ZSTD_decompressDCtx(dctx_.get(), dst, original, src, size);
+    return !ZSTD_isError(n) && n == original;
+  }
+
+private:
+  std::shared_ptr<const zstd_dictionary> dict_;
+  int level_;
+  std::unique_ptr<ZSTD_CCtx, decltype(&ZSTD_freeCCtx)> cctx_;
+  std::unique_ptr<ZSTD_DCtx, decltype(&ZSTD_freeDCtx)> dctx_;
+};
+#endif  // PDNNET_HAS_ZSTD
+
+/**
+ * Return a new codec for the given compression algorithm.
+ *
+ * @param type Compression algorithm
+ * Throws `std::invalid_argument` if the algorithm is not compiled in.
+ *
+ * @param type Compression algorithm
+ * @param dict Shared zstd dictionary, ignored unless `type` is zstd
+ * @returns Codec, `nullptr` for `compression_type::none`
+ */
+inline std::unique_ptr<compression_codec> make_compression_codec(
+  compression_type type, std::shared_ptr<const zstd_dictionary> dict = {})
+{
+  switch (type) {
+    case compression_type::none:
+      return {};
+#ifdef PDNNET_HAS_LZ4
+    case compression_type::lz4:
+      return std::make_unique<lz4_codec>();
+#endif  // PDNNET_HAS_LZ4
+#ifdef PDNNET_HAS_ZSTD
+    case compression_type::zstd:
+      return std::make_unique<zstd_codec>(std::move(dict));
+#endif  // PDNNET_HAS_ZSTD
+    default:
+      throw std::invalid_argument{
+        "Compression " + compression_name(type) + " not supported"
+      };
+  }
+}
+
+/**
+ * Compression stage statistics.
+ *
+ * All counters are atomic so they can be read while connections are active.
+ */
+struct compression_stats {
+  // frames passed to the compression stage
+  std::atomic<std::uint64_t> frames_in{};
+  // frames sent compressed
+  std::atomic<std::uint64_t> frames_compressed{};
+  // frames skipped by the compressibility check
+  std::atomic<std::uint64_t> frames_skipped{};
+  // frames compressed but sent raw since compression did not pay off
+  std::atomic<std::uint64_t> frames_expanded{};
+  // uncompressed bytes of frames passed to the stage
+  std::atomic<std::uint64_t> bytes_in{};
+  // bytes actually sent, i.e. compressed or raw payload size
+  std::atomic<std::uint64_t> bytes_out{};
+  // total compression and decompression time in nanoseconds
+  std::atomic<std::uint64_t> compress_ns{};
+  std::atomic<std::uint64_t> decompress_ns{};
+  // frames decompressed
+  std::atomic<std::uint64_t> frames_decompressed{};
+
+  /**
+   * Return ratio of bytes sent to bytes in, one if nothing sent yet.
+   */
+  double ratio() const noexcept
+  {
+    auto in = bytes_in.load(std::memory_order_relaxed);
+    if (!in)
+      return 1.;
+    return static_cast<double>(bytes_out.load(std::memory_order_relaxed)) / in;
+  }
+};
+
+/**
+ * Return `true` if a sample of the bytes looks compressible.
+ *
+ * Up to 256 bytes spread across the input are sampled. If almost every
+ * sampled byte value is distinct, the input is most likely already compressed
+ * or encrypted and is not worth spending CPU on.
+ *
+ * @param data Input bytes
+ * @param size Number of input bytes
+ */
+inline bool looks_compressible(const byte* data, std::size_t size) noexcept
+{
+  constexpr std::size_t n_sample = 256U;
+  if (size < n_sample)
+    return true;
+  bool seen[256] = {};
+  unsigned int n_distinct = 0;
+  auto stride = size / n_sample;
+  for (std::size_t i = 0; i < n_sample; i++) {
+    auto value = data[i * stride];
+    if (!seen[value]) {
+      seen[value] = true;
+      n_distinct++;
+    }
+  }
+  // uniformly random bytes give ~162 distinct values for 256 samples
+  return n_distinct < 150U;
+}
+
+/**
+ * Per-connection compression stage between framing and socket I/O.
+ *
+ * Compressed payloads are prefixed with the 4-byte big-endian original size.
+ * Payloads that are too small, fail the compressibility check, or do not
+ * shrink enough are passed through raw, so the frame header must record
+ * whether the stage compressed the payload or not.
+ */
+class compression_stage {
+public:
+  /**
+   * Default minimum payload size in bytes worth compressing.
+   */
+  static inline constexpr std::size_t min_size_default = 64U;
+
+  /**
+   * Ctor.
+   *
+   * @param codec Codec to use, must not be `nullptr`
+   * @param min_size Minimum payload size in bytes worth compressing
+   */
+  compression_stage(
+    std::unique_ptr<compression_codec> codec,
+    std::size_t min_size = min_size_default)
+    : codec_{std::move(codec)}, min_size_{min_size}, stats_{}
+  {
+    if (!codec_)
+      throw std::invalid_argument{"compression_stage codec cannot be null"};
+  }
+
+  /**
+   * Return the codec.
+   */
+  const auto& codec() const noexcept { return codec_; }
+
+  /**
+   * Return minimum payload size in bytes worth compressing.
+   */
+  auto min_size() const noexcept { return min_size_; }
+
+  /**
+   * Return const reference to the stage statistics.
+   */
+  const auto& stats() const noexcept { return stats_; }
+
+  /**
+   * Compress a payload and append it to an output buffer.
+   *
+   * Nothing is appended if the payload is passed through raw.
+   *
+   * @param data Payload bytes
+   * @param size Number of payload bytes
+   * @param out Buffer to append size prefix and compressed bytes to
+   * @returns `true` if compressed bytes were appended, `false` to send raw
+   */
+  bool compress(const byte* data, std::size_t size, std::vector<byte>& out)
+  {
+    stats_.frames_in.fetch_add(1, std::memory_order_relaxed);
+    stats_.bytes_in.fetch_add(size, std::memory_order_relaxed);
+    if (size < min_size_ || size > UINT32_MAX || !looks_compressible(data, size)) {
+      stats_.frames_skipped.fetch_add(1, std::memory_order_relaxed);
+      stats_.bytes_out.fetch_add(size, std::memory_order_relaxed);
+      return false;
+    }
+    auto start = std::chrono::steady_clock::now();
+    auto offset = out.size();
+    auto bound = codec_->bound(size);
+    out.resize(offset + 4U + bound);
+    store_be(out.data() + offset, static_cast<std::uint32_t>(size));
+    auto n = (bound) ?
+      codec_->compress(data, size, out.data() + offset + 4U, bound) : 0;
+    stats_.compress_ns.fetch_add(elapsed_ns(start), std::memory_order_relaxed);
+    // send raw unless we save at least 1/16 of the payload
+    if (!n || n + 4U > size - size / 16U) {
+      out.resize(offset);
+      stats_.frames_expanded.fetch_add(1, std::memory_order_relaxed);
+      stats_.bytes_out.fetch_add(size, std::memory_order_relaxed);
+      return false;
+    }
+    out.resize(offset + 4U + n);
+    stats_.frames_compressed.fetch_add(1, std::memory_order_relaxed);
+    stats_.bytes_out.fetch_add(n + 4U, std::memory_order_relaxed);
+    return true;
+  }
+
+  /**
+   * Decompress a payload produced by `compress`.
+   *
+   * @param data Compressed payload bytes, including the size prefix
+   * @param size Number of compressed payload bytes
+   * @param out Buffer to write decompressed bytes to, resized as needed
+   * @param max_size Maximum allowed decompressed size
+   * @returns Optional empty on success, with error message on failure
+   */
+  optional_error decompress(
+    const byte* data,
+    std::size_t size,
+    std::vector<byte>& out,
+    std::size_t max_size = UINT32_MAX)
+  {
+    if (size < 4U)
+      return "Compressed payload of " + std::to_string(size) +
+        " bytes is missing its size prefix";
+    auto original = load_be<std::uint32_t>(data);
+    if (original > max_size)
+      return "Decompressed size " + std::to_string(original) +
+        " exceeds max size " + std::to_string(max_size);
+    auto start = std::chrono::steady_clock::now();
+    out.resize(original);
+    if (!codec_->decompress(data + 4U, size - 4U, out.data(), original))
+      return "Corrupt compressed payload";
+    stats_.decompress_ns.fetch_add(elapsed_ns(start), std::memory_order_relaxed);
+    stats_.frames_decompressed.fetch_add(1, std::memory_order_relaxed);
+    return {};
+  }
+
+private:
+  std::unique_ptr<compression_codec> codec_;
+  std::size_t min_size_;
+  compression_stats stats_;
+
+  /**
+   * Return nanoseconds elapsed since the given time point.
+   *
+   * @param start Start time point
+   */
+  static std::uint64_t elapsed_ns(std::chrono::steady_clock::time_point start)
+  {
+    return static_cast<std::uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start
+      ).count()
+    );
+  }
+};
+
+/**
+ * Compression options offered by one side of a connection.
+ */
+struct compression_offer {
+  // bitmask of compression_type values the side supports
+  std::uint8_t types = supported_compression();
+  // ID of the shared zstd dictionary, zero for none
+  std::uint32_t dict_id = 0;
+};
+
+/**
+ * Negotiate the compression algorithm for a newly connected socket.
+ *
+ * The client sends an 8-byte hello with its offer and the server replies with
+ * the chosen algorithm. zstd is preferred, but only if both sides use the same
+ * dictionary, then LZ4, then no compression.
+ *
+ * Connecting and accepting do not negotiate on their own. Both ends must call
+ * this right after the connection is established and before any frames are
+ * exchanged, then build their `compression_stage` from the chosen algorithm.
+ *
+ * @param handle Connected socket handle
+ * @param server `true` if this is the accepting side of the connection
+ * @param offer Compression options this side supports
+ * @param chosen Negotiated compression algorithm
+ * @param timeout Timeout to use when waiting for the peer's hello
+ * @returns Optional empty on success, with error message on failure
+ */
+inline optional_error negotiate_compression(
+  socket_handle handle,
+  bool server,
+  const compression_offer& offer,
+  compression_type& chosen,
+  std::chrono::milliseconds timeout = std::chrono::milliseconds{5000})
+{
+  // hello format: 'P', 'Z', version, compression mask, dictionary ID
+  constexpr std::size_t hello_size = 8U;
+  constexpr byte version = 1U;
+  auto make_hello = [](std::uint8_t types, std::uint32_t dict_id)
+  {
+    std::string hello(hello_size, '\0');
+    hello[0] = 'P';
+    hello[1] = 'Z';
+    hello[2] = static_cast<char>(version);
+    hello[3] = static_cast<char>(types);
+    store_be(hello.data() + 4, dict_id);
+    return hello;
+  };
+  // read and validate a hello from the peer
+  byte peer[hello_size];
+  auto read_hello = [&]() -> optional_error
+  {
+    if (auto err = read_exact(handle, peer, hello_size, timeout))
+      return "Compression negotiation failed: " + *err;
+    if (peer[0] != 'P' || peer[1] != 'Z' || peer[2] != version)
+      return "Compression negotiation failed: bad hello from peer";
+    return {};
+  };
+  // client sends offer and reads the server's choice
+  if (!server) {
+    if (auto err = socket_writer{handle}(make_hello(offer.types, offer.dict_id)))
+      return err;
+    if (auto err = read_hello())
+      return err;
+    chosen = static_cast<compression_type>(peer[3]);
+    if (peer[3] & (peer[3] - 1) || (peer[3] && !(peer[3] & offer.types)))
+      return "Compression negotiation failed: server chose unsupported " +
+        std::to_string(peer[3]);
+    return {};
+  }
+  // server reads offer, chooses, and replies
+  if (auto err = read_hello())
+    return err;
+  auto common = static_cast<std::uint8_t>(offer.types & peer[3]);
+  auto zstd_mask = static_cast<std::uint8_t>(compression_type::zstd);
+  auto lz4_mask = static_cast<std::uint8_t>(compression_type::lz4);
+  if ((common & zstd_mask) && load_be<std::uint32_t>(peer + 4) == offer.dict_id)
+    chosen = compression_type::zstd;
+  else if (common & lz4_mask)
+    chosen = compression_type::lz4;
+  else
+    chosen = compression_type::none;
+  return socket_writer{handle}(
+    make_hello(static_cast<std::uint8_t>(chosen), offer.dict_id)
+  );
+}
+
+}  // namespace pdnnet
+
+#endif  // PDNNET_COMPRESSION_HH_
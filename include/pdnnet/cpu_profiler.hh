@@ -0,0 +1,336 @@
+/**
+ * @file cpu_profiler.hh
+ * @author Derek Huang
+ * @brief C++ header for attributing per-thread CPU time to handlers
+ * @copyright MIT License
+ */
+
+#ifndef PDNNET_CPU_PROFILER_HH_
+#define PDNNET_CPU_PROFILER_HH_
+
+#include "pdnnet/platform.h"
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif  // WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#elif defined(PDNNET_UNIX)
+#include <time.h>
+#endif  // !defined(_WIN32) && !defined(PDNNET_UNIX)
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "pdnnet/tsc_clock.hh"
+
+/**
+ * Maximum number of handlers a `cpu_profiler` can register.
+ */
+#ifndef PDNNET_CPU_PROFILER_MAX_HANDLERS
+#define PDNNET_CPU_PROFILER_MAX_HANDLERS 256
+#endif  // PDNNET_CPU_PROFILER_MAX_HANDLERS
+
+namespace pdnnet {
+
+/**
+ * Maximum number of handlers a `cpu_profiler` can register.
+ */
+inline constexpr std::size_t
+cpu_profiler_max_handlers{PDNNET_CPU_PROFILER_MAX_HANDLERS};
+
+/**
+ * Return the CPU time consumed by the calling thread.
+ *
+ * Uses `CLOCK_THREAD_CPUTIME_ID` on *nix and `GetThreadTimes` on Windows,
+ * where the resolution is much coarser. Returns zero if unsupported.
+ */
+inline std::chrono::nanoseconds thread_cpu_time() noexcept
+{
+#if defined(_WIN32)
+  FILETIME creation, exit, kernel, user;
+  if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user))
+    return {};
+  auto ticks = [](const FILETIME& t)
+  {
+    return (static_cast<std::uint64_t>(t.dwHighDateTime) << 32) | t.dwLowDateTime;
+  };
+  // FILETIME is in 100 ns ticks
+  return std::chrono::nanoseconds{100 * (ticks(kernel) + ticks(user))};
+#elif defined(CLOCK_THREAD_CPUTIME_ID)
+  timespec ts;
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts))
+    return {};
+  return std::chrono::seconds{ts.tv_sec} + std::chrono::nanoseconds{ts.tv_nsec};
+#else
+  return {};
+#endif  // !defined(_WIN32) && !defined(CLOCK_THREAD_CPUTIME_ID)
+}
+
+/**
+ * Number of buckets in a CPU-to-wall time ratio histogram.
+ *
+ * Bucket `i` counts calls whose ratio was in `[i / n, (i + 1) / n)`, with the
+ * last bucket also counting ratios of one or more.
+ */
+inline constexpr std::size_t cpu_ratio_buckets = 10U;
+
+/**
+ * CPU and wall time attributed to a handler.
+ *
+ * Calls with a ratio in the low buckets mostly waited, e.g. on I/O or locks,
+ * while calls in the high buckets were compute-bound.
+ */
+struct handler_profile {
+  std::string name;
+  std::uint64_t n_calls{};
+  std::chrono::microseconds cpu_time{};
+  std::chrono::microseconds wall_time{};
+  std::array<std::uint64_t, cpu_ratio_buckets> ratios{};
+
+  /**
+   * Return total CPU time as a fraction of total wall time.
+   */
+  double cpu_ratio() const noexcept
+  {
+    return (wall_time.count()) ?
+      static_cast<double>(cpu_time.count()) / wall_time.count() : 0.;
+  }
+};
+
+/**
+ * Thread-safe profiler attributing CPU and wall time to named handlers.
+ *
+ * Handlers are registered once by name, after which recording a call is a
+ * few relaxed atomic increments, so the profiler can stay enabled in
+ * production. Calls are usually recorded with a `cpu_scope`, e.g.
+ *
+ * @code{.cc}
+ * pdnnet::cpu_profiler profiler;
+ * auto id = profiler.handler("lookup");
+ * // on each call
+ * {
+ *   pdnnet::cpu_scope scope{&profiler, id};
+ *   // handle request
+ * }
+ * profiler.report(std::cout);
+ * @endcode
+ *
+ * Scopes may be nested, e.g. for routes inside a server's `serve`, in which
+ * case the outer handler's times include the inner handler's.
+ */
+class cpu_profiler {
+public:
+  /**
+   * Handler id type.
+   */
+  using handler_id = std::size_t;
+
+  /**
+   * Default ctor.
+   */
+  cpu_profiler()
+    : entries_{std::make_unique<handler_entry[]>(cpu_profiler_max_handlers)},
+      n_handlers_{}
+  {}
+
+  /**
+   * Deleted copy ctor.
+   */
+  cpu_profiler(const cpu_profiler&) = delete;
+
+  /**
+   * Return the id of a handler, registering it if needed.
+   *
+   * Throws `std::runtime_error` if `cpu_profiler_max_handlers` are registered.
+   *
+   * @param name Handler or route name
+   */
+  handler_id handler(std::string_view name)
+  {
+    std::lock_guard lock{mutex_};
+    auto it = ids_.find(std::string{name});
+    if (it != ids_.end())
+      return it->second;
+    if (n_handlers_ == cpu_profiler_max_handlers)
+      throw std::runtime_error{
+        "Cannot profile more than " + std::to_string(cpu_profiler_max_handlers) +
+        " handlers"
+      };
+    entries_[n_handlers_].name = name;
+    ids_.emplace(name, n_handlers_);
+    return n_handlers_++;
+  }
+
+  /**
+   * Return number of registered handlers.
+   */
+  auto n_handlers() const
+  {
+    std::lock_guard lock{mutex_};
+    return n_handlers_;
+  }
+
+  /**
+   * Record a call.
+   *
+   * @param id Handler id returned by `handler`
+   * @param cpu CPU time consumed by the calling thread during the call
+   * @param wall Wall time taken by the call
+   */
+  void record(
+    handler_id id, std::chrono::nanoseconds cpu, std::chrono::nanoseconds wall)
+  {
+    auto& e = entries_[id];
+    e.n_calls.fetch_add(1U, std::memory_order_relaxed);
+    e.cpu_ns.fetch_add(cpu.count(), std::memory_order_relaxed);
+    e.wall_ns.fetch_add(wall.count(), std::memory_order_relaxed);
+    auto bucket = cpu_ratio_buckets - 1U;
+    if (cpu < wall)
+      bucket = static_cast<std::size_t>(cpu_ratio_buckets * cpu.count() / wall.count());
+    e.ratios[bucket].fetch_add(1U, std::memory_order_relaxed);
+  }
+
+  /**
+   * Return profiles of all handlers in registration order.
+   */
+  auto snapshot() const
+  {
+    using std::chrono::duration_cast;
+    using std::chrono::microseconds;
+    using std::chrono::nanoseconds;
+    std::lock_guard lock{mutex_};
+    std::vector<handler_profile> profiles;
+    for (std::size_t i = 0; i < n_handlers_; i++) {
+      const auto& e = entries_[i];
+      auto& p = profiles.emplace_back();
+      p.name = e.name;
+      p.n_calls = e.n_calls.load(std::memory_order_relaxed);
+      p.cpu_time = duration_cast<microseconds>(nanoseconds{e.cpu_ns.load()});
+      p.wall_time = duration_cast<microseconds>(nanoseconds{e.wall_ns.load()});
+      for (std::size_t j = 0; j < cpu_ratio_buckets; j++)
+        p.ratios[j] = e.ratios[j].load(std::memory_order_relaxed);
+    }
+    return profiles;
+  }
+
+  /**
+   * Write a report of all handlers, most CPU time first.
+   *
+   * Each line gives the handler's calls, total CPU and wall milliseconds,
+   * mean CPU microseconds per call, overall CPU-to-wall ratio, and the ratio
+   * histogram from the lowest to the highest bucket.
+   *
+   * @param out Output stream
+   * @returns `out`
+   */
+  auto& report(std::ostream& out) const
+  {
+    auto profiles = snapshot();
+    std::sort(
+      profiles.begin(),
+      profiles.end(),
+      [](const auto& a, const auto& b) { return a.cpu_time > b.cpu_time; }
+    );
+    auto flags = out.flags();
+    auto precision = out.precision();
+    out << std::fixed << std::setprecision(3);
+    for (const auto& p : profiles) {
+      out << p.name << ": calls=" << p.n_calls << " cpu_ms=" <<
+        p.cpu_time.count() / 1000. << " wall_ms=" <<
+        p.wall_time.count() / 1000. << " cpu_us/call=" <<
+        ((p.n_calls) ? static_cast<double>(p.cpu_time.count()) / p.n_calls : 0.) <<
+        " cpu/wall=" << p.cpu_ratio() << " ratios=[";
+      for (std::size_t i = 0; i < cpu_ratio_buckets; i++)
+        out << ((i) ? " " : "") << p.ratios[i];
+      out << "]\n";
+    }
+    out.flags(flags);
+    out.precision(precision);
+    return out;
+  }
+
+private:
+  /**
+   * Per-handler counters.
+   */
+  struct handler_entry {
+    std::string name;
+    std::atomic<std::uint64_t> n_calls{};
+    std::atomic<std::int64_t> cpu_ns{};
+    std::atomic<std::int64_t> wall_ns{};
+    std::array<std::atomic<std::uint64_t>, cpu_ratio_buckets> ratios{};
+  };
+
+  mutable std::mutex mutex_;
+  // fixed capacity so entries can be recorded to without the mutex
+  std::unique_ptr<handler_entry[]> entries_;
+  std::unordered_map<std::string, handler_id> ids_;
+  std::size_t n_handlers_;
+};
+
+/**
+ * Scope attributing the calling thread's CPU and wall time to a handler.
+ *
+ * The scope must begin and end on the same thread. A null profiler makes the
+ * scope a no-op so it can be used unconditionally.
+ */
+class cpu_scope {
+public:
+  using clock_type = tsc_clock;
+
+  /**
+   * Ctor.
+   *
+   * @param profiler Profiler to record to, `nullptr` to do nothing
+   * @param id Handler id from `profiler->handler`
+   */
+  cpu_scope(cpu_profiler* profiler, cpu_profiler::handler_id id) noexcept
+    : profiler_{profiler},
+      id_{id},
+      wall_start_{(profiler) ? clock_type::now() : clock_type::time_point{}},
+      cpu_start_{(profiler) ? thread_cpu_time() : std::chrono::nanoseconds{}}
+  {}
+
+  /**
+   * Deleted copy ctor.
+   */
+  cpu_scope(const cpu_scope&) = delete;
+
+  /**
+   * Dtor.
+   *
+   * Records the call unless the profiler is null.
+   */
+  ~cpu_scope()
+  {
+    if (!profiler_)
+      return;
+    auto cpu = thread_cpu_time() - cpu_start_;
+    auto wall = clock_type::now() - wall_start_;
+    profiler_->record(id_, cpu, wall);
+  }
+
+private:
+  cpu_profiler* profiler_;
+  cpu_profiler::handler_id id_;
+  clock_type::time_point wall_start_;
+  std::chrono::nanoseconds cpu_start_;
+};
+
+}  // namespace pdnnet
+
+#endif  // PDNNET_CPU_PROFILER_HH_
@@ -0,0 +1,363 @@
+/**
+ * @file crc32c.hh
+ * @author Derek Huang
+ * @brief C++ header for hardware-accelerated CRC32C checksums
+ * @copyright MIT License
+ */
+
+#ifndef PDNNET_CRC32C_HH_
+#define PDNNET_CRC32C_HH_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "pdnnet/endian.hh"
+
+// hardware CRC32C instructions. on x86 the SSE4.2 crc32 instruction is used
+// if available at runtime, so the library need not be compiled with -msse4.2.
+// on ARM the CRC extension must be targeted, e.g. with -march=armv8-a+crc.
+#if defined(__x86_64__) || defined(__i386__) || \
+  defined(_M_X64) || (defined(_M_IX86) && !defined(_M_ARM64EC))
+#define PDNNET_HAS_SSE42_CRC32C
+#endif  // !defined(__x86_64__) && !defined(__i386__) && ...
+#if defined(__ARM_FEATURE_CRC32) && \
+  (!defined(__BYTE_ORDER__) || __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define PDNNET_HAS_ARM_CRC32C
+#endif  // !defined(__ARM_FEATURE_CRC32) || ...
+
+#if defined(PDNNET_HAS_SSE42_CRC32C)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif  // defined(_MSC_VER)
+#include <nmmintrin.h>
+#endif  // defined(PDNNET_HAS_SSE42_CRC32C)
+#if defined(PDNNET_HAS_ARM_CRC32C)
+#include <arm_acle.h>
+#endif  // defined(PDNNET_HAS_ARM_CRC32C)
+
+// GCC and Clang need the SSE4.2 target enabled per function when the
+// translation unit is not itself compiled for SSE4.2
+#if defined(PDNNET_HAS_SSE42_CRC32C) && defined(__GNUC__)
+#define PDNNET_CRC32C_TARGET __attribute__((target("sse4.2")))
+#else
+#define PDNNET_CRC32C_TARGET
+#endif  // !defined(PDNNET_HAS_SSE42_CRC32C) || !defined(__GNUC__)
+
+#ifndef PDNNET_CRC32C_BLOCK_SIZE
+#define PDNNET_CRC32C_BLOCK_SIZE 256U
+#endif  // PDNNET_CRC32C_BLOCK_SIZE
+
+namespace pdnnet {
+
+/**
+ * Per-stream block size in bytes used by the 3-way interleaved CRC32C.
+ *
+ * Inputs of at least 3 blocks are split into 3 independent streams so the
+ * crc32 instruction latency is hidden. Must be a multiple of 8.
+ */
+inline constexpr std::size_t crc32c_block_size = PDNNET_CRC32C_BLOCK_SIZE;
+
+static_assert(crc32c_block_size && !(crc32c_block_size % 8U));
+
+namespace detail {
+
+/**
+ * Reflected CRC32C (Castagnoli) polynomial.
+ */
+inline constexpr std::uint32_t crc32c_poly = 0x82F63B78U;
+
+/**
+ * Slicing-by-8 lookup tables for the table-driven CRC32C.
+ */
+struct crc32c_tables {
+  std::uint32_t values[8][256];
+};
+
+/**
+ * Return the slicing-by-8 lookup tables.
+ */
+constexpr auto make_crc32c_tables() noexcept
+{
+  crc32c_tables tables{};
+  for (std::uint32_t i = 0; i < 256U; i++) {
+    auto crc = i;
+    for (unsigned int k = 0; k < 8U; k++)
+      crc = (crc & 1U) ? (crc >> 1) ^ crc32c_poly : crc >> 1;
+    tables.values[0][i] = crc;
+  }
+  for (unsigned int i = 0; i < 256U; i++)
+    for (unsigned int k = 1; k < 8U; k++) {
+      auto prev = tables.values[k - 1][i];
+      tables.values[k][i] = (prev >> 8) ^ tables.values[0][prev & 0xFFU];
+    }
+  return tables;
+}
+
+/**
+ * Slicing-by-8 lookup tables computed at compile time.
+ */
+inline constexpr auto crc32c_lookup = make_crc32c_tables();
+
+/**
+ * Return product of two polynomials modulo the CRC32C polynomial.
+ *
+ * Polynomials use the reflected bit order, i.e. the MSB is the x^0 term.
+ *
+ * @param a First polynomial
+ * @param b Second polynomial
+ */
+constexpr std::uint32_t crc32c_multmodp(std::uint32_t a, std::uint32_t b) noexcept
+{
+  std::uint32_t product = 0;
+  for (std::uint32_t m = 1U << 31; m; m >>= 1) {
+    if (a & m)
+      product ^= b;
+    b = (b & 1U) ? (b >> 1) ^ crc32c_poly : b >> 1;
+  }
+  return product;
+}
+
+/**
+ * Return x^(8 * n) modulo the CRC32C polynomial.
+ *
+ * Multiplying a CRC register by this is the same as feeding it `n` zero bytes.
+ *
+ * @param n Number of bytes
+ */
+constexpr std::uint32_t crc32c_shift_poly(std::uint64_t n) noexcept
+{
+  // x^0 and x^8 in reflected bit order
+  std::uint32_t result = 1U << 31;
+  std::uint32_t power = 1U << 23;
+  for (; n; n >>= 1) {
+    if (n & 1U)
+      result = crc32c_multmodp(power, result);
+    power = crc32c_multmodp(power, power);
+  }
+  return result;
+}
+
+/**
+ * Return lookup tables for multiplying by x^(8 * n) modulo the polynomial.
+ *
+ * Multiplication by a fixed polynomial is linear, so the product can be
+ * computed from 4 lookups of the CRC register bytes instead of a bit loop.
+ *
+ * @param n Number of bytes to shift by
+ */
+constexpr auto make_crc32c_shift_tables(std::uint64_t n) noexcept
+{
+  crc32c_tables tables{};
+  auto shift = crc32c_shift_poly(n);
+  for (std::uint32_t i = 0; i < 256U; i++)
+    for (unsigned int k = 0; k < 4U; k++)
+      tables.values[k][i] = crc32c_multmodp(shift, i << (8U * k));
+  return tables;
+}
+
+/**
+ * Lookup tables for shifting a CRC register by one interleaved block.
+ */
+inline constexpr auto crc32c_block_shift = make_crc32c_shift_tables(crc32c_block_size);
+
+/**
+ * Shift a raw CRC32C register by one interleaved block of zero bytes.
+ *
+ * @param crc CRC register
+ */
+inline std::uint32_t crc32c_shift_block(std::uint32_t crc) noexcept
+{
+  const auto& t = crc32c_block_shift.values;
+  return t[0][crc & 0xFFU] ^ t[1][(crc >> 8) & 0xFFU] ^
+    t[2][(crc >> 16) & 0xFFU] ^ t[3][crc >> 24];
+}
+
+/**
+ * Update a raw CRC32C register using the slicing-by-8 tables.
+ *
+ * @param crc CRC register, i.e. without pre and post inversion
+ * @param data Input bytes
+ * @param size Number of input bytes
+ */
+inline std::uint32_t crc32c_update_table(
+  std::uint32_t crc, const unsigned char* data, std::size_t size) noexcept
+{
+  const auto& t = crc32c_lookup.values;
+  for (; size >= 8U; data += 8, size -= 8U) {
+    auto lo = load_le<std::uint32_t>(data) ^ crc;
+    auto hi = load_le<std::uint32_t>(data + 4);
+    crc = t[7][lo & 0xFFU] ^ t[6][(lo >> 8) & 0xFFU] ^
+      t[5][(lo >> 16) & 0xFFU] ^ t[4][lo >> 24] ^
+      t[3][hi & 0xFFU] ^ t[2][(hi >> 8) & 0xFFU] ^
+      t[1][(hi >> 16) & 0xFFU] ^ t[0][hi >> 24];
+  }
+  for (; size; data++, size--)
+    crc = (crc >> 8) ^ t[0][(crc ^ *data) & 0xFFU];
+  return crc;
+}
+
+#if defined(PDNNET_HAS_SSE42_CRC32C) || defined(PDNNET_HAS_ARM_CRC32C)
+/**
+ * Update a raw CRC32C register with a single byte using hardware CRC.
+ *
+ * @param crc CRC register
+ * @param value Input byte
+ */
+PDNNET_CRC32C_TARGET
+inline std::uint32_t crc32c_hw_u8(std::uint32_t crc, unsigned char value) noexcept
+{
+#if defined(PDNNET_HAS_SSE42_CRC32C)
+  return _mm_crc32_u8(crc, value);
+#else
+  return __crc32cb(crc, value);
+#endif  // !defined(PDNNET_HAS_SSE42_CRC32C)
+}
+
+/**
+ * Update a raw CRC32C register with 8 bytes using hardware CRC.
+ *
+ * @param crc CRC register
+ * @param data Address of 8 input bytes, need not be aligned
+ */
+PDNNET_CRC32C_TARGET
+inline std::uint32_t crc32c_hw_u64(std::uint32_t crc, const unsigned char* data) noexcept
+{
+#if defined(PDNNET_HAS_SSE42_CRC32C) && (defined(__x86_64__) || defined(_M_X64))
+  std::uint64_t value;
+  std::memcpy(&value, data, sizeof value);
+  return static_cast<std::uint32_t>(_mm_crc32_u64(crc, value));
+#elif defined(PDNNET_HAS_SSE42_CRC32C)
+  std::uint32_t lo, hi;
+  std::memcpy(&lo, data, sizeof lo);
+  std::memcpy(&hi, data + 4, sizeof hi);
+  return _mm_crc32_u32(_mm_crc32_u32(crc, lo), hi);
+#else
+  std::uint64_t value;
+  std::memcpy(&value, data, sizeof value);
+  return __crc32cd(crc, value);
+#endif  // !defined(PDNNET_HAS_SSE42_CRC32C)
+}
+
+/**
+ * Update a raw CRC32C register with a single stream using hardware CRC.
+ *
+ * @param crc CRC register
+ * @param data Input bytes
+ * @param size Number of input bytes
+ */
+PDNNET_CRC32C_TARGET
+inline std::uint32_t crc32c_update_hw_serial(
+  std::uint32_t crc, const unsigned char* data, std::size_t size) noexcept
+{
+  for (; size >= 8U; data += 8, size -= 8U)
+    crc = crc32c_hw_u64(crc, data);
+  for (; size; data++, size--)
+    crc = crc32c_hw_u8(crc, *data);
+  return crc;
+}
+
+/**
+ * Update a raw CRC32C register using hardware CRC.
+ *
+ * The crc32 instruction has a latency of several cycles but a throughput of
+ * one per cycle, so large inputs are processed as 3 interleaved streams whose
+ * CRCs are then combined by shifting with the precomputed block tables.
+ *
+ * @param crc CRC register
+ * @param data Input bytes
+ * @param size Number of input bytes
+ */
+PDNNET_CRC32C_TARGET
+inline std::uint32_t crc32c_update_hw(
+  std::uint32_t crc, const unsigned char* data, std::size_t size) noexcept
+{
+  constexpr auto block = crc32c_block_size;
+  for (; size >= 3U * block; data += 3U * block, size -= 3U * block) {
+    std::uint32_t crc0 = crc, crc1 = 0, crc2 = 0;
+    for (std::size_t i = 0; i < block; i += 8U) {
+      crc0 = crc32c_hw_u64(crc0, data + i);
+      crc1 = crc32c_hw_u64(crc1, data + block + i);
+      crc2 = crc32c_hw_u64(crc2, data + 2U * block + i);
+    }
+    crc = crc32c_shift_block(crc32c_shift_block(crc0) ^ crc1) ^ crc2;
+  }
+  return crc32c_update_hw_serial(crc, data, size);
+}
+#endif  // defined(PDNNET_HAS_SSE42_CRC32C) || defined(PDNNET_HAS_ARM_CRC32C)
+
+}  // namespace detail
+
+/**
+ * Return `true` if CRC32C computations use hardware CRC instructions.
+ */
+inline bool crc32c_hardware() noexcept
+{
+#if defined(PDNNET_HAS_ARM_CRC32C) || defined(__SSE4_2__)
+  return true;
+#elif defined(PDNNET_HAS_SSE42_CRC32C) && defined(_MSC_VER)
+  static const bool supported = []
+  {
+    int info[4];
+    __cpuid(info, 1);
+    return static_cast<bool>((info[2] >> 20) & 1);
+  }();
+  return supported;
+#elif defined(PDNNET_HAS_SSE42_CRC32C)
+  static const bool supported = __builtin_cpu_supports("sse4.2");
+  return supported;
+#else
+  return false;
+#endif  // !defined(PDNNET_HAS_ARM_CRC32C) && !defined(__SSE4_2__) && ...
+}
+
+/**
+ * Compute CRC32C with the table-driven implementation.
+ *
+ * @param data Input bytes
+ * @param size Number of input bytes
+ * @param crc Previous CRC32C value to continue from, zero to start
+ */
+inline std::uint32_t crc32c_table(
+  const void* data, std::size_t size, std::uint32_t crc = 0) noexcept
+{
+  return ~detail::crc32c_update_table(
+    ~crc, static_cast<const unsigned char*>(data), size
+  );
+}
+
+/**
+ * Compute CRC32C, using hardware CRC instructions if available.
+ *
+ * @param data Input bytes
+ * @param size Number of input bytes
+ * @param crc Previous CRC32C value to continue from, zero to start
+ */
+inline std::uint32_t crc32c(
+  const void* data, std::size_t size, std::uint32_t crc = 0) noexcept
+{
+#if defined(PDNNET_HAS_SSE42_CRC32C) || defined(PDNNET_HAS_ARM_CRC32C)
+  if (crc32c_hardware())
+    return ~detail::crc32c_update_hw(
+      ~crc, static_cast<const unsigned char*>(data), size
+    );
+#endif  // defined(PDNNET_HAS_SSE42_CRC32C) || defined(PDNNET_HAS_ARM_CRC32C)
+  return crc32c_table(data, size, crc);
+}
+
+/**
+ * Return the CRC32C of two concatenated inputs from their separate CRC32Cs.
+ *
+ * @param crc1 CRC32C of the first input
+ * @param crc2 CRC32C of the second input
+ * @param size2 Size of the second input in bytes
+ */
+constexpr std::uint32_t crc32c_combine(
+  std::uint32_t crc1, std::uint32_t crc2, std::uint64_t size2) noexcept
+{
+  return detail::crc32c_multmodp(detail::crc32c_shift_poly(size2), crc1) ^ crc2;
+}
+
+}  // namespace pdnnet
+
+#endif  // PDNNET_CRC32C_HH_
@@ -0,0 +1,445 @@
+/**
+ * @file deadline.hh
+ * @author Derek Huang
+ * @brief C++ header for end-to-end operation deadlines
+ * @copyright MIT License
+ */
+
+#ifndef PDNNET_DEADLINE_HH_
+#define PDNNET_DEADLINE_HH_
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif  // WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#include <WinSock2.h>
+#else
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#endif  // !defined(_WIN32)
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+#include "pdnnet/error.hh"
+#include "pdnnet/socket.hh"
+
+/**
+ * Maximum interval in milliseconds between checks for deadline cancellation.
+ *
+ * Blocking waits on a socket are split into slices no longer than this so a
+ * `deadline::cancel` call from another thread is noticed promptly.
+ */
+#ifndef PDNNET_DEADLINE_CANCEL_INTERVAL
+#define PDNNET_DEADLINE_CANCEL_INTERVAL 10
+#endif  // PDNNET_DEADLINE_CANCEL_INTERVAL
+
+namespace pdnnet {
+
+/**
+ * Maximum interval between checks for deadline cancellation.
+ */
+inline constexpr std::chrono::milliseconds
+deadline_cancel_interval{PDNNET_DEADLINE_CANCEL_INTERVAL};
+
+/**
+ * End-to-end deadline shared by a sequence of socket operations.
+ *
+ * Instead of each step of a request having its own timeout, operations taking
+ * a `deadline` consume from a single time budget measured against a steady
+ * clock, so connect, write, and read together are bounded by the budget. A
+ * deadline can also be cancelled from another thread, in which case any
+ * operation waiting on it returns an error within `deadline_cancel_interval`.
+ *
+ * @code{.cc}
+ * pdnnet::deadline deadline{std::chrono::milliseconds{500}};
+ * pdnnet::ipv4_client client;
+ * client.connect(host, port, deadline).throw_on_error();
+ * pdnnet::write(client.socket(), request.data(), request.size(), deadline)
+ *   .throw_on_error();
+ * std::string response;
+ * pdnnet::read(client.socket(), response, deadline).throw_on_error();
+ * @endcode
+ */
+class deadline {
+public:
+  using clock_type = std::chrono::steady_clock;
+
+  /**
+   * Default ctor.
+   *
+   * Creates a deadline that never expires but can still be cancelled.
+   */
+  deadline() noexcept
+    : expiry_{clock_type::time_point::max()}, budget_{-1}, cancelled_{}
+  {}
+
+  /**
+   * Ctor.
+   *
+   * @param budget Time budget starting now, must be nonnegative
+   */
+  explicit deadline(std::chrono::milliseconds budget) noexcept
+    : expiry_{clock_type::now() + budget}, budget_{budget}, cancelled_{}
+  {}
+
+  /**
+   * Deleted copy ctor.
+   *
+   * Operations refer to a deadline so a copy would not observe cancellation.
+   */
+  deadline(const deadline&) = delete;
+
+  /**
+   * Return the time point at which the deadline expires.
+   */
+  auto expiry() const noexcept { return expiry_; }
+
+  /**
+   * Return the original time budget, negative if infinite.
+   */
+  auto budget() const noexcept { return budget_; }
+
+  /**
+   * Return `true` if the deadline never expires.
+   */
+  bool infinite() const noexcept { return budget_.count() < 0; }
+
+  /**
+   * Cancel the deadline, causing pending and future operations to fail.
+   *
+   * This is thread-safe and can be called while another thread is blocked in
+   * an operation using the deadline.
+   */
+  void cancel() noexcept { cancelled_.store(true, std::memory_order_release); }
+
+  /**
+   * Return `true` if the deadline was cancelled.
+   */
+  bool cancelled() const noexcept
+  {
+    return cancelled_.load(std::memory_order_acquire);
+  }
+
+  /**
+   * Return `true` if the deadline was cancelled or has expired.
+   */
+  bool expired() const noexcept
+  {
+    return cancelled() || (!infinite() && clock_type::now() >= expiry_);
+  }
+
+  /**
+   * Return the remaining time, rounded up to the next millisecond.
+   *
+   * Returns zero if expired and `infinite_poll_timeout` if infinite.
+   */
+  std::chrono::milliseconds remaining() const noexcept
+  {
+    if (infinite())
+      return infinite_poll_timeout;
+    auto now = clock_type::now();
+    if (now >= expiry_)
+      return std::chrono::milliseconds{};
+    return std::chrono::ceil<std::chrono::milliseconds>(expiry_ - now);
+  }
+
+  /**
+   * Return an error if the deadline was cancelled or has expired.
+   *
+   * @param what Name of the operation being performed, e.g. "connect"
+   * @returns Optional empty if not expired, with error message otherwise
+   */
+  optional_error check(const std::string& what) const
+  {
+    if (cancelled())
+      return "Deadline cancelled during " + what;
+    if (expired())
+      return "Deadline of " + std::to_string(budget_.count()) +
+        " ms exceeded during " + what;
+    return {};
+  }
+
+  /**
+   * Block until the socket has one of the given events or the deadline ends.
+   *
+   * Error and hangup conditions also end the wait so the caller can retrieve
+   * the error from the next socket operation.
+   *
+   * @param handle Socket handle
+   * @param events Events to poll for, e.g. `POLLIN`
+   * @param what Name of the operation being performed, e.g. "read"
+   * @returns Optional empty if ready, with error message on expiry
+   */
+  optional_error wait(
+    socket_handle handle, short events, const std::string& what) const
+  {
+    while (true) {
+      if (auto err = check(what))
+        return err;
+      // wait no longer than the cancellation check interval
+      auto timeout = remaining();
+      if (infinite() || timeout > deadline_cancel_interval)
+        timeout = deadline_cancel_interval;
+      if (poll(handle, events, timeout) & (events | POLLERR | POLLHUP))
+        return {};
+    }
+  }
+
+private:
+  clock_type::time_point expiry_;
+  std::chrono::milliseconds budget_;
+  std::atomic<bool> cancelled_;
+};
+
+namespace detail {
+
+/**
+ * Return `true` if the last socket operation failed because it would block.
+ */
+inline bool would_block() noexcept
+{
+#if defined(_WIN32)
+  return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+  return errno == EAGAIN || errno == EWOULDBLOCK;
+#endif  // !defined(_WIN32)
+}
+
+/**
+ * Scope guard putting a socket into non-blocking mode.
+ *
+ * Blocking mode is restored on destruction.
+ */
+class nonblocking_scope {
+public:
+  /**
+   * Ctor.
+   *
+   * @param handle Socket handle
+   */
+  explicit nonblocking_scope(socket_handle handle) noexcept
+    : handle_{handle}, ok_{set_nonblocking(handle, true)}
+  {}
+
+  /**
+   * Deleted copy ctor.
+   */
+  nonblocking_scope(const nonblocking_scope&) = delete;
+
+  /**
+   * Dtor.
+   */
+  ~nonblocking_scope()
+  {
+    if (ok_)
+      set_nonblocking(handle_, false);
+  }
+
+  /**
+   * Return `true` if non-blocking mode was set successfully.
+   */
+  explicit operator bool() const noexcept { return ok_; }
+
+private:
+  socket_handle handle_;
+  bool ok_;
+};
+
+}  // namespace detail
+
+/**
+ * Connect a socket to an address before a deadline.
+ *
+ * The socket is put into non-blocking mode for the connection attempt and
+ * restored to blocking mode afterwards.
+ *
+ * @tparam AddrType `sockaddr_in` or `sockaddr_in6`
+ *
+ * @param handle Socket handle
+ * @param addr Address to connect to
+ * @param deadline Deadline bounding the connection attempt
+ * @returns Optional empty on success, with error message on failure
+ */
+template <PDNNET_INET_SOCKADDR(AddrType)>
+inline optional_error connect(
+  socket_handle handle, const AddrType& addr, const deadline& deadline)
+{
+  if (auto err = deadline.check("connect"))
+    return err;
+  detail::nonblocking_scope scope{handle};
+  if (!scope)
+    return "Could not make socket non-blocking: " + socket_error();
+  // connected immediately, e.g. for loopback
+  if (connect(handle, addr))
+    return {};
+#if defined(_WIN32)
+  if (!detail::would_block())
+#else
+  if (errno != EINPROGRESS)
+#endif  // !defined(_WIN32)
+    return "Socket connect error: " + socket_error();
+  // connection is complete when writable
+  if (auto err = deadline.wait(handle, POLLOUT, "connect"))
+    return err;
+  int error = 0;
+  socklen_t len = sizeof error;
+  if (
+    ::getsockopt(
+      handle, SOL_SOCKET, SO_ERROR, reinterpret_cast<char*>(&error), &len
+    )
+  )
+    return "Socket connect error: " + socket_error();
+  if (error)
+    return socket_error(error, "Socket connect error");
+  return {};
+}
+
+/**
+ * Write all bytes of a buffer to a socket before a deadline.
+ *
+ * @param handle Socket handle
+ * @param data Bytes to write
+ * @param size Number of bytes to write
+ * @param deadline Deadline bounding the write
+ * @returns Optional empty on success, with error message on failure
+ */
+inline optional_error write(
+  socket_handle handle,
+  const void* data,
+  std::size_t size,
+  const deadline& deadline)
+{
+  detail::nonblocking_scope scope{handle};
+  if (!scope)
+    return "Could not make socket non-blocking: " + socket_error();
+  auto bytes = static_cast<const char*>(data);
+  std::size_t n_sent = 0;
+  while (n_sent < size) {
+    if (auto err = deadline.wait(handle, POLLOUT, "write"))
+      return err;
+#if defined(_WIN32)
+    auto n_last = ::send(
+      handle,
+      bytes + n_sent,
+      static_cast<int>((std::min<std::size_t>)(size - n_sent, INT_MAX)),
+      0
+    );
+    if (n_last == SOCKET_ERROR) {
+      if (detail::would_block())
+        continue;
+      return winsock_error("send() failure");
+    }
+#else
+    auto n_last = ::write(handle, bytes + n_sent, size - n_sent);
+    if (n_last < 0) {
+      if (detail::would_block())
+        continue;
+      return errno_error("write() failure");
+    }
+#endif  // !defined(_WIN32)
+    n_sent += static_cast<std::size_t>(n_last);
+  }
+  return {};
+}
+
+/**
+ * Write a string to a socket before a deadline.
+ *
+ * @param handle Socket handle
+ * @param text String to write
+ * @param deadline Deadline bounding the write
+ * @returns Optional empty on success, with error message on failure
+ */
+inline auto write(
+  socket_handle handle, std::string_view text, const deadline& deadline)
+{
+  return write(handle, text.data(), text.size(), deadline);
+}
+
+/**
+ * Read from a socket until end of transmission before a deadline.
+ *
+ * On error, `out` still holds all the bytes that were received.
+ *
+ * @param handle Socket handle
+ * @param out String to append received bytes to
+ * @param deadline Deadline bounding the read
+ * @returns Optional empty on success, with error message on failure
+ */
+inline optional_error read(
+  socket_handle handle, std::string& out, const deadline& deadline)
+{
+  char buf[socket_read_size];
+  while (true) {
+    if (auto err = deadline.wait(handle, POLLIN, "read"))
+      return err;
+#if defined(_WIN32)
+    auto n_last = ::recv(handle, buf, static_cast<int>(sizeof buf), 0);
+    if (n_last == SOCKET_ERROR)
+      return winsock_error("recv() failure");
+#else
+    auto n_last = ::read(handle, buf, sizeof buf);
+    if (n_last < 0)
+      return errno_error("read() failure");
+#endif  // !defined(_WIN32)
+    // end of transmission
+    if (!n_last)
+      return {};
+    out.append(buf, static_cast<std::size_t>(n_last));
+  }
+}
+
+/**
+ * Read an exact number of bytes from a socket before a deadline.
+ *
+ * A short read due to end of transmission is treated as an error.
+ *
+ * @param handle Socket handle
+ * @param buf Buffer to write received bytes to
+ * @param size Number of bytes to read
+ * @param deadline Deadline bounding the read
+ * @returns Optional empty on success, with error message on failure
+ */
+inline optional_error read_exact(
+  socket_handle handle, void* buf, std::size_t size, const deadline& deadline)
+{
+  auto data = static_cast<char*>(buf);
+  std::size_t n_read = 0;
+  while (n_read < size) {
+    if (auto err = deadline.wait(handle, POLLIN, "read"))
+      return err;
+#if defined(_WIN32)
+    auto n_last = ::recv(
+      handle,
+      data + n_read,
+      static_cast<int>((std::min<std::size_t>)(size - n_read, INT_MAX)),
+      0
+    );
+    if (n_last == SOCKET_ERROR)
+      return winsock_error("recv() failure");
+#else
+    auto n_last = ::read(handle, data + n_read, size - n_read);
+    if (n_last < 0)
+      return errno_error("read() failure");
+#endif  // !defined(_WIN32)
+    if (!n_last)
+      return "End of transmission after " + std::to_string(n_read) + " of " +
+        std::to_string(size) + " bytes";
+    n_read += static_cast<std::size_t>(n_last);
+  }
+  return {};
+}
+
+}  // namespace pdnnet
+
+#endif  // PDNNET_DEADLINE_HH_
@@ -23,14 +23,19 @@
 #endif  // !defined(_WIN32)
 
 #include <atomic>
+#include <cstddef>
 #include <deque>
 #include <sstream>
 #include <stdexcept>
 #include <string_view>
 #include <thread>
 
+#include "pdnnet/activation.hh"
 #include "pdnnet/error.hh"
 #include "pdnnet/features.h"
+#include "pdnnet/flight_recorder.hh"
+#include "pdnnet/outbound.hh"
+#include "pdnnet/pressure.hh"
 #include "pdnnet/server.hh"
 #include "pdnnet/socket.hh"
 
@@ -51,7 +56,16 @@ public:
    *
    * Marks the server as not running.
    */
-  echoserver() : running_{} {}
+  echoserver()
+    : running_{},
+      pressure_{},
+      recorder_{},
+      high_watermark_{},
+      low_watermark_{},
+      read_size_{socket_read_size},
+      n_shed_{},
+      n_paused_{}
+  {}
 
   /**
    * Dtor.
@@ -105,6 +119,18 @@ public:
    */
   auto max_pending() const noexcept { return max_pending_; }
 
+  /**
+   * Return number of connections closed unserved due to resource pressure.
+   */
+  auto n_shed() const noexcept { return n_shed_.load(); }
+
+  /**
+   * Return number of times a connection paused reading for a slow client.
+   *
+   * Always zero unless the server was started with outbound watermarks.
+   */
+  auto n_paused() const noexcept { return n_paused_.load(); }
+
   /**
    * Return the host address as an IPv4 decimal-dotted string.
    *
@@ -151,6 +177,10 @@ public:
    * number of threads, one of the threads will join before another thread is
    * started to handle the incoming client connection.
    *
+   * By default all of a client's input is read before it is echoed back. If
+   * the params have outbound watermarks, input is instead echoed as it is
+   * read and reading pauses while too much output is queued for the client.
+   *
    * @note This function is thread-safe.
    *
    * @param params Server parameters to use when starting
@@ -170,9 +200,25 @@ public:
         continue;
       // accept client connection, possibly erroring
       auto cli_socket = accept(socket_);
+      // start request record here so time spent waiting for a thread is timed
+      request_record request;
+      detail::begin_request(recorder_, request);
+      // under resource pressure, close immediately if memory is critical and
+      // otherwise scale down the number of threads and the read size
+      auto max_threads = max_threads_;
+      auto read_size = read_size_;
+      if (pressure_) {
+        pressure_->update();
+        if (pressure_->shed()) {
+          n_shed_++;
+          continue;
+        }
+        max_threads = pressure_->max_concurrency(max_threads_);
+        read_size = pressure_->read_size(read_size_);
+      }
       // check if thread queue reached capacity. if so, join + remove first
-      // thread. socket descriptor is managed partially since join() can throw
-      if (thread_queue_.size() == max_threads_) {
+      // threads. socket descriptor is managed partially since join() can throw
+      while (thread_queue_.size() && thread_queue_.size() >= max_threads) {
         thread_queue_.front().join();
         thread_queue_.pop_front();
       }
@@ -185,15 +231,31 @@ public:
       // undefined behavior when the lambda is actually executed out of scope
       thread_queue_.emplace_back(
         std::thread{
-          [cli_sockfd]
+          [this, cli_sockfd, recorder = recorder_, request, read_size]() mutable
           {
             // own handle to automatically close later
             unique_socket socket{cli_sockfd};
-            // read from socket until there is no more to read + echo back
+            if (high_watermark_) {
+              echo_bounded(socket, recorder, request, read_size);
+              return;
+            }
+            // read from socket until there is no more to read + echo back.
+            // request phases are only marked if the request is recorded
+            if (recorder && wait_pollin(socket, socket_reader::poll_timeout_default))
+              request.first_byte = request_record::clock_type::now();
             std::stringstream stream;
-            stream << socket_reader{socket};
+            auto err = socket_reader{socket, read_size}(stream);
+            auto data = stream.str();
+            if (recorder) {
+              request.last_byte = request_record::clock_type::now();
+              request.bytes_in = data.size();
+            }
             // TODO: if we want to add server print, we need synchronization
-            stream >> socket_writer{socket};
+            if (!err)
+              err = socket_writer{socket}(data);
+            if (!err)
+              request.bytes_out = data.size();
+            detail::end_request(recorder, request, !err);
           }
         }
       );
@@ -221,37 +283,97 @@ private:
   std::deque<std::thread> thread_queue_;
   unsigned int max_threads_;
   unsigned int max_pending_;
+  pressure_monitor* pressure_;
+  flight_recorder* recorder_;
+  std::size_t high_watermark_;
+  std::size_t low_watermark_;
+  std::size_t read_size_;
+  std::atomic<std::size_t> n_shed_;
+  std::atomic<std::size_t> n_paused_;
 
   /**
    * Set the server state using the given parameters.
    *
    * Creates a new listening socket, binds the socket to the address, resolves
    * the address to the actual port, places the socket in listening mode for
-   * new IPv4 connections, and then marks the server as running.
+   * new IPv4 connections, and then marks the server as running. If the params
+   * have a listening socket handle, it is adopted instead.
    *
    * @param params Server parameters to set state with
    */
   void set_state(const server_params& params)
   {
-    // create new socket + set to local address with specified port
-    socket_ = unique_socket{AF_INET, SOCK_STREAM};
-    address_ = make_sockaddr_in(INADDR_ANY, params.port());
     // set max amount of threads and pending connections
     max_threads_ = params.max_concurrency();
     max_pending_ = params.max_pending();
-    // attempt to bind socket
-    if (!bind(socket_, address_))
-      throw std::runtime_error{socket_error("Could not bind socket")};
-    // get the actual socket address, e.g. if port is 0 it is resolved
-    if (!getsockname(socket_, address_))
-      throw std::runtime_error{socket_error("Could not retrieve socket address")};
-    // attempt to start listening for connections
-    if (!listen(socket_, max_pending_))
-      throw std::runtime_error{socket_error("Could not listen on socket")};
+    pressure_ = params.pressure();
+    recorder_ = params.recorder();
+    high_watermark_ = params.high_watermark();
+    low_watermark_ = params.low_watermark();
+    if (high_watermark_ && low_watermark_ >= high_watermark_)
+      throw std::invalid_argument{"Low watermark must be less than high watermark"};
+    read_size_ = params.read_size();
+    if (!read_size_)
+      throw std::invalid_argument{"Read size must be positive"};
+    // adopt a pre-opened listening socket, which is already bound
+    if (params.listen_handle() != bad_socket_handle)
+      socket_ = adopt_listener(params.listen_handle(), address_);
+    else {
+      // create new socket + set to local address with specified port
+      socket_ = unique_socket{AF_INET, SOCK_STREAM};
+      address_ = make_sockaddr_in(INADDR_ANY, params.port());
+      // attempt to bind socket
+      if (!bind(socket_, address_))
+        throw std::runtime_error{socket_error("Could not bind socket")};
+      // get the actual socket address, e.g. if port is 0 it is resolved
+      if (!getsockname(socket_, address_))
+        throw std::runtime_error{socket_error("Could not retrieve socket address")};
+      // attempt to start listening for connections
+      if (!listen(socket_, max_pending_))
+        throw std::runtime_error{socket_error("Could not listen on socket")};
+    }
     // mark as running
     running_ = true;
   }
 
+  /**
+   * Echo client input as it is read, pausing input while output is queued.
+   *
+   * Input ends like it does for `socket_reader`, i.e. at end of transmission
+   * or when no input arrives within its default poll timeout.
+   *
+   * @param socket Client socket
+   * @param recorder Flight recorder, `nullptr` if requests are not recorded
+   * @param request Request record
+   * @param read_size Number of bytes to read from the client at once
+   */
+  void echo_bounded(
+    socket_handle socket,
+    flight_recorder* recorder,
+    request_record& request,
+    std::size_t read_size)
+  {
+    if (recorder && wait_pollin(socket, socket_reader::poll_timeout_default))
+      request.first_byte = request_record::clock_type::now();
+    outbound_queue queue{socket, high_watermark_, low_watermark_};
+    queue.on_high([this] { n_paused_++; });
+    auto err = relay(
+      socket,
+      queue,
+      socket_reader::poll_timeout_default,
+      infinite_poll_timeout,
+      read_size
+    );
+    // input and output overlap, so the last byte is only known at the end
+    if (recorder) {
+      request.last_byte = request_record::clock_type::now();
+      request.bytes_in = queue.n_sent() + queue.queued_bytes();
+    }
+    if (!err)
+      request.bytes_out = queue.n_sent();
+    detail::end_request(recorder, request, !err);
+  }
+
   /**
    * Join all running threads in the thread queue and ignore exceptions.
    */
@@ -0,0 +1,87 @@
+/**
+ * @file endian.hh
+ * @author Derek Huang
+ * @brief C++ header for byte order helpers
+ * @copyright MIT License
+ */
+
+#ifndef PDNNET_ENDIAN_HH_
+#define PDNNET_ENDIAN_HH_
+
+#include <cstdint>
+#include <type_traits>
+
+namespace pdnnet {
+
+/**
+ * Load an unsigned integer stored in big-endian (network) byte order.
+ *
+ * Byte-by-byte access means no alignment is required and compilers reduce
+ * the expression to a single load and byte swap where possible.
+ *
+ * @tparam T Unsigned integral type
+ *
+ * @param data Address of the first byte
+ */
+template <typename T, typename = std::enable_if_t<std::is_unsigned_v<T>>>
+inline T load_be(const void* data) noexcept
+{
+  auto bytes = static_cast<const unsigned char*>(data);
+  T value = 0;
+  for (unsigned int i = 0; i < sizeof(T); i++)
+    value = static_cast<T>((value << 8) | bytes[i]);
+  return value;
+}
+
+/**
+ * Store an unsigned integer in big-endian (network) byte order.
+ *
+ * @tparam T Unsigned integral type
+ *
+ * @param data Address of the first byte
+ * @param value Value to store
+ */
+template <typename T, typename = std::enable_if_t<std::is_unsigned_v<T>>>
+inline void store_be(void* data, T value) noexcept
+{
+  auto bytes = static_cast<unsigned char*>(data);
+  for (unsigned int i = 0; i < sizeof(T); i++)
+    bytes[sizeof(T) - 1 - i] = static_cast<unsigned char>(value >> (8 * i));
+}
+
+/**
+ * Load an unsigned integer stored in little-endian byte order.
+ *
+ * @tparam T Unsigned integral type
+ *
+ * @param data Address of the first byte
+ */
+template <typename T, typename = std::enable_if_t<std::is_unsigned_v<T>>>
+inline T load_le(const void* data) noexcept
+{
+  auto bytes = static_cast<const unsigned char*>(data);
+  T value = 0;
+  for (unsigned int i = 0; i < sizeof(T); i++)
+    value = static_cast<T>(value | (static_cast<T>(bytes[i]) << (8 * i)));
+  return value;
+}
+
+/**
+ * Store an unsigned integer in little-endian byte order.
+ *
+ * @tparam T Unsigned integral type
+ *
+ * @param data Address of the first byte
+ * @param value Value to store
+ */
+template <typename T, typename = std::enable_if_t<std::is_unsigned_v<T>>>
+inline void store_le(void* data, T value) noexcept
+{
+  auto bytes = static_cast<unsigned char*>(data);
+  for (unsigned int i = 0; i < sizeof(T); i++)
+    bytes[i] = static_cast<unsigned char>(value >> (8 * i));
+}
+
+}  // namespace pdnnet
+
+#endif  // PDNNET_ENDIAN_HH_
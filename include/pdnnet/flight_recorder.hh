@@ -0,0 +1,576 @@
+/**
+ * @file flight_recorder.hh
+ * @author Derek Huang
+ * @brief C++ header for an always-on recorder of recent request timings
+ * @copyright MIT License
+ */
+
+#ifndef PDNNET_FLIGHT_RECORDER_HH_
+#define PDNNET_FLIGHT_RECORDER_HH_
+
+#include "pdnnet/platform.h"
+
+#ifdef PDNNET_UNIX
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <cerrno>
+#endif  // PDNNET_UNIX
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include "pdnnet/error.hh"
+#include "pdnnet/tsc_clock.hh"
+
+/**
+ * Default number of request records kept per ring.
+ */
+#ifndef PDNNET_FLIGHT_RECORDER_CAPACITY
+#define PDNNET_FLIGHT_RECORDER_CAPACITY 256
+#endif  // PDNNET_FLIGHT_RECORDER_CAPACITY
+
+namespace pdnnet {
+
+/**
+ * Default number of request records kept per ring.
+ */
+inline constexpr std::size_t
+flight_recorder_capacity{PDNNET_FLIGHT_RECORDER_CAPACITY};
+
+/**
+ * Timings and sizes of a single served request.
+ *
+ * Phase timestamps that were never set are left at the clock epoch.
+ */
+struct request_record {
+  // several phases are marked per request, so timestamps must be cheap
+  using clock_type = tsc_clock;
+
+  std::uint64_t id{};               // connection id
+  clock_type::time_point accepted;  // connection accepted
+  clock_type::time_point first_byte;  // first request byte readable
+  clock_type::time_point last_byte;   // request fully read
+  clock_type::time_point responded;   // response fully written
+  std::size_t bytes_in{};           // request bytes read
+  std::size_t bytes_out{};          // response bytes written
+  int status{};                     // zero on success, nonzero on failure
+
+  /**
+   * Return `true` if the given phase timestamp was set.
+   *
+   * @param phase Phase timestamp
+   */
+  static bool marked(clock_type::time_point phase) noexcept
+  {
+    return phase != clock_type::time_point{};
+  }
+
+  /**
+   * Return time from accept until the response was written.
+   *
+   * Zero if either phase was not marked.
+   */
+  clock_type::duration duration() const noexcept
+  {
+    if (!marked(accepted) || !marked(responded))
+      return {};
+    return responded - accepted;
+  }
+};
+
+#ifdef PDNNET_UNIX
+namespace detail {
+
+/**
+ * Write end of the pipe notified by the flight recorder signal handler.
+ */
+inline std::atomic<int> flight_recorder_signal_fd{-1};
+
+/**
+ * Signal handler notifying the flight recorder signal watcher.
+ *
+ * Only calls async-signal-safe functions and preserves `errno`.
+ */
+inline void flight_recorder_signal_handler(int /*signum*/) noexcept
+{
+  auto fd = flight_recorder_signal_fd.load();
+  if (fd < 0)
+    return;
+  auto saved_errno = errno;
+  char byte{};
+  (void) ::write(fd, &byte, 1U);
+  errno = saved_errno;
+}
+
+}  // namespace detail
+#endif  // PDNNET_UNIX
+
+/**
+ * Always-on recorder of recent request timings.
+ *
+ * Keeps the most recent `capacity()` request records of each thread in a
+ * fixed-size ring, so recording is a short critical section with no
+ * allocation. Histograms show that a tail latency is bad; a dump of the
+ * flight recorder shows which requests were slow and in which phase.
+ *
+ * Each thread is given an index on its first record into any recorder and
+ * uses ring `index % n_rings()`, so rings are shared modulo `n_rings()`. A
+ * fixed set of up to `n_rings()` threads recording into a single recorder,
+ * e.g. `reuseport_server` workers, each get their own ring. With more threads,
+ * threads that come and go like `echoserver`'s, or several recorders, threads
+ * share rings and may briefly contend on the ring mutex.
+ *
+ * Records are dumped on demand through `dump`, automatically when a request
+ * takes at least `slow_threshold()`, and on *nix when a signal registered
+ * with `dump_on_signal` is received, e.g. `kill -USR1 <pid>`.
+ *
+ * @code{.cc}
+ * pdnnet::flight_recorder recorder;
+ * recorder.slow_threshold(std::chrono::milliseconds{200});
+ * recorder.dump_on_signal().throw_on_error();
+ * server.start(pdnnet::server_params{}.recorder(&recorder));
+ * @endcode
+ */
+class flight_recorder {
+public:
+  using clock_type = request_record::clock_type;
+
+  /**
+   * Ctor.
+   *
+   * @param capacity Number of records kept per ring
+   * @param n_rings Number of rings, zero for the hardware concurrency
+   */
+  flight_recorder(
+    std::size_t capacity = flight_recorder_capacity,
+    unsigned int n_rings = 0U)
+    : capacity_{(capacity) ? capacity : 1U},
+      n_rings_{
+        (n_rings) ? n_rings : (std::max)(std::thread::hardware_concurrency(), 1U)
+      },
+      rings_{std::make_unique<ring[]>(n_rings_)},
+      slow_threshold_{},
+      slow_dump_interval_{std::chrono::seconds{1}},
+      output_{&std::cerr},
+      next_id_{},
+      n_recorded_{},
+      n_slow_{},
+      n_dumps_{},
+      last_slow_dump_{}
+#ifdef PDNNET_UNIX
+      ,
+      signum_{},
+      signal_pipe_{-1, -1},
+      watching_{}
+#endif  // PDNNET_UNIX
+  {
+    for (unsigned int i = 0; i < n_rings_; i++)
+      rings_[i].records.resize(capacity_);
+  }
+
+  /**
+   * Deleted copy ctor.
+   */
+  flight_recorder(const flight_recorder&) = delete;
+
+  /**
+   * Dtor.
+   *
+   * Stops watching for the dump signal if `dump_on_signal` was called.
+   */
+  ~flight_recorder()
+  {
+#ifdef PDNNET_UNIX
+    stop_signal_watch();
+#endif  // PDNNET_UNIX
+  }
+
+  /**
+   * Return number of records kept per ring.
+   */
+  auto capacity() const noexcept { return capacity_; }
+
+  /**
+   * Return number of rings.
+   */
+  auto n_rings() const noexcept { return n_rings_; }
+
+  /**
+   * Return request duration at which the recorder is dumped automatically.
+   */
+  auto slow_threshold() const noexcept { return slow_threshold_; }
+
+  /**
+   * Set request duration at which the recorder is dumped automatically.
+   *
+   * @param threshold Slow request threshold, zero to disable
+   * @returns `*this` to allow method chaining
+   */
+  auto& slow_threshold(std::chrono::milliseconds threshold) noexcept
+  {
+    slow_threshold_ = threshold;
+    return *this;
+  }
+
+  /**
+   * Return minimum time between automatic dumps for slow requests.
+   */
+  auto slow_dump_interval() const noexcept { return slow_dump_interval_; }
+
+  /**
+   * Set minimum time between automatic dumps for slow requests.
+   *
+   * Prevents a burst of slow requests from turning into a burst of dumps.
+   *
+   * @param interval Minimum time between slow request dumps
+   * @returns `*this` to allow method chaining
+   */
+  auto& slow_dump_interval(std::chrono::milliseconds interval) noexcept
+  {
+    slow_dump_interval_ = interval;
+    return *this;
+  }
+
+  /**
+   * Return stream that automatic dumps are written to.
+   */
+  auto output() const noexcept { return output_; }
+
+  /**
+   * Set stream that automatic dumps are written to.
+   *
+   * @note Must be set before recording or watching for signals starts.
+   *
+   * @param out Output stream that outlives the recorder
+   * @returns `*this` to allow method chaining
+   */
+  auto& output(std::ostream* out) noexcept
+  {
+    output_ = out;
+    return *this;
+  }
+
+  /**
+   * Return a new unique connection id.
+   *
+   * @note This function is thread-safe.
+   */
+  std::uint64_t next_id() noexcept
+  {
+    return ++next_id_;
+  }
+
+  /**
+   * Return total number of requests recorded.
+   */
+  auto n_recorded() const noexcept { return n_recorded_.load(); }
+
+  /**
+   * Return number of recorded requests at or over the slow threshold.
+   */
+  auto n_slow() const noexcept { return n_slow_.load(); }
+
+  /**
+   * Return number of dumps written, automatic or on demand.
+   */
+  auto n_dumps() const noexcept { return n_dumps_.load(); }
+
+  /**
+   * Record a request in the calling thread's ring.
+   *
+   * If the request took at least `slow_threshold()` and no slow request dump
+   * was made in the last `slow_dump_interval()`, the recorder is dumped to
+   * `output()` from the calling thread.
+   *
+   * @note This function is thread-safe.
+   *
+   * @param record Request record
+   */
+  void record(const request_record& record)
+  {
+    {
+      auto& ring = local_ring();
+      std::lock_guard lock{ring.mutex};
+      ring.records[ring.next] = record;
+      ring.next = (ring.next + 1U) % capacity_;
+      ring.size = (std::min)(ring.size + 1U, capacity_);
+    }
+    n_recorded_++;
+    if (slow_threshold_.count() <= 0 || record.duration() < slow_threshold_)
+      return;
+    n_slow_++;
+    // only one thread dumps per interval
+    auto now = clock_type::now().time_since_epoch().count();
+    auto last = last_slow_dump_.load();
+    auto interval = std::chrono::duration_cast<clock_type::duration>(
+      slow_dump_interval_
+    ).count();
+    if (last && now - last < interval)
+      return;
+    if (!last_slow_dump_.compare_exchange_strong(last, now))
+      return;
+    dump();
+  }
+
+  /**
+   * Return copies of all recorded requests ordered by accept time.
+   *
+   * @note This function is thread-safe.
+   */
+  auto snapshot() const
+  {
+    std::vector<request_record> records;
+    for (unsigned int i = 0; i < n_rings_; i++) {
+      auto& ring = rings_[i];
+      std::lock_guard lock{ring.mutex};
+      // oldest record is at next once the ring is full
+      std::size_t first = (ring.size < capacity_) ? 0U : ring.next;
+      for (std::size_t j = 0; j < ring.size; j++)
+        records.push_back(ring.records[(first + j) % capacity_]);
+    }
+    std::stable_sort(
+      records.begin(),
+      records.end(),
+      [](const auto& a, const auto& b) { return a.accepted < b.accepted; }
+    );
+    return records;
+  }
+
+  /**
+   * Write all recorded requests to a stream, oldest first.
+   *
+   * Each line gives the connection id, the age of the request, the offset of
+   * each phase from accept, bytes in and out, and the status. Phases that were
+   * not marked are printed as `-`.
+   *
+   * @note This function is thread-safe.
+   *
+   * @param out Output stream
+   */
+  void dump(std::ostream& out)
+  {
+    auto records = snapshot();
+    auto now = clock_type::now();
+    std::lock_guard lock{dump_mutex_};
+    out << "flight recorder: " << records.size() << " requests, " <<
+      n_slow_ << " slow\n";
+    for (const auto& record : records) {
+      out << "  id=" << record.id << " age=";
+      write_ms(out, now - record.accepted);
+      write_phase(out, " first_byte=", record, record.first_byte);
+      write_phase(out, " last_byte=", record, record.last_byte);
+      write_phase(out, " responded=", record, record.responded);
+      out << " in=" << record.bytes_in << " out=" << record.bytes_out <<
+        " status=" << record.status << "\n";
+    }
+    out << std::flush;
+    n_dumps_++;
+  }
+
+  /**
+   * Write all recorded requests to `output()`.
+   *
+   * @note This function is thread-safe.
+   */
+  void dump()
+  {
+    if (output_)
+      dump(*output_);
+  }
+
+#ifdef PDNNET_UNIX
+  /**
+   * Dump the recorder to `output()` whenever the given signal is received.
+   *
+   * A handler is installed for the signal that notifies a watcher thread owned
+   * by the recorder, so the dump itself does not run in signal context. Only
+   * one recorder can watch for signals at a time; the previous handler is
+   * restored when the recorder is destroyed.
+   *
+   * @param signum Signal number
+   * @returns Optional empty on success, with error message on failure
+   */
+  optional_error dump_on_signal(int signum = SIGUSR1)
+  {
+    if (watching_)
+      return "Flight recorder is already watching for signal " +
+        std::to_string(signum_);
+    if (::pipe(signal_pipe_))
+      return errno_error("pipe() failure");
+    for (auto fd : signal_pipe_) {
+      auto flags = ::fcntl(fd, F_GETFL);
+      if (flags < 0 || ::fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0 ||
+        ::fcntl(fd, F_SETFD, FD_CLOEXEC) < 0) {
+        auto err = errno_error("fcntl() failure");
+        close_signal_pipe();
+        return err;
+      }
+    }
+    // only one recorder can be notified by the handler
+    int no_fd = -1;
+    if (!detail::flight_recorder_signal_fd.compare_exchange_strong(
+      no_fd, signal_pipe_[1])) {
+      close_signal_pipe();
+      return "Another flight recorder is already watching for signals";
+    }
+    struct sigaction action{};
+    action.sa_handler = detail::flight_recorder_signal_handler;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (::sigaction(signum, &action, &old_action_)) {
+      auto err = errno_error("sigaction() failure");
+      detail::flight_recorder_signal_fd = -1;
+      close_signal_pipe();
+      return err;
+    }
+    signum_ = signum;
+    watching_ = true;
+    watcher_ = std::thread{&flight_recorder::watch_signal, this};
+    return {};
+  }
+#endif  // PDNNET_UNIX
+
+private:
+  /**
+   * Ring of the most recent records written by one or more threads.
+   */
+  struct ring {
+    std::mutex mutex;
+    std::vector<request_record> records;
+    std::size_t next{};
+    std::size_t size{};
+  };
+
+  std::size_t capacity_;
+  unsigned int n_rings_;
+  std::unique_ptr<ring[]> rings_;
+  std::chrono::milliseconds slow_threshold_;
+  std::chrono::milliseconds slow_dump_interval_;
+  std::ostream* output_;
+  std::atomic<std::uint64_t> next_id_;
+  std::atomic<std::size_t> n_recorded_;
+  std::atomic<std::size_t> n_slow_;
+  std::atomic<std::size_t> n_dumps_;
+  std::atomic<clock_type::rep> last_slow_dump_;
+  std::mutex dump_mutex_;
+#ifdef PDNNET_UNIX
+  int signum_;
+  int signal_pipe_[2];
+  struct sigaction old_action_;
+  std::atomic<bool> watching_;
+  std::thread watcher_;
+#endif  // PDNNET_UNIX
+
+  /**
+   * Return the ring assigned to the calling thread.
+   *
+   * Thread indices are shared by all recorders and never reused, so rings are
+   * shared modulo `n_rings()` as described in the class comment.
+   */
+  ring& local_ring() noexcept
+  {
+    static std::atomic<unsigned int> n_threads{};
+    thread_local auto index = n_threads++;
+    return rings_[index % n_rings_];
+  }
+
+  /**
+   * Write a duration in milliseconds with microsecond precision.
+   *
+   * @param out Output stream
+   * @param duration Duration to write
+   */
+  static void write_ms(std::ostream& out, clock_type::duration duration)
+  {
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(duration);
+    out << us.count() / 1000 << "." << std::setfill('0') << std::setw(3) <<
+      us.count() % 1000 << std::setfill(' ') << "ms";
+  }
+
+  /**
+   * Write the offset of a request phase from accept.
+   *
+   * @param out Output stream
+   * @param label Phase label
+   * @param record Request record
+   * @param phase Phase timestamp
+   */
+  static void write_phase(
+    std::ostream& out,
+    const char* label,
+    const request_record& record,
+    clock_type::time_point phase)
+  {
+    out << label;
+    if (!request_record::marked(phase) || !request_record::marked(record.accepted))
+      out << "-";
+    else {
+      out << "+";
+      write_ms(out, phase - record.accepted);
+    }
+  }
+
+#ifdef PDNNET_UNIX
+  /**
+   * Watcher thread loop dumping the recorder when the signal pipe is written.
+   */
+  void watch_signal()
+  {
+    pollfd pfd{signal_pipe_[0], POLLIN, 0};
+    while (watching_) {
+      if (::poll(&pfd, 1U, 100) <= 0 || !(pfd.revents & POLLIN))
+        continue;
+      // drain so signals received during the dump trigger only one more dump
+      char buf[64];
+      while (::read(signal_pipe_[0], buf, sizeof buf) > 0);
+      dump();
+    }
+  }
+
+  /**
+   * Stop the watcher thread and restore the previous signal handler.
+   */
+  void stop_signal_watch() noexcept
+  {
+    if (!watching_)
+      return;
+    watching_ = false;
+    try { watcher_.join(); }
+    catch (const std::system_error&) {}
+    ::sigaction(signum_, &old_action_, nullptr);
+    detail::flight_recorder_signal_fd = -1;
+    close_signal_pipe();
+  }
+
+  /**
+   * Close both ends of the signal pipe.
+   */
+  void close_signal_pipe() noexcept
+  {
+    for (auto& fd : signal_pipe_) {
+      if (fd >= 0)
+        ::close(fd);
+      fd = -1;
+    }
+  }
+#endif  // PDNNET_UNIX
+};
+
+}  // namespace pdnnet
+
+#endif  // PDNNET_FLIGHT_RECORDER_HH_
@@ -0,0 +1,928 @@
+/**
+ * @file frame.hh
+ * @author Derek Huang
+ * @brief C++ header for length-prefixed message framing
+ * @copyright MIT License
+ */
+
+#ifndef PDNNET_FRAME_HH_
+#define PDNNET_FRAME_HH_
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif  // WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#include <WinSock2.h>
+#else
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif  // !defined(_WIN32)
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "pdnnet/compression.hh"
+#include "pdnnet/crc32c.hh"
+#include "pdnnet/endian.hh"
+#include "pdnnet/error.hh"
+#include "pdnnet/memory.hh"
+#include "pdnnet/socket.hh"
+
+namespace pdnnet {
+
+/**
+ * Frame header size in bytes.
+ *
+ * The header is laid out in network byte order as follows:
+ *
+ * | Offset | Size | Field                    |
+ * | ------ | ---- | ------------------------ |
+ * | 0      | 4    | Payload size on the wire |
+ * | 4      | 1    | Frame flags              |
+ * | 5      | 1    | Application message type |
+ * | 6      | 1    | Stream, zero by default  |
+ * | 7      | 1    | Reserved, must be zero   |
+ *
+ * If the `frame_checksum` flag is set, the payload is followed by a 4-byte
+ * big-endian CRC32C of the header and payload as sent on the wire.
+ *
+ * A message may be split into chunks, each sent as a frame with the
+ * `frame_more` flag set except for the last. Chunks of a message are sent in
+ * order on the same stream and no other frame is sent on that stream until the
+ * message is complete, so frames on other streams can be interleaved between
+ * chunks. Each chunk is compressed and checksummed on its own.
+ */
+inline constexpr std::size_t frame_header_size = 8U;
+
+/**
+ * Frame flag indicating the payload was compressed by a `compression_stage`.
+ */
+inline constexpr std::uint8_t frame_compressed = 0x1U;
+
+/**
+ * Frame flag indicating the payload is followed by a CRC32C trailer.
+ */
+inline constexpr std::uint8_t frame_checksum = 0x2U;
+
+/**
+ * Frame checksum trailer size in bytes.
+ */
+inline constexpr std::size_t frame_checksum_size = 4U;
+
+/**
+ * Frame flag indicating more chunks of the message follow on the same stream.
+ */
+inline constexpr std::uint8_t frame_more = 0x4U;
+
+/**
+ * Mask of all the frame flags currently defined.
+ */
+inline constexpr std::uint8_t frame_flags_mask =
+  frame_compressed | frame_checksum | frame_more;
+
+#ifndef PDNNET_FRAME_SIZE_MAX
+#define PDNNET_FRAME_SIZE_MAX 16777216U
+#endif  // PDNNET_FRAME_SIZE_MAX
+
+/**
+ * Default maximum frame payload size accepted by a `frame_reader`.
+ */
+inline constexpr std::size_t frame_size_max = PDNNET_FRAME_SIZE_MAX;
+
+#ifndef PDNNET_FRAME_CHUNK_SIZE
+#define PDNNET_FRAME_CHUNK_SIZE 16384U
+#endif  // PDNNET_FRAME_CHUNK_SIZE
+
+/**
+ * Default payload bytes per chunk sent by a `frame_queue`.
+ */
+inline constexpr std::size_t frame_chunk_size = PDNNET_FRAME_CHUNK_SIZE;
+
+#ifndef PDNNET_FRAME_RCVLOWAT_MAX
+#define PDNNET_FRAME_RCVLOWAT_MAX 262144U
+#endif  // PDNNET_FRAME_RCVLOWAT_MAX
+
+/**
+ * Largest receive low watermark a `frame_reader` sets for a partial frame.
+ */
+inline constexpr std::size_t frame_rcvlowat_max = PDNNET_FRAME_RCVLOWAT_MAX;
+
+/**
+ * Received message frame.
+ */
+struct frame {
+  // application message type
+  std::uint8_t type = 0;
+  // frame flags as received
+  std::uint8_t flags = 0;
+  // decompressed payload
+  std::vector<byte> payload;
+
+  /**
+   * Return a string view of the payload.
+   */
+  std::string_view view() const noexcept
+  {
+    return {reinterpret_cast<const char*>(payload.data()), payload.size()};
+  }
+};
+
+/**
+ * Frame writer.
+ *
+ * Each frame is assembled in a reused buffer, optionally compressing the
+ * payload, and written to the socket with a single `socket_writer` call.
+ */
+class frame_writer {
+public:
+  /**
+   * Ctor.
+   *
+   * @param handle Socket handle
+   * @param compression Compression stage, `nullptr` to never compress
+   */
+  frame_writer(socket_handle handle, compression_stage* compression = nullptr)
+    : handle_{handle}, compression_{compression}, checksum_{}, n_frames_{}
+  {}
+
+  /**
+   * Set whether or not frames are sent with a CRC32C trailer.
+   *
+   * @param enable `true` to append checksums
+   */
+  auto& checksum(bool enable) noexcept
+  {
+    checksum_ = enable;
+    return *this;
+  }
+
+  /**
+   * Return `true` if frames are sent with a CRC32C trailer.
+   */
+  auto checksum() const noexcept { return checksum_; }
+
+  /**
+   * Write a frame.
+   *
+   * @param type Application message type
+   * @param data Payload bytes
+   * @param size Number of payload bytes
+   * @returns Optional empty on success, with error message on failure
+   */
+  optional_error operator()(std::uint8_t type, const void* data, std::size_t size)
+  {
+    return write(type, data, size, 0U, 0U);
+  }
+
+  /**
+   * Write a frame.
+   *
+   * @param type Application message type
+   * @param payload Payload bytes
+   * @returns Optional empty on success, with error message on failure
+   */
+  auto operator()(std::uint8_t type, std::string_view payload)
+  {
+    return (*this)(type, payload.data(), payload.size());
+  }
+
+  /**
+   * Write a frame on a stream, possibly as a chunk of a larger message.
+   *
+   * All chunks of a message must be written in order on the same stream
+   * before any other frame is written on that stream.
+   *
+   * @param stream Stream the frame is sent on
+   * @param more `true` if more chunks of the message follow
+   * @param type Application message type, the same for all chunks
+   * @param data Payload bytes
+   * @param size Number of payload bytes
+   * @returns Optional empty on success, with error message on failure
+   */
+  optional_error chunk(
+    std::uint8_t stream,
+    bool more,
+    std::uint8_t type,
+    const void* data,
+    std::size_t size)
+  {
+    return write(type, data, size, (more) ? frame_more : 0U, stream);
+  }
+
+  /**
+   * Return the compression stage, `nullptr` if not compressing.
+   */
+  auto compression() const noexcept { return compression_; }
+
+  /**
+   * Return number of frames written.
+   */
+  auto n_frames() const noexcept { return n_frames_; }
+
+private:
+  socket_handle handle_;
+  compression_stage* compression_;
+  bool checksum_;
+  std::vector<byte> out_;
+  std::size_t n_frames_;
+
+  /**
+   * Write a frame.
+   *
+   * @param type Application message type
+   * @param data Payload bytes
+   * @param size Number of payload bytes
+   * @param extra_flags Flags to set in addition to compression and checksum
+   * @param stream Stream the frame is sent on
+   * @returns Optional empty on success, with error message on failure
+   */
+  optional_error write(
+    std::uint8_t type,
+    const void* data,
+    std::size_t size,
+    std::uint8_t extra_flags,
+    std::uint8_t stream)
+  {
+    auto bytes = static_cast<const byte*>(data);
+    std::uint8_t flags = extra_flags | ((checksum_) ? frame_checksum : 0U);
+    out_.resize(frame_header_size);
+    // compression stage appends compressed payload if worthwhile
+    if (compression_ && compression_->compress(bytes, size, out_))
+      flags |= frame_compressed;
+    else
+      out_.insert(out_.end(), bytes, bytes + size);
+    // fill in header
+    auto wire_size = out_.size() - frame_header_size;
+    if (wire_size > UINT32_MAX)
+      return "Frame payload size " + std::to_string(wire_size) + " too large";
+    store_be(out_.data(), static_cast<std::uint32_t>(wire_size));
+    out_[4] = flags;
+    out_[5] = type;
+    out_[6] = stream;
+    out_[7] = 0U;
+    // checksum covers header and payload
+    if (checksum_) {
+      auto crc = crc32c(out_.data(), out_.size());
+      out_.resize(out_.size() + frame_checksum_size);
+      store_be(out_.data() + out_.size() - frame_checksum_size, crc);
+    }
+    // write header + payload + trailer together
+    if (auto err = socket_writer{handle_}(
+      reinterpret_cast<const char*>(out_.data()), out_.size()
+    ))
+      return err;
+    n_frames_++;
+    return {};
+  }
+};
+
+/**
+ * Frame reader.
+ *
+ * Reads frames written by a `frame_writer`, decompressing payloads as needed
+ * and reassembling chunked messages, so each read returns a whole message.
+ * When the peer ends transmission at a frame boundary no error is returned
+ * and `eof` will return `true`, e.g.
+ *
+ * @code{.cc}
+ * pdnnet::frame_reader reader{socket};
+ * pdnnet::frame msg;
+ * while (true) {
+ *   if (auto err = reader(msg))
+ *     throw std::runtime_error{*err};
+ *   if (reader.eof())
+ *     break;
+ *   // handle msg
+ * }
+ * @endcode
+ */
+class frame_reader {
+public:
+  /**
+   * Ctor.
+   *
+   * @param handle Socket handle
+   * @param compression Compression stage, `nullptr` if peer never compresses
+   * @param poll_timeout Timeout to use when polling socket for input
+   */
+  frame_reader(
+    socket_handle handle,
+    compression_stage* compression = nullptr,
+    std::chrono::milliseconds poll_timeout = infinite_poll_timeout)
+    : handle_{handle},
+      compression_{compression},
+      poll_timeout_{poll_timeout},
+      max_frame_size_{frame_size_max},
+      require_checksum_{},
+#if defined(_WIN32)
+      rcvlowat_{},
+#else
+      rcvlowat_{true},
+#endif  // !defined(_WIN32)
+      lowat_{1},
+      lowat_cap_{},
+      eof_{},
+      n_frames_{},
+      n_chunks_{},
+      n_reads_{}
+  {}
+
+  /**
+   * Set the maximum allowed payload size, both on the wire and decompressed.
+   *
+   * This also limits the size of a reassembled chunked message.
+   *
+   * @param size Maximum payload size in bytes
+   */
+  auto& max_frame_size(std::size_t size) noexcept
+  {
+    max_frame_size_ = size;
+    return *this;
+  }
+
+  /**
+   * Return the maximum allowed payload size.
+   */
+  auto max_frame_size() const noexcept { return max_frame_size_; }
+
+  /**
+   * Set whether or not frames without a CRC32C trailer are rejected.
+   *
+   * Frames that have a checksum are always verified.
+   *
+   * @param require `true` to reject frames without checksums
+   */
+  auto& require_checksum(bool require) noexcept
+  {
+    require_checksum_ = require;
+    return *this;
+  }
+
+  /**
+   * Return `true` if frames without a CRC32C trailer are rejected.
+   */
+  auto require_checksum() const noexcept { return require_checksum_; }
+
+  /**
+   * Set whether or not `SO_RCVLOWAT` is raised while a frame is incomplete.
+   *
+   * When only part of a frame has arrived, the socket's receive low watermark
+   * is set to the remaining bytes, capped at `frame_rcvlowat_max` and a
+   * quarter of the receive buffer size reported by `getsockopt` the first time
+   * the watermark is raised, so the reader wakes once for the rest of the
+   * frame instead of once per segment.
+   * The watermark is reset to one byte once the frame is read. If the poll
+   * timeout elapses first, the watermark is lowered to one byte and whatever
+   * has arrived is read, so the poll timeout still bounds the silence between
+   * segments and not the time for the rest of the frame. Frames that arrive
+   * whole cost no extra syscalls. Enabled by default except on Windows, where
+   * the option cannot be set, and disabled automatically if setting the
+   * option fails.
+   *
+   * @param enable `true` to raise the low watermark for partial frames
+   */
+  auto& rcvlowat(bool enable) noexcept
+  {
+    rcvlowat_ = enable;
+    return *this;
+  }
+
+  /**
+   * Return `true` if `SO_RCVLOWAT` is raised while a frame is incomplete.
+   */
+  auto rcvlowat() const noexcept { return rcvlowat_; }
+
+  /**
+   * Return `true` if the peer ended transmission at a frame boundary.
+   */
+  auto eof() const noexcept { return eof_; }
+
+  /**
+   * Return number of frames read, counting each chunk.
+   */
+  auto n_frames() const noexcept { return n_frames_; }
+
+  /**
+   * Return number of chunks of chunked messages read.
+   */
+  auto n_chunks() const noexcept { return n_chunks_; }
+
+  /**
+   * Return number of receive syscalls made for frame payloads.
+   */
+  auto n_reads() const noexcept { return n_reads_; }
+
+  /**
+   * Read the next message.
+   *
+   * Chunks are buffered until their message is complete. Messages on other
+   * streams completing in the meantime are returned first.
+   *
+   * @param msg Frame to read into. The flags are those of the last chunk.
+   * @returns Optional empty on success, with error message on failure
+   */
+  optional_error operator()(frame& msg)
+  {
+    while (true) {
+      std::uint8_t stream;
+      if (auto err = read_frame(msg, stream))
+        return err;
+      if (eof_) {
+        for (const auto& part : partial_)
+          if (part.pending)
+            return "End of transmission inside a chunked message";
+        return {};
+      }
+      // whole message with no chunks pending on its stream
+      auto more = msg.flags & frame_more;
+      if (!more && (stream >= partial_.size() || !partial_[stream].pending))
+        return {};
+      if (stream >= partial_.size())
+        partial_.resize(stream + 1U);
+      auto& part = partial_[stream];
+      n_chunks_++;
+      if (!part.pending) {
+        part.pending = true;
+        part.msg.type = msg.type;
+        part.msg.payload.clear();
+      }
+      else if (part.msg.type != msg.type)
+        return "Chunk of type " + std::to_string(msg.type) +
+          " continues message of type " + std::to_string(part.msg.type);
+      if (part.msg.payload.size() + msg.payload.size() > max_frame_size_)
+        return "Chunked message exceeds max size " + std::to_string(max_frame_size_);
+      part.msg.payload.insert(
+        part.msg.payload.end(), msg.payload.begin(), msg.payload.end()
+      );
+      if (more)
+        continue;
+      // last chunk, so hand over the reassembled payload
+      part.pending = false;
+      msg.payload.swap(part.msg.payload);
+      return {};
+    }
+  }
+
+private:
+  /**
+   * Message being reassembled from chunks on a stream.
+   */
+  struct partial_message {
+    bool pending = false;
+    frame msg;
+  };
+
+  socket_handle handle_;
+  compression_stage* compression_;
+  std::chrono::milliseconds poll_timeout_;
+  std::size_t max_frame_size_;
+  bool require_checksum_;
+  bool rcvlowat_;
+  // current receive low watermark, one unless a partial frame is pending
+  int lowat_;
+  // cap on the low watermark from the receive buffer size, zero until read
+  std::size_t lowat_cap_;
+  bool eof_;
+  std::size_t n_frames_;
+  std::size_t n_chunks_;
+  std::size_t n_reads_;
+  std::vector<byte> scratch_;
+  std::vector<partial_message> partial_;
+
+  /**
+   * Read the next frame on any stream.
+   *
+   * @param msg Frame to read into. Unchanged if end of transmission reached.
+   * @param stream Stream to write the frame's stream to
+   * @returns Optional empty on success, with error message on failure
+   */
+  optional_error read_frame(frame& msg, std::uint8_t& stream)
+  {
+    // read header, allowing end of transmission only before the first byte
+    byte header[frame_header_size];
+    std::size_t n_read;
+    if (auto err = read_exact(handle_, header, sizeof header, poll_timeout_, n_read))
+      return err;
+    if (!n_read) {
+      eof_ = true;
+      return {};
+    }
+    if (n_read < sizeof header)
+      return "Truncated frame header of " + std::to_string(n_read) + " bytes";
+    // validate header
+    auto size = load_be<std::uint32_t>(header);
+    auto flags = header[4];
+    if (size > max_frame_size_)
+      return "Frame payload size " + std::to_string(size) +
+        " exceeds max size " + std::to_string(max_frame_size_);
+    if (flags & ~frame_flags_mask)
+      return "Unknown frame flags " + std::to_string(flags);
+    if ((flags & frame_compressed) && !compression_)
+      return "Received compressed frame but no compression stage set";
+    if (require_checksum_ && !(flags & frame_checksum))
+      return "Received frame without required checksum";
+    // read payload + trailer. compressed payloads go through scratch buffer
+    auto& target = (flags & frame_compressed) ? scratch_ : msg.payload;
+    auto trailer_size = (flags & frame_checksum) ? frame_checksum_size : 0U;
+    target.resize(size + trailer_size);
+    if (auto err = read_payload(target.data(), target.size()))
+      return err;
+    // verify checksum over header and payload
+    if (flags & frame_checksum) {
+      auto expected = load_be<std::uint32_t>(target.data() + size);
+      auto actual = crc32c(target.data(), size, crc32c(header, sizeof header));
+      if (actual != expected)
+        return "Frame checksum mismatch: expected " + std::to_string(expected) +
+          ", got " + std::to_string(actual);
+      target.resize(size);
+    }
+    if (flags & frame_compressed) {
+      if (auto err = compression_->decompress(
+        scratch_.data(), size, msg.payload, max_frame_size_
+      ))
+        return err;
+    }
+    msg.type = header[5];
+    msg.flags = flags;
+    stream = header[6];
+    n_frames_++;
+    return {};
+  }
+
+  /**
+   * Read a frame payload, raising the receive low watermark if it is partial.
+   *
+   * @param buf Buffer to write the payload to
+   * @param size Number of bytes to read
+   * @returns Optional empty on success, with error message on failure
+   */
+  optional_error read_payload(void* buf, std::size_t size)
+  {
+    auto data = static_cast<char*>(buf);
+    std::size_t n_read = 0;
+    optional_error err;
+    while (n_read < size) {
+      // a raised watermark hides bytes that have arrived, so on timeout lower
+      // it and only time out if nothing at all has arrived
+      if (
+        !wait_pollin(handle_, poll_timeout_) &&
+        (lowat_ <= 1 || !set_lowat(1U) || !wait_pollin(handle_, 0))
+      ) {
+        err = "Timed out after " + std::to_string(poll_timeout_.count()) +
+          " ms waiting for " + std::to_string(size - n_read) + " bytes";
+        break;
+      }
+#if defined(_WIN32)
+      auto n_last = ::recv(
+        handle_,
+        data + n_read,
+        static_cast<int>((std::min<std::size_t>)(size - n_read, INT_MAX)),
+        0
+      );
+      if (n_last == SOCKET_ERROR) {
+        err = winsock_error("recv() failure");
+        break;
+      }
+#else
+      auto n_last = ::read(handle_, data + n_read, size - n_read);
+      if (n_last < 0) {
+        err = errno_error("read() failure");
+        break;
+      }
+#endif  // !defined(_WIN32)
+      n_reads_++;
+      if (!n_last) {
+        err = "End of transmission after " + std::to_string(n_read) + " of " +
+          std::to_string(size) + " bytes";
+        break;
+      }
+      n_read += static_cast<std::size_t>(n_last);
+      // rest of the frame has not arrived yet, so wait for all of it at once
+      if (rcvlowat_ && n_read < size)
+        set_lowat(size - n_read);
+    }
+    if (lowat_ > 1)
+      set_lowat(1U);
+    return err;
+  }
+
+  /**
+   * Set the receive low watermark if it differs from the current one.
+   *
+   * Disables raising the low watermark if the option cannot be set.
+   *
+   * @param remaining Bytes of the frame remaining
+   * @returns `true` on success, `false` if the option could not be set
+   */
+  bool set_lowat(std::size_t remaining) noexcept
+  {
+    auto target = (std::min)(remaining, frame_rcvlowat_max);
+    if (target > 1U)
+      target = (std::min)(target, lowat_cap());
+    auto lowat = static_cast<int>((std::max)(target, std::size_t{1}));
+    if (lowat == lowat_)
+      return true;
+    if (!set_recv_lowat(handle_, lowat)) {
+      rcvlowat_ = false;
+      return false;
+    }
+    lowat_ = lowat;
+    return true;
+  }
+
+  /**
+   * Return the cap on the receive low watermark, reading it on first use.
+   *
+   * Linux caps the watermark at half the buffer size `getsockopt` reports and
+   * half of that cap leaves the advertised window room for the watermark. The
+   * size is only read once since autotuning only grows the buffer, so the
+   * first size read stays a safe cap.
+   */
+  std::size_t lowat_cap() noexcept
+  {
+    if (!lowat_cap_) {
+      int buf_size;
+      if (recv_buffer_size(handle_, buf_size) && buf_size >= 8)
+        lowat_cap_ = static_cast<std::size_t>(buf_size) / 4U;
+      else
+        lowat_cap_ = frame_rcvlowat_max;
+    }
+    return lowat_cap_;
+  }
+};
+
+/**
+ * Number of priority levels of a `frame_queue`.
+ */
+inline constexpr unsigned int frame_priorities = 3U;
+
+/**
+ * Priority for small urgent frames, e.g. heartbeats and cancellations.
+ */
+inline constexpr unsigned int frame_priority_control = 0U;
+
+/**
+ * Priority for ordinary requests and responses.
+ */
+inline constexpr unsigned int frame_priority_normal = 1U;
+
+/**
+ * Priority for large transfers that may be delayed by other frames.
+ */
+inline constexpr unsigned int frame_priority_bulk = 2U;
+
+/**
+ * Per-connection output queues writing frames in priority order.
+ *
+ * Messages are queued by priority, lower values first, and sent on the stream
+ * equal to their priority. Messages larger than the chunk size are sent as
+ * chunks, and before each chunk the highest-priority queued message is picked
+ * again, so an urgent frame queued behind a large bulk transfer waits for at
+ * most one chunk instead of the whole transfer. Messages of equal priority
+ * are sent in the order they were queued.
+ *
+ * There is no writer thread. The first thread to queue a message while the
+ * queues are idle writes until they are empty, while other threads only queue
+ * their message and return, so writes never block on each other's sockets.
+ * Write errors are sticky and returned to every later caller. All member
+ * functions are thread-safe. Readers need a `frame_reader` to reassemble
+ * chunked messages, e.g.
+ *
+ * @code{.cc}
+ * pdnnet::frame_queue queue{socket};
+ * // bulk transfer on one thread
+ * queue(pdnnet::frame_priority_bulk, snapshot_type, snapshot);
+ * // heartbeat on another thread is sent between chunks of the snapshot
+ * queue(pdnnet::frame_priority_control, ping_type, "");
+ * @endcode
+ */
+class frame_queue {
+public:
+  /**
+   * Ctor.
+   *
+   * Throws `std::invalid_argument` if the chunk size is zero.
+   *
+   * @param handle Socket handle
+   * @param compression Compression stage, `nullptr` to never compress
+   * @param chunk_size Maximum payload bytes per chunk, must be positive
+   */
+  frame_queue(
+    socket_handle handle,
+    compression_stage* compression = nullptr,
+    std::size_t chunk_size = frame_chunk_size)
+    : writer_{handle, compression},
+      chunk_size_{chunk_size},
+      writing_{},
+      queued_bytes_{},
+      n_chunks_{},
+      n_interleaved_{}
+  {
+    if (!chunk_size_)
+      throw std::invalid_argument{"chunk_size must be positive"};
+  }
+
+  /**
+   * Deleted copy ctor.
+   */
+  frame_queue(const frame_queue&) = delete;
+
+  /**
+   * Set whether or not frames are sent with a CRC32C trailer.
+   *
+   * Must be called before any message is queued.
+   *
+   * @param enable `true` to append checksums
+   */
+  auto& checksum(bool enable) noexcept
+  {
+    writer_.checksum(enable);
+    return *this;
+  }
+
+  /**
+   * Queue a message, writing queued messages if no other thread is.
+   *
+   * @param priority Priority less than `frame_priorities`, lower is sooner
+   * @param type Application message type
+   * @param data Payload bytes
+   * @param size Number of payload bytes
+   * @returns Optional empty on success, with error message on failure
+   */
+  optional_error operator()(
+    unsigned int priority, std::uint8_t type, const void* data, std::size_t size)
+  {
+    auto bytes = static_cast<const byte*>(data);
+    return (*this)(priority, type, std::vector<byte>(bytes, bytes + size));
+  }
+
+  /**
+   * Queue a message, writing queued messages if no other thread is.
+   *
+   * @param priority Priority less than `frame_priorities`, lower is sooner
+   * @param type Application message type
+   * @param payload Payload bytes, moved into the queue
+   * @returns Optional empty on success, with error message on failure
+   */
+  optional_error operator()(
+    unsigned int priority, std::uint8_t type, std::vector<byte>&& payload)
+  {
+    if (priority >= frame_priorities)
+      return "Frame priority " + std::to_string(priority) + " out of range";
+    std::unique_lock lock{mutex_};
+    if (error_)
+      return error_;
+    queued_bytes_ += payload.size();
+    queues_[priority].push_back({type, std::move(payload), 0U});
+    if (writing_)
+      return {};
+    writing_ = true;
+    return drain(lock);
+  }
+
+  /**
+   * Queue a message, writing queued messages if no other thread is.
+   *
+   * @param priority Priority less than `frame_priorities`, lower is sooner
+   * @param type Application message type
+   * @param payload Payload bytes
+   * @returns Optional empty on success, with error message on failure
+   */
+  auto operator()(unsigned int priority, std::uint8_t type, std::string_view payload)
+  {
+    return (*this)(priority, type, payload.data(), payload.size());
+  }
+
+  /**
+   * Return the maximum payload bytes per chunk.
+   */
+  auto chunk_size() const noexcept { return chunk_size_; }
+
+  /**
+   * Return payload bytes queued but not yet written.
+   */
+  auto queued_bytes() const
+  {
+    std::lock_guard lock{mutex_};
+    return queued_bytes_;
+  }
+
+  /**
+   * Return number of chunks of chunked messages written.
+   */
+  auto n_chunks() const
+  {
+    std::lock_guard lock{mutex_};
+    return n_chunks_;
+  }
+
+  /**
+   * Return number of frames written between chunks of a lower-priority message.
+   */
+  auto n_interleaved() const
+  {
+    std::lock_guard lock{mutex_};
+    return n_interleaved_;
+  }
+
+  /**
+   * Return the write error, empty if none has occurred.
+   */
+  auto error() const
+  {
+    std::lock_guard lock{mutex_};
+    return error_;
+  }
+
+private:
+  /**
+   * Queued message and the number of its payload bytes already written.
+   */
+  struct message {
+    std::uint8_t type;
+    std::vector<byte> payload;
+    std::size_t offset;
+  };
+
+  frame_writer writer_;
+  std::size_t chunk_size_;
+  mutable std::mutex mutex_;
+  // deque so the message being written stays put while others are queued
+  std::deque<message> queues_[frame_priorities];
+  bool writing_;
+  std::size_t queued_bytes_;
+  std::size_t n_chunks_;
+  std::size_t n_interleaved_;
+  optional_error error_;
+
+  /**
+   * Write queued messages one frame at a time until the queues are empty.
+   *
+   * The mutex is released while writing so other threads can queue messages.
+   *
+   * @param lock Lock holding the mutex
+   * @returns Optional empty on success, with error message on failure
+   */
+  optional_error drain(std::unique_lock<std::mutex>& lock)
+  {
+    while (true) {
+      auto it = std::find_if(
+        std::begin(queues_),
+        std::end(queues_),
+        [](const auto& queue) { return !queue.empty(); }
+      );
+      if (it == std::end(queues_)) {
+        writing_ = false;
+        return {};
+      }
+      auto priority = static_cast<std::uint8_t>(it - std::begin(queues_));
+      auto& msg = it->front();
+      auto size = (std::min)(chunk_size_, msg.payload.size() - msg.offset);
+      auto more = msg.offset + size < msg.payload.size();
+      auto chunked = more || msg.offset;
+      // a lower-priority message is partway through being sent
+      auto interleaved = std::any_of(
+        it + 1,
+        std::end(queues_),
+        [](const auto& queue) { return !queue.empty() && queue.front().offset; }
+      );
+      lock.unlock();
+      auto err = writer_.chunk(
+        priority, more, msg.type, msg.payload.data() + msg.offset, size
+      );
+      lock.lock();
+      if (err) {
+        error_ = std::move(err);
+        for (auto& queue : queues_)
+          queue.clear();
+        queued_bytes_ = 0U;
+        writing_ = false;
+        return error_;
+      }
+      msg.offset += size;
+      queued_bytes_ -= size;
+      if (chunked)
+        n_chunks_++;
+      if (interleaved)
+        n_interleaved_++;
+      if (!more)
+        it->pop_front();
+    }
+  }
+};
+
+}  // namespace pdnnet
+
+#endif  // PDNNET_FRAME_HH_
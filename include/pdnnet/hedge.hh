@@ -0,0 +1,463 @@
+/**
+ * @file hedge.hh
+ * @author Derek Huang
+ * @brief C++ header for hedged client requests
+ * @copyright MIT License
+ */
+
+#ifndef PDNNET_HEDGE_HH_
+#define PDNNET_HEDGE_HH_
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif  // WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#include <WinSock2.h>
+#else
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif  // !defined(_WIN32)
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "pdnnet/client.hh"
+#include "pdnnet/deadline.hh"
+#include "pdnnet/error.hh"
+#include "pdnnet/socket.hh"
+
+namespace pdnnet {
+
+/**
+ * Client sending hedged requests to backends from a connection pool.
+ *
+ * A request is written to one backend and, if no response has started to
+ * arrive after `hedge_delay()`, the same request is written to the next
+ * backend, or over a second connection if there is only one backend. The
+ * first connection to return a response byte wins and the other connection
+ * is closed, cancelling it. Requests must therefore be idempotent.
+ *
+ * By default the hedge delay adapts to the `quantile()` of recently observed
+ * times to first response byte, so with the default 0.95 only the slowest
+ * 5% of requests are hedged. Hedges are additionally capped at `budget()` of
+ * all requests so a slow backend cannot double the load on the others.
+ *
+ * Responses are delimited by the backend closing the connection, like the
+ * other clients and servers in this library.
+ *
+ * @note This class is not thread-safe, but clients on different threads can
+ *  share a single `connection_pool`.
+ *
+ * @code{.cc}
+ * pdnnet::connection_pool pool;
+ * pool.add("10.0.0.1", 8888).throw_on_error();
+ * pool.add("10.0.0.2", 8888).throw_on_error();
+ * pdnnet::hedged_client client{pool};
+ * client.budget(0.02);
+ * std::string response;
+ * pdnnet::deadline deadline{std::chrono::milliseconds{500}};
+ * client.request("GET key\n", response, deadline).throw_on_error();
+ * @endcode
+ */
+class hedged_client {
+public:
+  using clock_type = deadline::clock_type;
+
+  /**
+   * Ctor.
+   *
+   * @param pool Connection pool with at least one backend
+   */
+  explicit hedged_client(connection_pool& pool)
+    : pool_{pool},
+      delay_{50},
+      adaptive_{true},
+      quantile_{0.95},
+      budget_{0.05},
+      window_{256U},
+      min_samples_{16U},
+      close_write_{true},
+      next_backend_{},
+      next_sample_{},
+      n_requests_{},
+      n_hedged_{},
+      n_hedge_wins_{},
+      n_budget_denied_{}
+  {}
+
+  /**
+   * Return the fixed hedge delay, used until enough samples are observed.
+   */
+  auto delay() const noexcept { return delay_; }
+
+  /**
+   * Set the fixed hedge delay, used until enough samples are observed.
+   *
+   * @param delay Hedge delay
+   * @returns `*this` to allow method chaining
+   */
+  auto& delay(std::chrono::milliseconds delay) noexcept
+  {
+    delay_ = delay;
+    return *this;
+  }
+
+  /**
+   * Return whether the hedge delay adapts to observed latencies.
+   */
+  auto adaptive() const noexcept { return adaptive_; }
+
+  /**
+   * Set whether the hedge delay adapts to observed latencies.
+   *
+   * @param enable `true` to use the observed `quantile()` once available
+   * @returns `*this` to allow method chaining
+   */
+  auto& adaptive(bool enable) noexcept
+  {
+    adaptive_ = enable;
+    return *this;
+  }
+
+  /**
+   * Return the latency quantile used as the adaptive hedge delay.
+   */
+  auto quantile() const noexcept { return quantile_; }
+
+  /**
+   * Set the latency quantile used as the adaptive hedge delay.
+   *
+   * @param q Quantile in `[0, 1]`, e.g. 0.95 for the p95 latency
+   * @returns `*this` to allow method chaining
+   */
+  auto& quantile(double q) noexcept
+  {
+    quantile_ = (std::min)((std::max)(q, 0.), 1.);
+    return *this;
+  }
+
+  /**
+   * Return the maximum fraction of requests that can be hedged.
+   */
+  auto budget() const noexcept { return budget_; }
+
+  /**
+   * Set the maximum fraction of requests that can be hedged.
+   *
+   * @param fraction Hedge budget, e.g. 0.05 for at most 5% extra requests
+   * @returns `*this` to allow method chaining
+   */
+  auto& budget(double fraction) noexcept
+  {
+    budget_ = (std::max)(fraction, 0.);
+    return *this;
+  }
+
+  /**
+   * Return number of recent latency samples the adaptive delay is taken from.
+   */
+  auto window() const noexcept { return window_; }
+
+  /**
+   * Set number of recent latency samples the adaptive delay is taken from.
+   *
+   * Existing samples are discarded.
+   *
+   * @param n_samples Window size, at least 1
+   * @returns `*this` to allow method chaining
+   */
+  auto& window(std::size_t n_samples)
+  {
+    window_ = (std::max)(n_samples, std::size_t{1U});
+    samples_.clear();
+    next_sample_ = 0;
+    return *this;
+  }
+
+  /**
+   * Return number of samples needed before the hedge delay adapts.
+   */
+  auto min_samples() const noexcept { return min_samples_; }
+
+  /**
+   * Set number of samples needed before the hedge delay adapts.
+   *
+   * @param n_samples Minimum number of samples
+   * @returns `*this` to allow method chaining
+   */
+  auto& min_samples(std::size_t n_samples) noexcept
+  {
+    min_samples_ = n_samples;
+    return *this;
+  }
+
+  /**
+   * Return whether the write end is closed after writing a request.
+   */
+  auto close_write() const noexcept { return close_write_; }
+
+  /**
+   * Set whether the write end is closed after writing a request.
+   *
+   * @param enable `true` to signal end of transmission after each request
+   * @returns `*this` to allow method chaining
+   */
+  auto& close_write(bool enable) noexcept
+  {
+    close_write_ = enable;
+    return *this;
+  }
+
+  /**
+   * Return the delay after which the next request would be hedged.
+   *
+   * This is the `quantile()` of the observed times to first response byte if
+   * `adaptive()` and at least `min_samples()` are observed, else `delay()`.
+   */
+  clock_type::duration hedge_delay() const
+  {
+    if (!adaptive_ || !samples_.size() || samples_.size() < min_samples_)
+      return delay_;
+    auto sorted = samples_;
+    auto k = (std::min)(
+      static_cast<std::size_t>(std::floor(quantile_ * sorted.size())),
+      sorted.size() - 1U
+    );
+    std::nth_element(sorted.begin(), sorted.begin() + k, sorted.end());
+    return sorted[k];
+  }
+
+  /**
+   * Return number of requests made.
+   */
+  auto n_requests() const noexcept { return n_requests_; }
+
+  /**
+   * Return number of requests that were hedged.
+   */
+  auto n_hedged() const noexcept { return n_hedged_; }
+
+  /**
+   * Return number of hedged requests answered first by the hedge.
+   */
+  auto n_hedge_wins() const noexcept { return n_hedge_wins_; }
+
+  /**
+   * Return number of hedges not sent because the budget was exhausted.
+   */
+  auto n_budget_denied() const noexcept { return n_budget_denied_; }
+
+  /**
+   * Send a request and read the response before a deadline.
+   *
+   * Fails only if the primary request could not be sent or neither the
+   * primary nor the hedge returned a response. On error, `response` may hold
+   * a partial response.
+   *
+   * @param request Request bytes
+   * @param response String to write the response to
+   * @param deadline Deadline bounding the request, including any hedge
+   * @returns Error wrapper empty on success, with error message on failure
+   */
+  optional_error request(
+    std::string_view request, std::string& response, const deadline& deadline)
+  {
+    auto n_backends = pool_.n_backends();
+    if (!n_backends)
+      return "Connection pool has no backends";
+    n_requests_++;
+    response.clear();
+    // hedge goes to the next backend or over a second connection
+    auto primary = next_backend_++ % n_backends;
+    auto secondary = (primary + 1U) % n_backends;
+    attempt attempts[2];
+    if (auto err = send(attempts[0], primary, request, deadline))
+      return err;
+    auto start = clock_type::now();
+    auto hedge_at = start + hedge_delay();
+    bool hedge_considered = false;
+    optional_error last_error;
+    // wait for the first response byte on either connection
+    while (true) {
+      if (auto err = deadline.check("read"))
+        return err;
+      auto now = clock_type::now();
+      // send the hedge if within budget once the delay has passed
+      if (!hedge_considered && now >= hedge_at) {
+        hedge_considered = true;
+        if (n_hedged_ + 1U > budget_ * n_requests_)
+          n_budget_denied_++;
+        else {
+          n_hedged_++;
+          // failure to hedge does not fail the request
+          if (send(attempts[1], secondary, request, deadline))
+            attempts[1].active = false;
+        }
+      }
+      if (!attempts[0].active && !attempts[1].active)
+        return (last_error) ? last_error : "All requests failed";
+      // wait no longer than the cancellation check interval or the hedge
+      auto timeout = deadline.remaining();
+      if (deadline.infinite() || timeout > deadline_cancel_interval)
+        timeout = deadline_cancel_interval;
+      if (!hedge_considered)
+        timeout = (std::min)(
+          timeout,
+          std::chrono::ceil<std::chrono::milliseconds>(hedge_at - now)
+        );
+      int winner;
+      if (auto err = wait_first_byte(attempts, timeout, winner, last_error))
+        return err;
+      if (winner < 0)
+        continue;
+      // first byte wins, cancel the other connection by closing it
+      auto& won = attempts[winner];
+      attempts[1 - winner].socket = {};
+      record(clock_type::now() - start);
+      if (winner == 1)
+        n_hedge_wins_++;
+      response = std::move(won.response);
+      return read(won.socket, response, deadline);
+    }
+  }
+
+private:
+  /**
+   * In-flight request on a single connection.
+   */
+  struct attempt {
+    unique_socket socket;
+    std::string response;
+    bool active = false;
+  };
+
+  connection_pool& pool_;
+  std::chrono::milliseconds delay_;
+  bool adaptive_;
+  double quantile_;
+  double budget_;
+  std::size_t window_;
+  std::size_t min_samples_;
+  bool close_write_;
+  std::size_t next_backend_;
+  std::vector<clock_type::duration> samples_;
+  std::size_t next_sample_;
+  std::size_t n_requests_;
+  std::size_t n_hedged_;
+  std::size_t n_hedge_wins_;
+  std::size_t n_budget_denied_;
+
+  /**
+   * Acquire a connection and write the request to it.
+   *
+   * @param to Attempt to send on
+   * @param backend Backend index
+   * @param request Request bytes
+   * @param deadline Request deadline
+   * @returns Error wrapper empty on success, with error message on failure
+   */
+  optional_error send(
+    attempt& to,
+    std::size_t backend,
+    std::string_view request,
+    const deadline& deadline)
+  {
+    if (auto err = pool_.acquire(backend, to.socket, deadline))
+      return err;
+    if (auto err = write(to.socket, request, deadline))
+      return err;
+    if (close_write_) {
+      try {
+        shutdown(to.socket, shutdown_type::write);
+      }
+      catch (const std::runtime_error& exc) {
+        return exc.what();
+      }
+    }
+    to.active = true;
+    return {};
+  }
+
+  /**
+   * Wait for the first response bytes on the active connections.
+   *
+   * Connections that fail or close without a response are deactivated.
+   *
+   * @param attempts In-flight requests
+   * @param timeout Maximum time to wait
+   * @param winner Index of the first connection to receive bytes, -1 if none
+   * @param last_error Updated with the error of any failed connection
+   * @returns Optional empty on success, with error message if polling fails
+   */
+  static optional_error wait_first_byte(
+    attempt (&attempts)[2],
+    std::chrono::milliseconds timeout,
+    int& winner,
+    optional_error& last_error)
+  {
+    winner = -1;
+    pollfd fds[2];
+    int index[2];
+    unsigned int n_fds = 0;
+    for (int i = 0; i < 2; i++) {
+      if (!attempts[i].active)
+        continue;
+      fds[n_fds] = {attempts[i].socket, POLLIN, 0};
+      index[n_fds++] = i;
+    }
+#if defined(_WIN32)
+    auto status = WSAPoll(fds, n_fds, static_cast<int>(timeout.count()));
+#else
+    auto status = ::poll(fds, n_fds, static_cast<int>(timeout.count()));
+#endif  // !defined(_WIN32)
+    if (status < 0)
+      return socket_error("poll() failed");
+    for (unsigned int j = 0; j < n_fds; j++) {
+      if (!(fds[j].revents & (POLLIN | POLLERR | POLLHUP)))
+        continue;
+      auto& at = attempts[index[j]];
+      char buf[socket_read_size];
+#if defined(_WIN32)
+      auto n_read = ::recv(at.socket, buf, static_cast<int>(sizeof buf), 0);
+#else
+      auto n_read = ::read(at.socket, buf, sizeof buf);
+#endif  // !defined(_WIN32)
+      if (n_read > 0) {
+        at.response.append(buf, static_cast<std::size_t>(n_read));
+        winner = index[j];
+        return {};
+      }
+      at.active = false;
+      last_error = (n_read) ?
+        socket_error("Request failed") :
+        std::string{"Backend closed the connection without a response"};
+    }
+    return {};
+  }
+
+  /**
+   * Record a time to first response byte for the adaptive hedge delay.
+   *
+   * @param latency Time from sending the request to the first response byte
+   */
+  void record(clock_type::duration latency)
+  {
+    if (samples_.size() < window_)
+      samples_.push_back(latency);
+    else
+      samples_[next_sample_] = latency;
+    next_sample_ = (next_sample_ + 1U) % window_;
+  }
+};
+
+}  // namespace pdnnet
+
+#endif  // PDNNET_HEDGE_HH_
@@ -0,0 +1,495 @@
+/**
+ * @file line_reader.hh
+ * @author Derek Huang
+ * @brief C++ header for delimiter scanning and line-oriented socket reads
+ * @copyright MIT License
+ */
+
+#ifndef PDNNET_LINE_READER_HH_
+#define PDNNET_LINE_READER_HH_
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif  // WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#include <WinSock2.h>
+#include <intrin.h>
+#else
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif  // !defined(_WIN32)
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "pdnnet/error.hh"
+#include "pdnnet/socket.hh"
+
+// SIMD instruction sets used for delimiter scanning. AVX2 is only used if the
+// compiler targets it, e.g. with -mavx2 or /arch:AVX2, while SSE2 is baseline
+// for x86-64. NEON is baseline for AArch64.
+#if defined(__AVX2__)
+#define PDNNET_HAS_AVX2
+#endif  // defined(__AVX2__)
+#if defined(__SSE2__) || defined(_M_X64) || \
+  (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PDNNET_HAS_SSE2
+#endif  // !defined(__SSE2__) && !defined(_M_X64) && ...
+#if defined(__ARM_NEON) || defined(_M_ARM64)
+#define PDNNET_HAS_NEON
+#endif  // !defined(__ARM_NEON) && !defined(_M_ARM64)
+
+#if defined(PDNNET_HAS_AVX2) || defined(PDNNET_HAS_SSE2)
+#include <immintrin.h>
+#endif  // defined(PDNNET_HAS_AVX2) || defined(PDNNET_HAS_SSE2)
+#if defined(PDNNET_HAS_NEON)
+#include <arm_neon.h>
+#endif  // defined(PDNNET_HAS_NEON)
+
+namespace pdnnet {
+
+namespace detail {
+
+/**
+ * Return number of trailing zero bits in a nonzero 32-bit mask.
+ *
+ * @param mask Nonzero mask
+ */
+inline unsigned int ctz32(std::uint32_t mask) noexcept
+{
+#if defined(_MSC_VER)
+  unsigned long index;
+  _BitScanForward(&index, mask);
+  return static_cast<unsigned int>(index);
+#else
+  return static_cast<unsigned int>(__builtin_ctz(mask));
+#endif  // !defined(_MSC_VER)
+}
+
+/**
+ * Return number of trailing zero bits in a nonzero 64-bit mask.
+ *
+ * @param mask Nonzero mask
+ */
+inline unsigned int ctz64(std::uint64_t mask) noexcept
+{
+#if defined(_MSC_VER)
+  unsigned long index;
+  _BitScanForward64(&index, mask);
+  return static_cast<unsigned int>(index);
+#else
+  return static_cast<unsigned int>(__builtin_ctzll(mask));
+#endif  // !defined(_MSC_VER)
+}
+
+/**
+ * Return pointer to first occurrence of a byte in a range using `memchr`.
+ *
+ * @param first Start of range
+ * @param last End of range
+ * @param c Byte to search for
+ * @returns Pointer to the byte or `last` if not found
+ */
+inline const char* find_byte_scalar(
+  const char* first, const char* last, char c) noexcept
+{
+  if (first == last)
+    return last;
+  auto pos = std::memchr(first, static_cast<unsigned char>(c), last - first);
+  return (pos) ? static_cast<const char*>(pos) : last;
+}
+
+#if defined(PDNNET_HAS_SSE2)
+/**
+ * Return pointer to first occurrence of a byte in a range using SSE2.
+ *
+ * @param first Start of range
+ * @param last End of range
+ * @param c Byte to search for
+ * @returns Pointer to the byte or `last` if not found
+ */
+inline const char* find_byte_sse2(
+  const char* first, const char* last, char c) noexcept
+{
+  auto needle = _mm_set1_epi8(c);
+  for (; last - first >= 16; first += 16) {
+    auto block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(first));
+    auto mask = static_cast<std::uint32_t>(
+      _mm_movemask_epi8(_mm_cmpeq_epi8(block, needle))
+    );
+    if (mask)
+      return first + ctz32(mask);
+  }
+  return find_byte_scalar(first, last, c);
+}
+#endif  // defined(PDNNET_HAS_SSE2)
+
+#if defined(PDNNET_HAS_AVX2)
+/**
+ * Return pointer to first occurrence of a byte in a range using AVX2.
+ *
+ * @param first Start of range
+ * @param last End of range
+ * @param c Byte to search for
+ * @returns Pointer to the byte or `last` if not found
+ */
+inline const char* find_byte_avx2(
+  const char* first, const char* last, char c) noexcept
+{
+  auto needle = _mm256_set1_epi8(c);
+  for (; last - first >= 32; first += 32) {
+    auto block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(first));
+    auto mask = static_cast<std::uint32_t>(
+      _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, needle))
+    );
+    if (mask)
+      return first + ctz32(mask);
+  }
+  return find_byte_sse2(first, last, c);
+}
+#endif  // defined(PDNNET_HAS_AVX2)
+
+#if defined(PDNNET_HAS_NEON)
+/**
+ * Return pointer to first occurrence of a byte in a range using NEON.
+ *
+ * Since NEON has no `movemask`, the comparison result is narrowed so that
+ * each byte becomes a nibble of a 64-bit mask.
+ *
+ * @param first Start of range
+ * @param last End of range
+ * @param c Byte to search for
+ * @returns Pointer to the byte or `last` if not found
+ */
+inline const char* find_byte_neon(
+  const char* first, const char* last, char c) noexcept
+{
+  auto needle = vdupq_n_u8(static_cast<std::uint8_t>(c));
+  for (; last - first >= 16; first += 16) {
+    auto block = vld1q_u8(reinterpret_cast<const std::uint8_t*>(first));
+    auto eq = vreinterpretq_u16_u8(vceqq_u8(block, needle));
+    auto mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(eq, 4)), 0);
+    if (mask)
+      return first + (ctz64(mask) >> 2);
+  }
+  return find_byte_scalar(first, last, c);
+}
+#endif  // defined(PDNNET_HAS_NEON)
+
+}  // namespace detail
+
+/**
+ * Return pointer to the first occurrence of a byte in a range.
+ *
+ * Uses the widest SIMD instruction set available at compile time, falling
+ * back to `memchr` for the tail of the range or if no SIMD is available.
+ *
+ * @param first Start of range
+ * @param last End of range
+ * @param c Byte to search for
+ * @returns Pointer to the byte or `last` if not found
+ */
+inline const char* find_byte(const char* first, const char* last, char c) noexcept
+{
+#if defined(PDNNET_HAS_AVX2)
+  return detail::find_byte_avx2(first, last, c);
+#elif defined(PDNNET_HAS_SSE2)
+  return detail::find_byte_sse2(first, last, c);
+#elif defined(PDNNET_HAS_NEON)
+  return detail::find_byte_neon(first, last, c);
+#else
+  return detail::find_byte_scalar(first, last, c);
+#endif  // !defined(PDNNET_HAS_AVX2) && !defined(PDNNET_HAS_SSE2) && ...
+}
+
+/**
+ * Line reader class for line-oriented protocols over a socket.
+ *
+ * Bytes are read into an internal receive buffer which is scanned for the
+ * delimiter with `find_byte`. Complete lines are returned as string views into
+ * the buffer without copying, with the delimiter stripped. Incomplete lines
+ * are carried over by compacting them to the front of the buffer before the
+ * next read, so bytes are never scanned twice. The buffer grows geometrically
+ * only if a single line does not fit, up to a configurable max line size.
+ *
+ * @code{.cc}
+ * pdnnet::line_reader reader{socket};
+ * reader.crlf(true);
+ * reader([](std::string_view line) { std::cout << line << "\n"; })
+ *   .throw_on_error();
+ * @endcode
+ *
+ * @note Line views are invalidated by the next call to `fill()`.
+ */
+class line_reader {
+public:
+  /**
+   * Default maximum line size in bytes.
+   */
+  static inline constexpr std::size_t max_line_size_default = 1U << 20;
+
+  /**
+   * Ctor.
+   *
+   * Buffer read size is given by `socket_read_size`.
+   *
+   * @param handle Socket handle
+   * @param poll_timeout Timeout to use when polling socket for input
+   */
+  line_reader(
+    socket_handle handle,
+    std::chrono::milliseconds poll_timeout = socket_reader::poll_timeout_default)
+    : line_reader{handle, socket_read_size, poll_timeout}
+  {}
+
+  /**
+   * Ctor.
+   *
+   * @param handle Socket handle
+   * @param buf_size Initial receive buffer size
+   * @param poll_timeout Timeout to use when polling socket for input
+   */
+  line_reader(
+    socket_handle handle,
+    std::size_t buf_size,
+    std::chrono::milliseconds poll_timeout = socket_reader::poll_timeout_default)
+    : handle_{handle},
+      buf_size_{buf_size},
+      buf_{std::make_unique<char[]>(buf_size_)},
+      begin_{},
+      scan_{},
+      end_{},
+      delim_{'\n'},
+      crlf_{},
+      max_line_size_{max_line_size_default},
+      poll_timeout_{poll_timeout},
+      eof_{}
+  {
+    if (!buf_size_)
+      throw std::invalid_argument{"buf_size must be positive"};
+  }
+
+  /**
+   * Return the delimiter byte.
+   */
+  auto delimiter() const noexcept { return delim_; }
+
+  /**
+   * Set the delimiter byte.
+   *
+   * @param delim New delimiter byte, e.g. `'\0'`, `'\n'`
+   * @returns `*this` to allow method chaining
+   */
+  auto& delimiter(char delim) noexcept
+  {
+    delim_ = delim;
+    return *this;
+  }
+
+  /**
+   * Return `true` if a `'\r'` preceding the delimiter is also stripped.
+   */
+  auto crlf() const noexcept { return crlf_; }
+
+  /**
+   * Enable or disable stripping of `'\r'` preceding the delimiter.
+   *
+   * This is used for CRLF-terminated protocols together with `'\n'`.
+   *
+   * @param enable `true` to strip the `'\r'`, `false` otherwise
+   * @returns `*this` to allow method chaining
+   */
+  auto& crlf(bool enable) noexcept
+  {
+    crlf_ = enable;
+    return *this;
+  }
+
+  /**
+   * Return the maximum line size in bytes.
+   */
+  auto max_line_size() const noexcept { return max_line_size_; }
+
+  /**
+   * Set the maximum line size in bytes.
+   *
+   * @param size Max line size, including delimiter
+   * @returns `*this` to allow method chaining
+   */
+  auto& max_line_size(std::size_t size) noexcept
+  {
+    max_line_size_ = size;
+    return *this;
+  }
+
+  /**
+   * Return current receive buffer size.
+   */
+  auto buf_size() const noexcept { return buf_size_; }
+
+  /**
+   * Return number of buffered bytes not yet returned as lines.
+   */
+  auto pending() const noexcept { return end_ - begin_; }
+
+  /**
+   * Return `true` if the peer has signaled end of transmission.
+   */
+  auto eof() const noexcept { return eof_; }
+
+  /**
+   * Return the next complete line from the buffer without reading.
+   *
+   * @returns Line view without the delimiter, empty if no complete line
+   */
+  std::optional<std::string_view> buffered_line() noexcept
+  {
+    auto first = buf_.get() + scan_;
+    auto last = buf_.get() + end_;
+    auto pos = find_byte(first, last, delim_);
+    // no delimiter, so remember where we stopped scanning
+    if (pos == last) {
+      scan_ = end_;
+      return {};
+    }
+    // line spans from begin_ to pos, excluding delimiter and maybe '\r'
+    std::string_view line{
+      buf_.get() + begin_, static_cast<std::size_t>(pos - (buf_.get() + begin_))
+    };
+    if (crlf_ && line.size() && line.back() == '\r')
+      line.remove_suffix(1U);
+    begin_ = scan_ = static_cast<std::size_t>(pos - buf_.get()) + 1U;
+    return line;
+  }
+
+  /**
+   * Return any trailing bytes after end of transmission as the final line.
+   *
+   * As with delimited lines, a trailing `'\r'` is stripped if `crlf()` is set.
+   *
+   * @returns Line view of the remaining bytes, empty if none
+   */
+  std::optional<std::string_view> remainder() noexcept
+  {
+    if (!eof_ || begin_ == end_)
+      return {};
+    std::string_view line{buf_.get() + begin_, end_ - begin_};
+    if (crlf_ && line.back() == '\r')
+      line.remove_suffix(1U);
+    begin_ = scan_ = end_;
+    return line;
+  }
+
+  /**
+   * Perform a single read from the socket into the receive buffer.
+   *
+   * Any incomplete line is first compacted to the front of the buffer. If no
+   * data arrives before the poll timeout, this returns without error.
+   *
+   * @returns Optional empty on success, with error message on failure
+   */
+  optional_error fill()
+  {
+    if (eof_)
+      return {};
+    // carry incomplete line over to the front of the buffer
+    if (begin_) {
+      std::memmove(buf_.get(), buf_.get() + begin_, end_ - begin_);
+      end_ -= begin_;
+      scan_ -= begin_;
+      begin_ = 0;
+    }
+    // single line fills the whole buffer so grow geometrically
+    if (end_ == buf_size_) {
+      if (buf_size_ >= max_line_size_)
+        return "Line exceeds max line size " + std::to_string(max_line_size_);
+      auto new_size = (std::min)(2 * buf_size_, max_line_size_);
+      auto new_buf = std::make_unique<char[]>(new_size);
+      std::memcpy(new_buf.get(), buf_.get(), end_);
+      buf_ = std::move(new_buf);
+      buf_size_ = new_size;
+    }
+    // poll before reading so slow peers don't block forever
+    if (!wait_pollin(handle_, poll_timeout_))
+      return {};
+#if defined(_WIN32)
+    auto n_read = ::recv(
+      handle_,
+      buf_.get() + end_,
+      static_cast<int>((std::min<std::size_t>)(buf_size_ - end_, INT_MAX)),
+      0
+    );
+    if (n_read == SOCKET_ERROR)
+      return winsock_error("recv() failure");
+#else
+    auto n_read = ::read(handle_, buf_.get() + end_, buf_size_ - end_);
+    if (n_read < 0)
+      return errno_error("read() failure");
+#endif  // !defined(_WIN32)
+    if (!n_read)
+      eof_ = true;
+    end_ += static_cast<std::size_t>(n_read);
+    return {};
+  }
+
+  /**
+   * Read from the socket until end of transmission, invoking a callable on
+   * each complete line.
+   *
+   * Any trailing bytes not terminated by the delimiter are passed as the last
+   * line. The callable is invoked with a `std::string_view`. If no data
+   * arrives before the poll timeout, this returns early without error.
+   *
+   * @tparam Func Callable taking a `std::string_view`
+   *
+   * @param func Callable invoked on each line
+   * @returns Optional empty on success, with error message on failure
+   */
+  template <typename Func>
+  optional_error operator()(Func&& func)
+  {
+    while (true) {
+      while (auto line = buffered_line())
+        func(*line);
+      if (eof_) {
+        if (auto line = remainder())
+          func(*line);
+        return {};
+      }
+      // no progress means the poll timed out
+      auto old_end = end_ - begin_;
+      if (auto err = fill())
+        return err;
+      if (!eof_ && end_ == old_end)
+        return {};
+    }
+  }
+
+private:
+  socket_handle handle_;
+  std::size_t buf_size_;
+  std::unique_ptr<char[]> buf_;
+  std::size_t begin_;
+  std::size_t scan_;
+  std::size_t end_;
+  char delim_;
+  bool crlf_;
+  std::size_t max_line_size_;
+  std::chrono::milliseconds poll_timeout_;
+  bool eof_;
+};
+
+}  // namespace pdnnet
+
+#endif  // PDNNET_LINE_READER_HH_
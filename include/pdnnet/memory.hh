@@ -9,11 +9,16 @@
 #define PDNNET_MEMORY_HH_
 
 #include <algorithm>
+#include <cstddef>
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
 #include <memory>
+#include <mutex>
+#include <string_view>
 #include <type_traits>
+#include <utility>
+#include <vector>
 
 namespace pdnnet {
 
@@ -22,6 +27,27 @@ namespace pdnnet {
  */
 using byte = unsigned char;
 
+/**
+ * Non-owning view of a contiguous range of read-only bytes.
+ */
+struct byte_span {
+  const byte* data{};
+  std::size_t size{};
+
+  /**
+   * Return `true` if the span has no bytes.
+   */
+  bool empty() const noexcept { return !size; }
+
+  /**
+   * Return the bytes as a string view.
+   */
+  auto view() const noexcept
+  {
+    return std::string_view{reinterpret_cast<const char*>(data), size};
+  }
+};
+
 /**
  * Byte buffer class template with unique ownership.
  *
@@ -53,7 +79,7 @@ public:
    * @param buf Allocated buffer to be deleted via `Deleter` to own
    * @param size Number of bytes in the allocated buffer
    */
-  explicit byte_buffer(const byte* buf, std::size_t size) noexcept
+  explicit byte_buffer(byte* buf, std::size_t size) noexcept
     : buf_{buf}, size_{size}
   {}
 
@@ -118,6 +144,142 @@ private:
   std::size_t size_;
 };
 
+/**
+ * Macro for the default `buffer_pool` buffer size.
+ *
+ * This can be redefined at compile time. However, prefer to use the
+ * `buffer_pool_buf_size` constexpr global in actual application code.
+ */
+#ifndef PDNNET_BUFFER_POOL_BUF_SIZE
+#define PDNNET_BUFFER_POOL_BUF_SIZE 16384U
+#endif  // PDNNET_BUFFER_POOL_BUF_SIZE
+
+/**
+ * Default `buffer_pool` buffer size.
+ */
+inline constexpr std::size_t buffer_pool_buf_size = PDNNET_BUFFER_POOL_BUF_SIZE;
+
+/**
+ * Thread-safe pool of equally-sized byte buffers.
+ *
+ * Buffers released back to the pool are kept on a free list so that later
+ * acquisitions avoid a heap allocation. The free list is capped so that a
+ * burst of connections does not pin its peak memory usage forever.
+ */
+class buffer_pool {
+public:
+  /**
+   * Ctor.
+   *
+   * @param buf_size Size of each buffer in bytes
+   * @param max_free Maximum number of free buffers to retain
+   */
+  buffer_pool(
+    std::size_t buf_size = buffer_pool_buf_size, std::size_t max_free = 64U)
+    : buf_size_{buf_size}, max_free_{max_free}
+  {}
+
+  /**
+   * Deleted copy ctor.
+   */
+  buffer_pool(const buffer_pool&) = delete;
+
+  /**
+   * Return size of each buffer in bytes.
+   */
+  auto buf_size() const noexcept { return buf_size_; }
+
+  /**
+   * Return maximum number of free buffers retained by the pool.
+   *
+   * @note This function is thread-safe.
+   */
+  auto max_free() const
+  {
+    std::lock_guard lock{mut_};
+    return max_free_;
+  }
+
+  /**
+   * Return number of free buffers currently held by the pool.
+   *
+   * @note This function is thread-safe.
+   */
+  auto n_free() const
+  {
+    std::lock_guard lock{mut_};
+    return free_.size();
+  }
+
+  /**
+   * Acquire a buffer, reusing a free buffer if one is available.
+   *
+   * @note This function is thread-safe.
+   */
+  byte_buffer<> acquire()
+  {
+    {
+      std::lock_guard lock{mut_};
+      if (free_.size()) {
+        auto buf = std::move(free_.back());
+        free_.pop_back();
+        return buf;
+      }
+    }
+    return byte_buffer<>{buf_size_};
+  }
+
+  /**
+   * Return a buffer to the pool.
+   *
+   * Buffers of the wrong size or in excess of `max_free()` are just freed.
+   *
+   * @note This function is thread-safe.
+   *
+   * @param buf Buffer previously returned by `acquire()`
+   */
+  void release(byte_buffer<>&& buf)
+  {
+    if (!buf.get() || buf.size() != buf_size_)
+      return;
+    std::lock_guard lock{mut_};
+    if (free_.size() < max_free_)
+      free_.push_back(std::move(buf));
+  }
+
+  /**
+   * Update the maximum number of free buffers, freeing any excess buffers.
+   *
+   * @note This function is thread-safe.
+   *
+   * @param max_free New maximum number of free buffers to retain
+   */
+  void shrink(std::size_t max_free)
+  {
+    std::lock_guard lock{mut_};
+    max_free_ = max_free;
+    if (free_.size() > max_free_)
+      free_.resize(max_free_);
+  }
+
+private:
+  std::size_t buf_size_;
+  std::size_t max_free_;
+  mutable std::mutex mut_;
+  std::vector<byte_buffer<>> free_;
+};
+
+/**
+ * Return reference to the default process-wide buffer pool.
+ *
+ * Buffers are `buffer_pool_buf_size` bytes each.
+ */
+inline auto& default_buffer_pool()
+{
+  static buffer_pool pool;
+  return pool;
+}
+
 }  // namespace pdnnet
 
 #endif  // PDNNET_MEMORY_HH_
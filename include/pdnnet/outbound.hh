@@ -0,0 +1,448 @@
+/**
+ * @file outbound.hh
+ * @author Derek Huang
+ * @brief C++ header for bounded outbound queues with backpressure
+ * @copyright MIT License
+ */
+
+#ifndef PDNNET_OUTBOUND_HH_
+#define PDNNET_OUTBOUND_HH_
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif  // WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#include <WinSock2.h>
+#else
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#endif  // !defined(_WIN32)
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "pdnnet/error.hh"
+#include "pdnnet/memory.hh"
+#include "pdnnet/socket.hh"
+
+/**
+ * Default number of queued bytes at which an outbound queue pauses input.
+ */
+#ifndef PDNNET_OUTBOUND_HIGH_WATERMARK
+#define PDNNET_OUTBOUND_HIGH_WATERMARK 1048576U
+#endif  // PDNNET_OUTBOUND_HIGH_WATERMARK
+
+/**
+ * Default number of queued bytes at which an outbound queue resumes input.
+ */
+#ifndef PDNNET_OUTBOUND_LOW_WATERMARK
+#define PDNNET_OUTBOUND_LOW_WATERMARK 262144U
+#endif  // PDNNET_OUTBOUND_LOW_WATERMARK
+
+namespace pdnnet {
+
+/**
+ * Default number of queued bytes at which an outbound queue pauses input.
+ */
+inline constexpr std::size_t
+outbound_high_watermark{PDNNET_OUTBOUND_HIGH_WATERMARK};
+
+/**
+ * Default number of queued bytes at which an outbound queue resumes input.
+ */
+inline constexpr std::size_t
+outbound_low_watermark{PDNNET_OUTBOUND_LOW_WATERMARK};
+
+/**
+ * Per-connection outbound queue with high and low watermarks.
+ *
+ * Writes never block. Bytes the socket does not accept immediately are
+ * queued and sent by later calls to `flush()`, usually when the socket polls
+ * writable. Once the queued bytes reach the high watermark the queue is
+ * paused and the high watermark callback is invoked, and once they drop to
+ * the low watermark the queue is resumed and the low watermark callback is
+ * invoked. While the queue is paused the application should stop reading
+ * from whatever produces its output, e.g. the input of an echo or relay, so
+ * memory stays bounded by roughly the high watermark plus one read when a
+ * peer reads slowly. The gap between the watermarks keeps a peer reading at
+ * about the production rate from pausing and resuming on every write.
+ *
+ * @code{.cc}
+ * pdnnet::outbound_queue queue{socket};
+ * queue.on_high([&] { stop_reading(upstream); });
+ * queue.on_low([&] { start_reading(upstream); });
+ * // when upstream has data
+ * queue(data).throw_on_error();
+ * // when socket is writable
+ * queue.flush().throw_on_error();
+ * @endcode
+ *
+ * The queue is not thread-safe and the callbacks are invoked from the call
+ * that crossed the watermark. On Windows the socket is put in non-blocking
+ * mode since `send` has no per-call non-blocking flag there.
+ */
+class outbound_queue {
+public:
+  /**
+   * Watermark callback type.
+   */
+  using callback_type = std::function<void()>;
+
+  /**
+   * Ctor.
+   *
+   * Throws `std::invalid_argument` if the watermarks are invalid.
+   *
+   * @param handle Socket handle
+   * @param high_watermark Queued bytes at which the queue pauses, positive
+   * @param low_watermark Queued bytes at which the queue resumes, less than
+   *  the high watermark
+   */
+  outbound_queue(
+    socket_handle handle,
+    std::size_t high_watermark = outbound_high_watermark,
+    std::size_t low_watermark = outbound_low_watermark)
+    : handle_{handle},
+      high_watermark_{high_watermark},
+      low_watermark_{low_watermark},
+      offset_{},
+      queued_bytes_{},
+      paused_{},
+      n_sent_{},
+      n_paused_{},
+      max_queued_bytes_{}
+  {
+    if (!high_watermark_)
+      throw std::invalid_argument{"high_watermark must be positive"};
+    if (low_watermark_ >= high_watermark_)
+      throw std::invalid_argument{"low_watermark must be less than high_watermark"};
+#if defined(_WIN32)
+    if (!set_nonblocking(handle_, true))
+      throw std::runtime_error{winsock_error("Could not set non-blocking mode")};
+#endif  // defined(_WIN32)
+  }
+
+  /**
+   * Deleted copy ctor.
+   */
+  outbound_queue(const outbound_queue&) = delete;
+
+  /**
+   * Return the socket handle.
+   */
+  auto handle() const noexcept { return handle_; }
+
+  /**
+   * Return the number of queued bytes at which the queue pauses.
+   */
+  auto high_watermark() const noexcept { return high_watermark_; }
+
+  /**
+   * Return the number of queued bytes at which the queue resumes.
+   */
+  auto low_watermark() const noexcept { return low_watermark_; }
+
+  /**
+   * Set the callback invoked when the queue reaches the high watermark.
+   *
+   * @param callback Callback, empty to unset
+   * @returns `*this` to allow method chaining
+   */
+  auto& on_high(callback_type callback)
+  {
+    on_high_ = std::move(callback);
+    return *this;
+  }
+
+  /**
+   * Set the callback invoked when the queue drops to the low watermark.
+   *
+   * @param callback Callback, empty to unset
+   * @returns `*this` to allow method chaining
+   */
+  auto& on_low(callback_type callback)
+  {
+    on_low_ = std::move(callback);
+    return *this;
+  }
+
+  /**
+   * Return `true` if the queue is paused, i.e. input should not be read.
+   */
+  auto paused() const noexcept { return paused_; }
+
+  /**
+   * Return `true` if no bytes are queued.
+   */
+  auto empty() const noexcept { return !queued_bytes_; }
+
+  /**
+   * Return number of bytes queued but not yet sent.
+   */
+  auto queued_bytes() const noexcept { return queued_bytes_; }
+
+  /**
+   * Return the largest number of bytes that were queued at once.
+   */
+  auto max_queued_bytes() const noexcept { return max_queued_bytes_; }
+
+  /**
+   * Return number of bytes sent so far.
+   */
+  auto n_sent() const noexcept { return n_sent_; }
+
+  /**
+   * Return number of times the queue has paused.
+   */
+  auto n_paused() const noexcept { return n_paused_; }
+
+  /**
+   * Send bytes, queuing whatever the socket does not accept immediately.
+   *
+   * Bytes are always accepted, even while paused, so one read's worth of
+   * output produced before the application noticed the pause is not lost.
+   *
+   * @param data Bytes to write
+   * @param size Number of bytes to write
+   * @returns Optional empty on success, with error message on failure
+   */
+  optional_error operator()(const void* data, std::size_t size)
+  {
+    auto bytes = static_cast<const byte*>(data);
+    // nothing queued, so try to send directly without copying
+    if (!queued_bytes_) {
+      std::size_t n_sent;
+      if (auto err = send_some(bytes, size, n_sent))
+        return err;
+      bytes += n_sent;
+      size -= n_sent;
+      if (!size)
+        return {};
+    }
+    chunks_.emplace_back(bytes, bytes + size);
+    queued_bytes_ += size;
+    if (queued_bytes_ > max_queued_bytes_)
+      max_queued_bytes_ = queued_bytes_;
+    if (!paused_ && queued_bytes_ >= high_watermark_) {
+      paused_ = true;
+      n_paused_++;
+      if (on_high_)
+        on_high_();
+    }
+    return {};
+  }
+
+  /**
+   * Send string view contents, queuing what is not accepted immediately.
+   *
+   * @param text Text to write
+   * @returns Optional empty on success, with error message on failure
+   */
+  auto operator()(std::string_view text)
+  {
+    return (*this)(text.data(), text.size());
+  }
+
+  /**
+   * Send as many queued bytes as the socket accepts without blocking.
+   *
+   * @returns Optional empty on success, with error message on failure
+   */
+  optional_error flush()
+  {
+    while (!chunks_.empty()) {
+      const auto& chunk = chunks_.front();
+      auto size = chunk.size() - offset_;
+      std::size_t n_sent;
+      auto err = send_some(chunk.data() + offset_, size, n_sent);
+      offset_ += n_sent;
+      queued_bytes_ -= n_sent;
+      if (offset_ == chunk.size()) {
+        chunks_.pop_front();
+        offset_ = 0;
+      }
+      if (err)
+        return err;
+      // socket buffer is full
+      if (n_sent < size)
+        break;
+    }
+    if (paused_ && queued_bytes_ <= low_watermark_) {
+      paused_ = false;
+      if (on_low_)
+        on_low_();
+    }
+    return {};
+  }
+
+private:
+  socket_handle handle_;
+  std::size_t high_watermark_;
+  std::size_t low_watermark_;
+  // queued writes, with the bytes of the front one already sent
+  std::deque<std::vector<byte>> chunks_;
+  std::size_t offset_;
+  std::size_t queued_bytes_;
+  bool paused_;
+  std::size_t n_sent_;
+  std::size_t n_paused_;
+  std::size_t max_queued_bytes_;
+  callback_type on_high_;
+  callback_type on_low_;
+
+  /**
+   * Send bytes until done or until the socket would block.
+   *
+   * @param data Bytes to send
+   * @param size Number of bytes to send
+   * @param n_sent Number of bytes sent
+   * @returns Optional empty on success, with error message on failure
+   */
+  optional_error send_some(const byte* data, std::size_t size, std::size_t& n_sent)
+  {
+    n_sent = 0;
+    while (n_sent < size) {
+#if defined(_WIN32)
+      auto n_last = ::send(
+        handle_,
+        reinterpret_cast<const char*>(data + n_sent),
+        static_cast<int>((std::min)(size - n_sent, std::size_t{INT_MAX})),
+        0
+      );
+      if (n_last == SOCKET_ERROR) {
+        if (WSAGetLastError() == WSAEWOULDBLOCK)
+          break;
+        return winsock_error("send() failure");
+      }
+#else
+      int flags = MSG_DONTWAIT;
+      // don't raise SIGPIPE if the peer has gone away
+#if defined(MSG_NOSIGNAL)
+      flags |= MSG_NOSIGNAL;
+#endif  // defined(MSG_NOSIGNAL)
+      auto n_last = ::send(handle_, data + n_sent, size - n_sent, flags);
+      if (n_last < 0) {
+        if (errno == EINTR)
+          continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+          break;
+        return errno_error("send() failure");
+      }
+#endif  // !defined(_WIN32)
+      n_sent += static_cast<std::size_t>(n_last);
+      n_sent_ += static_cast<std::size_t>(n_last);
+    }
+    return {};
+  }
+};
+
+/**
+ * Relay bytes read from a source socket to an outbound queue.
+ *
+ * Reading from the source stops while the queue is paused and resumes once
+ * it has drained to its low watermark, so a slow reader on the sink side
+ * pushes back on the source through TCP flow control instead of growing the
+ * queue. The source and the queue's socket may be the same, e.g. to echo.
+ *
+ * Input ends when the source reaches end of transmission or when nothing
+ * happens for `read_timeout` while reading, after which the queued bytes are
+ * flushed. The relay fails if the queue cannot make progress for
+ * `write_timeout`.
+ *
+ * @param source Socket handle to read from
+ * @param sink Outbound queue to write to
+ * @param read_timeout Timeout for input, negative for no timeout
+ * @param write_timeout Timeout for output progress, negative for no timeout
+ * @param read_size Number of bytes to read from the source at once
+ * @returns Optional empty on success, with error message on failure
+ */
+inline optional_error relay(
+  socket_handle source,
+  outbound_queue& sink,
+  std::chrono::milliseconds read_timeout = infinite_poll_timeout,
+  std::chrono::milliseconds write_timeout = infinite_poll_timeout,
+  std::size_t read_size = socket_read_size)
+{
+  auto buf = std::make_unique<byte[]>(read_size);
+  auto same = (source == sink.handle());
+  auto input_done = false;
+  while (true) {
+    auto reading = !input_done && !sink.paused();
+    if (!reading && sink.empty())
+      return {};
+    // poll the source for input and the sink for output as needed
+    pollfd fds[2]{};
+    unsigned int n_fds = 0;
+    if (reading)
+      fds[n_fds++] = {source, POLLIN, 0};
+    if (!sink.empty()) {
+      if (same && reading)
+        fds[0].events |= POLLOUT;
+      else
+        fds[n_fds++] = {sink.handle(), POLLOUT, 0};
+    }
+    auto timeout = (reading) ? read_timeout : write_timeout;
+#if defined(_WIN32)
+    auto status = WSAPoll(fds, n_fds, static_cast<int>(timeout.count()));
+#else
+    auto status = ::poll(fds, n_fds, static_cast<int>(timeout.count()));
+#endif  // !defined(_WIN32)
+    if (status < 0)
+      return socket_error("poll() failure");
+    if (!status) {
+      if (!reading)
+        return "Relay sink made no progress within " +
+          std::to_string(write_timeout.count()) + " ms";
+      input_done = true;
+      continue;
+    }
+    for (unsigned int i = 0; i < n_fds; i++) {
+      const auto& fd = fds[i];
+      // socket errors surface as flush or read errors
+      if ((fd.events & POLLOUT) && (fd.revents & (POLLOUT | POLLERR | POLLHUP))) {
+        if (auto err = sink.flush())
+          return err;
+      }
+      if (!(fd.events & POLLIN) || !(fd.revents & (POLLIN | POLLERR | POLLHUP)))
+        continue;
+#if defined(_WIN32)
+      auto n_read = ::recv(
+        source,
+        reinterpret_cast<char*>(buf.get()),
+        static_cast<int>(read_size),
+        0
+      );
+      if (n_read == SOCKET_ERROR)
+        return winsock_error("recv() failure");
+#else
+      auto n_read = ::recv(source, buf.get(), read_size, 0);
+      if (n_read < 0) {
+        if (errno == EINTR)
+          continue;
+        return errno_error("recv() failure");
+      }
+#endif  // !defined(_WIN32)
+      if (!n_read)
+        input_done = true;
+      else if (auto err = sink(buf.get(), static_cast<std::size_t>(n_read)))
+        return err;
+    }
+  }
+}
+
+}  // namespace pdnnet
+
+#endif  // PDNNET_OUTBOUND_HH_
@@ -0,0 +1,631 @@
+/**
+ * @file pressure.hh
+ * @author Derek Huang
+ * @brief C++ header for memory and CPU pressure monitoring
+ * @copyright MIT License
+ */
+
+#ifndef PDNNET_PRESSURE_HH_
+#define PDNNET_PRESSURE_HH_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "pdnnet/error.hh"
+#include "pdnnet/memory.hh"
+
+namespace pdnnet {
+
+/**
+ * Pressure stall information (PSI) for a resource.
+ *
+ * Averages are the percentage of wall time in which at least one task
+ * (`some`) or all non-idle tasks (`full`) were stalled on the resource over
+ * the last 10, 60, and 300 seconds. Totals are cumulative stall microseconds.
+ */
+struct psi_stats {
+  double some_avg10{};
+  double some_avg60{};
+  double some_avg300{};
+  std::uint64_t some_total{};
+  double full_avg10{};
+  double full_avg60{};
+  double full_avg300{};
+  std::uint64_t full_total{};
+};
+
+/**
+ * Parse pressure stall information from a PSI file.
+ *
+ * The format is that of the `/proc/pressure` files, e.g.
+ *
+ * @code{.txt}
+ * some avg10=0.00 avg60=0.00 avg300=0.00 total=0
+ * full avg10=0.00 avg60=0.00 avg300=0.00 total=0
+ * @endcode
+ *
+ * The `full` line is absent for system-wide CPU pressure on older kernels.
+ *
+ * @param path Path to PSI file
+ * @param stats Statistics to update on success
+ * @returns Optional empty on success, with error message on failure
+ */
+inline optional_error read_psi(const std::string& path, psi_stats& stats)
+{
+  std::ifstream in{path};
+  if (!in)
+    return "Could not open " + path;
+  psi_stats res;
+  std::string line;
+  while (std::getline(in, line)) {
+    std::istringstream ss{line};
+    std::string kind;
+    ss >> kind;
+    bool some = (kind == "some");
+    if (!some && kind != "full")
+      return "Unknown PSI line in " + path + ": " + line;
+    std::string field;
+    while (ss >> field) {
+      auto eq = field.find('=');
+      if (eq == std::string::npos)
+        return "Malformed PSI field in " + path + ": " + field;
+      auto key = field.substr(0, eq);
+      auto value = field.substr(eq + 1);
+      try {
+        if (key == "avg10")
+          (some ? res.some_avg10 : res.full_avg10) = std::stod(value);
+        else if (key == "avg60")
+          (some ? res.some_avg60 : res.full_avg60) = std::stod(value);
+        else if (key == "avg300")
+          (some ? res.some_avg300 : res.full_avg300) = std::stod(value);
+        else if (key == "total")
+          (some ? res.some_total : res.full_total) = std::stoull(value);
+      }
+      catch (const std::logic_error&) {
+        return "Malformed PSI value in " + path + ": " + field;
+      }
+    }
+  }
+  stats = res;
+  return {};
+}
+
+/**
+ * cgroup v2 memory usage and limits in bytes.
+ *
+ * Limits are zero if not set, i.e. if the cgroup file contains "max".
+ */
+struct cgroup_memory {
+  std::uint64_t current{};
+  std::uint64_t high{};
+  std::uint64_t max{};
+
+  /**
+   * Return the effective limit, the lower of the nonzero limits.
+   *
+   * Returns zero if there is no limit.
+   */
+  std::uint64_t limit() const noexcept
+  {
+    if (!high || !max)
+      return high + max;
+    return (std::min)(high, max);
+  }
+
+  /**
+   * Return usage as a fraction of the effective limit, zero if no limit.
+   */
+  double usage() const noexcept
+  {
+    auto lim = limit();
+    return (lim) ? static_cast<double>(current) / lim : 0.;
+  }
+};
+
+namespace detail {
+
+/**
+ * Read a single cgroup value where "max" means no limit.
+ *
+ * @param path Path to cgroup file
+ * @param value Value to update on success, zero for "max"
+ * @returns Optional empty on success, with error message on failure
+ */
+inline optional_error read_cgroup_value(
+  const std::string& path, std::uint64_t& value)
+{
+  std::ifstream in{path};
+  if (!in)
+    return "Could not open " + path;
+  std::string text;
+  in >> text;
+  if (text == "max") {
+    value = 0;
+    return {};
+  }
+  try {
+    value = std::stoull(text);
+  }
+  catch (const std::logic_error&) {
+    return "Malformed value in " + path + ": " + text;
+  }
+  return {};
+}
+
+}  // namespace detail
+
+/**
+ * Read cgroup v2 memory usage and limits.
+ *
+ * Missing `memory.high` or `memory.max` files are treated as no limit, e.g.
+ * for the root cgroup, but `memory.current` must exist.
+ *
+ * @param dir cgroup directory, e.g. `/sys/fs/cgroup/system.slice`
+ * @param mem Memory usage and limits to update on success
+ * @returns Optional empty on success, with error message on failure
+ */
+inline optional_error read_cgroup_memory(
+  const std::string& dir, cgroup_memory& mem)
+{
+  cgroup_memory res;
+  auto err = detail::read_cgroup_value(dir + "/memory.current", res.current);
+  if (err)
+    return err;
+  // limits are optional
+  detail::read_cgroup_value(dir + "/memory.high", res.high);
+  detail::read_cgroup_value(dir + "/memory.max", res.max);
+  mem = res;
+  return {};
+}
+
+/**
+ * Return the cgroup v2 directory of the current process.
+ *
+ * Parses the `0::` entry of `/proc/self/cgroup`, checking both the unified
+ * mount at `/sys/fs/cgroup` and the hybrid mount at `/sys/fs/cgroup/unified`.
+ * Returns an empty string if not found, e.g. on non-Linux platforms.
+ */
+inline std::string current_cgroup_dir()
+{
+  std::ifstream in{"/proc/self/cgroup"};
+  std::string line;
+  while (std::getline(in, line)) {
+    if (line.rfind("0::", 0) != 0)
+      continue;
+    auto rel = line.substr(3);
+    if (rel == "/")
+      rel.clear();
+    for (const char* root : {"/sys/fs/cgroup", "/sys/fs/cgroup/unified"}) {
+      auto dir = root + rel;
+      if (std::ifstream{dir + "/memory.current"})
+        return dir;
+    }
+  }
+  return {};
+}
+
+/**
+ * Resource pressure level.
+ */
+enum class pressure_level : unsigned int {
+  none = 0,
+  moderate,
+  high,
+  critical
+};
+
+/**
+ * Thresholds at which a metric reaches each pressure level.
+ *
+ * A metric at or above a threshold is at that level.
+ */
+struct pressure_thresholds {
+  double moderate;
+  double high;
+  double critical;
+
+  /**
+   * Return the pressure level of a metric value.
+   *
+   * @param value Metric value
+   */
+  pressure_level level(double value) const noexcept
+  {
+    if (value >= critical)
+      return pressure_level::critical;
+    if (value >= high)
+      return pressure_level::high;
+    if (value >= moderate)
+      return pressure_level::moderate;
+    return pressure_level::none;
+  }
+};
+
+/**
+ * Monitor of memory and CPU pressure driving graceful degradation.
+ *
+ * Samples cgroup v2 `memory.current`, `memory.high`, and `memory.max` plus
+ * the memory and CPU PSI files and reduces each to a `pressure_level`. The
+ * levels drive decisions meant to keep a process from being OOM-killed under
+ * bursts: shrinking managed buffer pools, scaling down per-connection read
+ * sizes and concurrency, and shedding new connections at critical memory
+ * pressure. CPU pressure only lowers concurrency.
+ *
+ * Memory pressure is the higher of the level of usage relative to the
+ * effective cgroup limit and the level of the 10 second `some` memory stall
+ * average. Sources that are unavailable, e.g. no cgroup v2 or no PSI support,
+ * are ignored, so on unsupported platforms the level is always `none`.
+ *
+ * Attach a monitor to a server with `server_params::pressure`. Servers call
+ * `update` from their accept loops, which resamples at most once per
+ * `interval()`, so no extra thread is needed.
+ *
+ * @code{.cc}
+ * pdnnet::pressure_monitor monitor;
+ * monitor.manage(pdnnet::default_buffer_pool());
+ * server.start(pdnnet::server_params{}.pressure(&monitor));
+ * @endcode
+ */
+class pressure_monitor {
+public:
+  /**
+   * Default ctor.
+   *
+   * Uses the cgroup of the current process and `/proc/pressure`, samples at
+   * most every 500 ms, and uses default thresholds.
+   */
+  pressure_monitor()
+    : pressure_monitor{current_cgroup_dir(), "/proc/pressure"}
+  {}
+
+  /**
+   * Ctor.
+   *
+   * @param cgroup_dir cgroup v2 directory, empty to skip cgroup sampling
+   * @param psi_dir Directory with `memory` and `cpu` PSI files, empty to skip
+   */
+  pressure_monitor(std::string cgroup_dir, std::string psi_dir)
+    : cgroup_dir_{std::move(cgroup_dir)},
+      psi_dir_{std::move(psi_dir)},
+      interval_{500},
+      memory_thresholds_{0.70, 0.85, 0.95},
+      memory_psi_thresholds_{10., 25., 50.},
+      cpu_psi_thresholds_{40., 70., 90.},
+      memory_level_{pressure_level::none},
+      cpu_level_{pressure_level::none},
+      n_samples_{}
+  {}
+
+  /**
+   * Deleted copy ctor.
+   */
+  pressure_monitor(const pressure_monitor&) = delete;
+
+  /**
+   * Return the cgroup v2 directory being sampled.
+   */
+  const auto& cgroup_dir() const noexcept { return cgroup_dir_; }
+
+  /**
+   * Return the PSI directory being sampled.
+   */
+  const auto& psi_dir() const noexcept { return psi_dir_; }
+
+  /**
+   * Return the minimum interval between samples taken by `update`.
+   */
+  auto interval() const noexcept { return interval_; }
+
+  /**
+   * Set the minimum interval between samples taken by `update`.
+   *
+   * @param value New sampling interval
+   * @returns `*this` to allow method chaining
+   */
+  auto& interval(std::chrono::milliseconds value) noexcept
+  {
+    interval_ = value;
+    return *this;
+  }
+
+  /**
+   * Return thresholds for memory usage as a fraction of the cgroup limit.
+   */
+  const auto& memory_thresholds() const noexcept { return memory_thresholds_; }
+
+  /**
+   * Set thresholds for memory usage as a fraction of the cgroup limit.
+   *
+   * Defaults to 0.70, 0.85, and 0.95.
+   *
+   * @param value New thresholds
+   * @returns `*this` to allow method chaining
+   */
+  auto& memory_thresholds(const pressure_thresholds& value) noexcept
+  {
+    memory_thresholds_ = value;
+    return *this;
+  }
+
+  /**
+   * Return thresholds for the 10 second `some` memory stall percentage.
+   */
+  const auto& memory_psi_thresholds() const noexcept
+  {
+    return memory_psi_thresholds_;
+  }
+
+  /**
+   * Set thresholds for the 10 second `some` memory stall percentage.
+   *
+   * Defaults to 10, 25, and 50.
+   *
+   * @param value New thresholds
+   * @returns `*this` to allow method chaining
+   */
+  auto& memory_psi_thresholds(const pressure_thresholds& value) noexcept
+  {
+    memory_psi_thresholds_ = value;
+    return *this;
+  }
+
+  /**
+   * Return thresholds for the 10 second `some` CPU stall percentage.
+   */
+  const auto& cpu_psi_thresholds() const noexcept { return cpu_psi_thresholds_; }
+
+  /**
+   * Set thresholds for the 10 second `some` CPU stall percentage.
+   *
+   * Defaults to 40, 70, and 90.
+   *
+   * @param value New thresholds
+   * @returns `*this` to allow method chaining
+   */
+  auto& cpu_psi_thresholds(const pressure_thresholds& value) noexcept
+  {
+    cpu_psi_thresholds_ = value;
+    return *this;
+  }
+
+  /**
+   * Manage a buffer pool, shrinking its free list as memory pressure rises.
+   *
+   * The pool must outlive the monitor or be removed with `unmanage`.
+   *
+   * @note This function is thread-safe.
+   *
+   * @param pool Buffer pool
+   * @returns `*this` to allow method chaining
+   */
+  auto& manage(buffer_pool& pool)
+  {
+    std::lock_guard lock{mut_};
+    pools_.emplace_back(&pool, pool.max_free());
+    return *this;
+  }
+
+  /**
+   * Stop managing a buffer pool, restoring its original max free buffers.
+   *
+   * @note This function is thread-safe.
+   *
+   * @param pool Buffer pool previously passed to `manage`
+   */
+  void unmanage(buffer_pool& pool)
+  {
+    std::lock_guard lock{mut_};
+    for (auto it = pools_.begin(); it != pools_.end(); it++) {
+      if (it->first == &pool) {
+        pool.shrink(it->second);
+        pools_.erase(it);
+        return;
+      }
+    }
+  }
+
+  /**
+   * Sample all pressure sources and update levels and managed pools.
+   *
+   * Sources that are unavailable are skipped.
+   *
+   * @note This function is thread-safe.
+   *
+   * @returns Optional empty on success, with error message on parse failure
+   */
+  optional_error sample()
+  {
+    std::lock_guard lock{mut_};
+    return sample_locked();
+  }
+
+  /**
+   * Sample if at least `interval()` has elapsed since the last sample.
+   *
+   * Returns immediately if another thread is already sampling, so this is
+   * cheap to call from hot accept loops. Parse errors are ignored.
+   *
+   * @note This function is thread-safe.
+   *
+   * @returns `true` if a sample was taken, `false` otherwise
+   */
+  bool update()
+  {
+    std::unique_lock lock{mut_, std::try_to_lock};
+    if (!lock.owns_lock())
+      return false;
+    auto now = std::chrono::steady_clock::now();
+    if (n_samples_ && now - last_sample_ < interval_)
+      return false;
+    sample_locked();
+    return true;
+  }
+
+  /**
+   * Return the last cgroup memory usage and limits.
+   *
+   * @note This function is thread-safe.
+   */
+  auto memory() const
+  {
+    std::lock_guard lock{mut_};
+    return memory_;
+  }
+
+  /**
+   * Return the last memory pressure stall information.
+   *
+   * @note This function is thread-safe.
+   */
+  auto memory_psi() const
+  {
+    std::lock_guard lock{mut_};
+    return memory_psi_;
+  }
+
+  /**
+   * Return the last CPU pressure stall information.
+   *
+   * @note This function is thread-safe.
+   */
+  auto cpu_psi() const
+  {
+    std::lock_guard lock{mut_};
+    return cpu_psi_;
+  }
+
+  /**
+   * Return the number of samples taken.
+   */
+  auto n_samples() const noexcept { return n_samples_.load(); }
+
+  /**
+   * Return the current memory pressure level.
+   */
+  auto memory_level() const noexcept { return memory_level_.load(); }
+
+  /**
+   * Return the current CPU pressure level.
+   */
+  auto cpu_level() const noexcept { return cpu_level_.load(); }
+
+  /**
+   * Return the current overall pressure level, the higher of memory and CPU.
+   */
+  auto level() const noexcept { return (std::max)(memory_level(), cpu_level()); }
+
+  /**
+   * Return the factor resource usage should be scaled by for a level.
+   *
+   * Halves for each level above `none`, i.e. 1, 1/2, 1/4, 1/8.
+   *
+   * @param level Pressure level
+   */
+  static constexpr double scale(pressure_level level) noexcept
+  {
+    return 1. / (1U << static_cast<unsigned int>(level));
+  }
+
+  /**
+   * Return a read size scaled down for the current memory pressure.
+   *
+   * @param base Read size without pressure
+   * @param min_size Minimum read size to return
+   */
+  std::size_t read_size(std::size_t base, std::size_t min_size = 512U) const noexcept
+  {
+    auto size = static_cast<std::size_t>(base * scale(memory_level()));
+    return (std::max)(size, (std::min)(base, min_size));
+  }
+
+  /**
+   * Return a concurrency limit scaled down for the current pressure.
+   *
+   * @param base Concurrency limit without pressure
+   * @returns Scaled concurrency limit, at least one unless `base` is zero
+   */
+  unsigned int max_concurrency(unsigned int base) const noexcept
+  {
+    auto limit = static_cast<unsigned int>(base * scale(level()));
+    return (base) ? (std::max)(limit, 1U) : 0U;
+  }
+
+  /**
+   * Return `true` if new work should be shed, i.e. memory is critical.
+   */
+  bool shed() const noexcept
+  {
+    return memory_level() == pressure_level::critical;
+  }
+
+private:
+  std::string cgroup_dir_;
+  std::string psi_dir_;
+  std::chrono::milliseconds interval_;
+  pressure_thresholds memory_thresholds_;
+  pressure_thresholds memory_psi_thresholds_;
+  pressure_thresholds cpu_psi_thresholds_;
+  mutable std::mutex mut_;
+  cgroup_memory memory_;
+  psi_stats memory_psi_;
+  psi_stats cpu_psi_;
+  std::vector<std::pair<buffer_pool*, std::size_t>> pools_;
+  std::chrono::steady_clock::time_point last_sample_;
+  std::atomic<pressure_level> memory_level_;
+  std::atomic<pressure_level> cpu_level_;
+  std::atomic<std::size_t> n_samples_;
+
+  /**
+   * Sample all pressure sources with the mutex held.
+   *
+   * @returns Optional empty on success, with error message on parse failure
+   */
+  optional_error sample_locked()
+  {
+    optional_error err;
+    auto mem_level = pressure_level::none;
+    auto cpu_level = pressure_level::none;
+    // missing files mean the source is unavailable, not an error
+    if (cgroup_dir_.size() && std::ifstream{cgroup_dir_ + "/memory.current"}) {
+      if (auto e = read_cgroup_memory(cgroup_dir_, memory_))
+        err = e;
+      else
+        mem_level = memory_thresholds_.level(memory_.usage());
+    }
+    if (psi_dir_.size() && std::ifstream{psi_dir_ + "/memory"}) {
+      if (auto e = read_psi(psi_dir_ + "/memory", memory_psi_))
+        err = e;
+      else
+        mem_level = (std::max)(
+          mem_level, memory_psi_thresholds_.level(memory_psi_.some_avg10)
+        );
+    }
+    if (psi_dir_.size() && std::ifstream{psi_dir_ + "/cpu"}) {
+      if (auto e = read_psi(psi_dir_ + "/cpu", cpu_psi_))
+        err = e;
+      else
+        cpu_level = cpu_psi_thresholds_.level(cpu_psi_.some_avg10);
+    }
+    memory_level_ = mem_level;
+    cpu_level_ = cpu_level;
+    // shrink managed pools, allowing them to grow back as pressure eases
+    for (auto& [pool, max_free] : pools_)
+      pool->shrink(static_cast<std::size_t>(max_free * scale(mem_level)));
+    last_sample_ = std::chrono::steady_clock::now();
+    n_samples_++;
+    return err;
+  }
+};
+
+}  // namespace pdnnet
+
+#endif  // PDNNET_PRESSURE_HH_
@@ -19,6 +19,7 @@
 #include <cerrno>
 #include <cstring>
 #include <stdexcept>
+#include <string>
 
 #include "pdnnet/error.hh"
 #include "pdnnet/features.h"
@@ -29,6 +30,11 @@
 #include <unistd.h>
 #endif  // PDNNET_UNIX
 
+#ifdef PDNNET_LINUX
+#include <pthread.h>
+#include <sched.h>
+#endif  // PDNNET_LINUX
+
 // currently only needed when PDNNET_BSD_DEFAULT_SOURCE not defined
 #ifndef PDNNET_BSD_DEFAULT_SOURCE
 #include <cstdlib>
@@ -95,6 +101,40 @@ inline auto getpid() noexcept
 }
 #endif  // !defined(PDNNET_UNIX) && !defined(_WIN32)
 
+/**
+ * Pin the calling thread to a single CPU.
+ *
+ * Uses `pthread_setaffinity_np` on Linux and `SetThreadAffinityMask` on
+ * Windows, where only the first 64 CPUs can be selected. On other platforms
+ * an error is always returned.
+ *
+ * @param cpu CPU index
+ * @returns Optional empty on success, with error message on failure
+ */
+inline optional_error pin_thread(unsigned int cpu)
+{
+#if defined(PDNNET_LINUX)
+  if (cpu >= CPU_SETSIZE)
+    return "CPU " + std::to_string(cpu) + " exceeds CPU_SETSIZE";
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  CPU_SET(cpu, &cpus);
+  // returns error number instead of setting errno
+  auto status = pthread_setaffinity_np(pthread_self(), sizeof cpus, &cpus);
+  if (status)
+    return "pthread_setaffinity_np() failed: " + std::string{std::strerror(status)};
+  return {};
+#elif defined(_WIN32)
+  if (cpu >= 64U)
+    return "CPU " + std::to_string(cpu) + " exceeds max of 63";
+  if (!SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR{1} << cpu))
+    return "SetThreadAffinityMask() failed: " + std::to_string(GetLastError());
+  return {};
+#else
+  return "Thread pinning to CPU " + std::to_string(cpu) + " not supported";
+#endif  // !defined(PDNNET_LINUX) && !defined(_WIN32)
+}
+
 }  // namespace pdnnet
 
 #endif  // PDNNET_PROCESS_HH_
@@ -0,0 +1,475 @@
+/**
+ * @file rcu.hh
+ * @author Derek Huang
+ * @brief C++ header for read-copy-update of read-mostly shared data
+ * @copyright MIT License
+ */
+
+#ifndef PDNNET_RCU_HH_
+#define PDNNET_RCU_HH_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace pdnnet {
+
+/**
+ * Epoch-based reclamation domain shared by RCU readers and cells.
+ *
+ * The domain keeps a global epoch and one slot per registered reader holding
+ * the epoch the reader entered its read-side critical section at, zero if the
+ * reader is idle. Writers advance the epoch when retiring an old version and
+ * may free it once no reader is still in a critical section from an earlier
+ * epoch, i.e. after a grace period.
+ */
+class rcu_domain {
+public:
+  /**
+   * Ctor.
+   */
+  rcu_domain() noexcept : epoch_{1U} {}
+
+  /**
+   * Deleted copy ctor.
+   */
+  rcu_domain(const rcu_domain&) = delete;
+
+  /**
+   * Return the current epoch.
+   */
+  auto epoch() const noexcept { return epoch_.load(); }
+
+  /**
+   * Return number of registered readers.
+   */
+  auto n_readers() const
+  {
+    std::lock_guard lock{mutex_};
+    return slots_.size() - free_.size();
+  }
+
+  /**
+   * Advance the epoch, returning the new epoch.
+   *
+   * Readers entering a critical section from now on see everything published
+   * before the call.
+   */
+  auto advance() noexcept { return ++epoch_; }
+
+  /**
+   * Return the lowest epoch of any reader in a critical section.
+   *
+   * Returns the maximum epoch value if no reader is in a critical section.
+   */
+  std::uint64_t min_active_epoch() const
+  {
+    auto res = (std::numeric_limits<std::uint64_t>::max)();
+    std::lock_guard lock{mutex_};
+    for (const auto& s : slots_) {
+      auto e = s.epoch.load();
+      if (e && e < res)
+        res = e;
+    }
+    return res;
+  }
+
+  /**
+   * Wait for a grace period, i.e. for all current critical sections to end.
+   *
+   * Must not be called from inside a critical section.
+   */
+  void synchronize()
+  {
+    auto target = advance();
+    while (min_active_epoch() < target)
+      std::this_thread::yield();
+  }
+
+private:
+  friend class rcu_reader;
+
+  /**
+   * Reader epoch slot, padded to avoid false sharing between readers.
+   */
+  struct alignas(64) slot {
+    std::atomic<std::uint64_t> epoch{};
+  };
+
+  mutable std::mutex mutex_;
+  // deque so slot addresses are stable as readers register
+  std::deque<slot> slots_;
+  std::vector<slot*> free_;
+  std::atomic<std::uint64_t> epoch_;
+
+  /**
+   * Register a reader, returning its slot.
+   */
+  slot* acquire_slot()
+  {
+    std::lock_guard lock{mutex_};
+    if (free_.empty())
+      return &slots_.emplace_back();
+    auto s = free_.back();
+    free_.pop_back();
+    return s;
+  }
+
+  /**
+   * Unregister a reader.
+   *
+   * @param s Slot returned by `acquire_slot`
+   */
+  void release_slot(slot* s)
+  {
+    std::lock_guard lock{mutex_};
+    free_.push_back(s);
+  }
+};
+
+/**
+ * Reader registered with an RCU domain.
+ *
+ * Each thread reading RCU cells needs its own reader, e.g. one per server
+ * worker thread, created once and reused for every request. Entering and
+ * leaving a critical section is a single store to the reader's own slot, so
+ * readers never contend with each other or with writers.
+ */
+class rcu_reader {
+public:
+  /**
+   * Ctor.
+   *
+   * @param domain Domain to register with, must outlive the reader
+   */
+  explicit rcu_reader(rcu_domain& domain)
+    : domain_{&domain}, slot_{domain.acquire_slot()}, depth_{}
+  {}
+
+  /**
+   * Deleted copy ctor.
+   */
+  rcu_reader(const rcu_reader&) = delete;
+
+  /**
+   * Dtor.
+   *
+   * The reader must not be in a critical section.
+   */
+  ~rcu_reader() { domain_->release_slot(slot_); }
+
+  /**
+   * Enter a read-side critical section.
+   *
+   * Critical sections may be nested. Versions read inside the outermost
+   * critical section stay valid until it is left.
+   */
+  void lock() noexcept
+  {
+    // the store must be visible before any cell pointer is loaded
+    if (!depth_++)
+      slot_->epoch.store(domain_->epoch_.load());
+  }
+
+  /**
+   * Leave a read-side critical section.
+   */
+  void unlock() noexcept
+  {
+    if (!--depth_)
+      slot_->epoch.store(0U, std::memory_order_release);
+  }
+
+  /**
+   * Return `true` if in a critical section.
+   */
+  bool locked() const noexcept { return depth_; }
+
+private:
+  rcu_domain* domain_;
+  rcu_domain::slot* slot_;
+  unsigned int depth_;
+};
+
+/**
+ * Immutable snapshot of an RCU cell's value.
+ *
+ * Holds the reader in a critical section until destroyed, so it should be
+ * scoped to a single request.
+ *
+ * @tparam T Value type
+ */
+template <typename T>
+class rcu_snapshot {
+public:
+  /**
+   * Ctor.
+   *
+   * The reader must already be in a critical section, which is left on
+   * destruction.
+   *
+   * @param reader Reader in a critical section
+   * @param value Value loaded inside the critical section
+   */
+  rcu_snapshot(rcu_reader& reader, const T* value) noexcept
+    : reader_{reader}, value_{value}
+  {}
+
+  /**
+   * Deleted copy ctor.
+   */
+  rcu_snapshot(const rcu_snapshot&) = delete;
+
+  /**
+   * Dtor.
+   */
+  ~rcu_snapshot() { reader_.unlock(); }
+
+  /**
+   * Return pointer to the value, `nullptr` if the cell is empty.
+   */
+  auto get() const noexcept { return value_; }
+
+  /**
+   * Return reference to the value.
+   */
+  const auto& operator*() const noexcept { return *value_; }
+
+  /**
+   * Return pointer to the value.
+   */
+  auto operator->() const noexcept { return value_; }
+
+  /**
+   * Return `true` if the cell was not empty.
+   */
+  explicit operator bool() const noexcept { return value_; }
+
+private:
+  rcu_reader& reader_;
+  const T* value_;
+};
+
+/**
+ * Read-mostly value updated by publishing new immutable versions.
+ *
+ * Readers get a snapshot of the current version without locks or atomic
+ * read-modify-write operations, so frequently read data such as routes,
+ * limits, or backend lists can be consulted on every request. Updates are
+ * serialized by a writer mutex, publish a new version with a single pointer
+ * swap, and retire the old version, which is freed once a grace period has
+ * passed. Retired versions are reclaimed on later updates or by `reclaim`.
+ *
+ * @code{.cc}
+ * pdnnet::rcu_domain domain;
+ * pdnnet::rcu_cell<route_table> routes{domain, load_routes()};
+ * // on each worker thread
+ * pdnnet::rcu_reader reader{domain};
+ * // on each request
+ * auto snapshot = routes.read(reader);
+ * auto backend = snapshot->lookup(path);
+ * // on reload
+ * routes.update(load_routes());
+ * @endcode
+ *
+ * @tparam T Value type
+ */
+template <typename T>
+class rcu_cell {
+public:
+  /**
+   * Ctor.
+   *
+   * @param domain Domain shared with the readers, must outlive the cell
+   * @param value Initial value, may be `nullptr`
+   */
+  rcu_cell(rcu_domain& domain, std::unique_ptr<T> value = nullptr) noexcept
+    : domain_{domain}, value_{value.release()}, n_updates_{}, n_reclaimed_{}
+  {}
+
+  /**
+   * Ctor.
+   *
+   * @param domain Domain shared with the readers, must outlive the cell
+   * @param value Initial value
+   */
+  rcu_cell(rcu_domain& domain, T value)
+    : rcu_cell{domain, std::make_unique<T>(std::move(value))}
+  {}
+
+  /**
+   * Deleted copy ctor.
+   */
+  rcu_cell(const rcu_cell&) = delete;
+
+  /**
+   * Dtor.
+   *
+   * Frees the current and all retired versions, so no reader may still be
+   * holding a snapshot.
+   */
+  ~rcu_cell()
+  {
+    delete value_.load();
+    for (auto& r : retired_)
+      delete r.value;
+  }
+
+  /**
+   * Return a snapshot of the current version.
+   *
+   * @param reader Reader of the calling thread
+   */
+  rcu_snapshot<T> read(rcu_reader& reader) const noexcept
+  {
+    reader.lock();
+    // sequentially consistent so the load is not ordered before lock()
+    return {reader, value_.load()};
+  }
+
+  /**
+   * Publish a new version and retire the previous one.
+   *
+   * Retired versions whose grace period has passed are freed. This does not
+   * wait for readers.
+   *
+   * @param value New value, may be `nullptr`
+   */
+  void update(std::unique_ptr<T> value)
+  {
+    std::lock_guard lock{mutex_};
+    publish(std::move(value));
+  }
+
+  /**
+   * Publish a new version and retire the previous one.
+   *
+   * @param value New value
+   */
+  void update(T value) { update(std::make_unique<T>(std::move(value))); }
+
+  /**
+   * Publish a modified copy of the current version.
+   *
+   * Concurrent calls are serialized so no modification is lost.
+   *
+   * @tparam F Callable taking a `T&` to modify
+   *
+   * @param modify Callable modifying a copy of the current value
+   */
+  template <typename F>
+  void modify(F&& modify)
+  {
+    std::lock_guard lock{mutex_};
+    auto current = value_.load();
+    auto value = (current) ? std::make_unique<T>(*current) : std::make_unique<T>();
+    std::forward<F>(modify)(*value);
+    publish(std::move(value));
+  }
+
+  /**
+   * Free retired versions whose grace period has passed.
+   *
+   * @returns Number of retired versions still waiting for readers
+   */
+  std::size_t reclaim()
+  {
+    std::lock_guard lock{mutex_};
+    return reclaim_retired();
+  }
+
+  /**
+   * Wait for a grace period and free all retired versions.
+   *
+   * Must not be called from inside a critical section.
+   */
+  void synchronize()
+  {
+    domain_.synchronize();
+    reclaim();
+  }
+
+  /**
+   * Return number of versions published by updates.
+   */
+  auto n_updates() const noexcept { return n_updates_.load(); }
+
+  /**
+   * Return number of retired versions freed.
+   */
+  auto n_reclaimed() const noexcept { return n_reclaimed_.load(); }
+
+  /**
+   * Return number of retired versions not yet freed.
+   */
+  auto n_retired() const
+  {
+    std::lock_guard lock{mutex_};
+    return retired_.size();
+  }
+
+private:
+  /**
+   * Retired version and the epoch it was retired at.
+   */
+  struct retired_value {
+    T* value;
+    std::uint64_t epoch;
+  };
+
+  rcu_domain& domain_;
+  std::atomic<T*> value_;
+  mutable std::mutex mutex_;
+  std::vector<retired_value> retired_;
+  std::atomic<std::size_t> n_updates_;
+  std::atomic<std::size_t> n_reclaimed_;
+
+  /**
+   * Swap in a new version and retire the old one. Writer mutex must be held.
+   *
+   * @param value New value
+   */
+  void publish(std::unique_ptr<T> value)
+  {
+    auto old = value_.exchange(value.release());
+    // readers entering at the new epoch or later cannot see the old version
+    if (old)
+      retired_.push_back({old, domain_.advance()});
+    n_updates_++;
+    reclaim_retired();
+  }
+
+  /**
+   * Free retired versions no reader can see. Writer mutex must be held.
+   *
+   * @returns Number of retired versions remaining
+   */
+  std::size_t reclaim_retired()
+  {
+    if (retired_.empty())
+      return 0U;
+    auto min_epoch = domain_.min_active_epoch();
+    auto it = retired_.begin();
+    while (it != retired_.end()) {
+      if (it->epoch <= min_epoch) {
+        delete it->value;
+        it = retired_.erase(it);
+        n_reclaimed_++;
+      }
+      else
+        ++it;
+    }
+    return retired_.size();
+  }
+};
+
+}  // namespace pdnnet
+
+#endif  // PDNNET_RCU_HH_
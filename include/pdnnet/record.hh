@@ -0,0 +1,454 @@
+/**
+ * @file record.hh
+ * @author Derek Huang
+ * @brief C++ header for the zero-copy binary record format
+ * @copyright MIT License
+ */
+
+#ifndef PDNNET_RECORD_HH_
+#define PDNNET_RECORD_HH_
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+#include "pdnnet/endian.hh"
+#include "pdnnet/error.hh"
+#include "pdnnet/memory.hh"
+
+namespace pdnnet {
+
+/**
+ * Record header size in bytes.
+ *
+ * A record is laid out in little-endian byte order as follows:
+ *
+ * | Offset | Size          | Field                          |
+ * | ------ | ------------- | ------------------------------ |
+ * | 0      | 4             | Record size including header   |
+ * | 4      | 2             | Application schema ID          |
+ * | 6      | 2             | Number of fields `n`           |
+ * | 8      | 4 * (`n` + 1) | Field offsets from record start |
+ *
+ * Field `i` spans offsets `i` to `i + 1`, the last offset being the record
+ * size, so variable-length fields need no separate length prefix. Offsets are
+ * validated once when a `record_view` is parsed and field accesses afterwards
+ * read directly from the underlying buffer.
+ */
+inline constexpr std::size_t record_header_size = 8U;
+
+/**
+ * Return the size in bytes of the header plus offset table of a record.
+ *
+ * @param n_fields Number of fields
+ */
+constexpr std::size_t record_prefix_size(std::size_t n_fields) noexcept
+{
+  return record_header_size + 4U * (n_fields + 1U);
+}
+
+/**
+ * Traits helper for types that can be stored as fixed-size record fields.
+ *
+ * @tparam T type
+ */
+template <typename T>
+inline constexpr bool is_record_scalar_v = std::is_arithmetic_v<T> &&
+  !std::is_same_v<T, bool> && !std::is_same_v<T, long double>;
+
+class record_view;
+
+inline optional_error parse_record(const void*, std::size_t, record_view&);
+
+/**
+ * Read-only view of a binary record.
+ *
+ * The view does not own the buffer, which must outlive the view. Create views
+ * with `parse_record`, which validates the header and offset table.
+ */
+class record_view {
+public:
+  /**
+   * Default ctor.
+   *
+   * Creates an empty view with no fields.
+   */
+  record_view() noexcept : data_{}, size_{}, n_fields_{}, schema_{} {}
+
+  /**
+   * Return pointer to the first record byte.
+   */
+  auto data() const noexcept { return data_; }
+
+  /**
+   * Return record size in bytes.
+   */
+  auto size() const noexcept { return size_; }
+
+  /**
+   * Return the application schema ID.
+   */
+  auto schema() const noexcept { return schema_; }
+
+  /**
+   * Return the number of fields.
+   */
+  auto n_fields() const noexcept { return n_fields_; }
+
+  /**
+   * Return pointer to the first byte of a field.
+   *
+   * @param i Field index, must be less than `n_fields()`
+   */
+  const byte* field_data(std::size_t i) const noexcept
+  {
+    return data_ + offset(i);
+  }
+
+  /**
+   * Return size of a field in bytes.
+   *
+   * @param i Field index, must be less than `n_fields()`
+   */
+  std::size_t field_size(std::size_t i) const noexcept
+  {
+    return offset(i + 1) - offset(i);
+  }
+
+  /**
+   * Return a field as a string view into the record buffer.
+   *
+   * @param i Field index
+   */
+  std::string_view string(std::size_t i) const
+  {
+    check_index(i);
+    return {reinterpret_cast<const char*>(field_data(i)), field_size(i)};
+  }
+
+  /**
+   * Return a fixed-size scalar field.
+   *
+   * @tparam T Integral or floating type
+   *
+   * @param i Field index
+   */
+  template <typename T, typename = std::enable_if_t<is_record_scalar_v<T>>>
+  T get(std::size_t i) const
+  {
+    check_index(i);
+    if (field_size(i) != sizeof(T))
+      throw std::out_of_range{
+        "Field " + std::to_string(i) + " has size " +
+        std::to_string(field_size(i)) + ", expected " + std::to_string(sizeof(T))
+      };
+    // load as unsigned integer of the same size then reinterpret bits
+    using uint_type = std::conditional_t<
+      sizeof(T) == 1U, std::uint8_t,
+      std::conditional_t<
+        sizeof(T) == 2U, std::uint16_t,
+        std::conditional_t<sizeof(T) == 4U, std::uint32_t, std::uint64_t>
+      >
+    >;
+    auto bits = load_le<uint_type>(field_data(i));
+    T value;
+    std::memcpy(&value, &bits, sizeof value);
+    return value;
+  }
+
+private:
+  const byte* data_;
+  std::size_t size_;
+  std::uint16_t n_fields_;
+  std::uint16_t schema_;
+
+  /**
+   * Return the offset of a field from the offset table.
+   *
+   * @param i Offset table index, at most `n_fields()`
+   */
+  std::uint32_t offset(std::size_t i) const noexcept
+  {
+    return load_le<std::uint32_t>(data_ + record_header_size + 4U * i);
+  }
+
+  /**
+   * Throw if a field index is out of range.
+   *
+   * @param i Field index
+   */
+  void check_index(std::size_t i) const
+  {
+    if (i >= n_fields_)
+      throw std::out_of_range{
+        "Field index " + std::to_string(i) + " out of range for record with " +
+        std::to_string(n_fields_) + " fields"
+      };
+  }
+
+  friend optional_error parse_record(const void*, std::size_t, record_view&);
+};
+
+/**
+ * Validate a binary record and create a view over it.
+ *
+ * The record may be followed by other data, i.e. `size` may exceed the size
+ * recorded in the record header.
+ *
+ * @param data Address of the first record byte
+ * @param size Number of bytes available
+ * @param view View to update on success
+ * @returns Optional empty on success, with error message on failure
+ */
+inline optional_error parse_record(
+  const void* data, std::size_t size, record_view& view)
+{
+  auto bytes = static_cast<const byte*>(data);
+  if (size < record_header_size)
+    return "Record of " + std::to_string(size) + " bytes too small for header";
+  auto record_size = load_le<std::uint32_t>(bytes);
+  auto n_fields = load_le<std::uint16_t>(bytes + 6);
+  auto prefix_size = record_prefix_size(n_fields);
+  if (record_size > size)
+    return "Record size " + std::to_string(record_size) + " exceeds the " +
+      std::to_string(size) + " bytes available";
+  if (prefix_size > record_size)
+    return "Record size " + std::to_string(record_size) +
+      " too small for offset table of " + std::to_string(n_fields) + " fields";
+  // offsets must be nondecreasing, start after the table, end at record end
+  std::uint32_t prev = static_cast<std::uint32_t>(prefix_size);
+  for (std::size_t i = 0; i <= n_fields; i++) {
+    auto off = load_le<std::uint32_t>(bytes + record_header_size + 4U * i);
+    if (off < prev || off > record_size)
+      return "Record field offset " + std::to_string(i) + " invalid";
+    prev = off;
+  }
+  if (prev != record_size)
+    return "Record end offset " + std::to_string(prev) +
+      " does not match record size " + std::to_string(record_size);
+  view.data_ = bytes;
+  view.size_ = record_size;
+  view.n_fields_ = n_fields;
+  view.schema_ = load_le<std::uint16_t>(bytes + 4);
+  return {};
+}
+
+/**
+ * Binary record builder.
+ *
+ * Fields are appended in order directly into a buffer acquired from a
+ * `buffer_pool`, which is returned to the pool on destruction. Records larger
+ * than the pool buffer size are built in a larger heap buffer instead.
+ *
+ * @code{.cc}
+ * pdnnet::record_builder builder{3U, schema_id};
+ * writer(msg_type, builder.add(user_id).add(name).add(score).finish());
+ * @endcode
+ */
+class record_builder {
+public:
+  /**
+   * Ctor.
+   *
+   * @param n_fields Number of fields in the record
+   * @param schema Application schema ID
+   * @param pool Buffer pool to acquire the output buffer from
+   */
+  record_builder(
+    std::uint16_t n_fields,
+    std::uint16_t schema = 0,
+    buffer_pool& pool = default_buffer_pool())
+    : pool_{pool}, buf_{pool.acquire()}
+  {
+    reset(n_fields, schema);
+  }
+
+  /**
+   * Deleted copy ctor.
+   */
+  record_builder(const record_builder&) = delete;
+
+  /**
+   * Dtor.
+   *
+   * Returns the buffer to the pool.
+   */
+  ~record_builder()
+  {
+    pool_.release(std::move(buf_));
+  }
+
+  /**
+   * Discard any fields and start a new record, reusing the buffer.
+   *
+   * @param n_fields Number of fields in the record
+   * @param schema Application schema ID
+   */
+  record_builder& reset(std::uint16_t n_fields, std::uint16_t schema = 0)
+  {
+    n_fields_ = n_fields;
+    n_added_ = 0;
+    size_ = record_prefix_size(n_fields);
+    reserve(size_);
+    store_le(buf_.get() + 4, schema);
+    store_le(buf_.get() + 6, n_fields);
+    set_offset(0);
+    return *this;
+  }
+
+  /**
+   * Return the number of fields in the record.
+   */
+  auto n_fields() const noexcept { return n_fields_; }
+
+  /**
+   * Return the number of fields appended so far.
+   */
+  auto n_added() const noexcept { return n_added_; }
+
+  /**
+   * Return the current record size in bytes.
+   */
+  auto size() const noexcept { return size_; }
+
+  /**
+   * Append a field of raw bytes.
+   *
+   * @param data Field bytes
+   * @param size Number of field bytes
+   */
+  auto& add(const void* data, std::size_t size)
+  {
+    auto dest = add_field(size);
+    if (size)
+      std::memcpy(dest, data, size);
+    return *this;
+  }
+
+  /**
+   * Append a string field.
+   *
+   * @param value String to append
+   */
+  auto& add(std::string_view value)
+  {
+    return add(value.data(), value.size());
+  }
+
+  /**
+   * Append a null-terminated string field.
+   *
+   * @note Overload necessary so string literals are not treated as pointers.
+   *
+   * @param value String to append
+   */
+  auto& add(const char* value)
+  {
+    return add(std::string_view{value});
+  }
+
+  /**
+   * Append a fixed-size scalar field.
+   *
+   * @tparam T Integral or floating type
+   *
+   * @param value Value to append
+   */
+  template <typename T, typename = std::enable_if_t<is_record_scalar_v<T>>>
+  auto& add(T value)
+  {
+    using uint_type = std::conditional_t<
+      sizeof(T) == 1U, std::uint8_t,
+      std::conditional_t<
+        sizeof(T) == 2U, std::uint16_t,
+        std::conditional_t<sizeof(T) == 4U, std::uint32_t, std::uint64_t>
+      >
+    >;
+    uint_type bits;
+    std::memcpy(&bits, &value, sizeof bits);
+    store_le(add_field(sizeof bits), bits);
+    return *this;
+  }
+
+  /**
+   * Append a field and return a pointer to write its contents in place.
+   *
+   * The pointer is invalidated by the next call that appends a field.
+   *
+   * @param size Number of field bytes
+   */
+  byte* add_field(std::size_t size)
+  {
+    if (n_added_ >= n_fields_)
+      throw std::out_of_range{
+        "Record already has all " + std::to_string(n_fields_) + " fields"
+      };
+    if (size > UINT32_MAX - size_)
+      throw std::length_error{"Record size would exceed UINT32_MAX"};
+    reserve(size_ + size);
+    auto dest = buf_.get() + size_;
+    size_ += size;
+    set_offset(++n_added_);
+    return dest;
+  }
+
+  /**
+   * Finish the record and return a string view of its bytes.
+   *
+   * Fields not yet appended are left empty. The view is invalidated by any
+   * further call to `reset` or by destruction of the builder.
+   */
+  std::string_view finish()
+  {
+    while (n_added_ < n_fields_)
+      set_offset(++n_added_);
+    store_le(buf_.get(), static_cast<std::uint32_t>(size_));
+    return {reinterpret_cast<const char*>(buf_.get()), size_};
+  }
+
+private:
+  buffer_pool& pool_;
+  byte_buffer<> buf_;
+  std::uint16_t n_fields_;
+  std::uint16_t n_added_;
+  std::size_t size_;
+
+  /**
+   * Write the offset of the current record end to the offset table.
+   *
+   * @param i Offset table index
+   */
+  void set_offset(std::size_t i) noexcept
+  {
+    store_le(
+      buf_.get() + record_header_size + 4U * i,
+      static_cast<std::uint32_t>(size_)
+    );
+  }
+
+  /**
+   * Ensure the buffer can hold the given number of bytes.
+   *
+   * Grows geometrically, returning the pooled buffer to the pool.
+   *
+   * @param capacity Required capacity in bytes
+   */
+  void reserve(std::size_t capacity)
+  {
+    if (capacity <= buf_.size())
+      return;
+    byte_buffer<> bigger{(std::max)(capacity, 2U * buf_.size())};
+    if (size_)
+      std::memcpy(bigger.get(), buf_.get(), (std::min)(size_, buf_.size()));
+    pool_.release(std::move(buf_));
+    buf_ = std::move(bigger);
+  }
+};
+
+}  // namespace pdnnet
+
+#endif  // PDNNET_RECORD_HH_
@@ -0,0 +1,695 @@
+/**
+ * @file rpc.hh
+ * @author Derek Huang
+ * @brief C++ header for multiplexed RPC over message frames
+ * @copyright MIT License
+ */
+
+#ifndef PDNNET_RPC_HH_
+#define PDNNET_RPC_HH_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "pdnnet/compression.hh"
+#include "pdnnet/cpu_profiler.hh"
+#include "pdnnet/deadline.hh"
+#include "pdnnet/endian.hh"
+#include "pdnnet/error.hh"
+#include "pdnnet/frame.hh"
+#include "pdnnet/memory.hh"
+#include "pdnnet/socket.hh"
+
+/**
+ * Timeout in milliseconds for the rest of a frame once its first byte arrives.
+ */
+#ifndef PDNNET_RPC_FRAME_TIMEOUT
+#define PDNNET_RPC_FRAME_TIMEOUT 1000
+#endif  // PDNNET_RPC_FRAME_TIMEOUT
+
+namespace pdnnet {
+
+/**
+ * RPC frame types.
+ *
+ * Every RPC frame payload starts with an 8-byte big-endian request id chosen
+ * by the client, followed by the request body, response body, or error
+ * message. Cancellation frames carry only the id.
+ */
+inline constexpr std::uint8_t rpc_request = 0x1U;
+inline constexpr std::uint8_t rpc_response = 0x2U;
+inline constexpr std::uint8_t rpc_error = 0x3U;
+inline constexpr std::uint8_t rpc_cancel = 0x4U;
+
+/**
+ * RPC request id size in bytes.
+ */
+inline constexpr std::size_t rpc_id_size = 8U;
+
+/**
+ * Timeout for the rest of a frame once its first byte arrives.
+ */
+inline constexpr std::chrono::milliseconds
+rpc_frame_timeout{PDNNET_RPC_FRAME_TIMEOUT};
+
+namespace detail {
+
+/**
+ * Prioritizes RPC frames written concurrently from multiple threads.
+ *
+ * Cancellations and errors are sent before requests and responses, and
+ * requests and responses larger than a chunk are sent as bulk, so a large
+ * payload does not hold up small calls multiplexed on the same connection.
+ */
+class rpc_writer {
+public:
+  /**
+   * Ctor.
+   *
+   * @param handle Socket handle
+   * @param compression Compression stage, `nullptr` to never compress
+   */
+  rpc_writer(socket_handle handle, compression_stage* compression)
+    : queue_{handle, compression}
+  {}
+
+  /**
+   * Write an RPC frame.
+   *
+   * @param type RPC frame type
+   * @param id Request id
+   * @param body Request body, response body, or error message
+   * @returns Optional empty on success, with error message on failure
+   */
+  optional_error operator()(
+    std::uint8_t type, std::uint64_t id, std::string_view body = {})
+  {
+    std::vector<byte> payload(rpc_id_size + body.size());
+    store_be(payload.data(), id);
+    std::copy(body.begin(), body.end(), payload.begin() + rpc_id_size);
+    auto priority = frame_priority_normal;
+    if (type == rpc_cancel || type == rpc_error)
+      priority = frame_priority_control;
+    else if (payload.size() > queue_.chunk_size())
+      priority = frame_priority_bulk;
+    return queue_(priority, type, std::move(payload));
+  }
+
+  /**
+   * Return the underlying frame queue.
+   */
+  const auto& queue() const noexcept { return queue_; }
+
+private:
+  frame_queue queue_;
+};
+
+/**
+ * Split an RPC frame payload into its request id and body.
+ *
+ * @param msg Received frame
+ * @param id Request id to write on success
+ * @param body Body view to write on success, valid while `msg` is unchanged
+ * @returns Optional empty on success, with error message on failure
+ */
+inline optional_error rpc_split(
+  const frame& msg, std::uint64_t& id, std::string_view& body)
+{
+  if (msg.payload.size() < rpc_id_size)
+    return "RPC frame of " + std::to_string(msg.payload.size()) +
+      " bytes is missing its request id";
+  id = load_be<std::uint64_t>(msg.payload.data());
+  body = msg.view().substr(rpc_id_size);
+  return {};
+}
+
+}  // namespace detail
+
+/**
+ * Client making concurrent RPC calls over a single connection.
+ *
+ * Each call is tagged with a fresh request id and recorded in a table of
+ * pending calls. A reader thread matches responses to pending calls by id, so
+ * responses may arrive in any order and a slow call does not hold up faster
+ * ones issued after it. All member functions are thread-safe.
+ *
+ * A call that is not answered before its deadline is cancelled, which sends a
+ * cancellation frame so the server can stop working on it. If the connection
+ * fails, all pending and future calls fail with the connection error.
+ *
+ * @code{.cc}
+ * pdnnet::rpc_client client{socket};
+ * std::string response;
+ * pdnnet::deadline deadline{std::chrono::milliseconds{100}};
+ * client.call("request", response, deadline).throw_on_error();
+ * @endcode
+ */
+class rpc_client {
+public:
+  /**
+   * Ctor.
+   *
+   * Starts the reader thread. The socket must outlive the client.
+   *
+   * @param handle Connected socket handle
+   * @param compression Compression stage, `nullptr` to never compress
+   */
+  rpc_client(socket_handle handle, compression_stage* compression = nullptr)
+    : handle_{handle},
+      compression_{compression},
+      writer_{handle, compression},
+      running_{true},
+      next_id_{1U},
+      n_calls_{},
+      n_cancelled_{}
+  {
+    thread_ = std::thread{&rpc_client::run, this};
+  }
+
+  /**
+   * Deleted copy ctor.
+   */
+  rpc_client(const rpc_client&) = delete;
+
+  /**
+   * Dtor.
+   *
+   * Stops the reader thread and fails any pending calls.
+   */
+  ~rpc_client()
+  {
+    running_ = false;
+    thread_.join();
+  }
+
+  /**
+   * Send a request, returning its id for a later `wait` or `cancel`.
+   *
+   * @param request Request body
+   * @param id Request id to write on success
+   * @returns Optional empty on success, with error message on failure
+   */
+  optional_error start(std::string_view request, std::uint64_t& id)
+  {
+    {
+      std::lock_guard lock{mutex_};
+      if (error_)
+        return error_;
+      id = next_id_++;
+      pending_.emplace(id, call_state{});
+    }
+    if (auto err = writer_(rpc_request, id, request)) {
+      std::lock_guard lock{mutex_};
+      pending_.erase(id);
+      return err;
+    }
+    n_calls_++;
+    return {};
+  }
+
+  /**
+   * Wait for the response to a request sent by `start`.
+   *
+   * If the deadline expires first the request is cancelled.
+   *
+   * @param id Request id
+   * @param response Response body to write on success
+   * @param deadline Deadline bounding the wait
+   * @returns Optional empty on success, with error message on failure
+   */
+  optional_error wait(
+    std::uint64_t id, std::string& response, const deadline& deadline)
+  {
+    std::unique_lock lock{mutex_};
+    auto it = pending_.find(id);
+    if (it == pending_.end())
+      return "No pending RPC call with id " + std::to_string(id);
+    // wake up periodically to notice deadline cancellation. the mutex is
+    // released while waiting, so no iterator is held across the wait since a
+    // concurrent start() may rehash and a concurrent cancel() may erase
+    while (!it->second.done) {
+      if (auto err = deadline.check("RPC call " + std::to_string(id))) {
+        lock.unlock();
+        cancel(id);
+        return err;
+      }
+      auto timeout = deadline.remaining();
+      if (deadline.infinite() || timeout > deadline_cancel_interval)
+        timeout = deadline_cancel_interval;
+      done_.wait_for(lock, timeout);
+      it = pending_.find(id);
+      if (it == pending_.end())
+        return "RPC call " + std::to_string(id) + " was cancelled";
+    }
+    auto state = std::move(it->second);
+    pending_.erase(id);
+    if (state.error)
+      return state.error;
+    response = std::move(state.response);
+    return {};
+  }
+
+  /**
+   * Make a call and wait for its response.
+   *
+   * @param request Request body
+   * @param response Response body to write on success
+   * @param deadline Deadline bounding the call
+   * @returns Optional empty on success, with error message on failure
+   */
+  optional_error call(
+    std::string_view request, std::string& response, const deadline& deadline)
+  {
+    std::uint64_t id;
+    if (auto err = start(request, id))
+      return err;
+    return wait(id, response, deadline);
+  }
+
+  /**
+   * Cancel a pending call.
+   *
+   * The call is forgotten and a cancellation frame is sent to the server. A
+   * response that arrives later is discarded.
+   *
+   * @param id Request id
+   * @returns Optional empty on success, with error message on failure
+   */
+  optional_error cancel(std::uint64_t id)
+  {
+    {
+      std::lock_guard lock{mutex_};
+      if (!pending_.erase(id))
+        return "No pending RPC call with id " + std::to_string(id);
+    }
+    n_cancelled_++;
+    return writer_(rpc_cancel, id);
+  }
+
+  /**
+   * Return number of calls waiting for a response.
+   */
+  auto n_pending() const
+  {
+    std::lock_guard lock{mutex_};
+    return pending_.size();
+  }
+
+  /**
+   * Return number of requests sent.
+   */
+  auto n_calls() const noexcept { return n_calls_.load(); }
+
+  /**
+   * Return number of calls cancelled, including by deadline expiry.
+   */
+  auto n_cancelled() const noexcept { return n_cancelled_.load(); }
+
+  /**
+   * Return the connection error, empty if the connection is still usable.
+   */
+  auto error() const
+  {
+    std::lock_guard lock{mutex_};
+    return error_;
+  }
+
+private:
+  /**
+   * Pending call state.
+   */
+  struct call_state {
+    bool done = false;
+    optional_error error;
+    std::string response;
+  };
+
+  socket_handle handle_;
+  compression_stage* compression_;
+  detail::rpc_writer writer_;
+  std::atomic<bool> running_;
+  mutable std::mutex mutex_;
+  std::condition_variable done_;
+  std::unordered_map<std::uint64_t, call_state> pending_;
+  optional_error error_;
+  std::uint64_t next_id_;
+  std::atomic<std::size_t> n_calls_;
+  std::atomic<std::size_t> n_cancelled_;
+  std::thread thread_;
+
+  /**
+   * Complete a pending call, ignoring ids that were cancelled.
+   *
+   * @param id Request id
+   * @param error Error message from the server, empty on success
+   * @param response Response body
+   */
+  void complete(std::uint64_t id, optional_error error, std::string_view response)
+  {
+    std::lock_guard lock{mutex_};
+    auto it = pending_.find(id);
+    if (it == pending_.end())
+      return;
+    it->second.done = true;
+    it->second.error = std::move(error);
+    it->second.response = response;
+    done_.notify_all();
+  }
+
+  /**
+   * Fail all pending and future calls.
+   *
+   * @param error Connection error message
+   */
+  void fail(optional_error error)
+  {
+    std::lock_guard lock{mutex_};
+    error_ = std::move(error);
+    for (auto& [id, state] : pending_) {
+      if (state.done)
+        continue;
+      state.done = true;
+      state.error = error_;
+    }
+    done_.notify_all();
+  }
+
+  /**
+   * Reader loop matching responses to pending calls until stopped.
+   */
+  void run()
+  {
+    frame_reader reader{handle_, compression_, rpc_frame_timeout};
+    frame msg;
+    while (running_) {
+      try {
+        if (!wait_pollin(handle_, deadline_cancel_interval))
+          continue;
+      }
+      catch (const std::runtime_error& exc) {
+        fail(exc.what());
+        return;
+      }
+      if (auto err = reader(msg)) {
+        fail(err);
+        return;
+      }
+      if (reader.eof()) {
+        fail("RPC connection closed by server");
+        return;
+      }
+      std::uint64_t id;
+      std::string_view body;
+      if (auto err = detail::rpc_split(msg, id, body)) {
+        fail(err);
+        return;
+      }
+      if (msg.type == rpc_response)
+        complete(id, {}, body);
+      else if (msg.type == rpc_error)
+        complete(id, std::string{body}, {});
+      else {
+        fail("Unexpected RPC frame type " + std::to_string(msg.type));
+        return;
+      }
+    }
+    fail("RPC client stopped");
+  }
+};
+
+/**
+ * Context of an RPC call being handled by a server.
+ */
+class rpc_context {
+public:
+  /**
+   * Ctor.
+   *
+   * @param id Request id
+   */
+  explicit rpc_context(std::uint64_t id) noexcept : id_{id}, cancelled_{} {}
+
+  /**
+   * Return the request id.
+   */
+  auto id() const noexcept { return id_; }
+
+  /**
+   * Return `true` if the client cancelled the call.
+   *
+   * Long-running handlers should check this and return early. The response
+   * of a cancelled call is not sent.
+   */
+  bool cancelled() const noexcept { return cancelled_; }
+
+  /**
+   * Mark the call as cancelled.
+   */
+  void cancel() noexcept { cancelled_ = true; }
+
+private:
+  std::uint64_t id_;
+  std::atomic<bool> cancelled_;
+};
+
+/**
+ * RPC request handler.
+ *
+ * Called concurrently from the session's handler threads. Returning an error
+ * sends it to the client as the call's error.
+ */
+using rpc_handler = std::function<
+  optional_error(std::string_view request, std::string& response, rpc_context& ctx)
+>;
+
+/**
+ * Server side of an RPC connection.
+ *
+ * Requests are handed to a fixed number of handler threads and each response
+ * is written as soon as its handler returns, so requests complete out of
+ * order. Cancellation frames mark running calls as cancelled and drop calls
+ * that have not started.
+ *
+ * @code{.cc}
+ * bool serve(pdnnet::unique_socket& cli_socket) override
+ * {
+ *   pdnnet::rpc_session session{cli_socket, handler_, 4U};
+ *   return !session.run();
+ * }
+ * @endcode
+ */
+class rpc_session {
+public:
+  /**
+   * Ctor.
+   *
+   * @param handle Connected socket handle
+   * @param handler Request handler
+   * @param concurrency Number of requests handled at once, at least 1
+   * @param compression Compression stage, `nullptr` to never compress
+   */
+  rpc_session(
+    socket_handle handle,
+    rpc_handler handler,
+    unsigned int concurrency = std::thread::hardware_concurrency(),
+    compression_stage* compression = nullptr)
+    : handle_{handle},
+      handler_{std::move(handler)},
+      concurrency_{(concurrency) ? concurrency : 1U},
+      compression_{compression},
+      writer_{handle, compression},
+      closing_{},
+      profiler_{},
+      profile_id_{},
+      n_requests_{},
+      n_cancelled_{},
+      n_errors_{}
+  {}
+
+  /**
+   * Deleted copy ctor.
+   */
+  rpc_session(const rpc_session&) = delete;
+
+  /**
+   * Serve requests until the client ends transmission.
+   *
+   * Requests already received are finished before returning.
+   *
+   * @returns Optional empty on success, with error message on failure
+   */
+  optional_error run()
+  {
+    std::vector<std::thread> workers;
+    for (unsigned int i = 0; i < concurrency_; i++)
+      workers.emplace_back(&rpc_session::work, this);
+    auto err = read_requests();
+    {
+      std::lock_guard lock{mutex_};
+      closing_ = true;
+    }
+    ready_.notify_all();
+    for (auto& worker : workers)
+      worker.join();
+    return err;
+  }
+
+  /**
+   * Set the CPU profiler that handler calls are recorded to.
+   *
+   * Must be called before `run`. Handlers can attribute time to individual
+   * methods or routes with their own nested `cpu_scope`.
+   *
+   * @param profiler CPU profiler that outlives the session, or `nullptr`
+   * @param name Handler name the calls are attributed to
+   * @returns `*this` to allow method chaining
+   */
+  auto& profiler(cpu_profiler* profiler, std::string_view name = "rpc")
+  {
+    profiler_ = profiler;
+    if (profiler_)
+      profile_id_ = profiler_->handler(name);
+    return *this;
+  }
+
+  /**
+   * Return number of requests received.
+   */
+  auto n_requests() const noexcept { return n_requests_.load(); }
+
+  /**
+   * Return number of requests cancelled by the client.
+   */
+  auto n_cancelled() const noexcept { return n_cancelled_.load(); }
+
+  /**
+   * Return number of requests the handler returned an error for.
+   */
+  auto n_errors() const noexcept { return n_errors_.load(); }
+
+private:
+  /**
+   * Received request waiting for or being handled by a handler thread.
+   */
+  struct call {
+    call(std::uint64_t id, std::string_view request)
+      : ctx{id}, request{request}
+    {}
+
+    rpc_context ctx;
+    std::string request;
+  };
+
+  socket_handle handle_;
+  rpc_handler handler_;
+  unsigned int concurrency_;
+  compression_stage* compression_;
+  detail::rpc_writer writer_;
+  std::mutex mutex_;
+  std::condition_variable ready_;
+  std::deque<std::shared_ptr<call>> queue_;
+  std::unordered_map<std::uint64_t, std::shared_ptr<call>> calls_;
+  bool closing_;
+  cpu_profiler* profiler_;
+  cpu_profiler::handler_id profile_id_;
+  std::atomic<std::size_t> n_requests_;
+  std::atomic<std::size_t> n_cancelled_;
+  std::atomic<std::size_t> n_errors_;
+
+  /**
+   * Read frames, queuing requests and applying cancellations, until EOF.
+   *
+   * @returns Optional empty on success, with error message on failure
+   */
+  optional_error read_requests()
+  {
+    frame_reader reader{handle_, compression_};
+    frame msg;
+    while (true) {
+      if (auto err = reader(msg))
+        return err;
+      if (reader.eof())
+        return {};
+      std::uint64_t id;
+      std::string_view body;
+      if (auto err = detail::rpc_split(msg, id, body))
+        return err;
+      std::lock_guard lock{mutex_};
+      if (msg.type == rpc_request) {
+        auto request = std::make_shared<call>(id, body);
+        calls_[id] = request;
+        queue_.push_back(std::move(request));
+        n_requests_++;
+        ready_.notify_one();
+      }
+      else if (msg.type == rpc_cancel) {
+        // calls not yet started are skipped by the handler threads
+        auto it = calls_.find(id);
+        if (it == calls_.end())
+          continue;
+        it->second->ctx.cancel();
+        calls_.erase(it);
+        n_cancelled_++;
+      }
+      else
+        return "Unexpected RPC frame type " + std::to_string(msg.type);
+    }
+  }
+
+  /**
+   * Handler thread loop taking requests off the queue until closing.
+   */
+  void work()
+  {
+    while (true) {
+      std::shared_ptr<call> request;
+      {
+        std::unique_lock lock{mutex_};
+        ready_.wait(lock, [this] { return closing_ || !queue_.empty(); });
+        if (queue_.empty())
+          return;
+        request = std::move(queue_.front());
+        queue_.pop_front();
+      }
+      if (request->ctx.cancelled())
+        continue;
+      std::string response;
+      optional_error err;
+      {
+        cpu_scope scope{profiler_, profile_id_};
+        err = handler_(request->request, response, request->ctx);
+      }
+      {
+        std::lock_guard lock{mutex_};
+        calls_.erase(request->ctx.id());
+      }
+      if (err)
+        n_errors_++;
+      if (request->ctx.cancelled())
+        continue;
+      // write failures mean the client is gone and show up as read errors
+      if (err)
+        writer_(rpc_error, request->ctx.id(), *err);
+      else
+        writer_(rpc_response, request->ctx.id(), response);
+    }
+  }
+};
+
+}  // namespace pdnnet
+
+#endif  // PDNNET_RPC_HH_
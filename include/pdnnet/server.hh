@@ -23,18 +23,201 @@
 #endif  // !defined(_WIN32)
 
 #include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <functional>
+#include <memory>
 #include <optional>
 #include <stdexcept>
 #include <string>
 #include <system_error>
 #include <thread>
+#include <utility>
+#include <vector>
 
+#include "pdnnet/activation.hh"
+#include "pdnnet/cpu_profiler.hh"
 #include "pdnnet/error.hh"
 #include "pdnnet/features.h"
+#include "pdnnet/flight_recorder.hh"
+#include "pdnnet/pressure.hh"
+#include "pdnnet/process.hh"
 #include "pdnnet/socket.hh"
 
 namespace pdnnet {
 
+/**
+ * Handler serving a connection accepted by an isolated listener.
+ *
+ * Should return `true` if the client was served, `false` on error.
+ */
+using listener_handler = std::function<bool(unique_socket&)>;
+
+/**
+ * Parameters for an additional listener isolated from the main server.
+ */
+struct listener_params {
+  std::string name;
+  inet_port_type port;
+  listener_handler handler;
+};
+
+/**
+ * Listening socket served by its own dedicated thread.
+ *
+ * Used for control plane endpoints, e.g. an admin or health check port, that
+ * must keep responding while the data plane is saturated. Connections are
+ * accepted and served one at a time on the listener's thread, so a slow data
+ * plane client or a full worker pool never delays them, and they are not
+ * subject to pressure-based load shedding. Errors serving a client are
+ * counted but do not stop the listener.
+ */
+class isolated_listener {
+public:
+  /**
+   * Ctor.
+   *
+   * Binds and starts listening on the socket and starts the serving thread.
+   *
+   * @param params Listener name, port, and connection handler
+   * @param max_pending Maximum length of pending connections queue
+   * @param profiler CPU profiler to attribute handler time to under the
+   *  listener's name, `nullptr` to not profile
+   */
+  isolated_listener(
+    listener_params params,
+    unsigned int max_pending,
+    cpu_profiler* profiler = nullptr)
+    : params_{std::move(params)},
+      socket_{AF_INET, SOCK_STREAM},
+      address_{make_sockaddr_in(INADDR_ANY, params_.port)},
+      profiler_{profiler},
+      profile_id_{(profiler) ? profiler->handler(params_.name) : 0U},
+      running_{},
+      n_served_{},
+      n_errors_{}
+  {
+    if (!bind(socket_, address_))
+      throw std::runtime_error{
+        socket_error("Could not bind " + params_.name + " socket")
+      };
+    if (!getsockname(socket_, address_))
+      throw std::runtime_error{
+        socket_error("Could not retrieve " + params_.name + " socket address")
+      };
+    if (!listen(socket_, max_pending))
+      throw std::runtime_error{
+        socket_error("Could not listen on " + params_.name + " socket")
+      };
+    running_ = true;
+    thread_ = std::thread{&isolated_listener::run, this};
+  }
+
+  /**
+   * Deleted copy ctor.
+   */
+  isolated_listener(const isolated_listener&) = delete;
+
+  /**
+   * Dtor.
+   *
+   * Stops the listener and joins its thread.
+   */
+  ~isolated_listener() { stop(); }
+
+  /**
+   * Return the listener name.
+   */
+  const auto& name() const noexcept { return params_.name; }
+
+  /**
+   * Return const reference to `sockaddr_in` socket address struct.
+   */
+  const auto& address() const noexcept { return address_; }
+
+  /**
+   * Return the port number in host byte order.
+   */
+  auto port() const noexcept { return ntohs(address_.sin_port); }
+
+  /**
+   * Return number of connections served.
+   */
+  auto n_served() const noexcept { return n_served_.load(); }
+
+  /**
+   * Return number of connections that failed to be served.
+   */
+  auto n_errors() const noexcept { return n_errors_.load(); }
+
+  /**
+   * Stop accepting connections and join the serving thread.
+   *
+   * The client being served, if any, is finished first.
+   */
+  void stop() noexcept
+  {
+    running_ = false;
+    if (thread_.joinable()) {
+      try { thread_.join(); }
+      catch (std::system_error&) {}
+    }
+  }
+
+private:
+  listener_params params_;
+  unique_socket socket_;
+  sockaddr_in address_;
+  cpu_profiler* profiler_;
+  cpu_profiler::handler_id profile_id_;
+  std::atomic<bool> running_;
+  std::atomic<std::size_t> n_served_;
+  std::atomic<std::size_t> n_errors_;
+  std::thread thread_;
+
+  /**
+   * Accept and serve connections until stopped.
+   */
+  void run()
+  {
+    while (running_) {
+      try {
+        if (!wait_pollin(socket_))
+          continue;
+        auto cli_socket = accept(socket_);
+        cpu_scope scope{profiler_, profile_id_};
+        if (params_.handler(cli_socket))
+          n_served_++;
+        else
+          n_errors_++;
+      }
+      catch (const std::runtime_error&) {
+        n_errors_++;
+      }
+    }
+  }
+};
+
+/**
+ * Start isolated listeners, returning them in the order they were given.
+ *
+ * @param params Listener parameters
+ * @param max_pending Maximum length of each pending connections queue
+ * @param profiler CPU profiler, `nullptr` to not profile
+ */
+inline auto start_listeners(
+  const std::vector<listener_params>& params,
+  unsigned int max_pending,
+  cpu_profiler* profiler = nullptr)
+{
+  std::vector<std::unique_ptr<isolated_listener>> listeners;
+  for (const auto& p : params)
+    listeners.push_back(
+      std::make_unique<isolated_listener>(p, max_pending, profiler)
+    );
+  return listeners;
+}
+
 /**
  * Helper class holding parameters used when starting a socket-based server.
  *
@@ -76,7 +259,17 @@ public:
     inet_port_type port,
     unsigned int max_pending,
     unsigned int max_concurrency) noexcept
-    : port_{port}, max_pending_{max_pending}, max_concurrency_{max_concurrency}
+    : port_{port},
+      max_pending_{max_pending},
+      max_concurrency_{max_concurrency},
+      cpu_affinity_{},
+      pressure_{},
+      recorder_{},
+      profiler_{},
+      listen_handle_{bad_socket_handle},
+      high_watermark_{},
+      low_watermark_{},
+      read_size_{socket_read_size}
   {}
 
   /**
@@ -98,6 +291,48 @@ public:
     return *this;
   }
 
+  /**
+   * Return handle of the pre-opened listening socket to adopt.
+   *
+   * This is `bad_socket_handle` if the server creates its own socket.
+   */
+  auto listen_handle() const noexcept { return listen_handle_; }
+
+  /**
+   * Set a pre-opened listening socket for the server to adopt.
+   *
+   * Instead of creating and binding a socket to the port, the server listens
+   * on a duplicate of the handle with the backlog it was opened with. The
+   * caller keeps the original open, so connections queue in the kernel while
+   * the server is starting, stopped, or restarting instead of being refused.
+   * Adopting sockets is only supported on *nix systems.
+   *
+   * @param handle Listening IPv4 stream socket, `bad_socket_handle` to unset
+   * @returns `*this` to allow method chaining
+   */
+  auto& listen_handle(socket_handle handle) noexcept
+  {
+    listen_handle_ = handle;
+    return *this;
+  }
+
+  /**
+   * Adopt the first socket passed by socket activation, if any.
+   *
+   * If no sockets were passed using the `LISTEN_FDS` convention the server
+   * binds to the port as usual, so the same program can run with or without
+   * a supervisor. See `listen_fds` for details.
+   *
+   * @returns `*this` to allow method chaining
+   */
+  auto& socket_activation()
+  {
+    auto handles = listen_fds();
+    if (handles.size())
+      listen_handle_ = handles.front();
+    return *this;
+  }
+
   /**
    * Return maximum length of pending connections queue.
    */
@@ -132,12 +367,225 @@ public:
     return *this;
   }
 
+  /**
+   * Return whether connections are steered to workers by receiving CPU.
+   */
+  auto cpu_affinity() const noexcept { return cpu_affinity_; }
+
+  /**
+   * Set whether connections are steered to workers by receiving CPU.
+   *
+   * Only used by servers with per-CPU listeners, e.g. `reuseport_server`.
+   * Worker threads are pinned to CPUs and each connection is accepted by the
+   * worker pinned to the CPU that handled its NIC receive queue.
+   *
+   * @param enable `true` to enable CPU affinity
+   * @returns `*this` to allow method chaining
+   */
+  auto& cpu_affinity(bool enable) noexcept
+  {
+    cpu_affinity_ = enable;
+    return *this;
+  }
+
+  /**
+   * Return the resource pressure monitor, `nullptr` if not set.
+   */
+  auto pressure() const noexcept { return pressure_; }
+
+  /**
+   * Set the resource pressure monitor used to degrade under pressure.
+   *
+   * Servers update the monitor from their accept loops, close new connections
+   * immediately while it reports `shed()`, limit the number of connections
+   * served at once to its scaled `max_concurrency`, and scale the per-read
+   * size given by `read_size()` down by memory pressure.
+   *
+   * @param monitor Pressure monitor that outlives the server, or `nullptr`
+   * @returns `*this` to allow method chaining
+   */
+  auto& pressure(pressure_monitor* monitor) noexcept
+  {
+    pressure_ = monitor;
+    return *this;
+  }
+
+  /**
+   * Return the request flight recorder, `nullptr` if not set.
+   */
+  auto recorder() const noexcept { return recorder_; }
+
+  /**
+   * Set the flight recorder that served requests are recorded to.
+   *
+   * Servers mark the accept and response phases of each connection they
+   * serve. Connections closed unserved under resource pressure are not
+   * recorded.
+   *
+   * @param recorder Flight recorder that outlives the server, or `nullptr`
+   * @returns `*this` to allow method chaining
+   */
+  auto& recorder(flight_recorder* recorder) noexcept
+  {
+    recorder_ = recorder;
+    return *this;
+  }
+
+  /**
+   * Return the CPU profiler, `nullptr` if not set.
+   */
+  auto profiler() const noexcept { return profiler_; }
+
+  /**
+   * Set the CPU profiler that time spent serving connections is recorded to.
+   *
+   * Servers attribute the thread CPU and wall time of each `serve` call to
+   * the "serve" handler and of each isolated listener's calls to the
+   * listener's name. `serve` implementations can attribute time to finer
+   * grained handlers or routes with their own `cpu_scope`.
+   *
+   * @param profiler CPU profiler that outlives the server, or `nullptr`
+   * @returns `*this` to allow method chaining
+   */
+  auto& profiler(cpu_profiler* profiler) noexcept
+  {
+    profiler_ = profiler;
+    return *this;
+  }
+
+  /**
+   * Return queued bytes at which a connection's output pauses its input.
+   *
+   * This is zero if connection output is not bounded.
+   */
+  auto high_watermark() const noexcept { return high_watermark_; }
+
+  /**
+   * Return queued bytes at which a connection's output resumes its input.
+   */
+  auto low_watermark() const noexcept { return low_watermark_; }
+
+  /**
+   * Set outbound queue watermarks for servers that relay input to output.
+   *
+   * Servers that support watermarks, e.g. `echoserver`, queue each
+   * connection's output in an `outbound_queue` and stop reading its input
+   * while the queue is above the high watermark, so a client that reads
+   * slowly cannot grow server memory without bound. Clients must then read
+   * while they write or the connection stalls once the queue is full.
+   *
+   * @param high Queued bytes at which input pauses, zero to not bound output
+   * @param low Queued bytes at which input resumes, less than `high`
+   * @returns `*this` to allow method chaining
+   */
+  auto& watermarks(std::size_t high, std::size_t low) noexcept
+  {
+    high_watermark_ = high;
+    low_watermark_ = low;
+    return *this;
+  }
+
+  /**
+   * Return number of bytes per read from a client connection.
+   */
+  auto read_size() const noexcept { return read_size_; }
+
+  /**
+   * Set number of bytes per read from a client connection.
+   *
+   * Under memory pressure servers scale this down with the pressure monitor's
+   * `read_size`, so connections buffer less at once. Servers that read for
+   * their clients, e.g. `echoserver`, apply it directly, and `serve`
+   * implementations of `ipv4_server` and `reuseport_server` get the scaled
+   * size from their `read_size()`.
+   *
+   * @param size Bytes per read, must be positive
+   * @returns `*this` to allow method chaining
+   */
+  auto& read_size(std::size_t size) noexcept
+  {
+    read_size_ = size;
+    return *this;
+  }
+
+  /**
+   * Return parameters of the additional isolated listeners.
+   */
+  const auto& listeners() const noexcept { return listeners_; }
+
+  /**
+   * Add an isolated listener, e.g. for an admin or health check port.
+   *
+   * Servers start each listener with its own thread when they start and stop
+   * them when they stop, so the listener keeps serving while the server is
+   * saturated. Listeners use the same max pending connections queue length.
+   *
+   * @param name Listener name used in error messages
+   * @param port Port number in host byte order, zero for the next free port
+   * @param handler Connection handler, called on the listener's thread
+   * @returns `*this` to allow method chaining
+   */
+  auto& listener(std::string name, inet_port_type port, listener_handler handler)
+  {
+    listeners_.push_back({std::move(name), port, std::move(handler)});
+    return *this;
+  }
+
 private:
   inet_port_type port_;
   unsigned int max_pending_;
   unsigned int max_concurrency_;
+  bool cpu_affinity_;
+  pressure_monitor* pressure_;
+  flight_recorder* recorder_;
+  cpu_profiler* profiler_;
+  socket_handle listen_handle_;
+  std::size_t high_watermark_;
+  std::size_t low_watermark_;
+  std::size_t read_size_;
+  std::vector<listener_params> listeners_;
 };
 
+namespace detail {
+
+/**
+ * Start a request record for a newly accepted connection.
+ *
+ * @param recorder Flight recorder, `nullptr` if requests are not recorded
+ * @param request Request record to reset
+ */
+inline void begin_request(flight_recorder* recorder, request_record& request)
+{
+  request = {};
+  request.accepted = request_record::clock_type::now();
+  if (recorder)
+    request.id = recorder->next_id();
+}
+
+/**
+ * Finish a request record for a served connection and record it.
+ *
+ * The response phase is marked now unless already marked by the server and a
+ * failed connection without a status is given a status of `-1`.
+ *
+ * @param recorder Flight recorder, `nullptr` if requests are not recorded
+ * @param request Request record
+ * @param served `true` if the connection was served successfully
+ */
+inline void end_request(
+  flight_recorder* recorder, request_record& request, bool served)
+{
+  if (!recorder)
+    return;
+  if (!request_record::marked(request.responded))
+    request.responded = request_record::clock_type::now();
+  if (!served && !request.status)
+    request.status = -1;
+  recorder->record(request);
+}
+
+}  // namespace detail
+
 /**
  * Generic IPv4 server interface.
  *
@@ -148,7 +596,15 @@ public:
   /**
    * Ctor.
    */
-  ipv4_server() : running_{} {}
+  ipv4_server()
+    : running_{},
+      pressure_{},
+      read_size_{socket_read_size},
+      recorder_{},
+      profiler_{},
+      serve_id_{},
+      n_shed_{}
+  {}
 
   /**
    * Virtual dtor.
@@ -190,6 +646,18 @@ public:
    */
   bool running() const noexcept { return running_; }
 
+  /**
+   * Return number of connections closed unserved due to resource pressure.
+   */
+  auto n_shed() const noexcept { return n_shed_.load(); }
+
+  /**
+   * Return the isolated listeners in the order they were added.
+   *
+   * Empty unless the server is running.
+   */
+  const auto& isolated_listeners() const noexcept { return isolated_; }
+
   /**
    * Return the host address as an IPv4 decimal-dotted string.
    *
@@ -247,8 +715,18 @@ public:
         continue;
       // if there is data to read, accept the socket
       auto cli_socket = accept(socket_);
-      // serve the connection as defined by user. stop on error
-      if (!serve(cli_socket)) {
+      // close without serving if memory pressure is critical
+      if (shed_connection())
+        continue;
+      // serve the connection as defined by user and record it. stop on error
+      detail::begin_request(recorder_, request_);
+      bool served;
+      {
+        cpu_scope scope{profiler_, serve_id_};
+        served = serve(cli_socket);
+      }
+      detail::end_request(recorder_, request_, served);
+      if (!served) {
         reset_state();
         return EXIT_FAILURE;
       }
@@ -305,50 +783,453 @@ protected:
    */
   virtual bool serve(unique_socket& cli_socket) = 0;
 
+  /**
+   * Return reference to the record of the request being served.
+   *
+   * Only valid during `serve`, which can mark the first byte, last byte, and
+   * response phases and set the byte counts and status to give the flight
+   * recorder, if any, a detailed breakdown of the request.
+   */
+  auto& request() noexcept { return request_; }
+
+  /**
+   * Return number of bytes `serve` should read at once from a client.
+   *
+   * This is the `read_size()` of the server params, scaled down by memory
+   * pressure if a pressure monitor is set.
+   */
+  std::size_t read_size() const noexcept
+  {
+    return (pressure_) ? pressure_->read_size(read_size_) : read_size_;
+  }
+
 private:
   unique_socket socket_;
   sockaddr_in address_;
   unsigned int max_pending_;
   std::atomic<bool> running_;
+  pressure_monitor* pressure_;
+  std::size_t read_size_;
+  flight_recorder* recorder_;
+  cpu_profiler* profiler_;
+  cpu_profiler::handler_id serve_id_;
+  request_record request_;
+  std::atomic<std::size_t> n_shed_;
+  std::vector<std::unique_ptr<isolated_listener>> isolated_;
   std::thread bg_thread_;
 
+  /**
+   * Update the pressure monitor and return `true` to shed a new connection.
+   */
+  bool shed_connection()
+  {
+    if (!pressure_)
+      return false;
+    pressure_->update();
+    if (!pressure_->shed())
+      return false;
+    n_shed_++;
+    return true;
+  }
+
   /**
    * Create listening socket, resolve its port, and mark server as running.
    *
    * The socket is bound to the local address and port 0 is correctly resolved.
+   * If the params have a listening socket handle, it is adopted instead.
    *
    * @param params Server start params
    */
   void set_state(const server_params& params)
   {
-    // create new socket + set to local address with specified port
-    socket_ = unique_socket{AF_INET, SOCK_STREAM};
-    address_ = make_sockaddr_in(INADDR_ANY, params.port());
     // set max amount of connections that can be pending in queue
     max_pending_ = params.max_pending();
-    // attempt to bind socket
-    if (!bind(socket_, address_))
-      throw std::runtime_error{socket_error("Could not bind socket")};
-    // get the actual socket address, e.g. if port is 0 it is resolved
-    if (!getsockname(socket_, address_))
-      throw std::runtime_error{socket_error("Could not retrieve socket address")};
-    // attempt to start listening for connections
-    if (!listen(socket_, max_pending_))
-      throw std::runtime_error{socket_error("Could not listen on socket")};
+    pressure_ = params.pressure();
+    read_size_ = params.read_size();
+    if (!read_size_)
+      throw std::invalid_argument{"Read size must be positive"};
+    recorder_ = params.recorder();
+    profiler_ = params.profiler();
+    if (profiler_)
+      serve_id_ = profiler_->handler("serve");
+    // adopt a pre-opened listening socket, which is already bound
+    if (params.listen_handle() != bad_socket_handle)
+      socket_ = adopt_listener(params.listen_handle(), address_);
+    else {
+      // create new socket + set to local address with specified port
+      socket_ = unique_socket{AF_INET, SOCK_STREAM};
+      address_ = make_sockaddr_in(INADDR_ANY, params.port());
+      // attempt to bind socket
+      if (!bind(socket_, address_))
+        throw std::runtime_error{socket_error("Could not bind socket")};
+      // get the actual socket address, e.g. if port is 0 it is resolved
+      if (!getsockname(socket_, address_))
+        throw std::runtime_error{socket_error("Could not retrieve socket address")};
+      // attempt to start listening for connections
+      if (!listen(socket_, max_pending_))
+        throw std::runtime_error{socket_error("Could not listen on socket")};
+    }
+    // start any control plane listeners on their own threads
+    isolated_ = start_listeners(params.listeners(), max_pending_, profiler_);
     // mark as running
     running_ = true;
   }
 
   /**
-   * Destroy listening socket and mark server as not running.
+   * Destroy listening sockets and mark server as not running.
    */
   void reset_state() noexcept
   {
+    isolated_.clear();
     socket_ = {};
     running_ = false;
   }
 };
 
+/**
+ * IPv4 server with one `SO_REUSEPORT` listener and worker thread per CPU.
+ *
+ * `max_concurrency()` workers are started, each accepting and serving
+ * connections from its own listening socket, so there is no contention on a
+ * shared accept queue. By default the kernel hashes connections across the
+ * listeners. If `cpu_affinity()` is set, worker `i` is pinned to CPU `i` and a
+ * classic BPF program steers each connection to the listener of the CPU that
+ * received it, so packet processing and the application thread share a
+ * cache. `SO_INCOMING_CPU` is checked on accepted sockets to count mismatches,
+ * e.g. if there are fewer workers than CPUs handling NIC queues.
+ *
+ * @note CPU affinity is only supported on Linux.
+ */
+class reuseport_server {
+public:
+  /**
+   * Ctor.
+   */
+  reuseport_server()
+    : address_{},
+      running_{},
+      cpu_affinity_{},
+      pressure_{},
+      read_size_{socket_read_size},
+      recorder_{},
+      profiler_{},
+      serve_id_{},
+      n_accepted_{},
+      n_cpu_mismatch_{},
+      n_active_{},
+      n_shed_{}
+  {}
+
+  /**
+   * Virtual dtor.
+   *
+   * If the server is running in a background thread it is joined.
+   */
+  virtual ~reuseport_server()
+  {
+    try { join(); }
+    catch (std::system_error&) {}
+  }
+
+  /**
+   * Return const reference to `sockaddr_in` socket address struct.
+   *
+   * Value returned is unspecified unless server is running.
+   */
+  const auto& address() const noexcept { return address_; }
+
+  /**
+   * Return the port number in host byte order.
+   *
+   * Value returned is unspecified unless server is running.
+   */
+  auto port() const noexcept
+  {
+    return ntohs(address_.sin_port);
+  }
+
+  /**
+   * Return number of listening sockets and worker threads.
+   *
+   * Value returned is unspecified unless server is running.
+   */
+  auto n_workers() const noexcept { return n_workers_; }
+
+  /**
+   * Return whether connections are steered to workers by receiving CPU.
+   *
+   * Value returned is unspecified unless server is running.
+   */
+  bool cpu_affinity() const noexcept { return cpu_affinity_; }
+
+  /**
+   * Return number of connections accepted.
+   */
+  auto n_accepted() const noexcept { return n_accepted_.load(); }
+
+  /**
+   * Return number of accepted connections received on a different CPU.
+   *
+   * Always zero unless `cpu_affinity()` is `true`.
+   */
+  auto n_cpu_mismatch() const noexcept { return n_cpu_mismatch_.load(); }
+
+  /**
+   * Return number of connections closed unserved due to resource pressure.
+   *
+   * Connections are shed if memory pressure is critical or if the number of
+   * connections being served reaches the pressure-scaled worker count.
+   */
+  auto n_shed() const noexcept { return n_shed_.load(); }
+
+  /**
+   * Return the isolated listeners in the order they were added.
+   *
+   * Empty unless the server is running.
+   */
+  const auto& isolated_listeners() const noexcept { return isolated_; }
+
+  /**
+   * Return whether the server is currently running.
+   */
+  bool running() const noexcept { return running_; }
+
+  /**
+   * Start the listening sockets and workers and serve connections.
+   *
+   * @note This function is *not* thread safe.
+   *
+   * @param params Server parameters, with one worker per `max_concurrency()`
+   * @param background `true` to run in a background thread, `false` to block
+   * @returns `EXIT_SUCCESS` on success, `EXIT_FAILURE` on failure
+   */
+  int start(const server_params& params, bool background = false)
+  {
+    if (running_)
+      throw std::runtime_error{"Server is already running"};
+    if (background) {
+      bg_thread_ = std::thread{&reuseport_server::start, this, params, false};
+      return EXIT_SUCCESS;
+    }
+    set_state(params);
+    // run workers until told to stop or one fails
+    std::atomic<bool> failed{};
+    std::vector<std::thread> workers;
+    for (unsigned int i = 0; i < n_workers_; i++)
+      workers.emplace_back([this, i, &failed] { if (!work(i)) failed = true; });
+    for (auto& worker : workers)
+      worker.join();
+    reset_state();
+    return (failed) ? EXIT_FAILURE : EXIT_SUCCESS;
+  }
+
+  /**
+   * Return if the server is joinable.
+   *
+   * `true` if server is running in a background thread, `false` otherwise.
+   */
+  bool joinable() const noexcept
+  {
+    return bg_thread_.joinable();
+  }
+
+  /**
+   * Force the server running in the background to block the current thread.
+   *
+   * No-op if server is not running in a background thread.
+   */
+  void join()
+  {
+    if (joinable())
+      bg_thread_.join();
+  }
+
+  /**
+   * Stop accepting any new incoming connections.
+   *
+   * Workers finish serving their current client before exiting.
+   *
+   * This function can be called from multiple threads safely.
+   */
+  void stop() noexcept
+  {
+    running_ = false;
+  }
+
+protected:
+  /**
+   * Serve the client connection.
+   *
+   * This is called concurrently from all the worker threads.
+   *
+   * @param cli_socket Client socket
+   * @param worker Index of the calling worker, i.e. its CPU if pinned
+   * @returns `true` if client was served, `false` if error
+   */
+  virtual bool serve(unique_socket& cli_socket, unsigned int worker) = 0;
+
+  /**
+   * Return reference to the record of the request a worker is serving.
+   *
+   * Only valid during `serve` for the calling worker, which can mark the
+   * first byte, last byte, and response phases and set the byte counts and
+   * status to give the flight recorder, if any, a detailed breakdown.
+   *
+   * @param worker Index of the calling worker
+   */
+  auto& request(unsigned int worker) noexcept { return requests_[worker]; }
+
+  /**
+   * Return number of bytes `serve` should read at once from a client.
+   *
+   * This is the `read_size()` of the server params, scaled down by memory
+   * pressure if a pressure monitor is set.
+   */
+  std::size_t read_size() const noexcept
+  {
+    return (pressure_) ? pressure_->read_size(read_size_) : read_size_;
+  }
+
+private:
+  std::vector<unique_socket> listeners_;
+  sockaddr_in address_;
+  unsigned int n_workers_;
+  std::atomic<bool> running_;
+  bool cpu_affinity_;
+  pressure_monitor* pressure_;
+  std::size_t read_size_;
+  flight_recorder* recorder_;
+  cpu_profiler* profiler_;
+  cpu_profiler::handler_id serve_id_;
+  std::vector<request_record> requests_;
+  std::atomic<std::size_t> n_accepted_;
+  std::atomic<std::size_t> n_cpu_mismatch_;
+  std::atomic<unsigned int> n_active_;
+  std::atomic<std::size_t> n_shed_;
+  std::vector<std::unique_ptr<isolated_listener>> isolated_;
+  std::thread bg_thread_;
+
+  /**
+   * Update the pressure monitor and return `true` to shed a new connection.
+   *
+   * If `false` is returned, the connection is counted as active and the
+   * caller must decrement `n_active_` after serving it.
+   */
+  bool shed_connection()
+  {
+    auto n_active = ++n_active_;
+    if (!pressure_)
+      return false;
+    pressure_->update();
+    if (!pressure_->shed() && n_active <= pressure_->max_concurrency(n_workers_))
+      return false;
+    n_active_--;
+    n_shed_++;
+    return true;
+  }
+
+  /**
+   * Worker loop accepting and serving connections on a single listener.
+   *
+   * @param i Worker index
+   * @returns `true` if stopped normally, `false` on error
+   */
+  bool work(unsigned int i)
+  {
+    try {
+      if (cpu_affinity_)
+        pin_thread(i).throw_on_error();
+      while (running_) {
+        if (!wait_pollin(listeners_[i]))
+          continue;
+        auto cli_socket = accept(listeners_[i]);
+        n_accepted_++;
+        // check that the connection was steered to the right CPU
+        int cpu;
+        if (cpu_affinity_ && incoming_cpu(cli_socket, cpu) &&
+          cpu != static_cast<int>(i))
+          n_cpu_mismatch_++;
+        // close without serving if under pressure
+        if (shed_connection())
+          continue;
+        detail::begin_request(recorder_, requests_[i]);
+        bool served;
+        {
+          cpu_scope scope{profiler_, serve_id_};
+          served = serve(cli_socket, i);
+        }
+        n_active_--;
+        detail::end_request(recorder_, requests_[i], served);
+        if (!served) {
+          running_ = false;
+          return false;
+        }
+      }
+    }
+    catch (const std::runtime_error&) {
+      running_ = false;
+      return false;
+    }
+    return true;
+  }
+
+  /**
+   * Create and bind the listening sockets and mark server as running.
+   *
+   * The first socket resolves the port, e.g. if port 0 is requested, which
+   * the remaining sockets then bind to.
+   *
+   * @param params Server start params
+   */
+  void set_state(const server_params& params)
+  {
+    n_workers_ = (params.max_concurrency()) ? params.max_concurrency() : 1U;
+    cpu_affinity_ = params.cpu_affinity();
+    pressure_ = params.pressure();
+    read_size_ = params.read_size();
+    if (!read_size_)
+      throw std::invalid_argument{"Read size must be positive"};
+    recorder_ = params.recorder();
+    profiler_ = params.profiler();
+    if (profiler_)
+      serve_id_ = profiler_->handler("serve");
+    requests_.assign(n_workers_, {});
+    address_ = make_sockaddr_in(INADDR_ANY, params.port());
+    listeners_.clear();
+    // listeners join the reuseport group in the order they start listening
+    for (unsigned int i = 0; i < n_workers_; i++) {
+      unique_socket listener{AF_INET, SOCK_STREAM};
+      if ((n_workers_ > 1U || cpu_affinity_) && !set_reuseport(listener, true))
+        throw std::runtime_error{socket_error("Could not enable SO_REUSEPORT")};
+      if (!bind(listener, address_))
+        throw std::runtime_error{socket_error("Could not bind socket")};
+      if (!i && !getsockname(listener, address_))
+        throw std::runtime_error{socket_error("Could not retrieve socket address")};
+      if (!listen(listener, params.max_pending()))
+        throw std::runtime_error{socket_error("Could not listen on socket")};
+      listeners_.push_back(std::move(listener));
+    }
+    // steer connections by receiving CPU
+    if (cpu_affinity_ && !attach_reuseport_cpu_filter(listeners_.front(), n_workers_))
+      throw std::runtime_error{socket_error("Could not attach reuseport CPU filter")};
+    // control plane listeners are not pinned so they can run on any CPU
+    isolated_ = start_listeners(
+      params.listeners(), params.max_pending(), profiler_
+    );
+    running_ = true;
+  }
+
+  /**
+   * Destroy listening sockets and mark server as not running.
+   */
+  void reset_state() noexcept
+  {
+    isolated_.clear();
+    listeners_.clear();
+    running_ = false;
+  }
+};
+
 }  // namespace pdnnet
 
 #endif  // PDNNET_SERVER_HH_
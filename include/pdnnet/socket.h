@@ -289,6 +289,117 @@ PDNNET_PUBLIC int
 pdnnet_socket_fwrite_s(
   pdnnet_socket sockfd, size_t read_size, PDNNET_SA(Out) FILE *f) PDNNET_NOEXCEPT;
 
+/**
+ * Message framing used by `pdnnet_socket_onlmsg`.
+ *
+ * @param PDNNET_SOCKET_MSG_DELIM Messages are terminated by a delimiter byte,
+ *  e.g. `'\n'` for lines. The delimiter is not part of the message.
+ * @param PDNNET_SOCKET_MSG_PREFIX Messages are preceded by a 4-byte unsigned
+ *  big-endian length that is not part of the message.
+ */
+typedef enum {
+  PDNNET_SOCKET_MSG_DELIM,
+  PDNNET_SOCKET_MSG_PREFIX
+} pdnnet_socket_msg_type;
+
+/**
+ * Struct describing how messages are framed for `pdnnet_socket_onlmsg`.
+ *
+ * Below is a description of the members.
+ *
+ * @param type Message framing type
+ * @param delim Delimiter byte, only used with `PDNNET_SOCKET_MSG_DELIM`
+ * @param max_msg_size Max message size in bytes, zero for no limit
+ */
+typedef struct {
+  pdnnet_socket_msg_type type;
+  unsigned char delim;
+  size_t max_msg_size;
+} pdnnet_socket_msg_format;
+
+/**
+ * Struct holding state information when performing a message-based read.
+ *
+ * Below is a description of the members.
+ *
+ * @param sockfd Socket file descriptor being read from
+ * @param msg Current message, pointing into the read buffer. Followed by a
+ *  null terminator so it can be treated as a string if appropriate. Only
+ *  valid for the duration of the callback and must not be modified.
+ * @param msg_size Current message size, not including the null terminator
+ * @param buf_size Current read buffer size, grown only when a single message
+ *  does not fit in the buffer
+ * @param n_msgs Number of complete messages received, including this one
+ * @param n_reads Number of successful `read()` calls made
+ * @param n_read_total Total number of bytes read so far
+ */
+typedef struct {
+  pdnnet_socket sockfd;
+  const void *msg;
+  size_t msg_size;
+  size_t buf_size;
+  size_t n_msgs;
+  size_t n_reads;
+  size_t n_read_total;
+} pdnnet_socket_msg_state;
+
+/**
+ * Function pointer typedef for use with `pdnnet_socket_onlmsg`.
+ *
+ * The function takes the address of the `pdnnet_socket_msg_state` describing
+ * the current message and external state via the `void *` second parameter.
+ *
+ * On success, the function should return 0, otherwise the negation of a valid
+ * `errno` value, which stops the read and is returned to the caller.
+ */
+typedef int (*pdnnet_socket_onlmsg_func)(
+  PDNNET_SA(In) pdnnet_socket_msg_state *,
+  PDNNET_SA(Opt(In_Out)) void *) PDNNET_NOEXCEPT;
+
+/**
+ * Declare a `pdnnet_socket_onlmsg_func`.
+ *
+ * Message state is accessed via `state`, external state through `data`.
+ *
+ * @param name Function name
+ */
+#define PDNNET_SOCKET_ONLMSG_FUNC(name) \
+  int \
+  name( \
+    PDNNET_SA(In) pdnnet_socket_msg_state *state, \
+    PDNNET_SA(Opt(In_Out)) void *data)
+
+/**
+ * Read from a socket until end of transmission, one message at a time.
+ *
+ * Unlike `pdnnet_socket_onlread2`, `msg_action` is invoked once per complete
+ * message instead of once per `read` call. Messages are handed to the callback
+ * in place from a single read buffer, which is compacted by moving any partial
+ * message to the front only when the buffer end is reached and is grown
+ * geometrically only when a single message does not fit.
+ *
+ * With delimiter framing, trailing bytes without a delimiter at end of
+ * transmission are passed as a final message. With length prefix framing,
+ * trailing bytes that do not form a complete message are an error.
+ *
+ * @param sockfd Socket file descriptor to read from
+ * @param read_size Initial read buffer size, i.e. max bytes per `read` call
+ * @param format Message framing
+ * @param msg_action Function to invoke for each complete message
+ * @param msg_action_param Parameter to pass to `msg_action`
+ * @returns 0 on success, -EINVAL if `read_size` is zero or `format` is `NULL`
+ *  or invalid, -ENOMEM on buffer allocation failure, -EMSGSIZE if a message
+ *  exceeds the max message size, -EBADMSG if transmission ended in the middle
+ *  of a length-prefixed message, -errno for other errors
+ */
+PDNNET_PUBLIC int
+pdnnet_socket_onlmsg(
+  pdnnet_socket sockfd,
+  size_t read_size,
+  PDNNET_SA(In) const pdnnet_socket_msg_format *format,
+  PDNNET_SA(Opt(In)) pdnnet_socket_onlmsg_func msg_action,
+  PDNNET_SA(Opt(In_Out)) void *msg_action_param) PDNNET_NOEXCEPT;
+
 PDNNET_EXTERN_C_END
 
 #endif  // PDNNET_SOCKET_H_
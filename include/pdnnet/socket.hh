@@ -20,14 +20,17 @@
 // for *nix systems, use standard socket API
 #else
 #include <arpa/inet.h>
+#include <fcntl.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <poll.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <unistd.h>
 #endif  // !defined(_WIN32)
 
+#include <algorithm>
 #include <cerrno>
 #include <chrono>
 #include <climits>
@@ -49,6 +52,10 @@
 #include "pdnnet/platform.h"
 #include "pdnnet/warnings.h"
 
+#ifdef PDNNET_LINUX
+#include <linux/filter.h>
+#endif  // PDNNET_LINUX
+
 namespace pdnnet {
 
 /**
@@ -888,6 +895,324 @@ inline bool getsockname(socket_handle handle, AddrType& addr) noexcept
   return true;
 }
 
+/**
+ * Enable or disable corking of partial TCP segments on a socket handle.
+ *
+ * While corked, the kernel only sends full segments, so several small writes
+ * are coalesced into as few segments as possible. Uncorking pushes out any
+ * partial segment immediately. Uses `TCP_CORK` on Linux and `TCP_NOPUSH` on
+ * BSD-like systems. On other platforms this is a no-op that returns `false`.
+ *
+ * On error, `errno` (*nix) or `WSAGetLastError` (Windows) should be checked.
+ *
+ * @param handle Connected TCP socket handle
+ * @param enable `true` to cork, `false` to uncork
+ * @returns `true` on success, `false` on error or if unsupported
+ */
+inline bool set_tcp_cork(socket_handle handle, bool enable) noexcept
+{
+#if defined(TCP_CORK) || defined(TCP_NOPUSH)
+  int value = enable;
+#if defined(TCP_CORK)
+  return !::setsockopt(handle, IPPROTO_TCP, TCP_CORK, &value, sizeof value);
+#else
+  return !::setsockopt(handle, IPPROTO_TCP, TCP_NOPUSH, &value, sizeof value);
+#endif  // !defined(TCP_CORK)
+#else
+  (void) handle;
+  (void) enable;
+  return false;
+#endif  // !defined(TCP_CORK) && !defined(TCP_NOPUSH)
+}
+
+/**
+ * Enable or disable non-blocking mode on a socket handle.
+ *
+ * Uses `fcntl` with `O_NONBLOCK` on *nix systems, preserving other file status
+ * flags, and `ioctlsocket` with `FIONBIO` on Windows.
+ *
+ * On error, `errno` (*nix) or `WSAGetLastError` (Windows) should be checked.
+ *
+ * @param handle Socket handle
+ * @param enable `true` for non-blocking mode, `false` for blocking mode
+ * @returns `true` on success, `false` on error
+ */
+inline bool set_nonblocking(socket_handle handle, bool enable) noexcept
+{
+#if defined(_WIN32)
+  u_long value = enable;
+  return ::ioctlsocket(handle, FIONBIO, &value) != SOCKET_ERROR;
+#else
+  auto flags = ::fcntl(handle, F_GETFL);
+  if (flags < 0)
+    return false;
+  flags = enable ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+  return ::fcntl(handle, F_SETFL, flags) >= 0;
+#endif  // !defined(_WIN32)
+}
+
+/**
+ * Set the kernel send buffer size of a socket handle.
+ *
+ * On Linux the kernel doubles the value to allow for bookkeeping overhead,
+ * clamps it to `net.core.wmem_max`, and disables send buffer autotuning.
+ *
+ * @param handle Socket handle
+ * @param size Requested buffer size in bytes
+ * @returns `true` on success, `false` on error
+ */
+inline bool set_send_buffer_size(socket_handle handle, int size) noexcept
+{
+  return !::setsockopt(
+    handle, SOL_SOCKET, SO_SNDBUF, reinterpret_cast<const char*>(&size), sizeof size
+  );
+}
+
+/**
+ * Set the kernel receive buffer size of a socket handle.
+ *
+ * On Linux the kernel doubles the value to allow for bookkeeping overhead,
+ * clamps it to `net.core.rmem_max`, and disables receive buffer autotuning.
+ * The TCP window scale is negotiated at connect time, so for large buffers
+ * this should be set before connecting or listening.
+ *
+ * @param handle Socket handle
+ * @param size Requested buffer size in bytes
+ * @returns `true` on success, `false` on error
+ */
+inline bool set_recv_buffer_size(socket_handle handle, int size) noexcept
+{
+  return !::setsockopt(
+    handle, SOL_SOCKET, SO_RCVBUF, reinterpret_cast<const char*>(&size), sizeof size
+  );
+}
+
+/**
+ * Get the kernel send buffer size of a socket handle.
+ *
+ * @param handle Socket handle
+ * @param size Buffer size in bytes to write on success
+ * @returns `true` on success, `false` on error
+ */
+inline bool send_buffer_size(socket_handle handle, int& size) noexcept
+{
+  socklen_t len = sizeof size;
+  return !::getsockopt(
+    handle, SOL_SOCKET, SO_SNDBUF, reinterpret_cast<char*>(&size), &len
+  );
+}
+
+/**
+ * Get the kernel receive buffer size of a socket handle.
+ *
+ * @param handle Socket handle
+ * @param size Buffer size in bytes to write on success
+ * @returns `true` on success, `false` on error
+ */
+inline bool recv_buffer_size(socket_handle handle, int& size) noexcept
+{
+  socklen_t len = sizeof size;
+  return !::getsockopt(
+    handle, SOL_SOCKET, SO_RCVBUF, reinterpret_cast<char*>(&size), &len
+  );
+}
+
+/**
+ * Set the receive low watermark of a socket handle.
+ *
+ * Reads block and `poll` only reports `POLLIN` once at least `size` bytes are
+ * queued, or on end of transmission or error, so a reader needing a known
+ * number of bytes is not woken for every segment. Linux caps the value at
+ * half the receive buffer size. Windows does not support setting the option,
+ * so this returns `false` there.
+ *
+ * @param handle Socket handle
+ * @param size Low watermark in bytes, at least one
+ * @returns `true` on success, `false` on error or if unsupported
+ */
+inline bool set_recv_lowat(socket_handle handle, int size) noexcept
+{
+  return !::setsockopt(
+    handle, SOL_SOCKET, SO_RCVLOWAT, reinterpret_cast<const char*>(&size), sizeof size
+  );
+}
+
+/**
+ * Get the receive low watermark of a socket handle.
+ *
+ * @param handle Socket handle
+ * @param size Low watermark in bytes to write on success
+ * @returns `true` on success, `false` on error
+ */
+inline bool recv_lowat(socket_handle handle, int& size) noexcept
+{
+  socklen_t len = sizeof size;
+  return !::getsockopt(
+    handle, SOL_SOCKET, SO_RCVLOWAT, reinterpret_cast<char*>(&size), &len
+  );
+}
+
+/**
+ * Enable or disable `SO_REUSEPORT` on a socket handle.
+ *
+ * Must be set before binding. Sockets with this option bound to the same
+ * address and port form a group the kernel load balances connections across.
+ * On platforms without `SO_REUSEPORT` this is a no-op that returns `false`.
+ *
+ * @param handle Socket handle
+ * @param enable `true` to enable, `false` to disable
+ * @returns `true` on success, `false` on error or if unsupported
+ */
+inline bool set_reuseport(socket_handle handle, bool enable) noexcept
+{
+#if defined(SO_REUSEPORT)
+  int value = enable;
+  return !::setsockopt(handle, SOL_SOCKET, SO_REUSEPORT, &value, sizeof value);
+#else
+  (void) handle;
+  (void) enable;
+  return false;
+#endif  // !defined(SO_REUSEPORT)
+}
+
+/**
+ * Enable or disable `SO_REUSEADDR` on a socket handle.
+ *
+ * Must be set before binding. Allows binding a local address and port that is
+ * still held by a connection in `TIME_WAIT`.
+ *
+ * @param handle Socket handle
+ * @param enable `true` to enable, `false` to disable
+ * @returns `true` on success, `false` on error
+ */
+inline bool set_reuseaddr(socket_handle handle, bool enable) noexcept
+{
+  int value = enable;
+  return !::setsockopt(
+    handle,
+    SOL_SOCKET,
+    SO_REUSEADDR,
+    reinterpret_cast<const char*>(&value),
+    sizeof value
+  );
+}
+
+/**
+ * Enable or disable `IP_BIND_ADDRESS_NO_PORT` on a socket handle.
+ *
+ * When enabled, binding to port zero before connecting only fixes the source
+ * address, with the ephemeral port chosen at connect time. This lets the
+ * kernel reuse a source port across different destinations, so clients that
+ * bind before connecting are not limited to one connection per local port. On
+ * platforms without `IP_BIND_ADDRESS_NO_PORT` this is a no-op that returns
+ * `false`.
+ *
+ * @param handle Socket handle
+ * @param enable `true` to enable, `false` to disable
+ * @returns `true` on success, `false` on error or if unsupported
+ */
+inline bool set_bind_address_no_port(socket_handle handle, bool enable) noexcept
+{
+#if defined(IP_BIND_ADDRESS_NO_PORT)
+  int value = enable;
+  return !::setsockopt(
+    handle, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &value, sizeof value
+  );
+#else
+  (void) handle;
+  (void) enable;
+  return false;
+#endif  // !defined(IP_BIND_ADDRESS_NO_PORT)
+}
+
+/**
+ * Set `SO_LINGER` on a socket handle.
+ *
+ * Enabling with a zero timeout makes closing the socket abortive, i.e. the
+ * connection is reset and does not enter `TIME_WAIT`. Unsent data is lost, so
+ * this is intended for load testing tools rather than regular clients.
+ *
+ * @param handle Socket handle
+ * @param enable `true` to enable lingering, `false` to disable
+ * @param seconds Linger timeout in seconds
+ * @returns `true` on success, `false` on error
+ */
+inline bool set_linger(socket_handle handle, bool enable, int seconds) noexcept
+{
+  linger value{};
+  value.l_onoff = enable;
+  value.l_linger = static_cast<decltype(value.l_linger)>(seconds);
+  return !::setsockopt(
+    handle,
+    SOL_SOCKET,
+    SO_LINGER,
+    reinterpret_cast<const char*>(&value),
+    sizeof value
+  );
+}
+
+/**
+ * Get the CPU that processed the most recent packets received by a socket.
+ *
+ * For accepted sockets this is the CPU that handled the NIC receive queue the
+ * connection hashed to. Uses `SO_INCOMING_CPU` on Linux. On other platforms
+ * this is a no-op that returns `false`.
+ *
+ * @param handle Connected socket handle
+ * @param cpu CPU index to write on success
+ * @returns `true` on success, `false` on error or if unsupported
+ */
+inline bool incoming_cpu(socket_handle handle, int& cpu) noexcept
+{
+#if defined(SO_INCOMING_CPU)
+  socklen_t len = sizeof cpu;
+  return !::getsockopt(handle, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len);
+#else
+  (void) handle;
+  (void) cpu;
+  return false;
+#endif  // !defined(SO_INCOMING_CPU)
+}
+
+/**
+ * Steer connections in a `SO_REUSEPORT` group by the receiving CPU.
+ *
+ * Attaches a classic BPF program to the group that returns the receiving CPU
+ * modulo `n_sockets`, i.e. a connection handled by CPU `i` is queued on the
+ * `i % n_sockets`th socket to join the group. Sockets join the group in the
+ * order they start listening, so socket `i` should be served by a thread
+ * pinned to CPU `i`. Uses `SO_ATTACH_REUSEPORT_CBPF` on Linux. On other
+ * platforms this is a no-op that returns `false`.
+ *
+ * @param handle Handle of any listening socket in the group
+ * @param n_sockets Number of sockets in the group, must be positive
+ * @returns `true` on success, `false` on error or if unsupported
+ */
+inline bool attach_reuseport_cpu_filter(
+  socket_handle handle, unsigned int n_sockets) noexcept
+{
+#if defined(SO_ATTACH_REUSEPORT_CBPF)
+  if (!n_sockets)
+    return false;
+  sock_filter code[] = {
+    // A = current CPU
+    {BPF_LD | BPF_W | BPF_ABS, 0, 0, static_cast<__u32>(SKF_AD_OFF + SKF_AD_CPU)},
+    // A = A % n_sockets
+    {BPF_ALU | BPF_MOD | BPF_K, 0, 0, n_sockets},
+    // return A
+    {BPF_RET | BPF_A, 0, 0, 0}
+  };
+  sock_fprog prog{sizeof code / sizeof *code, code};
+  return !::setsockopt(
+    handle, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof prog
+  );
+#else
+  (void) handle;
+  (void) n_sockets;
+  return false;
+#endif  // !defined(SO_ATTACH_REUSEPORT_CBPF)
+}
+
 /**
  * Poll a single socket for events.
  *
@@ -1072,6 +1397,7 @@ public:
     std::chrono::milliseconds poll_timeout = poll_timeout_default)
     : handle_{handle},
       buf_size_{buf_size},
+      buf_cap_{buf_size},
       buf_{std::make_unique<unsigned char[]>(buf_size_)},
       poll_timeout_{poll_timeout}
   {}
@@ -1114,15 +1440,38 @@ public:
       if ((n_read = ::read(handle_, buf_.get(), buf_size_)) < 0)
         return errno_error("read() failure");
 #endif  // !defined(_WIN32)
-      // write to stream + clear buffer
+      // write to stream. no need to clear buffer since only n_read bytes used
       out.write(reinterpret_cast<const CharT*>(buf_.get()), n_read / sizeof(CharT));
-      std::memset(buf_.get(), 0, buf_size_);
     }
     while (n_read);
     // no bytes left in buffer (n_read is 0), so done
     return {};
   }
 
+  /**
+   * Return the read buffer size, i.e. number of bytes per read.
+   */
+  auto buf_size() const noexcept { return buf_size_; }
+
+  /**
+   * Set the read buffer size, i.e. number of bytes per read.
+   *
+   * Useful for matching reads to the kernel receive buffer size, e.g. as
+   * chosen by a `bdp_tuner`. The buffer is only reallocated if it grows.
+   *
+   * @param new_size New read buffer size, must be positive
+   * @returns `*this` to allow method chaining
+   */
+  auto& buf_size(std::size_t new_size)
+  {
+    if (new_size > buf_cap_) {
+      buf_ = std::make_unique<unsigned char[]>(new_size);
+      buf_cap_ = new_size;
+    }
+    buf_size_ = new_size;
+    return *this;
+  }
+
   /**
    * Read from socket until end of transmission and return bytes as a string.
    *
@@ -1142,6 +1491,7 @@ public:
 private:
   socket_handle handle_;
   std::size_t buf_size_;
+  std::size_t buf_cap_;
   std::unique_ptr<unsigned char[]> buf_;
   std::chrono::milliseconds poll_timeout_;
 };
@@ -1202,6 +1552,81 @@ inline auto read(
   return read<CharT, Traits>(handle, socket_read_size, poll_timeout);
 }
 
+/**
+ * Read an exact number of bytes from a socket.
+ *
+ * Polls before each read so that a stalled peer results in an error instead
+ * of blocking forever. If the peer signals end of transmission before `size`
+ * bytes are read, no error is returned but `n_read` will be less than `size`.
+ *
+ * @param handle Socket handle
+ * @param buf Buffer to write received bytes to
+ * @param size Number of bytes to read
+ * @param timeout Timeout to use when polling for each chunk of input
+ * @param n_read Number of bytes actually read
+ * @returns Optional empty on success, with error message on failure
+ */
+inline optional_error read_exact(
+  socket_handle handle,
+  void* buf,
+  std::size_t size,
+  std::chrono::milliseconds timeout,
+  std::size_t& n_read)
+{
+  auto data = static_cast<char*>(buf);
+  n_read = 0;
+  while (n_read < size) {
+    if (!wait_pollin(handle, timeout))
+      return "Timed out after " + std::to_string(timeout.count()) +
+        " ms waiting for " + std::to_string(size - n_read) + " bytes";
+#if defined(_WIN32)
+    auto n_last = ::recv(
+      handle,
+      data + n_read,
+      static_cast<int>((std::min<std::size_t>)(size - n_read, INT_MAX)),
+      0
+    );
+    if (n_last == SOCKET_ERROR)
+      return winsock_error("recv() failure");
+#else
+    auto n_last = ::read(handle, data + n_read, size - n_read);
+    if (n_last < 0)
+      return errno_error("read() failure");
+#endif  // !defined(_WIN32)
+    // end of transmission
+    if (!n_last)
+      return {};
+    n_read += static_cast<std::size_t>(n_last);
+  }
+  return {};
+}
+
+/**
+ * Read an exact number of bytes from a socket.
+ *
+ * Unlike the overload taking `n_read`, a short read is treated as an error.
+ *
+ * @param handle Socket handle
+ * @param buf Buffer to write received bytes to
+ * @param size Number of bytes to read
+ * @param timeout Timeout to use when polling for each chunk of input
+ * @returns Optional empty on success, with error message on failure
+ */
+inline optional_error read_exact(
+  socket_handle handle,
+  void* buf,
+  std::size_t size,
+  std::chrono::milliseconds timeout = infinite_poll_timeout)
+{
+  std::size_t n_read;
+  if (auto err = read_exact(handle, buf, size, timeout, n_read))
+    return err;
+  if (n_read < size)
+    return "End of transmission after " + std::to_string(n_read) + " of " +
+      std::to_string(size) + " bytes";
+  return {};
+}
+
 /**
  * Socket writer class for abstracting writes to raw sockets.
  *
@@ -0,0 +1,468 @@
+/**
+ * @file source_address.hh
+ * @author Derek Huang
+ * @brief C++ header for client source address and ephemeral port management
+ * @copyright MIT License
+ */
+
+#ifndef PDNNET_SOURCE_ADDRESS_HH_
+#define PDNNET_SOURCE_ADDRESS_HH_
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "pdnnet/deadline.hh"
+#include "pdnnet/error.hh"
+#include "pdnnet/socket.hh"
+
+namespace pdnnet {
+
+/**
+ * System-wide TCP socket counts.
+ *
+ * `tw` is the number of connections in `TIME_WAIT`, each of which holds its
+ * local port for the destination until it expires.
+ */
+struct tcp_sockstat {
+  std::uint64_t inuse{};
+  std::uint64_t orphan{};
+  std::uint64_t tw{};
+  std::uint64_t alloc{};
+  std::uint64_t mem{};
+};
+
+/**
+ * Parse system-wide TCP socket counts from a sockstat file.
+ *
+ * The format is that of `/proc/net/sockstat`, where the relevant line is
+ *
+ * @code{.txt}
+ * TCP: inuse 13 orphan 0 tw 2 alloc 13 mem 16
+ * @endcode
+ *
+ * @param path Path to sockstat file
+ * @param stats Statistics to update on success
+ * @returns Optional empty on success, with error message on failure
+ */
+inline optional_error read_tcp_sockstat(const std::string& path, tcp_sockstat& stats)
+{
+  std::ifstream in{path};
+  if (!in)
+    return "Could not open " + path;
+  std::string line;
+  while (std::getline(in, line)) {
+    std::istringstream ss{line};
+    std::string kind;
+    ss >> kind;
+    if (kind != "TCP:")
+      continue;
+    tcp_sockstat res;
+    std::string key;
+    std::uint64_t value;
+    while (ss >> key >> value) {
+      if (key == "inuse")
+        res.inuse = value;
+      else if (key == "orphan")
+        res.orphan = value;
+      else if (key == "tw")
+        res.tw = value;
+      else if (key == "alloc")
+        res.alloc = value;
+      else if (key == "mem")
+        res.mem = value;
+    }
+    if (!ss.eof())
+      return "Malformed TCP line in " + path + ": " + line;
+    stats = res;
+    return {};
+  }
+  return "No TCP line in " + path;
+}
+
+/**
+ * Parse system-wide TCP socket counts from `/proc/net/sockstat`.
+ *
+ * @param stats Statistics to update on success
+ * @returns Optional empty on success, with error message on failure
+ */
+inline auto read_tcp_sockstat(tcp_sockstat& stats)
+{
+  return read_tcp_sockstat("/proc/net/sockstat", stats);
+}
+
+/**
+ * Inclusive range of local ports in host byte order.
+ *
+ * An empty range, i.e. with `first` zero, means no range.
+ */
+struct port_range {
+  inet_port_type first{};
+  inet_port_type last{};
+
+  /**
+   * Return number of ports in the range.
+   */
+  std::size_t size() const noexcept
+  {
+    return (first && first <= last) ? last - first + 1U : 0U;
+  }
+};
+
+/**
+ * Parse the ephemeral port range from a file.
+ *
+ * The format is that of `/proc/sys/net/ipv4/ip_local_port_range`, i.e. the
+ * first and last port separated by whitespace.
+ *
+ * @param path Path to port range file
+ * @param range Range to update on success
+ * @returns Optional empty on success, with error message on failure
+ */
+inline optional_error read_local_port_range(const std::string& path, port_range& range)
+{
+  std::ifstream in{path};
+  if (!in)
+    return "Could not open " + path;
+  unsigned long first, last;
+  if (!(in >> first >> last) || !first || first > last || last > 65535UL)
+    return "Malformed port range in " + path;
+  range.first = static_cast<inet_port_type>(first);
+  range.last = static_cast<inet_port_type>(last);
+  return {};
+}
+
+/**
+ * Parse the ephemeral port range from `ip_local_port_range`.
+ *
+ * @param range Range to update on success
+ * @returns Optional empty on success, with error message on failure
+ */
+inline auto read_local_port_range(port_range& range)
+{
+  return read_local_port_range("/proc/sys/net/ipv4/ip_local_port_range", range);
+}
+
+/**
+ * Source address and ephemeral port metrics.
+ *
+ * `time_wait` and `in_use` are system-wide. `port_capacity` is the number of
+ * concurrent connections the source addresses and port range allow to a
+ * single destination, which is the limit a client connecting to one backend
+ * at a high rate runs into, since each closed connection holds its port in
+ * `TIME_WAIT` for a minute or more.
+ */
+struct source_metrics {
+  std::size_t n_binds{};
+  std::size_t n_exhausted{};
+  std::uint64_t time_wait{};
+  std::uint64_t in_use{};
+  std::size_t port_capacity{};
+
+  /**
+   * Return used ports as a fraction of capacity, zero if capacity is unknown.
+   *
+   * This is an upper bound as not every socket is to the same destination.
+   */
+  double port_usage() const noexcept
+  {
+    if (!port_capacity)
+      return 0.;
+    return static_cast<double>(time_wait + in_use) / port_capacity;
+  }
+};
+
+/**
+ * Write source metrics as a single line of key-value pairs.
+ *
+ * @param out Output stream
+ * @param metrics Metrics to write
+ */
+inline auto& operator<<(std::ostream& out, const source_metrics& metrics)
+{
+  return out << "binds=" << metrics.n_binds << " exhausted=" <<
+    metrics.n_exhausted << " time_wait=" << metrics.time_wait << " in_use=" <<
+    metrics.in_use << " port_capacity=" << metrics.port_capacity <<
+    " port_usage=" << metrics.port_usage();
+}
+
+namespace detail {
+
+/**
+ * Return the last socket error value.
+ */
+inline int last_socket_error() noexcept
+{
+#if defined(_WIN32)
+  return WSAGetLastError();
+#else
+  return errno;
+#endif  // !defined(_WIN32)
+}
+
+/**
+ * Return `true` if a socket error means no local address or port was free.
+ *
+ * @param err Socket error value, e.g. from `last_socket_error()`
+ */
+inline bool address_exhausted(int err) noexcept
+{
+#if defined(_WIN32)
+  return err == WSAEADDRINUSE || err == WSAEADDRNOTAVAIL;
+#else
+  return err == EADDRINUSE || err == EADDRNOTAVAIL;
+#endif  // !defined(_WIN32)
+}
+
+}  // namespace detail
+
+/**
+ * Thread-safe rotation of client sockets across local source addresses.
+ *
+ * A TCP connection is identified by its source address and port and its
+ * destination address and port, so a client connecting to one destination
+ * from one source address can have at most one connection per ephemeral port,
+ * including connections still in `TIME_WAIT`. Spreading connections across
+ * several local addresses, e.g. 127.0.0.1 through 127.0.0.4 for a loopback
+ * backend, multiplies that limit.
+ *
+ * Without a port range, sockets are bound with `IP_BIND_ADDRESS_NO_PORT` so
+ * the kernel still picks the port at connect time. With a port range, ports
+ * are handed out round-robin from the range and bound with `SO_REUSEADDR`, so a
+ * port in `TIME_WAIT` can be reused for other destinations, while reusing it
+ * for the same destination fails at connect time and is counted as exhausted.
+ * Settings should be changed before the pool is shared between threads.
+ */
+class source_address_pool {
+public:
+  /**
+   * Default ctor.
+   *
+   * With no addresses and no port range, sockets are not bound.
+   */
+  source_address_pool() noexcept
+    : ports_{},
+      abortive_close_{},
+      next_addr_{},
+      next_port_{},
+      n_binds_{},
+      n_exhausted_{}
+  {}
+
+  /**
+   * Deleted copy ctor.
+   */
+  source_address_pool(const source_address_pool&) = delete;
+
+  /**
+   * Add a local source address.
+   *
+   * @param address Numeric IPv4 address, e.g. "127.0.0.2"
+   * @returns Optional empty on success, with error message on failure
+   */
+  optional_error add(const std::string& address)
+  {
+    in_addr addr;
+    if (::inet_pton(AF_INET, address.c_str(), &addr) != 1)
+      return "Invalid IPv4 source address: " + address;
+    add(ntohl(addr.s_addr));
+    return {};
+  }
+
+  /**
+   * Add a local source address.
+   *
+   * @param address IPv4 address in host byte order, e.g. `INADDR_LOOPBACK`
+   */
+  void add(inet_addr_type address)
+  {
+    std::lock_guard lock{mutex_};
+    addrs_.push_back(make_sockaddr_in(address, 0));
+  }
+
+  /**
+   * Return number of source addresses.
+   */
+  auto n_addresses() const
+  {
+    std::lock_guard lock{mutex_};
+    return addrs_.size();
+  }
+
+  /**
+   * Set the local port range to bind sockets to.
+   *
+   * An empty range means the kernel picks the port.
+   *
+   * @param range Inclusive port range in host byte order
+   */
+  auto& ports(port_range range) noexcept
+  {
+    ports_ = range;
+    return *this;
+  }
+
+  /**
+   * Return the local port range to bind sockets to.
+   */
+  auto ports() const noexcept { return ports_; }
+
+  /**
+   * Set whether connected sockets are closed abortively.
+   *
+   * This sets `SO_LINGER` with a zero timeout so closed connections are reset
+   * instead of entering `TIME_WAIT`. Only for tools where losing unsent data
+   * and sending resets to the peer is acceptable.
+   *
+   * @param enable `true` to enable, `false` to disable
+   */
+  auto& abortive_close(bool enable) noexcept
+  {
+    abortive_close_ = enable;
+    return *this;
+  }
+
+  /**
+   * Return whether connected sockets are closed abortively.
+   */
+  auto abortive_close() const noexcept { return abortive_close_; }
+
+  /**
+   * Bind a socket to the next source address and port.
+   *
+   * @param handle Unbound IPv4 socket handle
+   * @returns Optional empty on success, with error message on failure
+   */
+  optional_error bind(socket_handle handle)
+  {
+    auto addr = next_addr();
+    if (!ports_.size()) {
+      if (addr.sin_addr.s_addr == htonl(INADDR_ANY))
+        return {};
+      // not supported everywhere, in which case the port is fixed at bind
+      set_bind_address_no_port(handle, true);
+      return bind(handle, addr);
+    }
+    if (!set_reuseaddr(handle, true))
+      return "Could not set SO_REUSEADDR: " + socket_error();
+    for (std::size_t i = 0; i < ports_.size(); i++) {
+      addr.sin_port = htons(
+        static_cast<inet_port_type>(ports_.first + next_port_++ % ports_.size())
+      );
+      if (pdnnet::bind(handle, addr)) {
+        n_binds_++;
+        return {};
+      }
+      if (!detail::address_exhausted(detail::last_socket_error()))
+        return "Socket bind error: " + socket_error();
+    }
+    n_exhausted_++;
+    return "No free source port in " + std::to_string(ports_.first) + "-" +
+      std::to_string(ports_.last);
+  }
+
+  /**
+   * Bind a socket to the next source address and connect it before a deadline.
+   *
+   * @param handle Unbound IPv4 socket handle
+   * @param addr Destination address
+   * @param deadline Deadline bounding the connection attempt
+   * @returns Optional empty on success, with error message on failure
+   */
+  optional_error connect(
+    socket_handle handle, const sockaddr_in& addr, const deadline& deadline)
+  {
+    if (auto err = bind(handle))
+      return err;
+    if (abortive_close_ && !set_linger(handle, true, 0))
+      return "Could not set SO_LINGER: " + socket_error();
+    auto err = pdnnet::connect(handle, addr, deadline);
+    // with IP_BIND_ADDRESS_NO_PORT the port is picked here and can run out
+    if (err && detail::address_exhausted(detail::last_socket_error()))
+      n_exhausted_++;
+    return err;
+  }
+
+  /**
+   * Return number of sockets bound.
+   */
+  std::size_t n_binds() const noexcept { return n_binds_; }
+
+  /**
+   * Return number of binds or connects that failed for lack of a free port.
+   */
+  std::size_t n_exhausted() const noexcept { return n_exhausted_; }
+
+  /**
+   * Return current source metrics.
+   *
+   * System-wide counts are left as zero if they cannot be read, e.g. on
+   * platforms without `/proc`.
+   */
+  auto metrics() const
+  {
+    source_metrics res;
+    res.n_binds = n_binds_;
+    res.n_exhausted = n_exhausted_;
+    tcp_sockstat stats;
+    if (!read_tcp_sockstat(stats)) {
+      res.time_wait = stats.tw;
+      res.in_use = stats.inuse;
+    }
+    auto range = ports_;
+    if (range.size() || !read_local_port_range(range))
+      res.port_capacity = range.size() * (std::max)(n_addresses(), std::size_t{1});
+    return res;
+  }
+
+private:
+  mutable std::mutex mutex_;
+  std::vector<sockaddr_in> addrs_;
+  port_range ports_;
+  bool abortive_close_;
+  std::atomic<std::size_t> next_addr_;
+  std::atomic<std::size_t> next_port_;
+  std::atomic<std::size_t> n_binds_;
+  std::atomic<std::size_t> n_exhausted_;
+
+  /**
+   * Return the next source address with port zero, `INADDR_ANY` if none.
+   */
+  sockaddr_in next_addr()
+  {
+    std::lock_guard lock{mutex_};
+    if (addrs_.empty())
+      return make_sockaddr_in(INADDR_ANY, 0);
+    return addrs_[next_addr_++ % addrs_.size()];
+  }
+
+  /**
+   * Bind a socket to a source address with port zero.
+   *
+   * @param handle Socket handle
+   * @param addr Source address
+   * @returns Optional empty on success, with error message on failure
+   */
+  optional_error bind(socket_handle handle, const sockaddr_in& addr)
+  {
+    if (pdnnet::bind(handle, addr)) {
+      n_binds_++;
+      return {};
+    }
+    if (detail::address_exhausted(detail::last_socket_error()))
+      n_exhausted_++;
+    return "Socket bind error: " + socket_error();
+  }
+};
+
+}  // namespace pdnnet
+
+#endif  // PDNNET_SOURCE_ADDRESS_HH_
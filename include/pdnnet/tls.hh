@@ -27,6 +27,7 @@
 #endif  // _WIN32
 
 #include <cstdint>
+#include <functional>
 #include <memory>
 #include <optional>
 #include <ostream>
@@ -745,6 +746,37 @@ public:
     return "Fatal TLS handshake error: " + ssl_error;
   }
 
+  /**
+   * Perform the TLS handshake with a client through an accepted socket.
+   *
+   * The TLS context must have a certificate and private key loaded.
+   *
+   * @param handle Accepted socket handle
+   * @returns Optional error empty on success, with error on failure
+   */
+  optional_error accept_handshake(socket_handle handle)
+  {
+    // set I/O facility using the accepted socket handle
+    if (!SSL_set_fd(layer_, handle))
+      return openssl_error_string("Failed to set socket handle");
+    // perform TLS handshake with client
+    auto status = SSL_accept(layer_);
+    // 1 on success
+    if (status == 1)
+      return {};
+    // otherwise, failure. use SSL_get_error to get TLS layer error code
+    auto ssl_error = openssl_ssl_error_string(SSL_get_error(layer_, status));
+    // 0 for controlled failure, otherwise fatal
+    if (!status)
+      return "Controlled TLS handshake error: " + ssl_error;
+    return "Fatal TLS handshake error: " + ssl_error;
+  }
+
+  /**
+   * Return `true` if the handshake resumed a previous session.
+   */
+  bool session_reused() const noexcept { return SSL_session_reused(layer_); }
+
 private:
   SSL* layer_;
 };
@@ -0,0 +1,302 @@
+/**
+ * @file tsc_clock.hh
+ * @author Derek Huang
+ * @brief C++ header for a calibrated time stamp counter clock
+ * @copyright MIT License
+ */
+
+#ifndef PDNNET_TSC_CLOCK_HH_
+#define PDNNET_TSC_CLOCK_HH_
+
+// the TSC is only read on x86-64, where it is always present
+#if defined(__x86_64__) || defined(_M_X64)
+#define PDNNET_HAS_TSC
+#endif  // !defined(__x86_64__) && !defined(_M_X64)
+
+#if defined(PDNNET_HAS_TSC)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif  // !defined(_MSC_VER)
+#endif  // defined(PDNNET_HAS_TSC)
+
+#include <chrono>
+#include <cstdint>
+#include <ratio>
+
+/**
+ * Milliseconds spent calibrating the TSC against `std::chrono::steady_clock`.
+ */
+#ifndef PDNNET_TSC_CALIBRATION_MS
+#define PDNNET_TSC_CALIBRATION_MS 20
+#endif  // PDNNET_TSC_CALIBRATION_MS
+
+namespace pdnnet {
+
+/**
+ * Milliseconds spent calibrating the TSC against `std::chrono::steady_clock`.
+ */
+inline constexpr std::chrono::milliseconds
+tsc_calibration_time{PDNNET_TSC_CALIBRATION_MS};
+
+namespace detail {
+
+/**
+ * Return `true` if the CPU has an invariant TSC.
+ *
+ * An invariant TSC ticks at a constant rate in all power states and is
+ * synchronized across cores, so differences of readings taken on different
+ * cores are meaningful.
+ */
+inline bool invariant_tsc() noexcept
+{
+#if defined(PDNNET_HAS_TSC)
+#if defined(_MSC_VER)
+  int regs[4];
+  __cpuid(regs, 0x80000000);
+  if (static_cast<unsigned int>(regs[0]) < 0x80000007U)
+    return false;
+  __cpuid(regs, 0x80000007);
+  return regs[3] & (1 << 8);
+#else
+  unsigned int eax, ebx, ecx, edx;
+  if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx))
+    return false;
+  return edx & (1U << 8);
+#endif  // !defined(_MSC_VER)
+#else
+  return false;
+#endif  // !defined(PDNNET_HAS_TSC)
+}
+
+/**
+ * Return `(a * b) >> 32` without intermediate overflow.
+ *
+ * @param a Multiplicand
+ * @param b Multiplier
+ */
+inline std::uint64_t mul_shift32(std::uint64_t a, std::uint64_t b) noexcept
+{
+#if defined(_MSC_VER) && defined(_M_X64)
+  std::uint64_t high;
+  auto low = _umul128(a, b, &high);
+  return (high << 32) | (low >> 32);
+#elif defined(__SIZEOF_INT128__)
+  return static_cast<std::uint64_t>((static_cast<unsigned __int128>(a) * b) >> 32);
+#else
+  // only used without the TSC, so precision is not critical
+  return static_cast<std::uint64_t>(static_cast<long double>(a) * b / 4294967296.);
+#endif  // !defined(_MSC_VER) || !defined(_M_X64)
+}
+
+/**
+ * TSC calibration against `std::chrono::steady_clock`.
+ *
+ * A TSC reading `t` corresponds to `base_ns + ((t - base_ticks) * mult) >> 32`
+ * nanoseconds since the steady clock epoch.
+ */
+struct tsc_calibration {
+  bool enabled{};
+  std::uint64_t base_ticks{};
+  std::int64_t base_ns{};
+  std::uint64_t mult{};
+  double frequency{};
+};
+
+}  // namespace detail
+
+/**
+ * Clock reading the CPU time stamp counter.
+ *
+ * Satisfies the standard *Clock* requirements with nanosecond durations and
+ * shares the epoch of `std::chrono::steady_clock`, so time points of the two
+ * can be converted with `to_steady` and `from_steady`. On x86-64 CPUs with an
+ * invariant TSC, `now()` is a `rdtsc` and a multiply instead of a call into
+ * the vDSO `clock_gettime`, which matters when several timestamps are taken
+ * per request. Elsewhere, or without an invariant TSC, the clock simply reads
+ * `std::chrono::steady_clock`.
+ *
+ * The TSC is calibrated against `steady_clock` over `tsc_calibration_time` on
+ * first use, so call `calibrate()` at startup to keep that off the hot path.
+ * Readings drift from `steady_clock` by the calibration error, typically a
+ * few parts per million, so the clock is meant for measuring intervals, not
+ * for deadlines that must agree with other clocks over long periods.
+ */
+class tsc_clock {
+public:
+  using rep = std::int64_t;
+  using period = std::nano;
+  using duration = std::chrono::duration<rep, period>;
+  using time_point = std::chrono::time_point<tsc_clock>;
+  static constexpr bool is_steady = true;
+
+  /**
+   * Return the current time.
+   *
+   * `rdtsc` is not ordered with respect to surrounding instructions, so use
+   * `now_ordered()` to end a measurement of a short code section.
+   */
+  static time_point now() noexcept
+  {
+#if defined(PDNNET_HAS_TSC)
+    const auto& cal = calibration();
+    if (cal.enabled)
+      return from_ticks(cal, __rdtsc());
+#endif  // defined(PDNNET_HAS_TSC)
+    return from_steady(std::chrono::steady_clock::now());
+  }
+
+  /**
+   * Return the current time after all preceding instructions have executed.
+   *
+   * Uses `rdtscp`, which waits for prior instructions to complete, at the
+   * cost of a few more cycles than `now()`.
+   */
+  static time_point now_ordered() noexcept
+  {
+#if defined(PDNNET_HAS_TSC)
+    const auto& cal = calibration();
+    if (cal.enabled) {
+      unsigned int aux;
+      return from_ticks(cal, __rdtscp(&aux));
+    }
+#endif  // defined(PDNNET_HAS_TSC)
+    return from_steady(std::chrono::steady_clock::now());
+  }
+
+  /**
+   * Calibrate the clock if not already calibrated.
+   *
+   * Blocks for `tsc_calibration_time` the first time it is called.
+   */
+  static void calibrate() noexcept { calibration(); }
+
+  /**
+   * Return `true` if the clock reads the TSC instead of `steady_clock`.
+   */
+  static bool tsc() noexcept { return calibration().enabled; }
+
+  /**
+   * Return the calibrated TSC frequency in Hz, zero if the TSC is not used.
+   */
+  static double frequency() noexcept { return calibration().frequency; }
+
+  /**
+   * Convert a time point to a `std::chrono::steady_clock` time point.
+   *
+   * @param tp Time point
+   */
+  static auto to_steady(time_point tp) noexcept
+  {
+    return std::chrono::steady_clock::time_point{
+      std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        tp.time_since_epoch()
+      )
+    };
+  }
+
+  /**
+   * Convert a `std::chrono::steady_clock` time point to a time point.
+   *
+   * @param tp Steady clock time point
+   */
+  static time_point from_steady(std::chrono::steady_clock::time_point tp) noexcept
+  {
+    return time_point{std::chrono::duration_cast<duration>(tp.time_since_epoch())};
+  }
+
+private:
+  /**
+   * Return the calibration, calibrating on first call.
+   */
+  static const detail::tsc_calibration& calibration() noexcept
+  {
+    static const auto cal = make_calibration();
+    return cal;
+  }
+
+  /**
+   * Convert a TSC reading to a time point.
+   *
+   * @param cal TSC calibration
+   * @param ticks TSC reading
+   */
+  static time_point from_ticks(
+    const detail::tsc_calibration& cal, std::uint64_t ticks) noexcept
+  {
+    // readings from before calibration, e.g. on another core, are clamped
+    auto delta = (ticks > cal.base_ticks) ? ticks - cal.base_ticks : 0U;
+    return time_point{
+      duration{cal.base_ns + static_cast<rep>(detail::mul_shift32(delta, cal.mult))}
+    };
+  }
+
+#if defined(PDNNET_HAS_TSC)
+  /**
+   * Read the TSC together with the steady clock.
+   *
+   * The TSC is read between two steady clock readings and matched with their
+   * midpoint. The tightest of a few attempts is used to limit the error from
+   * being preempted between readings.
+   *
+   * @param ticks TSC reading
+   * @param ns Matching steady clock nanoseconds since its epoch
+   */
+  static void read_pair(std::uint64_t& ticks, std::int64_t& ns) noexcept
+  {
+    using std::chrono::nanoseconds;
+    using std::chrono::steady_clock;
+    auto best = INT64_MAX;
+    for (int i = 0; i < 8; i++) {
+      auto before = nanoseconds{steady_clock::now().time_since_epoch()}.count();
+      auto t = __rdtsc();
+      auto after = nanoseconds{steady_clock::now().time_since_epoch()}.count();
+      if (after - before < best) {
+        best = after - before;
+        ticks = t;
+        ns = before + (after - before) / 2;
+      }
+    }
+  }
+#endif  // defined(PDNNET_HAS_TSC)
+
+  /**
+   * Calibrate the TSC against the steady clock.
+   *
+   * Returns a disabled calibration if there is no invariant TSC or if the
+   * measured frequency is implausible, e.g. under some hypervisors.
+   */
+  static detail::tsc_calibration make_calibration() noexcept
+  {
+    detail::tsc_calibration cal;
+#if defined(PDNNET_HAS_TSC)
+    if (!detail::invariant_tsc())
+      return cal;
+    std::uint64_t ticks0, ticks1;
+    std::int64_t ns0, ns1;
+    read_pair(ticks0, ns0);
+    // spin instead of sleeping so the core stays out of deep idle states
+    auto end = std::chrono::steady_clock::now() + tsc_calibration_time;
+    while (std::chrono::steady_clock::now() < end);
+    read_pair(ticks1, ns1);
+    if (ticks1 <= ticks0 || ns1 <= ns0)
+      return cal;
+    auto frequency = 1e9 * static_cast<double>(ticks1 - ticks0) / (ns1 - ns0);
+    // reject anything outside 100 MHz to 100 GHz
+    if (frequency < 1e8 || frequency > 1e11)
+      return cal;
+    cal.enabled = true;
+    cal.base_ticks = ticks0;
+    cal.base_ns = ns0;
+    cal.mult = static_cast<std::uint64_t>(4294967296. * 1e9 / frequency);
+    cal.frequency = frequency;
+#endif  // defined(PDNNET_HAS_TSC)
+    return cal;
+  }
+};
+
+}  // namespace pdnnet
+
+#endif  // PDNNET_TSC_CLOCK_HH_
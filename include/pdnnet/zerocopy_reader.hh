@@ -0,0 +1,278 @@
+/**
+ * @file zerocopy_reader.hh
+ * @author Derek Huang
+ * @brief C++ header for zero-copy TCP receives
+ * @copyright MIT License
+ */
+
+#ifndef PDNNET_ZEROCOPY_READER_HH_
+#define PDNNET_ZEROCOPY_READER_HH_
+
+#include "pdnnet/platform.h"
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif  // WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#include <WinSock2.h>
+#else
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif  // !defined(_WIN32)
+
+#ifdef PDNNET_LINUX
+#include <sys/mman.h>
+#endif  // PDNNET_LINUX
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "pdnnet/error.hh"
+#include "pdnnet/memory.hh"
+#include "pdnnet/socket.hh"
+
+// TCP_ZEROCOPY_RECEIVE is Linux 4.18+ and needs glibc's tcp_zerocopy_receive
+#if defined(PDNNET_LINUX) && defined(TCP_ZEROCOPY_RECEIVE)
+#define PDNNET_HAS_TCP_ZEROCOPY_RECEIVE
+#endif  // !defined(PDNNET_LINUX) || !defined(TCP_ZEROCOPY_RECEIVE)
+
+/**
+ * Default size of the region received pages are mapped into.
+ */
+#ifndef PDNNET_ZEROCOPY_MAP_SIZE
+#define PDNNET_ZEROCOPY_MAP_SIZE 2097152U
+#endif  // PDNNET_ZEROCOPY_MAP_SIZE
+
+namespace pdnnet {
+
+/**
+ * Default size of the region received pages are mapped into.
+ */
+inline constexpr std::size_t zerocopy_map_size = PDNNET_ZEROCOPY_MAP_SIZE;
+
+/**
+ * Socket reader returning received bytes as spans without copying them.
+ *
+ * On Linux, `getsockopt` with `TCP_ZEROCOPY_RECEIVE` maps pages of received
+ * data into a page-aligned region mapped from the socket, so bulk transfers
+ * are not copied out of the kernel. Only whole pages of payload can be
+ * mapped, so mapping is effective when the sender's segments carry payloads
+ * that are multiples of the page size, e.g. with a 4096-byte MSS. Bytes that
+ * cannot be mapped, e.g. the unaligned remainder of a segment, are copied
+ * into a buffer as usual. Elsewhere, or if the kernel does not support
+ * zero-copy receives for the socket, all bytes are copied.
+ *
+ * Each span is only valid until the next call to `next()`, after which its
+ * pages are released back to the kernel, e.g.
+ *
+ * @code{.cc}
+ * pdnnet::zerocopy_reader reader{socket};
+ * pdnnet::byte_span span;
+ * do {
+ *   reader.next(span).throw_on_error();
+ *   consume(span.data, span.size);
+ * }
+ * while (!reader.eof());
+ * @endcode
+ *
+ * @note The mapping holds a reference to the socket, so the connection is not
+ *  released until the reader is also destroyed.
+ */
+class zerocopy_reader {
+public:
+  /**
+   * Ctor.
+   *
+   * The map size is rounded up to a whole number of pages.
+   *
+   * @param handle Socket handle
+   * @param map_size Bytes to map per receive, zero to always copy
+   * @param poll_timeout Timeout to use when polling socket for input
+   */
+  zerocopy_reader(
+    socket_handle handle,
+    std::size_t map_size = zerocopy_map_size,
+    std::chrono::milliseconds poll_timeout = infinite_poll_timeout)
+    : handle_{handle},
+      map_{},
+      map_size_{},
+      n_released_{},
+      copy_buf_{std::make_unique<byte[]>(socket_read_size)},
+      poll_timeout_{poll_timeout},
+      eof_{},
+      n_mapped_{},
+      n_copied_{}
+  {
+#if defined(PDNNET_HAS_TCP_ZEROCOPY_RECEIVE)
+    if (!map_size)
+      return;
+    auto page_size = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+    // mapped length is a 32-bit field
+    map_size = (std::min)(map_size, std::size_t{UINT32_MAX} / page_size * page_size);
+    map_size_ = (map_size + page_size - 1) / page_size * page_size;
+    // not every socket can be mapped, e.g. without kernel support
+    auto map = ::mmap(nullptr, map_size_, PROT_READ, MAP_SHARED, handle_, 0);
+    if (map == MAP_FAILED)
+      map_size_ = 0;
+    else
+      map_ = map;
+#else
+    (void) map_size;
+#endif  // !defined(PDNNET_HAS_TCP_ZEROCOPY_RECEIVE)
+  }
+
+  /**
+   * Deleted copy ctor.
+   */
+  zerocopy_reader(const zerocopy_reader&) = delete;
+
+  /**
+   * Dtor.
+   *
+   * Unmaps the receive region.
+   */
+  ~zerocopy_reader()
+  {
+    unmap();
+  }
+
+  /**
+   * Return `true` if received pages are being mapped instead of copied.
+   */
+  bool zerocopy() const noexcept { return map_; }
+
+  /**
+   * Return number of bytes in the region received pages are mapped into.
+   */
+  auto map_size() const noexcept { return map_size_; }
+
+  /**
+   * Return `true` if the peer has ended transmission.
+   */
+  auto eof() const noexcept { return eof_; }
+
+  /**
+   * Return number of bytes received by mapping pages.
+   */
+  auto n_mapped() const noexcept { return n_mapped_; }
+
+  /**
+   * Return number of bytes received by copying.
+   */
+  auto n_copied() const noexcept { return n_copied_; }
+
+  /**
+   * Receive the next span of bytes.
+   *
+   * Blocks until input is available or the poll timeout elapses. The span is
+   * empty on timeout or at end of transmission, which sets `eof()`. Bytes of
+   * the previous span must not be accessed after this call.
+   *
+   * @param span Span to point at received bytes
+   * @returns Optional empty on success, with error message on failure
+   */
+  optional_error next(byte_span& span)
+  {
+    span = {};
+    release();
+    if (eof_ || !wait_pollin(handle_, poll_timeout_))
+      return {};
+    auto n_copy = socket_read_size;
+#if defined(PDNNET_HAS_TCP_ZEROCOPY_RECEIVE)
+    if (map_) {
+      tcp_zerocopy_receive zc{};
+      zc.address = reinterpret_cast<std::uintptr_t>(map_);
+      zc.length = static_cast<std::uint32_t>(map_size_);
+      socklen_t len = sizeof zc;
+      if (::getsockopt(handle_, IPPROTO_TCP, TCP_ZEROCOPY_RECEIVE, &zc, &len)) {
+        // unsupported, e.g. on older kernels, so copy from now on. other
+        // errors, e.g. EIO at end of transmission, are reported by recv
+        if (errno == ENOPROTOOPT || errno == EOPNOTSUPP || errno == EINVAL)
+          unmap();
+      }
+      else if (zc.length) {
+        n_released_ = zc.length;
+        n_mapped_ += zc.length;
+        span = {static_cast<const byte*>(map_), zc.length};
+        return {};
+      }
+      // copy the bytes preceding the next mappable page
+      else if (zc.recv_skip_hint)
+        n_copy = (std::min)(n_copy, std::size_t{zc.recv_skip_hint});
+    }
+#endif  // defined(PDNNET_HAS_TCP_ZEROCOPY_RECEIVE)
+#if defined(_WIN32)
+    auto n_read = ::recv(
+      handle_, reinterpret_cast<char*>(copy_buf_.get()), static_cast<int>(n_copy), 0
+    );
+    if (n_read == SOCKET_ERROR)
+      return winsock_error("recv() failure");
+#else
+    ssize_type n_read;
+    do {
+      n_read = ::recv(handle_, copy_buf_.get(), n_copy, 0);
+    }
+    while (n_read < 0 && errno == EINTR);
+    if (n_read < 0)
+      return errno_error("recv() failure");
+#endif  // !defined(_WIN32)
+    if (!n_read)
+      eof_ = true;
+    n_copied_ += static_cast<std::size_t>(n_read);
+    span = {copy_buf_.get(), static_cast<std::size_t>(n_read)};
+    return {};
+  }
+
+private:
+  socket_handle handle_;
+  void* map_;
+  std::size_t map_size_;
+  // mapped bytes of the last span, released on the next receive
+  std::size_t n_released_;
+  std::unique_ptr<byte[]> copy_buf_;
+  std::chrono::milliseconds poll_timeout_;
+  bool eof_;
+  std::size_t n_mapped_;
+  std::size_t n_copied_;
+
+  /**
+   * Release the pages mapped for the last span.
+   *
+   * The next receive would also do this, but doing it eagerly is cheaper.
+   */
+  void release() noexcept
+  {
+#if defined(PDNNET_HAS_TCP_ZEROCOPY_RECEIVE)
+    if (n_released_)
+      ::madvise(map_, n_released_, MADV_DONTNEED);
+#endif  // defined(PDNNET_HAS_TCP_ZEROCOPY_RECEIVE)
+    n_released_ = 0;
+  }
+
+  /**
+   * Unmap the receive region so all further bytes are copied.
+   */
+  void unmap() noexcept
+  {
+#if defined(PDNNET_HAS_TCP_ZEROCOPY_RECEIVE)
+    if (map_)
+      ::munmap(map_, map_size_);
+#endif  // defined(PDNNET_HAS_TCP_ZEROCOPY_RECEIVE)
+    map_ = nullptr;
+    map_size_ = 0;
+    n_released_ = 0;
+  }
+};
+
+}  // namespace pdnnet
+
+#endif  // PDNNET_ZEROCOPY_READER_HH_
@@ -16,8 +16,11 @@
 #include <sys/types.h>
 #endif  // !defined(_WIN32)
 
+#include <chrono>
 #include <cstdlib>
 #include <iostream>
+#include <sstream>
+#include <string>
 
 #define PDNNET_HAS_PROGRAM_USAGE
 #define PDNNET_ADD_CLIOPT_HOST
@@ -28,6 +31,7 @@
 
 #include "pdnnet/client.hh"
 #include "pdnnet/cliopt.h"
+#include "pdnnet/deadline.hh"
 #include "pdnnet/error.hh"
 #include "pdnnet/features.h"
 #include "pdnnet/socket.hh"
@@ -36,29 +40,34 @@ PDNNET_PROGRAM_USAGE_DEF
 (
   "Simple ackserver++ client that sends a message and expects a response.\n"
   "\n"
-  "An improved C++ version of the original ackclient program."
+  "An improved C++ version of the original ackclient program.\n"
+  "\n"
+  "The timeout bounds connecting, writing, and reading the response together."
 )
 
 PDNNET_ARG_MAIN
 {
   PDNNET_CLIOPT_PARSE_OPTIONS();
+  // read message from stdin first so waiting on input is not counted
+  std::stringstream message;
+  for (std::string line; std::getline(std::cin, line) && !std::cin.eof(); )
+    message << line << '\n';
+  // single deadline bounding connect, write, and read together
+  pdnnet::deadline deadline{std::chrono::milliseconds{PDNNET_CLIOPT(timeout)}};
   // create IPv4 TCP/IP client + attempt connection
   pdnnet::ipv4_client client{};
-  client.connect(PDNNET_CLIOPT(host), PDNNET_CLIOPT(port)).exit_on_error();
-  // read from stdin and write to socket
-  std::cin >> pdnnet::client_writer{client};
-  // block until response is detected
-  if (!pdnnet::wait_pollin(client.socket(), PDNNET_CLIOPT(timeout))) {
-    std::cerr << "Error: Operation timed out after " <<
-      PDNNET_CLIOPT(timeout) << " ms" << std::endl;
-    return EXIT_FAILURE;
-  }
+  client.connect(PDNNET_CLIOPT(host), PDNNET_CLIOPT(port), deadline)
+    .exit_on_error();
+  // write message to socket
+  pdnnet::write(client.socket(), message.str(), deadline).exit_on_error();
+  // read until server closes the connection
+  std::string response;
+  pdnnet::read(client.socket(), response, deadline).exit_on_error();
   // print identifying header like original ackclient. we flush instead of
   // using std::endl since we don't want newline
   std::cout << PDNNET_PROGRAM_NAME << ": Received from " <<
     client.host_name() << ": " << std::flush;
-  // read from socket until nothing left to read and write to output stream,
-  // include trailing newline. socket is fully closed on exit
-  std::cout << pdnnet::client_reader{client} << std::endl;
+  // write response to output stream, include trailing newline
+  std::cout << response << std::endl;
   return EXIT_SUCCESS;
 }
@@ -59,16 +59,16 @@ PDNNET_PROGRAM_USAGE_DEF
 )
 
 /**
- * Used by the `pdnnet_socket_onlread` call to print the client message chunks.
+ * Used by the `pdnnet_socket_onlmsg` call to print each client message line.
  *
  * @note This function uses `PDNNET_PROGRAM_NAME` and so should not be called
  *  on its own without calling `PDNNET_CLIOPT_PARSE_OPTIONS` first in `main`.
  */
 static
-PDNNET_SOCKET_ONLREAD_FUNC(print_client_msg)
+PDNNET_SOCKET_ONLMSG_FUNC(print_client_line)
 {
-  // for first chunk, print header with client address if possible
-  if (state->n_reads == 1)
+  // for first line, print header with client address if possible
+  if (state->n_msgs == 1)
 #ifdef PDNNET_BSD_DEFAULT_SOURCE
     printf(
       "%s: Received from %s: ",
@@ -78,8 +78,8 @@ PDNNET_SOCKET_ONLREAD_FUNC(print_client_msg)
 #else
     printf("%s: Received from [unknown]: ", PDNNET_PROGRAM_NAME);
 #endif  // PDNNET_BSD_DEFAULT_SOURCE
-  // print actual message content
-  printf("%s", (const char *) state->msg_buf);
+  // print line content, restoring the newline delimiter
+  printf("%s\n", (const char *) state->msg);
   return 0;
 }
 
@@ -101,25 +101,28 @@ handle_client(int cli_sock, const struct sockaddr_in *cli_addr)
     return -EINVAL;
   // static buffer for acknowledgment message
   static const char ack_buf[] = "Acknowledged message received";
-  // action to perform while reading client messages. if verbose, will just
-  // print, otherwise nothing will be done
-  pdnnet_socket_onlread_func read_action;
-  read_action = (PDNNET_CLIOPT(verbose)) ? print_client_msg : NULL;
-  // read client message and print each received chunk if running verbosely
-  if (
-    pdnnet_socket_onlread_s(
+  // if verbose, read client message line by line and print each line,
+  // otherwise just read until end of transmission
+  static const pdnnet_socket_msg_format line_format = {
+    PDNNET_SOCKET_MSG_DELIM, '\n', 0
+  };
+  int status;
+  if (PDNNET_CLIOPT(verbose))
+    status = pdnnet_socket_onlmsg(
       cli_sock,
       PDNNET_CLIOPT(message_bytes),
-      read_action,
-      (void *) cli_addr  // not modified by print_client_msg
-    ) < 0
-  ) {
+      &line_format,
+      print_client_line,
+      (void *) cli_addr  // not modified by print_client_line
+    );
+  else
+    status = pdnnet_socket_onlread_s(
+      cli_sock, PDNNET_CLIOPT(message_bytes), NULL, NULL
+    );
+  if (status < 0) {
     PDNNET_ERRNO_RETURN(shutdown(cli_sock, SHUT_RDWR));
-    return -errno;
+    return status;
   }
-  // trailing newline to finish off
-  if (PDNNET_CLIOPT(verbose))
-    puts("");
   // send acknowledgment + shutdown completely to end transmission
   PDNNET_ERRNO_RETURN(write(cli_sock, ack_buf, sizeof ack_buf - 1));
   PDNNET_ERRNO_RETURN(shutdown(cli_sock, SHUT_RDWR));
@@ -5,8 +5,11 @@
  * @copyright MIT License
  */
 
+#include <chrono>
 #include <cstdlib>
 #include <iostream>
+#include <sstream>
+#include <string>
 
 #define PDNNET_HAS_PROGRAM_USAGE
 #define PDNNET_ADD_CLIOPT_HOST
@@ -17,6 +20,7 @@
 
 #include "pdnnet/client.hh"
 #include "pdnnet/cliopt.h"
+#include "pdnnet/deadline.hh"
 #include "pdnnet/error.hh"
 #include "pdnnet/features.h"
 #include "pdnnet/socket.hh"
@@ -25,25 +29,30 @@ PDNNET_PROGRAM_USAGE_DEF
 (
   "Simple echoserver client that sends a message and expects a response.\n"
   "\n"
-  "The message is read from stdin and the server response is printed to stdout."
+  "The message is read from stdin and the server response is printed to stdout.\n"
+  "\n"
+  "The timeout bounds connecting, writing, and reading the response together."
 )
 
 PDNNET_ARG_MAIN
 {
   PDNNET_CLIOPT_PARSE_OPTIONS();
+  // read message from stdin first so waiting on input is not counted
+  std::stringstream message;
+  for (std::string line; std::getline(std::cin, line) && !std::cin.eof(); )
+    message << line << '\n';
+  // single deadline bounding connect, write, and read together
+  pdnnet::deadline deadline{std::chrono::milliseconds{PDNNET_CLIOPT(timeout)}};
   // create IPv4 TCP/IP client + attempt connection
   pdnnet::ipv4_client client{};
-  client.connect(PDNNET_CLIOPT(host), PDNNET_CLIOPT(port)).exit_on_error();
-  // read from stdin and write to socket
-  std::cin >> pdnnet::client_writer{client};
-  // block until server response is detected
-  if (!pdnnet::wait_pollin(client.socket(), PDNNET_CLIOPT(timeout))) {
-    std::cerr << "Error: Operation timed out after " <<
-      PDNNET_CLIOPT(timeout) << " ms " << std::endl;
-    return EXIT_FAILURE;
-  }
-  // read from socket until end of transmission and write to output stream,
-  // include trailing newline. socket is fully closed on exit
-  std::cout << pdnnet::client_reader{client} << std::endl;
+  client.connect(PDNNET_CLIOPT(host), PDNNET_CLIOPT(port), deadline)
+    .exit_on_error();
+  // write message to socket
+  pdnnet::write(client.socket(), message.str(), deadline).exit_on_error();
+  // read until server closes the connection
+  std::string response;
+  pdnnet::read(client.socket(), response, deadline).exit_on_error();
+  // write response to output stream, include trailing newline
+  std::cout << response << std::endl;
   return EXIT_SUCCESS;
 }
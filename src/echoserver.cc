@@ -12,6 +12,7 @@
 #define PDNNET_HAS_PROGRAM_USAGE
 #define PDNNET_ADD_CLIOPT_PORT
 #define PDNNET_ADD_CLIOPT_MAX_CONNECT
+#include "pdnnet/activation.hh"
 #include "pdnnet/cliopt.h"
 #include "pdnnet/echoserver.hh"
 #include "pdnnet/process.hh"
@@ -38,12 +39,17 @@ PDNNET_PROGRAM_USAGE_DEF
   "sends the same data back. Client is expected to signal end of tranmission\n"
   "after writing with a call to shutdown() or pdnnet::shutdown().\n"
   "\n"
+  "If a listening socket is passed using LISTEN_FDS/LISTEN_PID, e.g. by a\n"
+  "supervisor doing socket activation, it is used instead of the port.\n"
+  "\n"
   EXEC_NOTE
 )
 
 PDNNET_ARG_MAIN
 {
   PDNNET_CLIOPT_PARSE_OPTIONS();
+  // take any sockets passed by socket activation before LISTEN_PID changes
+  auto activated = pdnnet::listen_fds(true);
   // run in background as daemon on *nix
 #if defined(_WIN32)
   // don't use FreeConsole otherwise you cannot interact with the console.
@@ -58,11 +64,14 @@ PDNNET_ARG_MAIN
   // start server in new thread with given parameters. we need to do this so we
   // can print the state of the running server from the current thread
   std::thread server_thread{
-    [&server]
+    [&server, &activated]
     {
       auto params = pdnnet::server_params{}
           .port(PDNNET_CLIOPT(port))
           .max_pending(PDNNET_CLIOPT(max_connect));
+      // listen on the activated socket instead of binding the port
+      if (activated.size())
+        params.listen_handle(activated.front());
       server.start(params);
     }
   };
@@ -24,6 +24,7 @@
 
 #include <errno.h>
 #include <limits.h>  // note: only INT_MAX used when _WIN32 defined
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -185,3 +186,190 @@ pdnnet_socket_fwrite_s(
     (void *) f
   );
 }
+
+/**
+ * Invoke the message action on a message in the read buffer.
+ *
+ * The byte following the message is temporarily replaced with a null
+ * terminator so the message can be treated as a string by the action.
+ *
+ * @param state Message read state to update
+ * @param msg First message byte
+ * @param msg_size Number of message bytes
+ * @param msg_action Function to invoke for the message
+ * @param msg_action_param Parameter to pass to `msg_action`
+ * @returns 0 on success, negative value returned by `msg_action` on error
+ */
+static int
+pdnnet_socket_onlmsg_deliver(
+  PDNNET_SA(In_Out) pdnnet_socket_msg_state *state,
+  PDNNET_SA(In_Out) unsigned char *msg,
+  size_t msg_size,
+  PDNNET_SA(Opt(In)) pdnnet_socket_onlmsg_func msg_action,
+  PDNNET_SA(Opt(In_Out)) void *msg_action_param)
+{
+  int status = 0;
+  unsigned char next = msg[msg_size];
+  state->msg = msg;
+  state->msg_size = msg_size;
+  state->n_msgs += 1;
+  if (msg_action) {
+    msg[msg_size] = '\0';
+    status = msg_action(state, msg_action_param);
+    msg[msg_size] = next;
+  }
+  return (status < 0) ? status : 0;
+}
+
+int
+pdnnet_socket_onlmsg(
+  pdnnet_socket sockfd,
+  size_t read_size,
+  PDNNET_SA(In) const pdnnet_socket_msg_format *format,
+  PDNNET_SA(Opt(In)) pdnnet_socket_onlmsg_func msg_action,
+  PDNNET_SA(Opt(In_Out)) void *msg_action_param)
+{
+  if (!read_size || !format)
+    return -EINVAL;
+  if (
+    format->type != PDNNET_SOCKET_MSG_DELIM &&
+    format->type != PDNNET_SOCKET_MSG_PREFIX
+  )
+    return -EINVAL;
+  // return status
+  int status = 0;
+  // buffered bytes are [begin, end), scan is how many bytes past begin were
+  // already searched for a delimiter, need is the number of bytes past begin
+  // the next message requires, or zero if unknown
+  size_t begin = 0, end = 0, scan = 0, need = 0;
+  // number of bytes last read
+  pdnnet_ssize_t n_read;
+  // message state struct
+  pdnnet_socket_msg_state ms;
+  ms.sockfd = sockfd;
+  ms.msg = NULL;
+  ms.msg_size = 0;
+  ms.buf_size = read_size;
+  ms.n_msgs = ms.n_reads = ms.n_read_total = 0;
+  // allocated buffer has an extra byte so messages can be null-terminated
+  unsigned char *buf = malloc(read_size + 1);
+  if (!buf)
+    return -ENOMEM;
+  // until client signals end of transmission
+  while (true) {
+    // deliver all complete messages in the buffer
+    while (true) {
+      size_t avail = end - begin;
+      if (format->type == PDNNET_SOCKET_MSG_PREFIX) {
+        if (avail < 4) {
+          need = 4;
+          break;
+        }
+        const unsigned char *p = buf + begin;
+        size_t msg_size = ((size_t) p[0] << 24) | ((size_t) p[1] << 16) |
+          ((size_t) p[2] << 8) | (size_t) p[3];
+        if (
+          (format->max_msg_size && msg_size > format->max_msg_size) ||
+          msg_size > SIZE_MAX - 5
+        ) {
+          status = -EMSGSIZE;
+          goto end;
+        }
+        if (avail < 4 + msg_size) {
+          need = 4 + msg_size;
+          break;
+        }
+        if (
+          (
+            status = pdnnet_socket_onlmsg_deliver(
+              &ms, buf + begin + 4, msg_size, msg_action, msg_action_param
+            )
+          ) < 0
+        )
+          goto end;
+        begin += 4 + msg_size;
+      }
+      else {
+        unsigned char *p = memchr(buf + begin + scan, format->delim, avail - scan);
+        if (!p) {
+          scan = avail;
+          if (format->max_msg_size && avail > format->max_msg_size) {
+            status = -EMSGSIZE;
+            goto end;
+          }
+          need = avail + 1;
+          break;
+        }
+        size_t msg_size = (size_t) (p - (buf + begin));
+        if (
+          (
+            status = pdnnet_socket_onlmsg_deliver(
+              &ms, buf + begin, msg_size, msg_action, msg_action_param
+            )
+          ) < 0
+        )
+          goto end;
+        begin += msg_size + 1;
+        scan = 0;
+      }
+    }
+    // everything consumed, so reuse buffer from the start without copying
+    if (begin == end)
+      begin = end = 0;
+    // no room left to read into. move partial message to the front and only
+    // grow geometrically if the partial message fills the whole buffer
+    if (end == ms.buf_size) {
+      if (begin) {
+        memmove(buf, buf + begin, end - begin);
+        end -= begin;
+        begin = 0;
+      }
+      if (end == ms.buf_size) {
+        size_t new_size = (ms.buf_size > SIZE_MAX / 2 - 1) ?
+          SIZE_MAX - 1 : 2 * ms.buf_size;
+        if (new_size < need)
+          new_size = need;
+        unsigned char *new_buf = realloc(buf, new_size + 1);
+        if (!new_buf) {
+          status = -ENOMEM;
+          goto end;
+        }
+        buf = new_buf;
+        ms.buf_size = new_size;
+      }
+    }
+    // read as much as fits after the buffered bytes
+    size_t n_free = ms.buf_size - end;
+#if defined(_WIN32)
+    if (n_free > INT_MAX)
+      n_free = INT_MAX;
+    if ((n_read = recv(sockfd, (char *) buf + end, (int) n_free, 0)) == SOCKET_ERROR) {
+      status = -WSAGetLastError();
+      goto end;
+    }
+#else
+    if ((n_read = read(sockfd, buf + end, n_free)) < 0) {
+      status = -errno;
+      goto end;
+    }
+#endif  // !defined(_WIN32)
+    ms.n_reads += 1;
+    ms.n_read_total += n_read;
+    // end of transmission
+    if (!n_read)
+      break;
+    end += n_read;
+  }
+  // handle any trailing partial message
+  if (end > begin) {
+    if (format->type == PDNNET_SOCKET_MSG_PREFIX)
+      status = -EBADMSG;
+    else
+      status = pdnnet_socket_onlmsg_deliver(
+        &ms, buf + begin, end - begin, msg_action, msg_action_param
+      );
+  }
+end:
+  free(buf);
+  return status;
+}
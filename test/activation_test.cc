@@ -0,0 +1,198 @@
+/**
+ * @file activation_test.cc
+ * @author Derek Huang
+ * @brief activation.hh unit tests
+ * @copyright MIT License
+ */
+
+#include "pdnnet/activation.hh"
+
+#include <chrono>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "pdnnet/echoserver.hh"
+#include "pdnnet/platform.h"
+#include "pdnnet/server.hh"
+#include "pdnnet/socket.hh"
+
+#include "loopback.hh"
+
+namespace {
+
+#ifdef PDNNET_UNIX
+/**
+ * Socket activation testing fixture.
+ *
+ * Plays the part of the supervisor by opening a loopback listening socket.
+ */
+class ActivationTest : public ::testing::Test {
+protected:
+  /**
+   * Open the listening socket and clear any activation variables.
+   */
+  void SetUp() override
+  {
+    clear_env();
+    listener_ = pdnnet::test::loopback_listener(addr_, 8U);
+  }
+
+  /**
+   * Clear activation variables and restore the first activation descriptor.
+   */
+  void TearDown() override
+  {
+    clear_env();
+    if (saved_fd_ >= 0) {
+      dup2(saved_fd_, pdnnet::listen_fds_start);
+      close(saved_fd_);
+    }
+    else if (passed_)
+      close(pdnnet::listen_fds_start);
+  }
+
+  /**
+   * Unset the activation variables.
+   */
+  static void clear_env()
+  {
+    unsetenv("LISTEN_PID");
+    unsetenv("LISTEN_FDS");
+  }
+
+  /**
+   * Pass the listening socket as the first activation descriptor.
+   *
+   * Whatever is open at that descriptor is saved and restored on teardown.
+   */
+  void pass_listener()
+  {
+    if (fcntl(pdnnet::listen_fds_start, F_GETFD) >= 0)
+      saved_fd_ = fcntl(pdnnet::listen_fds_start, F_DUPFD_CLOEXEC, 0);
+    ASSERT_EQ(
+      pdnnet::listen_fds_start, dup2(listener_, pdnnet::listen_fds_start)
+    ) << pdnnet::errno_error();
+    passed_ = true;
+    setenv("LISTEN_PID", std::to_string(getpid()).c_str(), true);
+    setenv("LISTEN_FDS", "1", true);
+  }
+
+  /**
+   * Connect to the listening socket.
+   */
+  auto connect() const
+  {
+    pdnnet::unique_socket socket{AF_INET, SOCK_STREAM};
+    if (!pdnnet::connect(socket, addr_))
+      throw std::runtime_error{pdnnet::socket_error("Could not connect")};
+    return socket;
+  }
+
+  pdnnet::unique_socket listener_;
+  sockaddr_in addr_;
+  int saved_fd_{-1};
+  bool passed_{};
+};
+
+/**
+ * Server replying to each client with a fixed message.
+ */
+class reply_server : public pdnnet::ipv4_server {
+protected:
+  bool serve(pdnnet::unique_socket& cli_socket) override
+  {
+    return !pdnnet::socket_writer{cli_socket}("ok");
+  }
+};
+
+/**
+ * Test that only sockets meant for this process are returned.
+ */
+TEST_F(ActivationTest, EnvTest)
+{
+  EXPECT_TRUE(pdnnet::listen_fds().empty());
+  setenv("LISTEN_PID", std::to_string(getpid() + 1).c_str(), true);
+  setenv("LISTEN_FDS", "1", true);
+  EXPECT_TRUE(pdnnet::listen_fds().empty());
+  setenv("LISTEN_FDS", "one", true);
+  EXPECT_THROW(pdnnet::listen_fds(), std::runtime_error);
+  // unsetting the environment leaves nothing for child processes
+  setenv("LISTEN_FDS", "1", true);
+  pdnnet::listen_fds(true);
+  EXPECT_EQ(nullptr, std::getenv("LISTEN_PID"));
+  EXPECT_EQ(nullptr, std::getenv("LISTEN_FDS"));
+  // without activation the server binds its port as usual
+  pdnnet::server_params params;
+  EXPECT_EQ(pdnnet::bad_socket_handle, params.socket_activation().listen_handle());
+}
+
+/**
+ * Test that a server adopts an activated socket across restarts.
+ */
+TEST_F(ActivationTest, RestartTest)
+{
+  pass_listener();
+  auto handles = pdnnet::listen_fds();
+  ASSERT_EQ(1U, handles.size());
+  EXPECT_EQ(pdnnet::listen_fds_start, handles[0]);
+  auto params = pdnnet::server_params{}.socket_activation();
+  ASSERT_EQ(pdnnet::listen_fds_start, params.listen_handle());
+  {
+    reply_server server;
+    server.start(params, true);
+    while (!server.running())
+      std::this_thread::yield();
+    EXPECT_EQ(ntohs(addr_.sin_port), server.port());
+    auto client = connect();
+    EXPECT_EQ("ok", pdnnet::read(client, std::chrono::milliseconds{1000}));
+    server.stop();
+    server.join();
+  }
+  // connections queue instead of being refused while no server runs
+  auto queued = connect();
+  reply_server server;
+  server.start(params, true);
+  EXPECT_EQ("ok", pdnnet::read(queued, std::chrono::milliseconds{1000}));
+  server.stop();
+  server.join();
+}
+
+/**
+ * Test that the echo server serves on an adopted socket.
+ */
+TEST_F(ActivationTest, EchoserverTest)
+{
+  pdnnet::echoserver server;
+  std::thread thread{
+    [this, &server] { server.start(pdnnet::server_params{}.listen_handle(listener_)); }
+  };
+  while (!server.running())
+    std::this_thread::yield();
+  EXPECT_EQ(ntohs(addr_.sin_port), server.port());
+  auto client = connect();
+  EXPECT_FALSE((pdnnet::socket_writer{client, true}("hello")));
+  EXPECT_EQ("hello", pdnnet::read(client, std::chrono::milliseconds{1000}));
+  server.stop();
+  thread.join();
+}
+
+/**
+ * Test that sockets that are not listening are rejected.
+ */
+TEST_F(ActivationTest, NotListeningTest)
+{
+  pdnnet::unique_socket socket{AF_INET, SOCK_STREAM};
+  sockaddr_in addr;
+  EXPECT_THROW(pdnnet::adopt_listener(socket, addr), std::runtime_error);
+  EXPECT_THROW(
+    reply_server{}.start(pdnnet::server_params{}.listen_handle(socket)),
+    std::runtime_error
+  );
+}
+#endif  // PDNNET_UNIX
+
+}  // namespace
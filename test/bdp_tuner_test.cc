@@ -0,0 +1,121 @@
+/**
+ * @file bdp_tuner_test.cc
+ * @author Derek Huang
+ * @brief bdp_tuner.hh unit tests
+ * @copyright MIT License
+ */
+
+#include "pdnnet/bdp_tuner.hh"
+
+#include <chrono>
+#include <cstddef>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <tuple>
+
+#include <gtest/gtest.h>
+
+#include "pdnnet/platform.h"
+#include "pdnnet/socket.hh"
+
+#include "loopback.hh"
+
+namespace {
+
+/**
+ * `bdp_tuner` testing fixture.
+ *
+ * Creates a connected pair of loopback TCP sockets for each test.
+ */
+class BdpTunerTest : public ::testing::Test {
+protected:
+  /**
+   * Connect the loopback socket pair.
+   */
+  void SetUp() override
+  {
+    std::tie(writer_socket_, reader_socket_) = pdnnet::test::loopback_pair();
+  }
+
+  /**
+   * Write the given data and close the writer end on a separate thread.
+   *
+   * @param data Data to write
+   */
+  std::thread write_async(const std::string& data)
+  {
+    return std::thread{
+      [this, &data]
+      {
+        pdnnet::socket_writer writer{writer_socket_, true};
+        writer(data).throw_on_error();
+      }
+    };
+  }
+
+  pdnnet::unique_socket writer_socket_;
+  pdnnet::unique_socket reader_socket_;
+};
+
+/**
+ * Test that resizing the reader chunk size does not change what is read.
+ */
+TEST_F(BdpTunerTest, ReaderResizeTest)
+{
+  std::string data(100000U, 'a');
+  for (std::size_t i = 0; i < data.size(); i++)
+    data[i] = static_cast<char>('a' + i % 26);
+  auto writer = write_async(data);
+  pdnnet::socket_reader reader{reader_socket_, 7U, std::chrono::milliseconds{1000}};
+  EXPECT_EQ(7U, reader.buf_size());
+  EXPECT_EQ(65536U, reader.buf_size(65536U).buf_size());
+  // shrinking reuses the existing buffer
+  EXPECT_EQ(4096U, reader.buf_size(4096U).buf_size());
+  std::stringstream received;
+  auto err = reader(received);
+  writer.join();
+  ASSERT_FALSE(err) << *err;
+  EXPECT_EQ(data, received.str());
+}
+
+/**
+ * Test that sampling a busy connection sets buffers within the caps.
+ */
+TEST_F(BdpTunerTest, SampleTest)
+{
+#if defined(PDNNET_LINUX)
+  pdnnet::bdp_tuner tuner;
+  tuner.min_buffer(128U * 1024U).max_buffer(1024U * 1024U).max_read_size(256U * 1024U);
+  // baseline sample before any data is sent
+  auto err = tuner.sample(writer_socket_);
+  ASSERT_FALSE(err) << *err;
+  std::string data(4U * 1024U * 1024U, 'x');
+  auto writer = write_async(data);
+  pdnnet::socket_reader reader{reader_socket_, 4096U, std::chrono::milliseconds{1000}};
+  std::stringstream received;
+  err = reader(received);
+  writer.join();
+  ASSERT_FALSE(err) << *err;
+  ASSERT_EQ(data.size(), received.str().size());
+  // bytes were acked so throughput and RTT are known
+  err = tuner.sample(writer_socket_);
+  ASSERT_FALSE(err) << *err;
+  EXPECT_EQ(2U, tuner.n_samples());
+  EXPECT_GT(tuner.throughput(), 0.);
+  EXPECT_GT(tuner.rtt().count(), 0);
+  EXPECT_GE(tuner.n_adjustments(), 1U);
+  EXPECT_GE(tuner.send_buffer(), tuner.min_buffer());
+  EXPECT_LE(tuner.send_buffer(), tuner.max_buffer());
+  EXPECT_EQ(tuner.send_buffer(), tuner.recv_buffer());
+  EXPECT_LE(tuner.read_size(), tuner.max_read_size());
+  // kernel reports double the requested size
+  int size;
+  ASSERT_TRUE(pdnnet::send_buffer_size(writer_socket_, size)) << pdnnet::socket_error();
+  EXPECT_GE(static_cast<std::size_t>(size), tuner.send_buffer());
+#else
+  GTEST_SKIP() << "TCP_INFO not supported on this platform";
+#endif  // !defined(PDNNET_LINUX)
+}
+
+}  // namespace
@@ -0,0 +1,120 @@
+/**
+ * @file buffered_writer_test.cc
+ * @author Derek Huang
+ * @brief buffered_writer.hh unit tests
+ * @copyright MIT License
+ */
+
+#include "pdnnet/buffered_writer.hh"
+
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <utility>
+
+#include <gtest/gtest.h>
+
+#include "pdnnet/memory.hh"
+#include "pdnnet/socket.hh"
+
+#include "loopback.hh"
+
+namespace {
+
+/**
+ * `buffered_writer` testing fixture.
+ *
+ * Creates a connected pair of loopback TCP sockets for each test.
+ */
+class BufferedWriterTest : public ::testing::Test {
+protected:
+  /**
+   * Connect the loopback socket pair.
+   */
+  void SetUp() override
+  {
+    std::tie(writer_socket_, reader_socket_) = pdnnet::test::loopback_pair();
+  }
+
+  /**
+   * Close writer end and return everything received by the reader end.
+   */
+  std::string received()
+  {
+    pdnnet::shutdown(writer_socket_, pdnnet::shutdown_type::write);
+    return pdnnet::read(reader_socket_, std::chrono::milliseconds{1000});
+  }
+
+  pdnnet::unique_socket writer_socket_;
+  pdnnet::unique_socket reader_socket_;
+};
+
+/**
+ * Test that small writes are coalesced into a single send on flush.
+ */
+TEST_F(BufferedWriterTest, CoalesceTest)
+{
+  pdnnet::buffered_writer writer{writer_socket_};
+  ASSERT_FALSE(writer("status\r\n"));
+  ASSERT_FALSE(writer(std::string{"header\r\n\r\n"}));
+  ASSERT_FALSE(writer("body", 4U));
+  EXPECT_EQ(22U, writer.pending());
+  EXPECT_EQ(0U, writer.n_writes());
+  ASSERT_FALSE(writer.flush());
+  EXPECT_EQ(0U, writer.pending());
+  EXPECT_EQ(1U, writer.n_writes());
+  EXPECT_EQ("status\r\nheader\r\n\r\nbody", received());
+}
+
+/**
+ * Test that reaching the flush threshold sends the buffered bytes.
+ */
+TEST_F(BufferedWriterTest, ThresholdTest)
+{
+  pdnnet::buffer_pool pool{64U};
+  std::string text{"0123456789abcdefghij"};
+  {
+    pdnnet::buffered_writer writer{writer_socket_, 8U, pool};
+    EXPECT_EQ(8U, writer.flush_threshold());
+    ASSERT_FALSE(writer(text));
+    EXPECT_EQ(2U, writer.n_writes());
+    EXPECT_EQ(4U, writer.pending());
+  }
+  // buffer is returned to the pool on destruction
+  EXPECT_EQ(1U, pool.n_free());
+  EXPECT_EQ(text, received());
+}
+
+/**
+ * Test that a zero flush threshold throws without taking a pooled buffer.
+ */
+TEST_F(BufferedWriterTest, ZeroThresholdTest)
+{
+  pdnnet::buffer_pool pool{64U};
+  pool.release(pool.acquire());
+  ASSERT_EQ(1U, pool.n_free());
+  EXPECT_THROW(
+    (pdnnet::buffered_writer{writer_socket_, 0U, pool, true}),
+    std::invalid_argument
+  );
+  EXPECT_EQ(1U, pool.n_free());
+}
+
+/**
+ * Test that messages larger than the buffer are written directly.
+ */
+TEST_F(BufferedWriterTest, LargeWriteTest)
+{
+  pdnnet::buffer_pool pool{16U};
+  std::string text(100U, 'x');
+  {
+    pdnnet::buffered_writer writer{writer_socket_, pool};
+    ASSERT_FALSE(writer("abc"));
+    ASSERT_FALSE(writer(text));
+    EXPECT_EQ(0U, writer.pending());
+  }
+  EXPECT_EQ("abc" + text, received());
+}
+
+}  // namespace
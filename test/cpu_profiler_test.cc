@@ -0,0 +1,166 @@
+/**
+ * @file cpu_profiler_test.cc
+ * @author Derek Huang
+ * @brief cpu_profiler.hh unit tests
+ * @copyright MIT License
+ */
+
+#include "pdnnet/cpu_profiler.hh"
+
+#include <chrono>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "pdnnet/server.hh"
+#include "pdnnet/socket.hh"
+
+namespace {
+
+/**
+ * Busy loop on the calling thread until it has used the given CPU time.
+ *
+ * Spinning on CPU time instead of wall time keeps the CPU time consumed
+ * independent of how often the thread is preempted, e.g. under `ctest -j`.
+ *
+ * @param duration CPU time to spin for
+ */
+void spin(std::chrono::milliseconds duration)
+{
+  auto start = pdnnet::thread_cpu_time();
+  volatile unsigned long sink = 0;
+  while (pdnnet::thread_cpu_time() - start < duration)
+    sink = sink + 1;
+}
+
+/**
+ * Test that recorded calls land in the expected ratio buckets.
+ */
+TEST(CpuProfilerTest, RecordTest)
+{
+  using std::chrono::milliseconds;
+  pdnnet::cpu_profiler profiler;
+  auto id = profiler.handler("lookup");
+  EXPECT_EQ(id, profiler.handler("lookup"));
+  EXPECT_EQ(1U, profiler.n_handlers());
+  profiler.record(id, milliseconds{1}, milliseconds{10});
+  profiler.record(id, milliseconds{5}, milliseconds{10});
+  // CPU time can exceed wall time by clock granularity
+  profiler.record(id, milliseconds{11}, milliseconds{10});
+  auto profiles = profiler.snapshot();
+  ASSERT_EQ(1U, profiles.size());
+  const auto& p = profiles[0];
+  EXPECT_EQ("lookup", p.name);
+  EXPECT_EQ(3U, p.n_calls);
+  EXPECT_EQ(std::chrono::microseconds{17000}, p.cpu_time);
+  EXPECT_EQ(std::chrono::microseconds{30000}, p.wall_time);
+  EXPECT_EQ(1U, p.ratios[1]);
+  EXPECT_EQ(1U, p.ratios[5]);
+  EXPECT_EQ(1U, p.ratios[pdnnet::cpu_ratio_buckets - 1]);
+}
+
+/**
+ * Test that scopes tell compute-bound calls apart from waiting calls.
+ */
+TEST(CpuProfilerTest, ScopeTest)
+{
+  pdnnet::cpu_profiler profiler;
+  auto compute = profiler.handler("compute");
+  auto wait = profiler.handler("wait");
+  for (int i = 0; i < 3; i++) {
+    {
+      pdnnet::cpu_scope scope{&profiler, compute};
+      spin(std::chrono::milliseconds{20});
+    }
+    {
+      pdnnet::cpu_scope scope{&profiler, wait};
+      std::this_thread::sleep_for(std::chrono::milliseconds{20});
+    }
+  }
+  // null profiler records nothing
+  { pdnnet::cpu_scope scope{nullptr, compute}; }
+  auto profiles = profiler.snapshot();
+  ASSERT_EQ(2U, profiles.size());
+  EXPECT_EQ(3U, profiles[0].n_calls);
+  EXPECT_EQ(3U, profiles[1].n_calls);
+  // preemption lowers the compute ratio under load, but never its CPU time
+  EXPECT_GE(profiles[0].cpu_time, std::chrono::milliseconds{60});
+  EXPECT_GT(profiles[0].cpu_ratio(), profiles[1].cpu_ratio());
+  EXPECT_LT(profiles[1].cpu_ratio(), 0.5);
+  EXPECT_EQ(3U, profiles[1].ratios[0] + profiles[1].ratios[1]);
+  EXPECT_GE(profiles[1].wall_time, std::chrono::milliseconds{60});
+}
+
+/**
+ * Test that the report lists the most CPU-heavy handler first.
+ */
+TEST(CpuProfilerTest, ReportTest)
+{
+  using std::chrono::milliseconds;
+  pdnnet::cpu_profiler profiler;
+  profiler.record(profiler.handler("light"), milliseconds{1}, milliseconds{4});
+  profiler.record(profiler.handler("heavy"), milliseconds{8}, milliseconds{8});
+  std::ostringstream out;
+  profiler.report(out);
+  EXPECT_EQ(
+    "heavy: calls=1 cpu_ms=8.000 wall_ms=8.000 cpu_us/call=8000.000 "
+      "cpu/wall=1.000 ratios=[0 0 0 0 0 0 0 0 0 1]\n"
+    "light: calls=1 cpu_ms=1.000 wall_ms=4.000 cpu_us/call=1000.000 "
+      "cpu/wall=0.250 ratios=[0 0 1 0 0 0 0 0 0 0]\n",
+    out.str()
+  );
+}
+
+/**
+ * Test that registering too many handlers throws.
+ */
+TEST(CpuProfilerTest, CapacityTest)
+{
+  pdnnet::cpu_profiler profiler;
+  for (std::size_t i = 0; i < pdnnet::cpu_profiler_max_handlers; i++)
+    profiler.handler("route" + std::to_string(i));
+  EXPECT_THROW(profiler.handler("overflow"), std::runtime_error);
+  EXPECT_NO_THROW(profiler.handler("route0"));
+}
+
+/**
+ * Server that replies to each client after some computation.
+ */
+class compute_server : public pdnnet::ipv4_server {
+protected:
+  bool serve(pdnnet::unique_socket& cli_socket) override
+  {
+    spin(std::chrono::milliseconds{5});
+    return !pdnnet::socket_writer{cli_socket}("ok");
+  }
+};
+
+/**
+ * Test that a server attributes its serve calls to the profiler.
+ */
+TEST(CpuProfilerTest, ServerTest)
+{
+  pdnnet::cpu_profiler profiler;
+  compute_server server;
+  server.start(pdnnet::server_params{}.profiler(&profiler), true);
+  while (!server.running())
+    std::this_thread::yield();
+  auto addr = pdnnet::make_sockaddr_in(INADDR_LOOPBACK, server.port());
+  for (int i = 0; i < 3; i++) {
+    pdnnet::unique_socket client{AF_INET, SOCK_STREAM};
+    ASSERT_TRUE(pdnnet::connect(client, addr)) << pdnnet::socket_error();
+    EXPECT_EQ("ok", pdnnet::read(client, std::chrono::milliseconds{1000}));
+  }
+  server.stop();
+  server.join();
+  auto profiles = profiler.snapshot();
+  ASSERT_EQ(1U, profiles.size());
+  EXPECT_EQ("serve", profiles[0].name);
+  EXPECT_EQ(3U, profiles[0].n_calls);
+  EXPECT_GE(profiles[0].cpu_time, std::chrono::milliseconds{10});
+}
+
+}  // namespace
@@ -0,0 +1,87 @@
+/**
+ * @file crc32c_test.cc
+ * @author Derek Huang
+ * @brief crc32c.hh unit tests
+ * @copyright MIT License
+ */
+
+#include "pdnnet/crc32c.hh"
+
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace {
+
+/**
+ * Return a buffer of random bytes.
+ *
+ * @param size Number of bytes
+ */
+auto random_bytes(std::size_t size)
+{
+  std::vector<unsigned char> bytes(size);
+  std::mt19937 gen{8888};
+  std::uniform_int_distribution<int> dist{0, 255};
+  for (auto& byte : bytes)
+    byte = static_cast<unsigned char>(dist(gen));
+  return bytes;
+}
+
+/**
+ * Test CRC32C against known check values.
+ */
+TEST(Crc32cTest, CheckValueTest)
+{
+  std::string check{"123456789"};
+  EXPECT_EQ(0xE3069283U, pdnnet::crc32c(check.data(), check.size()));
+  EXPECT_EQ(0xE3069283U, pdnnet::crc32c_table(check.data(), check.size()));
+  // 32 zero bytes, from RFC 3720 appendix B.4
+  std::vector<unsigned char> zeros(32U);
+  EXPECT_EQ(0x8A9136AAU, pdnnet::crc32c(zeros.data(), zeros.size()));
+  EXPECT_EQ(0U, pdnnet::crc32c(nullptr, 0));
+}
+
+/**
+ * Test that the dispatched and table versions agree for all sizes/alignments.
+ *
+ * Sizes cross the 3-way interleaving threshold so both hardware paths run.
+ */
+TEST(Crc32cTest, TableTest)
+{
+  auto bytes = random_bytes(4U * pdnnet::crc32c_block_size + 64U);
+  std::vector<std::size_t> sizes{
+    0U, 1U, 7U, 8U, 9U, 63U,
+    3U * pdnnet::crc32c_block_size - 1U,
+    3U * pdnnet::crc32c_block_size,
+    3U * pdnnet::crc32c_block_size + 13U,
+    4U * pdnnet::crc32c_block_size
+  };
+  for (auto size : sizes)
+    for (std::size_t offset = 0; offset < 8U; offset++)
+      EXPECT_EQ(
+        pdnnet::crc32c_table(bytes.data() + offset, size),
+        pdnnet::crc32c(bytes.data() + offset, size)
+      ) << "size=" << size << ", offset=" << offset;
+}
+
+/**
+ * Test incremental computation and combining of CRC32C values.
+ */
+TEST(Crc32cTest, CombineTest)
+{
+  auto bytes = random_bytes(10000U);
+  auto expected = pdnnet::crc32c(bytes.data(), bytes.size());
+  for (std::size_t split : {0U, 1U, 100U, 5000U, 9999U, 10000U}) {
+    auto crc1 = pdnnet::crc32c(bytes.data(), split);
+    auto crc2 = pdnnet::crc32c(bytes.data() + split, bytes.size() - split);
+    EXPECT_EQ(expected, pdnnet::crc32c(bytes.data() + split, bytes.size() - split, crc1));
+    EXPECT_EQ(expected, pdnnet::crc32c_combine(crc1, crc2, bytes.size() - split));
+  }
+}
+
+}  // namespace
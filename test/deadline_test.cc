@@ -0,0 +1,127 @@
+/**
+ * @file deadline_test.cc
+ * @author Derek Huang
+ * @brief deadline.hh unit tests
+ * @copyright MIT License
+ */
+
+#include "pdnnet/deadline.hh"
+
+#include <chrono>
+#include <string>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "pdnnet/client.hh"
+#include "pdnnet/socket.hh"
+
+#include "loopback.hh"
+
+namespace {
+
+/**
+ * `deadline` testing fixture.
+ *
+ * Creates a loopback TCP listener for each test.
+ */
+class DeadlineTest : public ::testing::Test {
+protected:
+  /**
+   * Create the loopback listener.
+   */
+  void SetUp() override
+  {
+    listener_ = pdnnet::test::loopback_listener(addr_);
+  }
+
+  pdnnet::unique_socket listener_;
+  sockaddr_in addr_;
+};
+
+/**
+ * Test that connect, write, and read all consume from one deadline.
+ */
+TEST_F(DeadlineTest, RoundTripTest)
+{
+  // server echoes the request in uppercase and closes
+  std::thread server{
+    [this]
+    {
+      auto socket = pdnnet::accept(listener_);
+      pdnnet::deadline deadline{std::chrono::milliseconds{5000}};
+      std::string request(5U, '\0');
+      pdnnet::read_exact(socket, request.data(), request.size(), deadline)
+        .throw_on_error();
+      for (auto& c : request)
+        c = static_cast<char>(c - 'a' + 'A');
+      pdnnet::write(socket, request, deadline).throw_on_error();
+    }
+  };
+  pdnnet::deadline deadline{std::chrono::milliseconds{5000}};
+  pdnnet::ipv4_client client;
+  auto err = client.connect("127.0.0.1", ntohs(addr_.sin_port), deadline);
+  ASSERT_FALSE(err) << *err;
+  EXPECT_TRUE(client.connected());
+  err = pdnnet::write(client.socket(), "hello", deadline);
+  ASSERT_FALSE(err) << *err;
+  std::string response;
+  err = pdnnet::read(client.socket(), response, deadline);
+  server.join();
+  ASSERT_FALSE(err) << *err;
+  EXPECT_EQ("HELLO", response);
+  EXPECT_FALSE(deadline.expired());
+  EXPECT_LE(deadline.remaining(), deadline.budget());
+}
+
+/**
+ * Test that a read from a silent peer fails once the deadline expires.
+ */
+TEST_F(DeadlineTest, ExpiryTest)
+{
+  pdnnet::unique_socket socket{AF_INET, SOCK_STREAM};
+  ASSERT_TRUE(pdnnet::connect(socket, addr_)) << pdnnet::socket_error();
+  auto peer = pdnnet::accept(listener_);
+  pdnnet::deadline deadline{std::chrono::milliseconds{50}};
+  std::string response;
+  auto start = pdnnet::deadline::clock_type::now();
+  auto err = pdnnet::read(socket, response, deadline);
+  auto elapsed = pdnnet::deadline::clock_type::now() - start;
+  ASSERT_TRUE(err);
+  EXPECT_NE(std::string::npos, err->find("exceeded during read")) << *err;
+  EXPECT_GE(elapsed, std::chrono::milliseconds{50});
+  EXPECT_LT(elapsed, std::chrono::milliseconds{1000});
+  EXPECT_EQ(std::chrono::milliseconds{}, deadline.remaining());
+  // later operations fail immediately
+  err = pdnnet::write(socket, "late", deadline);
+  ASSERT_TRUE(err);
+  EXPECT_NE(std::string::npos, err->find("exceeded during write")) << *err;
+}
+
+/**
+ * Test that cancelling from another thread unblocks a pending read.
+ */
+TEST_F(DeadlineTest, CancelTest)
+{
+  pdnnet::unique_socket socket{AF_INET, SOCK_STREAM};
+  ASSERT_TRUE(pdnnet::connect(socket, addr_)) << pdnnet::socket_error();
+  auto peer = pdnnet::accept(listener_);
+  // infinite deadline only ends when cancelled
+  pdnnet::deadline deadline;
+  EXPECT_TRUE(deadline.infinite());
+  std::thread canceller{
+    [&deadline]
+    {
+      std::this_thread::sleep_for(std::chrono::milliseconds{20});
+      deadline.cancel();
+    }
+  };
+  std::string response;
+  auto err = pdnnet::read(socket, response, deadline);
+  canceller.join();
+  ASSERT_TRUE(err);
+  EXPECT_NE(std::string::npos, err->find("cancelled during read")) << *err;
+  EXPECT_TRUE(deadline.cancelled());
+}
+
+}  // namespace
@@ -0,0 +1,162 @@
+/**
+ * @file flight_recorder_test.cc
+ * @author Derek Huang
+ * @brief flight_recorder.hh unit tests
+ * @copyright MIT License
+ */
+
+#include "pdnnet/flight_recorder.hh"
+
+#include <chrono>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "pdnnet/echoserver.hh"
+#include "pdnnet/platform.h"
+#include "pdnnet/server.hh"
+#include "pdnnet/socket.hh"
+
+#ifdef PDNNET_UNIX
+#include <signal.h>
+#endif  // PDNNET_UNIX
+
+namespace {
+
+/**
+ * Return a request record accepted at the given offset from now.
+ *
+ * @param id Connection id
+ * @param duration Time from accept to response
+ */
+auto make_record(std::uint64_t id, std::chrono::milliseconds duration)
+{
+  pdnnet::request_record record;
+  record.id = id;
+  record.accepted = pdnnet::request_record::clock_type::now() +
+    std::chrono::milliseconds{id};
+  record.responded = record.accepted + duration;
+  return record;
+}
+
+/**
+ * Test that each ring only keeps its most recent records.
+ */
+TEST(FlightRecorderTest, RingTest)
+{
+  pdnnet::flight_recorder recorder{4U, 1U};
+  for (std::uint64_t id = 1; id <= 6; id++)
+    recorder.record(make_record(id, std::chrono::milliseconds{1}));
+  auto records = recorder.snapshot();
+  ASSERT_EQ(4U, records.size());
+  for (std::size_t i = 0; i < records.size(); i++)
+    EXPECT_EQ(i + 3U, records[i].id);
+  EXPECT_EQ(6U, recorder.n_recorded());
+  EXPECT_EQ(0U, recorder.n_slow());
+  EXPECT_EQ(0U, recorder.n_dumps());
+}
+
+/**
+ * Test that slow requests trigger a rate-limited dump.
+ */
+TEST(FlightRecorderTest, SlowDumpTest)
+{
+  std::stringstream out;
+  pdnnet::flight_recorder recorder;
+  recorder
+    .slow_threshold(std::chrono::milliseconds{100})
+    .slow_dump_interval(std::chrono::milliseconds{60000})
+    .output(&out);
+  auto fast = make_record(recorder.next_id(), std::chrono::milliseconds{5});
+  fast.first_byte = fast.accepted + std::chrono::milliseconds{1};
+  fast.bytes_in = 12U;
+  recorder.record(fast);
+  EXPECT_EQ(0U, recorder.n_dumps());
+  recorder.record(make_record(recorder.next_id(), std::chrono::milliseconds{150}));
+  EXPECT_EQ(1U, recorder.n_slow());
+  EXPECT_EQ(1U, recorder.n_dumps());
+  auto text = out.str();
+  EXPECT_NE(std::string::npos, text.find("2 requests, 1 slow")) << text;
+  EXPECT_NE(std::string::npos, text.find("first_byte=+1.000ms")) << text;
+  EXPECT_NE(std::string::npos, text.find("last_byte=- ")) << text;
+  EXPECT_NE(std::string::npos, text.find("responded=+150.000ms")) << text;
+  EXPECT_NE(std::string::npos, text.find("in=12")) << text;
+  // second slow request is within the dump interval
+  recorder.record(make_record(recorder.next_id(), std::chrono::milliseconds{200}));
+  EXPECT_EQ(2U, recorder.n_slow());
+  EXPECT_EQ(1U, recorder.n_dumps());
+}
+
+#ifdef PDNNET_UNIX
+/**
+ * Test that the recorder is dumped when the registered signal is received.
+ */
+TEST(FlightRecorderTest, SignalTest)
+{
+  std::stringstream out;
+  pdnnet::flight_recorder recorder;
+  recorder.output(&out);
+  recorder.record(make_record(recorder.next_id(), std::chrono::milliseconds{1}));
+  auto err = recorder.dump_on_signal(SIGUSR1);
+  ASSERT_FALSE(err) << *err;
+  // only one recorder can watch for signals
+  pdnnet::flight_recorder other;
+  EXPECT_TRUE(other.dump_on_signal(SIGUSR1));
+  ASSERT_EQ(0, ::raise(SIGUSR1));
+  auto start = std::chrono::steady_clock::now();
+  while (
+    !recorder.n_dumps() &&
+    std::chrono::steady_clock::now() - start < std::chrono::seconds{5}
+  )
+    std::this_thread::sleep_for(std::chrono::milliseconds{1});
+  EXPECT_EQ(1U, recorder.n_dumps());
+  EXPECT_NE(std::string::npos, out.str().find("id=1 ")) << out.str();
+}
+#endif  // PDNNET_UNIX
+
+/**
+ * Test that the echo server records every phase of a request.
+ */
+TEST(FlightRecorderTest, EchoServerTest)
+{
+  pdnnet::flight_recorder recorder;
+  pdnnet::echoserver server;
+  std::thread server_thread{
+    [&]
+    {
+      server.start(pdnnet::server_params{}.max_concurrency(1U).recorder(&recorder));
+    }
+  };
+  while (!server.running())
+    std::this_thread::yield();
+  {
+    pdnnet::unique_socket socket{AF_INET, SOCK_STREAM};
+    auto addr = pdnnet::make_sockaddr_in(INADDR_LOOPBACK, server.port());
+    ASSERT_TRUE(pdnnet::connect(socket, addr)) << pdnnet::socket_error();
+    pdnnet::socket_writer{socket, true}("hello").throw_on_error();
+    EXPECT_EQ("hello", pdnnet::read(socket, std::chrono::milliseconds{1000}));
+  }
+  // record is made after the response is written
+  auto start = std::chrono::steady_clock::now();
+  while (
+    !recorder.n_recorded() &&
+    std::chrono::steady_clock::now() - start < std::chrono::seconds{5}
+  )
+    std::this_thread::sleep_for(std::chrono::milliseconds{1});
+  server.stop();
+  server_thread.join();
+  auto records = recorder.snapshot();
+  ASSERT_EQ(1U, records.size());
+  const auto& record = records.front();
+  EXPECT_EQ(1U, record.id);
+  EXPECT_LE(record.accepted, record.first_byte);
+  EXPECT_LE(record.first_byte, record.last_byte);
+  EXPECT_LE(record.last_byte, record.responded);
+  EXPECT_EQ(5U, record.bytes_in);
+  EXPECT_EQ(5U, record.bytes_out);
+  EXPECT_EQ(0, record.status);
+}
+
+}  // namespace
@@ -0,0 +1,485 @@
+/**
+ * @file frame_test.cc
+ * @author Derek Huang
+ * @brief frame.hh and compression.hh unit tests
+ * @copyright MIT License
+ */
+
+#include "pdnnet/frame.hh"
+
+#ifndef _WIN32
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#endif  // _WIN32
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "pdnnet/compression.hh"
+#include "pdnnet/memory.hh"
+#include "pdnnet/socket.hh"
+
+#include "loopback.hh"
+
+namespace {
+
+/**
+ * Run-length encoding codec for testing the compression stage.
+ *
+ * Output is a sequence of (count, value) byte pairs.
+ */
+class rle_codec : public pdnnet::compression_codec {
+public:
+  std::size_t bound(std::size_t size) const noexcept override
+  {
+    return 2U * size;
+  }
+
+  std::size_t compress(
+    const pdnnet::byte* src,
+    std::size_t size,
+    pdnnet::byte* dst,
+    std::size_t capacity) override
+  {
+    std::size_t n = 0;
+    for (std::size_t i = 0; i < size;) {
+      std::size_t run = 1;
+      while (i + run < size && run < 255U && src[i + run] == src[i])
+        run++;
+      if (n + 2U > capacity)
+        return 0;
+      dst[n++] = static_cast<pdnnet::byte>(run);
+      dst[n++] = src[i];
+      i += run;
+    }
+    return n;
+  }
+
+  bool decompress(
+    const pdnnet::byte* src,
+    std::size_t size,
+    pdnnet::byte* dst,
+    std::size_t original) override
+  {
+    std::size_t n = 0;
+    for (std::size_t i = 0; i + 1 < size; i += 2) {
+      if (n + src[i] > original)
+        return false;
+      for (unsigned int j = 0; j < src[i]; j++)
+        dst[n++] = src[i + 1];
+    }
+    return n == original;
+  }
+};
+
+/**
+ * Frame testing fixture.
+ *
+ * Creates a connected pair of loopback TCP sockets for each test.
+ */
+class FrameTest : public ::testing::Test {
+protected:
+  /**
+   * Connect the loopback socket pair.
+   */
+  void SetUp() override
+  {
+    std::tie(writer_socket_, reader_socket_) = pdnnet::test::loopback_pair();
+  }
+
+  /**
+   * Return a new compression stage using the test codec.
+   */
+  static auto make_stage()
+  {
+    return std::make_unique<pdnnet::compression_stage>(
+      std::make_unique<rle_codec>()
+    );
+  }
+
+  /**
+   * Check that frames round trip through a library codec.
+   *
+   * @param type Compression algorithm
+   */
+  void codec_round_trip(pdnnet::compression_type type)
+  {
+    EXPECT_TRUE(pdnnet::supported_compression() & static_cast<std::uint8_t>(type));
+    pdnnet::compression_stage send_stage{pdnnet::make_compression_codec(type)};
+    pdnnet::compression_stage recv_stage{pdnnet::make_compression_codec(type)};
+    std::string text;
+    for (unsigned int i = 0; text.size() < 65536U; i++)
+      text += "record " + std::to_string(i % 97U) + " of a repetitive payload\n";
+    pdnnet::frame_writer writer{writer_socket_, &send_stage};
+    ASSERT_FALSE(writer(1U, text));
+    ASSERT_FALSE(writer(2U, std::string(4096U, 'z')));
+    pdnnet::shutdown(writer_socket_, pdnnet::shutdown_type::write);
+    EXPECT_EQ(2U, send_stage.stats().frames_compressed);
+    EXPECT_LT(send_stage.stats().ratio(), 0.5);
+    pdnnet::frame_reader reader{
+      reader_socket_, &recv_stage, std::chrono::milliseconds{1000}
+    };
+    pdnnet::frame msg;
+    ASSERT_FALSE(reader(msg));
+    EXPECT_EQ(pdnnet::frame_compressed, msg.flags);
+    EXPECT_EQ(text, msg.view());
+    ASSERT_FALSE(reader(msg));
+    EXPECT_EQ(pdnnet::frame_compressed, msg.flags);
+    EXPECT_EQ(std::string(4096U, 'z'), msg.view());
+    EXPECT_EQ(2U, recv_stage.stats().frames_decompressed);
+  }
+
+  pdnnet::unique_socket writer_socket_;
+  pdnnet::unique_socket reader_socket_;
+};
+
+/**
+ * Test that frames round trip and end of transmission is clean.
+ */
+TEST_F(FrameTest, RoundTripTest)
+{
+  pdnnet::frame_writer writer{writer_socket_};
+  ASSERT_FALSE(writer(1U, "hello"));
+  ASSERT_FALSE(writer(2U, ""));
+  ASSERT_FALSE(writer(3U, std::string(1000U, 'x')));
+  EXPECT_EQ(3U, writer.n_frames());
+  pdnnet::shutdown(writer_socket_, pdnnet::shutdown_type::write);
+  // read frames back
+  pdnnet::frame_reader reader{reader_socket_, nullptr, std::chrono::milliseconds{1000}};
+  pdnnet::frame msg;
+  ASSERT_FALSE(reader(msg));
+  EXPECT_EQ(1U, msg.type);
+  EXPECT_EQ("hello", msg.view());
+  ASSERT_FALSE(reader(msg));
+  EXPECT_EQ(2U, msg.type);
+  EXPECT_EQ("", msg.view());
+  ASSERT_FALSE(reader(msg));
+  EXPECT_EQ(3U, msg.type);
+  EXPECT_EQ(std::string(1000U, 'x'), msg.view());
+  EXPECT_FALSE(reader.eof());
+  ASSERT_FALSE(reader(msg));
+  EXPECT_TRUE(reader.eof());
+  EXPECT_EQ(3U, reader.n_frames());
+}
+
+/**
+ * Test that the compression stage compresses only worthwhile payloads.
+ */
+TEST_F(FrameTest, CompressionTest)
+{
+  auto send_stage = make_stage();
+  auto recv_stage = make_stage();
+  // repetitive, too small, and random payloads
+  std::string repetitive(4096U, 'a');
+  std::string small{"tiny"};
+  std::string noise(4096U, '\0');
+  std::mt19937 gen{8888};
+  std::uniform_int_distribution<int> dist{0, 255};
+  for (auto& c : noise)
+    c = static_cast<char>(dist(gen));
+  pdnnet::frame_writer writer{writer_socket_, send_stage.get()};
+  ASSERT_FALSE(writer(1U, repetitive));
+  ASSERT_FALSE(writer(2U, small));
+  ASSERT_FALSE(writer(3U, noise));
+  pdnnet::shutdown(writer_socket_, pdnnet::shutdown_type::write);
+  // check stats
+  const auto& stats = send_stage->stats();
+  EXPECT_EQ(3U, stats.frames_in);
+  EXPECT_EQ(1U, stats.frames_compressed);
+  EXPECT_EQ(2U, stats.frames_skipped);
+  EXPECT_LT(stats.ratio(), 0.75);
+  // read back and check payloads + flags
+  pdnnet::frame_reader reader{
+    reader_socket_, recv_stage.get(), std::chrono::milliseconds{1000}
+  };
+  pdnnet::frame msg;
+  ASSERT_FALSE(reader(msg));
+  EXPECT_EQ(pdnnet::frame_compressed, msg.flags);
+  EXPECT_EQ(repetitive, msg.view());
+  ASSERT_FALSE(reader(msg));
+  EXPECT_EQ(0U, msg.flags);
+  EXPECT_EQ(small, msg.view());
+  ASSERT_FALSE(reader(msg));
+  EXPECT_EQ(0U, msg.flags);
+  EXPECT_EQ(noise, msg.view());
+  EXPECT_EQ(1U, recv_stage->stats().frames_decompressed);
+}
+
+/**
+ * Test that frames round trip through the LZ4 codec.
+ */
+TEST_F(FrameTest, Lz4Test)
+{
+#if defined(PDNNET_HAS_LZ4)
+  codec_round_trip(pdnnet::compression_type::lz4);
+#else
+  GTEST_SKIP() << "LZ4 codec not enabled, configure with -DENABLE_LZ4=ON";
+#endif  // !defined(PDNNET_HAS_LZ4)
+}
+
+/**
+ * Test that frames round trip through the zstd codec.
+ */
+TEST_F(FrameTest, ZstdTest)
+{
+#if defined(PDNNET_HAS_ZSTD)
+  codec_round_trip(pdnnet::compression_type::zstd);
+#else
+  EXPECT_THROW(
+    pdnnet::make_compression_codec(pdnnet::compression_type::zstd, {}),
+    std::invalid_argument
+  );
+  GTEST_SKIP() << "zstd codec not enabled, configure with -DENABLE_ZSTD=ON";
+#endif  // !defined(PDNNET_HAS_ZSTD)
+}
+
+/**
+ * Test that a frame exceeding the max frame size is an error.
+ */
+TEST_F(FrameTest, MaxFrameTest)
+{
+  ASSERT_FALSE(pdnnet::frame_writer{writer_socket_}(1U, std::string(64U, 'x')));
+  pdnnet::frame_reader reader{reader_socket_, nullptr, std::chrono::milliseconds{1000}};
+  reader.max_frame_size(16U);
+  pdnnet::frame msg;
+  EXPECT_TRUE(reader(msg));
+}
+
+/**
+ * Test that frame checksums are verified on receive.
+ */
+TEST_F(FrameTest, ChecksumTest)
+{
+  // send two checksummed frames, the first of which is read normally
+  pdnnet::frame_writer writer{writer_socket_};
+  writer.checksum(true);
+  ASSERT_FALSE(writer(1U, "payload"));
+  ASSERT_FALSE(writer(2U, "payload"));
+  pdnnet::shutdown(writer_socket_, pdnnet::shutdown_type::write);
+  pdnnet::frame_reader reader{reader_socket_, nullptr, std::chrono::milliseconds{1000}};
+  reader.require_checksum(true);
+  pdnnet::frame msg;
+  ASSERT_FALSE(reader(msg));
+  EXPECT_EQ(pdnnet::frame_checksum, msg.flags);
+  EXPECT_EQ("payload", msg.view());
+  // second frame is intact, so relay it back with a flipped payload bit
+  auto frame_size = pdnnet::frame_header_size + 7U + pdnnet::frame_checksum_size;
+  std::string raw(frame_size, '\0');
+  ASSERT_FALSE(pdnnet::read_exact(reader_socket_, raw.data(), raw.size()));
+  raw[pdnnet::frame_header_size] ^= 0x4;
+  ASSERT_FALSE(pdnnet::socket_writer{reader_socket_}(raw));
+  pdnnet::shutdown(reader_socket_, pdnnet::shutdown_type::write);
+  pdnnet::frame_reader relay_reader{
+    writer_socket_, nullptr, std::chrono::milliseconds{1000}
+  };
+  EXPECT_TRUE(relay_reader(msg));
+}
+
+/**
+ * Test that chunks interleaved across streams are reassembled.
+ */
+TEST_F(FrameTest, ChunkTest)
+{
+  pdnnet::frame_writer writer{writer_socket_};
+  writer.checksum(true);
+  ASSERT_FALSE(writer.chunk(2U, true, 7U, "bulk ", 5U));
+  ASSERT_FALSE(writer.chunk(1U, true, 1U, "pi", 2U));
+  ASSERT_FALSE(writer(9U, "whole"));
+  ASSERT_FALSE(writer.chunk(1U, false, 1U, "ng", 2U));
+  ASSERT_FALSE(writer.chunk(2U, false, 7U, "data", 4U));
+  // truncated message
+  ASSERT_FALSE(writer.chunk(3U, true, 3U, "partial", 7U));
+  pdnnet::shutdown(writer_socket_, pdnnet::shutdown_type::write);
+  pdnnet::frame_reader reader{reader_socket_, nullptr, std::chrono::milliseconds{1000}};
+  pdnnet::frame msg;
+  // messages are returned in the order they complete
+  ASSERT_FALSE(reader(msg));
+  EXPECT_EQ(9U, msg.type);
+  EXPECT_EQ("whole", msg.view());
+  ASSERT_FALSE(reader(msg));
+  EXPECT_EQ(1U, msg.type);
+  EXPECT_EQ("ping", msg.view());
+  ASSERT_FALSE(reader(msg));
+  EXPECT_EQ(7U, msg.type);
+  EXPECT_EQ("bulk data", msg.view());
+  EXPECT_EQ(pdnnet::frame_checksum, msg.flags);
+  EXPECT_EQ(4U, reader.n_chunks());
+  EXPECT_TRUE(reader(msg));
+  EXPECT_EQ(6U, reader.n_frames());
+}
+
+/**
+ * Test that a frame trickling in is read with few wakeups.
+ */
+TEST_F(FrameTest, RcvlowatTest)
+{
+  // capture the raw bytes of a large frame to replay them slowly
+  std::string payload(65536U, '\0');
+  for (std::size_t i = 0; i < payload.size(); i++)
+    payload[i] = static_cast<char>(i % 251U);
+  ASSERT_FALSE((pdnnet::frame_writer{writer_socket_}(1U, payload)));
+  std::string raw(pdnnet::frame_header_size + payload.size(), '\0');
+  ASSERT_FALSE(pdnnet::read_exact(reader_socket_, raw.data(), raw.size()));
+  // without Nagle's algorithm each piece is sent as it is written
+  int nodelay = 1;
+  ASSERT_FALSE(
+    ::setsockopt(
+      reader_socket_,
+      IPPROTO_TCP,
+      TCP_NODELAY,
+      reinterpret_cast<const char*>(&nodelay),
+      sizeof nodelay
+    )
+  );
+  for (auto enable : {true, false}) {
+    std::thread replay{
+      [this, &raw]
+      {
+        pdnnet::socket_writer writer{reader_socket_};
+        for (std::size_t i = 0; i < raw.size(); i += 4096U) {
+          EXPECT_FALSE(writer(std::string_view{raw}.substr(i, 4096U)));
+          std::this_thread::sleep_for(std::chrono::milliseconds{2});
+        }
+      }
+    };
+    pdnnet::frame_reader reader{writer_socket_, nullptr, std::chrono::milliseconds{2000}};
+    reader.rcvlowat(enable);
+    pdnnet::frame msg;
+    auto err = reader(msg);
+    replay.join();
+    ASSERT_FALSE(err) << *err;
+    EXPECT_EQ(payload, msg.view());
+    // low watermark is ignored on some platforms, e.g. Windows
+#if defined(PDNNET_LINUX)
+    if (enable) {
+      EXPECT_TRUE(reader.rcvlowat());
+      EXPECT_GE(3U, reader.n_reads());
+    }
+#endif  // defined(PDNNET_LINUX)
+    // low watermark is reset once the frame is read
+    int lowat;
+    if (pdnnet::recv_lowat(writer_socket_, lowat)) {
+      EXPECT_EQ(1, lowat);
+    }
+  }
+}
+
+/**
+ * Test that a slow but steady sender does not time out a partial frame.
+ */
+TEST_F(FrameTest, RcvlowatTimeoutTest)
+{
+  std::string payload(16384U, 'x');
+  ASSERT_FALSE((pdnnet::frame_writer{writer_socket_}(1U, payload)));
+  std::string raw(pdnnet::frame_header_size + payload.size(), '\0');
+  ASSERT_FALSE(pdnnet::read_exact(reader_socket_, raw.data(), raw.size()));
+  // each piece arrives within the poll timeout, but the frame does not
+  std::thread replay{
+    [this, &raw]
+    {
+      pdnnet::socket_writer writer{reader_socket_};
+      for (std::size_t i = 0; i < raw.size(); i += 4096U) {
+        EXPECT_FALSE(writer(std::string_view{raw}.substr(i, 4096U)));
+        std::this_thread::sleep_for(std::chrono::milliseconds{100});
+      }
+    }
+  };
+  pdnnet::frame_reader reader{writer_socket_, nullptr, std::chrono::milliseconds{250}};
+  pdnnet::frame msg;
+  auto err = reader(msg);
+  replay.join();
+  ASSERT_FALSE(err) << *err;
+  EXPECT_EQ(payload, msg.view());
+  int lowat;
+  if (pdnnet::recv_lowat(writer_socket_, lowat)) {
+    EXPECT_EQ(1, lowat);
+  }
+}
+
+/**
+ * Test that a frame queue rejects a zero chunk size.
+ */
+TEST_F(FrameTest, QueueChunkSizeTest)
+{
+  EXPECT_THROW((pdnnet::frame_queue{writer_socket_, nullptr, 0U}), std::invalid_argument);
+  EXPECT_NO_THROW((pdnnet::frame_queue{writer_socket_, nullptr, 1U}));
+}
+
+/**
+ * Test that urgent frames are sent between chunks of a bulk transfer.
+ */
+TEST_F(FrameTest, QueueTest)
+{
+  // small buffers so the bulk transfer blocks until the reader catches up
+  pdnnet::set_send_buffer_size(writer_socket_, 16384);
+  pdnnet::set_recv_buffer_size(reader_socket_, 16384);
+  pdnnet::frame_queue queue{writer_socket_, nullptr, 4096U};
+  std::string bulk(1U << 20, 'b');
+  pdnnet::optional_error bulk_err;
+  std::thread bulk_thread{
+    [&] { bulk_err = queue(pdnnet::frame_priority_bulk, 2U, bulk); }
+  };
+  // the bulk thread is blocked writing, so the ping is only queued
+  while (queue.queued_bytes() == 0U)
+    std::this_thread::yield();
+  std::this_thread::sleep_for(std::chrono::milliseconds{20});
+  ASSERT_FALSE(queue(pdnnet::frame_priority_control, 1U, "ping"));
+  EXPECT_TRUE(queue(pdnnet::frame_priorities, 1U, "bad"));
+  pdnnet::frame_reader reader{reader_socket_, nullptr, std::chrono::milliseconds{1000}};
+  pdnnet::frame msg;
+  ASSERT_FALSE(reader(msg));
+  EXPECT_EQ(1U, msg.type);
+  EXPECT_EQ("ping", msg.view());
+  ASSERT_FALSE(reader(msg));
+  EXPECT_EQ(2U, msg.type);
+  EXPECT_EQ(bulk, msg.view());
+  bulk_thread.join();
+  ASSERT_FALSE(bulk_err) << *bulk_err;
+  EXPECT_EQ(bulk.size() / 4096U, queue.n_chunks());
+  EXPECT_EQ(1U, queue.n_interleaved());
+  EXPECT_EQ(0U, queue.queued_bytes());
+}
+
+/**
+ * Test that compression negotiation picks the best common algorithm.
+ */
+TEST_F(FrameTest, NegotiateTest)
+{
+  auto lz4 = static_cast<std::uint8_t>(pdnnet::compression_type::lz4);
+  auto zstd = static_cast<std::uint8_t>(pdnnet::compression_type::zstd);
+  // zstd is rejected by the server since dictionary IDs differ
+  pdnnet::compression_offer client_offer{std::uint8_t(lz4 | zstd), 7U};
+  pdnnet::compression_offer server_offer{std::uint8_t(lz4 | zstd), 8U};
+  pdnnet::compression_type server_choice;
+  pdnnet::optional_error server_err;
+  std::thread server{
+    [&]
+    {
+      server_err = pdnnet::negotiate_compression(
+        reader_socket_, true, server_offer, server_choice
+      );
+    }
+  };
+  pdnnet::compression_type client_choice;
+  auto client_err = pdnnet::negotiate_compression(
+    writer_socket_, false, client_offer, client_choice
+  );
+  server.join();
+  ASSERT_FALSE(client_err) << *client_err;
+  ASSERT_FALSE(server_err) << *server_err;
+  EXPECT_EQ(pdnnet::compression_type::lz4, client_choice);
+  EXPECT_EQ(pdnnet::compression_type::lz4, server_choice);
+}
+
+}  // namespace
@@ -0,0 +1,240 @@
+/**
+ * @file hedge_test.cc
+ * @author Derek Huang
+ * @brief hedge.hh unit tests
+ * @copyright MIT License
+ */
+
+#include "pdnnet/hedge.hh"
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "pdnnet/client.hh"
+#include "pdnnet/deadline.hh"
+#include "pdnnet/platform.h"
+#include "pdnnet/socket.hh"
+
+#include "loopback.hh"
+
+namespace {
+
+/**
+ * Loopback backend answering each request after a fixed delay.
+ *
+ * Responses are the backend name followed by the request.
+ */
+class backend {
+public:
+  /**
+   * Ctor.
+   *
+   * @param name Backend name prefixed to responses
+   * @param delay Delay before each response
+   */
+  backend(std::string name, std::chrono::milliseconds delay)
+    : name_{std::move(name)},
+      delay_{delay},
+      addr_{},
+      listener_{pdnnet::test::loopback_listener(addr_, 16U)},
+      stop_{}
+  {
+    thread_ = std::thread{&backend::run, this};
+  }
+
+  /**
+   * Dtor.
+   */
+  ~backend()
+  {
+    stop_ = true;
+    thread_.join();
+    for (auto& worker : workers_)
+      worker.join();
+  }
+
+  /**
+   * Return port number in host byte order.
+   */
+  auto port() const noexcept { return ntohs(addr_.sin_port); }
+
+private:
+  std::string name_;
+  std::chrono::milliseconds delay_;
+  // addr_ is written when listener_ is created
+  sockaddr_in addr_;
+  pdnnet::unique_socket listener_;
+  std::atomic<bool> stop_;
+  std::thread thread_;
+  std::vector<std::thread> workers_;
+
+  /**
+   * Accept connections and answer each on its own thread until stopped.
+   */
+  void run()
+  {
+    while (!stop_) {
+      if (!pdnnet::wait_pollin(listener_, 10))
+        continue;
+      auto fd = pdnnet::accept(listener_).release();
+      workers_.emplace_back(
+        [this, fd]
+        {
+          pdnnet::unique_socket socket{fd};
+          pdnnet::deadline deadline{std::chrono::milliseconds{5000}};
+          std::string request;
+          if (pdnnet::read(socket, request, deadline))
+            return;
+          std::this_thread::sleep_for(delay_);
+          // client may have cancelled by closing the connection
+          pdnnet::write(socket, name_ + ":" + request, deadline);
+        }
+      );
+    }
+  }
+};
+
+/**
+ * Hedged client testing fixture.
+ */
+class HedgeTest : public ::testing::Test {
+protected:
+  /**
+   * Ignore `SIGPIPE` since backends write to cancelled connections.
+   */
+  static void SetUpTestSuite()
+  {
+#ifdef PDNNET_UNIX
+    std::signal(SIGPIPE, SIG_IGN);
+#endif  // PDNNET_UNIX
+  }
+
+  /**
+   * Add a backend to the pool.
+   *
+   * @param name Backend name
+   * @param delay Backend response delay
+   */
+  void add_backend(const std::string& name, std::chrono::milliseconds delay)
+  {
+    backends_.push_back(std::make_unique<backend>(name, delay));
+    auto err = pool_.add("127.0.0.1", backends_.back()->port());
+    ASSERT_FALSE(err) << *err;
+  }
+
+  std::vector<std::unique_ptr<backend>> backends_;
+  pdnnet::connection_pool pool_;
+};
+
+/**
+ * Test that a slow backend is hedged and the faster response is taken.
+ */
+TEST_F(HedgeTest, HedgeWinTest)
+{
+  add_backend("slow", std::chrono::milliseconds{2000});
+  add_backend("fast", std::chrono::milliseconds{});
+  pdnnet::hedged_client client{pool_};
+  client.delay(std::chrono::milliseconds{20}).adaptive(false).budget(1.);
+  pdnnet::deadline deadline{std::chrono::milliseconds{1000}};
+  std::string response;
+  auto start = pdnnet::deadline::clock_type::now();
+  auto err = client.request("hello", response, deadline);
+  auto elapsed = pdnnet::deadline::clock_type::now() - start;
+  ASSERT_FALSE(err) << *err;
+  EXPECT_EQ("fast:hello", response);
+  EXPECT_EQ(1U, client.n_hedged());
+  EXPECT_EQ(1U, client.n_hedge_wins());
+  EXPECT_LT(elapsed, std::chrono::milliseconds{1000});
+}
+
+/**
+ * Test that fast responses are not hedged.
+ */
+TEST_F(HedgeTest, NoHedgeTest)
+{
+  add_backend("a", std::chrono::milliseconds{});
+  add_backend("b", std::chrono::milliseconds{});
+  pdnnet::hedged_client client{pool_};
+  client.delay(std::chrono::milliseconds{1000}).budget(1.);
+  pdnnet::deadline deadline{std::chrono::milliseconds{1000}};
+  std::string response;
+  for (auto expected : {"a:x", "b:x", "a:x"}) {
+    auto err = client.request("x", response, deadline);
+    ASSERT_FALSE(err) << *err;
+    EXPECT_EQ(expected, response);
+  }
+  EXPECT_EQ(3U, client.n_requests());
+  EXPECT_EQ(0U, client.n_hedged());
+}
+
+/**
+ * Test that hedges are not sent once the budget is used up.
+ */
+TEST_F(HedgeTest, BudgetTest)
+{
+  add_backend("slow", std::chrono::milliseconds{50});
+  pdnnet::hedged_client client{pool_};
+  client.delay(std::chrono::milliseconds{1}).adaptive(false).budget(0.5);
+  pdnnet::deadline deadline{std::chrono::milliseconds{2000}};
+  std::string response;
+  for (int i = 0; i < 4; i++) {
+    auto err = client.request("x", response, deadline);
+    ASSERT_FALSE(err) << *err;
+    EXPECT_EQ("slow:x", response);
+  }
+  // first request cannot hedge since 1 hedge would be 100% of requests
+  EXPECT_EQ(2U, client.n_hedged());
+  EXPECT_EQ(2U, client.n_budget_denied());
+}
+
+/**
+ * Test that the hedge delay adapts to observed latencies.
+ */
+TEST_F(HedgeTest, AdaptiveTest)
+{
+  add_backend("a", std::chrono::milliseconds{});
+  pdnnet::hedged_client client{pool_};
+  client.delay(std::chrono::milliseconds{1000}).min_samples(4U).window(8U);
+  EXPECT_EQ(std::chrono::milliseconds{1000}, client.hedge_delay());
+  pdnnet::deadline deadline{std::chrono::milliseconds{2000}};
+  std::string response;
+  for (int i = 0; i < 4; i++)
+    ASSERT_FALSE(client.request("x", response, deadline));
+  EXPECT_LT(client.hedge_delay(), std::chrono::milliseconds{500});
+}
+
+/**
+ * Test that prefilled connections are reused by requests.
+ */
+TEST_F(HedgeTest, PoolTest)
+{
+  add_backend("a", std::chrono::milliseconds{});
+  pdnnet::deadline deadline{std::chrono::milliseconds{1000}};
+  auto err = pool_.prefill(0U, 2U, deadline);
+  ASSERT_FALSE(err) << *err;
+  EXPECT_EQ(2U, pool_.n_idle(0U));
+  EXPECT_EQ(2U, pool_.n_connects());
+  pdnnet::hedged_client client{pool_};
+  std::string response;
+  err = client.request("x", response, deadline);
+  ASSERT_FALSE(err) << *err;
+  EXPECT_EQ("a:x", response);
+  EXPECT_EQ(1U, pool_.n_reused());
+  EXPECT_EQ(1U, pool_.n_idle(0U));
+  // unused connections can be returned
+  pdnnet::unique_socket socket;
+  ASSERT_FALSE(pool_.acquire(0U, socket, deadline));
+  EXPECT_EQ(0U, pool_.n_idle(0U));
+  pool_.release(0U, std::move(socket));
+  EXPECT_EQ(1U, pool_.n_idle(0U));
+}
+
+}  // namespace
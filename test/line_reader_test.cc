@@ -0,0 +1,156 @@
+/**
+ * @file line_reader_test.cc
+ * @author Derek Huang
+ * @brief line_reader.hh unit tests
+ * @copyright MIT License
+ */
+
+#include "pdnnet/line_reader.hh"
+
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "pdnnet/socket.hh"
+
+#include "loopback.hh"
+
+namespace {
+
+/**
+ * Test that `find_byte` agrees with `memchr` for all lengths and positions.
+ */
+TEST(FindByteTest, MemchrTest)
+{
+  // lengths span the scalar tail and several SIMD blocks
+  for (std::size_t len = 0; len < 100U; len++) {
+    std::string text(len, 'a');
+    // no match anywhere
+    EXPECT_EQ(text.data() + len, pdnnet::find_byte(text.data(), text.data() + len, '\n'));
+    // match at each position, with a second match later to ensure first wins
+    for (std::size_t i = 0; i < len; i++) {
+      auto copy = text;
+      copy[i] = '\n';
+      if (i + 7 < len)
+        copy[i + 7] = '\n';
+      auto first = copy.data();
+      auto last = first + len;
+      auto expected = static_cast<const char*>(std::memchr(first, '\n', len));
+      EXPECT_EQ(expected, pdnnet::find_byte(first, last, '\n')) <<
+        "len=" << len << ", i=" << i;
+    }
+  }
+}
+
+/**
+ * `line_reader` testing fixture.
+ *
+ * Creates a connected pair of loopback TCP sockets for each test.
+ */
+class LineReaderTest : public ::testing::Test {
+protected:
+  /**
+   * Connect the loopback socket pair.
+   */
+  void SetUp() override
+  {
+    std::tie(writer_socket_, reader_socket_) = pdnnet::test::loopback_pair();
+  }
+
+  /**
+   * Write the given pieces and then close the writer end.
+   *
+   * @param pieces Pieces to write with separate writes
+   */
+  void write_pieces(const std::vector<std::string>& pieces)
+  {
+    for (const auto& piece : pieces)
+      ASSERT_FALSE(pdnnet::socket_writer{writer_socket_}(piece));
+    pdnnet::shutdown(writer_socket_, pdnnet::shutdown_type::write);
+  }
+
+  /**
+   * Read all lines with the given reader.
+   *
+   * @param reader Line reader to read with
+   */
+  static auto read_lines(pdnnet::line_reader& reader)
+  {
+    std::vector<std::string> lines;
+    auto err = reader([&lines](std::string_view line) { lines.emplace_back(line); });
+    EXPECT_FALSE(err) << *err;
+    return lines;
+  }
+
+  pdnnet::unique_socket writer_socket_;
+  pdnnet::unique_socket reader_socket_;
+};
+
+/**
+ * Test that incomplete lines are carried over across reads.
+ */
+TEST_F(LineReaderTest, CarryOverTest)
+{
+  write_pieces({"set a 1\nge", "t a\nstats\n", "tail"});
+  pdnnet::line_reader reader{reader_socket_, std::chrono::milliseconds{1000}};
+  std::vector<std::string> expected{"set a 1", "get a", "stats", "tail"};
+  EXPECT_EQ(expected, read_lines(reader));
+  EXPECT_TRUE(reader.eof());
+}
+
+/**
+ * Test that CRLF-terminated lines have the carriage return stripped.
+ */
+TEST_F(LineReaderTest, CrlfTest)
+{
+  write_pieces({"GET / HTTP/1.1\r\nHost: x\r", "\n\r\n"});
+  pdnnet::line_reader reader{reader_socket_, std::chrono::milliseconds{1000}};
+  reader.crlf(true);
+  std::vector<std::string> expected{"GET / HTTP/1.1", "Host: x", ""};
+  EXPECT_EQ(expected, read_lines(reader));
+}
+
+/**
+ * Test that an unterminated final line also has the carriage return stripped.
+ */
+TEST_F(LineReaderTest, CrlfRemainderTest)
+{
+  write_pieces({"Host: x\r\n", "tail\r"});
+  pdnnet::line_reader reader{reader_socket_, std::chrono::milliseconds{1000}};
+  reader.crlf(true);
+  std::vector<std::string> expected{"Host: x", "tail"};
+  EXPECT_EQ(expected, read_lines(reader));
+  EXPECT_TRUE(reader.eof());
+}
+
+/**
+ * Test that the buffer grows when a single line exceeds it.
+ */
+TEST_F(LineReaderTest, GrowTest)
+{
+  std::string long_line(100U, 'x');
+  write_pieces({long_line + "|short|"});
+  pdnnet::line_reader reader{reader_socket_, 4U, std::chrono::milliseconds{1000}};
+  reader.delimiter('|');
+  std::vector<std::string> expected{long_line, "short"};
+  EXPECT_EQ(expected, read_lines(reader));
+  EXPECT_LE(100U, reader.buf_size());
+}
+
+/**
+ * Test that a line exceeding the max line size is an error.
+ */
+TEST_F(LineReaderTest, MaxLineTest)
+{
+  write_pieces({std::string(64U, 'x')});
+  pdnnet::line_reader reader{reader_socket_, 4U, std::chrono::milliseconds{1000}};
+  reader.max_line_size(16U);
+  EXPECT_TRUE(reader([](std::string_view) {}));
+}
+
+}  // namespace
@@ -0,0 +1,65 @@
+/**
+ * @file loopback.hh
+ * @author Derek Huang
+ * @brief C++ header for loopback socket helpers shared by the unit tests
+ * @copyright MIT License
+ */
+
+#ifndef PDNNET_TEST_LOOPBACK_HH_
+#define PDNNET_TEST_LOOPBACK_HH_
+
+#include <stdexcept>
+#include <utility>
+
+#include "pdnnet/socket.hh"
+
+namespace pdnnet {
+namespace test {
+
+/**
+ * Return a TCP socket listening on the next free port.
+ *
+ * Throws `std::runtime_error` on failure, which fails the calling test.
+ *
+ * @param addr Address to write the bound address and port to
+ * @param max_pending Maximum number of pending connections
+ * @param host Address to bind in host byte order, e.g. `INADDR_ANY`
+ */
+inline auto loopback_listener(
+  sockaddr_in& addr,
+  unsigned int max_pending = 1U,
+  inet_addr_type host = INADDR_LOOPBACK)
+{
+  unique_socket listener{AF_INET, SOCK_STREAM};
+  addr = make_sockaddr_in(host, 0);
+  if (!bind(listener, addr))
+    throw std::runtime_error{socket_error("Could not bind socket")};
+  if (!getsockname(listener, addr))
+    throw std::runtime_error{socket_error("Could not retrieve socket address")};
+  if (!listen(listener, max_pending))
+    throw std::runtime_error{socket_error("Could not listen on socket")};
+  return listener;
+}
+
+/**
+ * Return a connected pair of loopback TCP sockets.
+ *
+ * Throws `std::runtime_error` on failure, which fails the calling test.
+ *
+ * @returns Pair of the connecting end and the accepted end
+ */
+inline auto loopback_pair()
+{
+  sockaddr_in addr;
+  auto listener = loopback_listener(addr);
+  unique_socket client{AF_INET, SOCK_STREAM};
+  if (!connect(client, addr))
+    throw std::runtime_error{socket_error("Could not connect")};
+  auto server = accept(listener);
+  return std::make_pair(std::move(client), std::move(server));
+}
+
+}  // namespace test
+}  // namespace pdnnet
+
+#endif  // PDNNET_TEST_LOOPBACK_HH_
@@ -0,0 +1,185 @@
+/**
+ * @file outbound_test.cc
+ * @author Derek Huang
+ * @brief outbound.hh unit tests
+ * @copyright MIT License
+ */
+
+#include "pdnnet/outbound.hh"
+
+#include <chrono>
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include <gtest/gtest.h>
+
+#include "pdnnet/echoserver.hh"
+#include "pdnnet/server.hh"
+#include "pdnnet/socket.hh"
+
+#include "loopback.hh"
+
+namespace {
+
+/**
+ * Outbound queue testing fixture.
+ *
+ * Provides connected pairs of loopback TCP sockets with small buffers so that
+ * output backs up quickly when the reading end does not read.
+ */
+class OutboundTest : public ::testing::Test {
+protected:
+  static constexpr std::size_t high_ = 65536U;
+  static constexpr std::size_t low_ = 16384U;
+
+  /**
+   * Return a connected pair of sockets, writing end first.
+   */
+  static auto make_pair()
+  {
+    auto pair = pdnnet::test::loopback_pair();
+    pdnnet::set_send_buffer_size(pair.first, 16384);
+    pdnnet::set_recv_buffer_size(pair.second, 16384);
+    return pair;
+  }
+
+  /**
+   * Read whatever is available within the timeout.
+   *
+   * @param handle Socket handle
+   * @param out String to append read bytes to
+   * @returns Number of bytes read, zero at end of transmission or on timeout
+   */
+  static std::size_t read_some(pdnnet::socket_handle handle, std::string& out)
+  {
+    if (!pdnnet::wait_pollin(handle, std::chrono::milliseconds{2000}))
+      return 0U;
+    char buf[8192];
+    auto n_read = ::recv(handle, buf, static_cast<int>(sizeof buf), 0);
+    if (n_read <= 0)
+      return 0U;
+    out.append(buf, static_cast<std::size_t>(n_read));
+    return static_cast<std::size_t>(n_read);
+  }
+};
+
+/**
+ * Test that invalid watermarks are rejected.
+ */
+TEST_F(OutboundTest, InvalidTest)
+{
+  auto [writer, reader] = make_pair();
+  EXPECT_THROW((pdnnet::outbound_queue{writer, 0U, 0U}), std::invalid_argument);
+  EXPECT_THROW((pdnnet::outbound_queue{writer, low_, high_}), std::invalid_argument);
+  EXPECT_THROW((pdnnet::outbound_queue{writer, high_, high_}), std::invalid_argument);
+}
+
+/**
+ * Test that the callbacks fire once per crossing of each watermark.
+ */
+TEST_F(OutboundTest, WatermarkTest)
+{
+  auto [writer, reader] = make_pair();
+  pdnnet::outbound_queue queue{writer, high_, low_};
+  unsigned int n_high = 0, n_low = 0;
+  queue.on_high([&] { n_high++; }).on_low([&] { n_low++; });
+  std::string block(8192U, 'x');
+  std::size_t n_written = 0;
+  // nothing is read, so the socket buffers fill and the queue grows
+  while (!queue.paused() && n_written < 16U * high_) {
+    ASSERT_FALSE(queue(block));
+    n_written += block.size();
+  }
+  ASSERT_TRUE(queue.paused());
+  EXPECT_GE(queue.queued_bytes(), high_);
+  EXPECT_EQ(1U, n_high);
+  // writes are still accepted while paused
+  ASSERT_FALSE(queue(block));
+  n_written += block.size();
+  EXPECT_EQ(1U, n_high);
+  EXPECT_EQ(1U, queue.n_paused());
+  // reading lets the queue drain to the low watermark
+  std::string received;
+  while (queue.paused()) {
+    ASSERT_LT(0U, read_some(reader, received));
+    ASSERT_FALSE(queue.flush());
+  }
+  EXPECT_EQ(1U, n_low);
+  EXPECT_LE(queue.queued_bytes(), low_);
+  while (!queue.empty()) {
+    read_some(reader, received);
+    ASSERT_FALSE(queue.flush());
+  }
+  EXPECT_EQ(n_written, queue.n_sent());
+  EXPECT_EQ(0U, queue.queued_bytes());
+  EXPECT_GE(queue.max_queued_bytes(), high_);
+  EXPECT_EQ(1U, n_low);
+  EXPECT_EQ(1U, n_high);
+}
+
+/**
+ * Test that relaying to a slow reader bounds the queue.
+ */
+TEST_F(OutboundTest, RelayTest)
+{
+  auto [source_writer, source] = make_pair();
+  auto [sink, sink_reader] = make_pair();
+  std::string data;
+  for (std::size_t i = 0; data.size() < 2U << 20; i++)
+    data += std::to_string(i) + ' ';
+  std::thread writer_thread{
+    [&, &source_writer = source_writer]
+    {
+      EXPECT_FALSE((pdnnet::socket_writer{source_writer, true}(data)));
+    }
+  };
+  pdnnet::outbound_queue queue{sink, high_, low_};
+  pdnnet::optional_error err;
+  std::thread relay_thread{
+    [&, &source = source]
+    {
+      err = pdnnet::relay(source, queue);
+      pdnnet::shutdown(queue.handle(), pdnnet::shutdown_type::write);
+    }
+  };
+  // let the relay back up before reading anything
+  std::this_thread::sleep_for(std::chrono::milliseconds{50});
+  std::string received;
+  while (read_some(sink_reader, received));
+  writer_thread.join();
+  relay_thread.join();
+  ASSERT_FALSE(err) << *err;
+  EXPECT_EQ(data, received);
+  EXPECT_LE(1U, queue.n_paused());
+  EXPECT_LT(queue.max_queued_bytes(), high_ + pdnnet::socket_read_size);
+}
+
+/**
+ * Test that the echo server echoes with bounded output.
+ */
+TEST_F(OutboundTest, EchoserverTest)
+{
+  pdnnet::echoserver server;
+  std::thread thread{
+    [&server] { server.start(pdnnet::server_params{}.watermarks(high_, low_)); }
+  };
+  while (!server.running())
+    std::this_thread::yield();
+  pdnnet::unique_socket client{AF_INET, SOCK_STREAM};
+  auto addr = pdnnet::make_sockaddr_in(INADDR_LOOPBACK, server.port());
+  ASSERT_TRUE(pdnnet::connect(client, addr)) << pdnnet::socket_error();
+  EXPECT_FALSE((pdnnet::socket_writer{client, true}("hello")));
+  EXPECT_EQ("hello", pdnnet::read(client, std::chrono::milliseconds{1000}));
+  server.stop();
+  thread.join();
+  // low watermark must be below the high watermark
+  EXPECT_THROW(
+    server.start(pdnnet::server_params{}.watermarks(low_, high_)),
+    std::invalid_argument
+  );
+}
+
+}  // namespace
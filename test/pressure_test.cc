@@ -0,0 +1,255 @@
+/**
+ * @file pressure_test.cc
+ * @author Derek Huang
+ * @brief pressure.hh unit tests
+ * @copyright MIT License
+ */
+
+#include "pdnnet/pressure.hh"
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "pdnnet/memory.hh"
+#include "pdnnet/server.hh"
+#include "pdnnet/socket.hh"
+
+namespace {
+
+/**
+ * `pressure_monitor` testing fixture.
+ *
+ * Writes fake cgroup and PSI files to a temporary directory.
+ */
+class PressureTest : public ::testing::Test {
+protected:
+  /**
+   * Create the directory and write files for an unpressured cgroup.
+   */
+  void SetUp() override
+  {
+    dir_ = std::filesystem::path{::testing::TempDir()} /
+      ("pdnnet_pressure_test_" + std::to_string(std::hash<std::thread::id>{}(
+        std::this_thread::get_id())));
+    std::filesystem::create_directories(dir_);
+    write("memory.current", "100000\n");
+    write("memory.high", "max\n");
+    write("memory.max", "1000000\n");
+    set_psi("memory", 0.);
+    set_psi("cpu", 0.);
+  }
+
+  /**
+   * Remove the directory.
+   */
+  void TearDown() override
+  {
+    std::filesystem::remove_all(dir_);
+  }
+
+  /**
+   * Write a file with the given contents.
+   *
+   * @param name File name
+   * @param text File contents
+   */
+  void write(const std::string& name, const std::string& text)
+  {
+    std::ofstream{dir_ / name} << text;
+  }
+
+  /**
+   * Write a PSI file with the given 10 second `some` average.
+   *
+   * @param name File name
+   * @param avg10 10 second `some` stall percentage
+   */
+  void set_psi(const std::string& name, double avg10)
+  {
+    write(
+      name,
+      "some avg10=" + std::to_string(avg10) + " avg60=1.50 avg300=0.25 total=1234\n"
+      "full avg10=0.00 avg60=0.00 avg300=0.00 total=56\n"
+    );
+  }
+
+  std::filesystem::path dir_;
+};
+
+/**
+ * Test parsing of PSI and cgroup memory files.
+ */
+TEST_F(PressureTest, ParseTest)
+{
+  set_psi("memory", 12.5);
+  pdnnet::psi_stats psi;
+  auto err = pdnnet::read_psi((dir_ / "memory").string(), psi);
+  ASSERT_FALSE(err) << *err;
+  EXPECT_DOUBLE_EQ(12.5, psi.some_avg10);
+  EXPECT_DOUBLE_EQ(1.5, psi.some_avg60);
+  EXPECT_EQ(1234U, psi.some_total);
+  EXPECT_EQ(56U, psi.full_total);
+  pdnnet::cgroup_memory mem;
+  err = pdnnet::read_cgroup_memory(dir_.string(), mem);
+  ASSERT_FALSE(err) << *err;
+  EXPECT_EQ(100000U, mem.current);
+  EXPECT_EQ(0U, mem.high);
+  EXPECT_EQ(1000000U, mem.limit());
+  EXPECT_DOUBLE_EQ(0.1, mem.usage());
+  // malformed and missing files
+  write("cpu", "some avg10=abc\n");
+  EXPECT_TRUE(pdnnet::read_psi((dir_ / "cpu").string(), psi));
+  EXPECT_TRUE(pdnnet::read_psi((dir_ / "missing").string(), psi));
+}
+
+/**
+ * Test that rising pressure scales down pools, reads, and concurrency.
+ */
+TEST_F(PressureTest, LevelTest)
+{
+  pdnnet::buffer_pool pool{64U, 16U};
+  pdnnet::pressure_monitor monitor{dir_.string(), dir_.string()};
+  monitor.manage(pool);
+  auto err = monitor.sample();
+  ASSERT_FALSE(err) << *err;
+  EXPECT_EQ(pdnnet::pressure_level::none, monitor.level());
+  EXPECT_EQ(16U, pool.max_free());
+  EXPECT_EQ(8192U, monitor.read_size(8192U));
+  EXPECT_EQ(8U, monitor.max_concurrency(8U));
+  // usage near memory.high, which is lower than memory.max
+  write("memory.high", "110000\n");
+  ASSERT_FALSE(monitor.sample());
+  EXPECT_EQ(pdnnet::pressure_level::high, monitor.memory_level());
+  EXPECT_EQ(4U, pool.max_free());
+  EXPECT_EQ(2048U, monitor.read_size(8192U));
+  EXPECT_EQ(2U, monitor.max_concurrency(8U));
+  EXPECT_FALSE(monitor.shed());
+  // memory stalls push memory pressure to critical
+  set_psi("memory", 75.);
+  ASSERT_FALSE(monitor.sample());
+  EXPECT_EQ(pdnnet::pressure_level::critical, monitor.memory_level());
+  EXPECT_EQ(1U, monitor.max_concurrency(8U));
+  EXPECT_EQ(1024U, monitor.read_size(8192U));
+  EXPECT_EQ(512U, monitor.read_size(2048U));
+  EXPECT_TRUE(monitor.shed());
+  // CPU pressure only lowers concurrency
+  write("memory.high", "max\n");
+  set_psi("memory", 0.);
+  set_psi("cpu", 50.);
+  ASSERT_FALSE(monitor.sample());
+  EXPECT_EQ(pdnnet::pressure_level::none, monitor.memory_level());
+  EXPECT_EQ(pdnnet::pressure_level::moderate, monitor.cpu_level());
+  EXPECT_EQ(16U, pool.max_free());
+  EXPECT_EQ(8192U, monitor.read_size(8192U));
+  EXPECT_EQ(4U, monitor.max_concurrency(8U));
+  // update is rate limited
+  monitor.interval(std::chrono::milliseconds{60000});
+  auto n_samples = monitor.n_samples();
+  EXPECT_FALSE(monitor.update());
+  EXPECT_EQ(n_samples, monitor.n_samples());
+  monitor.unmanage(pool);
+}
+
+/**
+ * Test that unavailable sources are ignored.
+ */
+TEST_F(PressureTest, UnavailableTest)
+{
+  pdnnet::pressure_monitor monitor{"", (dir_ / "missing").string()};
+  auto err = monitor.sample();
+  ASSERT_FALSE(err) << *err;
+  EXPECT_EQ(pdnnet::pressure_level::none, monitor.level());
+  EXPECT_EQ(1U, monitor.n_samples());
+}
+
+/**
+ * Server that echoes a single byte per connection.
+ */
+class byte_server : public pdnnet::reuseport_server {
+protected:
+  bool serve(pdnnet::unique_socket& cli_socket, unsigned int /*worker*/) override
+  {
+    pdnnet::socket_writer{cli_socket}("x");
+    return true;
+  }
+};
+
+/**
+ * Test that servers close connections unserved at critical memory pressure.
+ */
+TEST_F(PressureTest, ShedTest)
+{
+  write("memory.current", "990000\n");
+  pdnnet::pressure_monitor monitor{dir_.string(), dir_.string()};
+  monitor.interval(std::chrono::milliseconds{});
+  byte_server server;
+  server.start(
+    pdnnet::server_params{}.max_concurrency(1U).pressure(&monitor), true
+  );
+  while (!server.running())
+    std::this_thread::yield();
+  auto connect_read = [&server]
+  {
+    pdnnet::unique_socket socket{AF_INET, SOCK_STREAM};
+    auto addr = pdnnet::make_sockaddr_in(INADDR_LOOPBACK, server.port());
+    EXPECT_TRUE(pdnnet::connect(socket, addr)) << pdnnet::socket_error();
+    return pdnnet::read(socket, std::chrono::milliseconds{1000});
+  };
+  // shed at critical pressure
+  EXPECT_EQ("", connect_read());
+  EXPECT_EQ(1U, server.n_shed());
+  // served once pressure subsides
+  write("memory.current", "100000\n");
+  EXPECT_EQ("x", connect_read());
+  EXPECT_EQ(1U, server.n_shed());
+  server.stop();
+  server.join();
+}
+
+/**
+ * Server that replies with the read size it would serve a connection with.
+ */
+class read_size_server : public pdnnet::reuseport_server {
+protected:
+  bool serve(pdnnet::unique_socket& cli_socket, unsigned int /*worker*/) override
+  {
+    pdnnet::socket_writer{cli_socket}(std::to_string(read_size()));
+    return true;
+  }
+};
+
+/**
+ * Test that servers scale their read size down under memory pressure.
+ */
+TEST_F(PressureTest, ServerReadSizeTest)
+{
+  pdnnet::pressure_monitor monitor{dir_.string(), dir_.string()};
+  monitor.interval(std::chrono::milliseconds{});
+  read_size_server server;
+  server.start(
+    pdnnet::server_params{}.max_concurrency(1U).read_size(8192U).pressure(&monitor),
+    true
+  );
+  while (!server.running())
+    std::this_thread::yield();
+  auto connect_read = [&server]
+  {
+    pdnnet::unique_socket socket{AF_INET, SOCK_STREAM};
+    auto addr = pdnnet::make_sockaddr_in(INADDR_LOOPBACK, server.port());
+    EXPECT_TRUE(pdnnet::connect(socket, addr)) << pdnnet::socket_error();
+    return pdnnet::read(socket, std::chrono::milliseconds{1000});
+  };
+  EXPECT_EQ("8192", connect_read());
+  // usage near memory.high
+  write("memory.high", "110000\n");
+  EXPECT_EQ("2048", connect_read());
+  server.stop();
+  server.join();
+}
+
+}  // namespace
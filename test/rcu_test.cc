@@ -0,0 +1,143 @@
+/**
+ * @file rcu_test.cc
+ * @author Derek Huang
+ * @brief rcu.hh unit tests
+ * @copyright MIT License
+ */
+
+#include "pdnnet/rcu.hh"
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace {
+
+/**
+ * Value counting its live instances.
+ */
+struct tracked {
+  static inline std::atomic<int> n_live{};
+
+  tracked(int value = 0) : value{value} { n_live++; }
+  tracked(const tracked& other) : value{other.value} { n_live++; }
+  ~tracked() { n_live--; }
+
+  int value;
+};
+
+/**
+ * Test that readers see updates and that a snapshot outlives its update.
+ */
+TEST(RcuTest, SnapshotTest)
+{
+  pdnnet::rcu_domain domain;
+  {
+    pdnnet::rcu_cell<tracked> cell{domain, tracked{1}};
+    pdnnet::rcu_reader reader{domain};
+    EXPECT_EQ(1U, domain.n_readers());
+    {
+      auto snapshot = cell.read(reader);
+      EXPECT_TRUE(reader.locked());
+      EXPECT_EQ(1, snapshot->value);
+      cell.update(tracked{2});
+      // the old version is still held by the snapshot
+      EXPECT_EQ(1, snapshot->value);
+      EXPECT_EQ(1U, cell.n_retired());
+      EXPECT_EQ(2, tracked::n_live);
+    }
+    EXPECT_FALSE(reader.locked());
+    EXPECT_EQ(0U, cell.reclaim());
+    EXPECT_EQ(1U, cell.n_reclaimed());
+    EXPECT_EQ(1, tracked::n_live);
+    EXPECT_EQ(2, cell.read(reader)->value);
+    // copy-on-write modification
+    cell.modify([](tracked& t) { t.value++; });
+    EXPECT_EQ(3, cell.read(reader)->value);
+    EXPECT_EQ(2U, cell.n_updates());
+    EXPECT_EQ(0U, cell.n_retired());
+  }
+  EXPECT_EQ(0, tracked::n_live);
+  EXPECT_EQ(0U, domain.n_readers());
+}
+
+/**
+ * Test that a reader entering after an update does not hold back reclamation.
+ */
+TEST(RcuTest, GracePeriodTest)
+{
+  pdnnet::rcu_domain domain;
+  pdnnet::rcu_cell<int> cell{domain, 1};
+  pdnnet::rcu_reader old_reader{domain};
+  pdnnet::rcu_reader new_reader{domain};
+  old_reader.lock();
+  cell.update(2);
+  cell.update(3);
+  {
+    // nested critical section keeps the original epoch
+    auto nested = cell.read(old_reader);
+    EXPECT_EQ(3, *nested);
+  }
+  EXPECT_TRUE(old_reader.locked());
+  auto fresh = cell.read(new_reader);
+  EXPECT_EQ(3, *fresh);
+  EXPECT_EQ(2U, cell.reclaim());
+  old_reader.unlock();
+  EXPECT_EQ(0U, cell.reclaim());
+  EXPECT_EQ(2U, cell.n_reclaimed());
+}
+
+/**
+ * Test that concurrent readers always see a consistent version.
+ */
+TEST(RcuTest, ConcurrentTest)
+{
+  // each version holds n copies of the same value
+  using version = std::vector<std::size_t>;
+  constexpr std::size_t n_values = 64U;
+  constexpr std::size_t n_versions = 2000U;
+  pdnnet::rcu_domain domain;
+  pdnnet::rcu_cell<version> cell{domain, version(n_values, 0U)};
+  std::atomic<bool> done{};
+  std::atomic<std::size_t> n_torn{};
+  std::atomic<std::size_t> n_reads{};
+  std::vector<std::thread> readers;
+  for (int i = 0; i < 4; i++)
+    readers.emplace_back(
+      [&]
+      {
+        pdnnet::rcu_reader reader{domain};
+        std::size_t last = 0;
+        while (!done) {
+          auto snapshot = cell.read(reader);
+          auto first = snapshot->front();
+          for (auto value : *snapshot)
+            if (value != first)
+              n_torn++;
+          // versions never go backwards
+          if (first < last)
+            n_torn++;
+          last = first;
+          n_reads++;
+        }
+      }
+    );
+  for (std::size_t i = 1; i <= n_versions; i++)
+    cell.update(version(n_values, i));
+  done = true;
+  for (auto& reader : readers)
+    reader.join();
+  cell.synchronize();
+  EXPECT_EQ(0U, n_torn);
+  EXPECT_LT(0U, n_reads);
+  EXPECT_EQ(n_versions, cell.n_updates());
+  EXPECT_EQ(n_versions, cell.n_reclaimed());
+  EXPECT_EQ(0U, cell.n_retired());
+}
+
+}  // namespace
@@ -0,0 +1,100 @@
+/**
+ * @file record_test.cc
+ * @author Derek Huang
+ * @brief record.hh unit tests
+ * @copyright MIT License
+ */
+
+#include "pdnnet/record.hh"
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include <gtest/gtest.h>
+
+#include "pdnnet/endian.hh"
+#include "pdnnet/memory.hh"
+
+namespace {
+
+/**
+ * Test that built records can be parsed and their fields read in place.
+ */
+TEST(RecordTest, RoundTripTest)
+{
+  pdnnet::buffer_pool pool{256U};
+  pdnnet::record_builder builder{5U, 42U, pool};
+  auto bytes = builder
+    .add(std::uint64_t{1234567890123U})
+    .add("alice")
+    .add(-7)
+    .add(2.5)
+    .finish();
+  pdnnet::record_view view;
+  auto err = pdnnet::parse_record(bytes.data(), bytes.size(), view);
+  ASSERT_FALSE(err) << *err;
+  EXPECT_EQ(bytes.size(), view.size());
+  EXPECT_EQ(42U, view.schema());
+  EXPECT_EQ(5U, view.n_fields());
+  EXPECT_EQ(1234567890123U, view.get<std::uint64_t>(0));
+  EXPECT_EQ("alice", view.string(1));
+  EXPECT_EQ(-7, view.get<int>(2));
+  EXPECT_EQ(2.5, view.get<double>(3));
+  // field not appended is empty
+  EXPECT_EQ(0U, view.field_size(4));
+  // accessors reference the builder buffer directly
+  EXPECT_EQ(bytes.data(), reinterpret_cast<const char*>(view.data()));
+  // wrong type size or index
+  EXPECT_THROW(view.get<std::uint32_t>(0), std::out_of_range);
+  EXPECT_THROW(view.string(5), std::out_of_range);
+  EXPECT_THROW(builder.add(1), std::out_of_range);
+}
+
+/**
+ * Test that records larger than the pooled buffer grow and stay intact.
+ */
+TEST(RecordTest, GrowTest)
+{
+  pdnnet::buffer_pool pool{32U};
+  std::string large(100U, 'x');
+  {
+    pdnnet::record_builder builder{2U, 0U, pool};
+    auto bytes = builder.add("head").add(large).finish();
+    pdnnet::record_view view;
+    ASSERT_FALSE(pdnnet::parse_record(bytes.data(), bytes.size(), view));
+    EXPECT_EQ("head", view.string(0));
+    EXPECT_EQ(large, view.string(1));
+    // pooled buffer was returned when the builder grew
+    EXPECT_EQ(1U, pool.n_free());
+  }
+  // larger buffer is not pooled
+  EXPECT_EQ(1U, pool.n_free());
+}
+
+/**
+ * Test that malformed records are rejected.
+ */
+TEST(RecordTest, MalformedTest)
+{
+  pdnnet::record_builder builder{2U};
+  std::string bytes{builder.add("ab").add("cd").finish()};
+  pdnnet::record_view view;
+  // truncated
+  EXPECT_TRUE(pdnnet::parse_record(bytes.data(), 4U, view));
+  EXPECT_TRUE(pdnnet::parse_record(bytes.data(), bytes.size() - 1U, view));
+  // field offsets out of order
+  auto bad = bytes;
+  pdnnet::store_le(bad.data() + pdnnet::record_header_size + 4U, std::uint32_t{100U});
+  EXPECT_TRUE(pdnnet::parse_record(bad.data(), bad.size(), view));
+  // field count too large for record size
+  bad = bytes;
+  pdnnet::store_le(bad.data() + 6U, std::uint16_t{1000U});
+  EXPECT_TRUE(pdnnet::parse_record(bad.data(), bad.size(), view));
+  // trailing data after record is allowed
+  ASSERT_FALSE(pdnnet::parse_record((bytes + "tail").data(), bytes.size() + 4U, view));
+  EXPECT_EQ(bytes.size(), view.size());
+}
+
+}  // namespace
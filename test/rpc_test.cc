@@ -0,0 +1,281 @@
+/**
+ * @file rpc_test.cc
+ * @author Derek Huang
+ * @brief rpc.hh unit tests
+ * @copyright MIT License
+ */
+
+#include "pdnnet/rpc.hh"
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "pdnnet/deadline.hh"
+#include "pdnnet/error.hh"
+#include "pdnnet/platform.h"
+#include "pdnnet/socket.hh"
+
+#include "loopback.hh"
+
+namespace {
+
+/**
+ * RPC testing fixture.
+ *
+ * Serves one RPC session over a loopback connection. Requests are of the form
+ * "<delay ms>:<text>" and are answered with the text after the delay, or with
+ * an error if the text is "fail".
+ */
+class RpcTest : public ::testing::Test {
+protected:
+  /**
+   * Ignore `SIGPIPE` in case the session writes after the client closes.
+   */
+  static void SetUpTestSuite()
+  {
+#ifdef PDNNET_UNIX
+    std::signal(SIGPIPE, SIG_IGN);
+#endif  // PDNNET_UNIX
+  }
+
+  /**
+   * Connect the client socket to a session running on a server thread.
+   */
+  void SetUp() override
+  {
+    std::tie(socket_, server_socket_) = pdnnet::test::loopback_pair();
+    session_ = std::make_unique<pdnnet::rpc_session>(
+      server_socket_, &RpcTest::handle, 4U
+    );
+    server_ = std::thread{[this] { session_err_ = session_->run(); }};
+  }
+
+  /**
+   * End the session and join the server thread.
+   */
+  void TearDown() override
+  {
+    // may fail if the connection was already torn down
+    try { pdnnet::shutdown(socket_, pdnnet::shutdown_type::write); }
+    catch (const std::runtime_error&) {}
+    server_.join();
+    EXPECT_FALSE(session_err_) << *session_err_;
+  }
+
+  /**
+   * Handle a test request.
+   *
+   * @param request Request of the form "<delay ms>:<text>"
+   * @param response Response to write
+   * @param ctx Call context
+   */
+  static pdnnet::optional_error handle(
+    std::string_view request, std::string& response, pdnnet::rpc_context& ctx)
+  {
+    auto colon = request.find(':');
+    auto delay = std::chrono::milliseconds{
+      std::stoi(std::string{request.substr(0, colon)})
+    };
+    auto start = std::chrono::steady_clock::now();
+    while (std::chrono::steady_clock::now() - start < delay) {
+      if (ctx.cancelled())
+        return "cancelled";
+      std::this_thread::sleep_for(std::chrono::milliseconds{1});
+    }
+    auto text = request.substr(colon + 1);
+    if (text == "fail")
+      return "handler failed";
+    response = text;
+    return {};
+  }
+
+  pdnnet::unique_socket socket_;
+  pdnnet::unique_socket server_socket_;
+  std::unique_ptr<pdnnet::rpc_session> session_;
+  pdnnet::optional_error session_err_;
+  std::thread server_;
+};
+
+/**
+ * Test that a single call round trips.
+ */
+TEST_F(RpcTest, CallTest)
+{
+  pdnnet::rpc_client client{socket_};
+  pdnnet::deadline deadline{std::chrono::milliseconds{1000}};
+  std::string response;
+  auto err = client.call("0:hello", response, deadline);
+  ASSERT_FALSE(err) << *err;
+  EXPECT_EQ("hello", response);
+  err = client.call("0:fail", response, deadline);
+  ASSERT_TRUE(err);
+  EXPECT_EQ("handler failed", *err);
+  EXPECT_EQ(0U, client.n_pending());
+  EXPECT_EQ(2U, client.n_calls());
+}
+
+/**
+ * Test that a fast call is not blocked behind a slow one.
+ */
+TEST_F(RpcTest, OutOfOrderTest)
+{
+  pdnnet::rpc_client client{socket_};
+  std::uint64_t slow_id;
+  auto err = client.start("300:slow", slow_id);
+  ASSERT_FALSE(err) << *err;
+  std::string response;
+  auto start = std::chrono::steady_clock::now();
+  pdnnet::deadline fast_deadline{std::chrono::milliseconds{1000}};
+  err = client.call("0:fast", response, fast_deadline);
+  auto fast_elapsed = std::chrono::steady_clock::now() - start;
+  ASSERT_FALSE(err) << *err;
+  EXPECT_EQ("fast", response);
+  EXPECT_LT(fast_elapsed, std::chrono::milliseconds{200});
+  EXPECT_EQ(1U, client.n_pending());
+  pdnnet::deadline slow_deadline{std::chrono::milliseconds{2000}};
+  err = client.wait(slow_id, response, slow_deadline);
+  ASSERT_FALSE(err) << *err;
+  EXPECT_EQ("slow", response);
+}
+
+/**
+ * Test concurrent calls from many threads over the same connection.
+ */
+TEST_F(RpcTest, ConcurrentTest)
+{
+  pdnnet::rpc_client client{socket_};
+  std::atomic<unsigned int> n_ok{};
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 8; i++)
+    threads.emplace_back(
+      [&client, &n_ok, i]
+      {
+        for (int j = 0; j < 10; j++) {
+          auto text = std::to_string(i) + "." + std::to_string(j);
+          pdnnet::deadline deadline{std::chrono::milliseconds{2000}};
+          std::string response;
+          if (!client.call(std::to_string(j % 3) + ":" + text, response, deadline) &&
+            response == text)
+            n_ok++;
+        }
+      }
+    );
+  for (auto& thread : threads)
+    thread.join();
+  EXPECT_EQ(80U, n_ok);
+  EXPECT_EQ(80U, session_->n_requests());
+}
+
+/**
+ * Test that waiting survives calls started concurrently by other threads.
+ */
+TEST_F(RpcTest, WaitRehashTest)
+{
+  pdnnet::rpc_client client{socket_};
+  std::uint64_t id;
+  ASSERT_FALSE(client.start("200:waited", id));
+  pdnnet::optional_error err;
+  std::string response;
+  std::thread waiter{
+    [&]
+    {
+      pdnnet::deadline deadline{std::chrono::milliseconds{5000}};
+      err = client.wait(id, response, deadline);
+    }
+  };
+  // grow the pending calls enough to rehash while the waiter is blocked
+  std::vector<std::uint64_t> ids(256U);
+  for (auto& other : ids)
+    ASSERT_FALSE(client.start("0:other", other));
+  waiter.join();
+  ASSERT_FALSE(err) << *err;
+  EXPECT_EQ("waited", response);
+  for (auto other : ids) {
+    pdnnet::deadline deadline{std::chrono::milliseconds{5000}};
+    ASSERT_FALSE(client.wait(other, response, deadline));
+    EXPECT_EQ("other", response);
+  }
+}
+
+/**
+ * Test that cancelling a call from another thread ends the wait for it.
+ */
+TEST_F(RpcTest, WaitCancelTest)
+{
+  pdnnet::rpc_client client{socket_};
+  std::uint64_t id;
+  ASSERT_FALSE(client.start("5000:cancelled", id));
+  pdnnet::optional_error err;
+  std::thread waiter{
+    [&]
+    {
+      pdnnet::deadline deadline{std::chrono::milliseconds{5000}};
+      std::string response;
+      err = client.wait(id, response, deadline);
+    }
+  };
+  std::this_thread::sleep_for(std::chrono::milliseconds{20});
+  ASSERT_FALSE(client.cancel(id));
+  waiter.join();
+  // unless the waiter was slow to start, it was waiting when cancelled
+  EXPECT_TRUE(err);
+  EXPECT_EQ(0U, client.n_pending());
+}
+
+/**
+ * Test that an expired call is cancelled on the server.
+ */
+TEST_F(RpcTest, TimeoutTest)
+{
+  pdnnet::rpc_client client{socket_};
+  pdnnet::deadline deadline{std::chrono::milliseconds{20}};
+  std::string response;
+  auto err = client.call("5000:late", response, deadline);
+  ASSERT_TRUE(err);
+  EXPECT_NE(std::string::npos, err->find("exceeded")) << *err;
+  EXPECT_EQ(1U, client.n_cancelled());
+  EXPECT_EQ(0U, client.n_pending());
+  // cancellation stops the handler long before its delay ends
+  auto start = std::chrono::steady_clock::now();
+  while (
+    !session_->n_cancelled() &&
+    std::chrono::steady_clock::now() - start < std::chrono::seconds{2}
+  )
+    std::this_thread::sleep_for(std::chrono::milliseconds{1});
+  EXPECT_EQ(1U, session_->n_cancelled());
+  // connection is still usable
+  pdnnet::deadline next_deadline{std::chrono::milliseconds{1000}};
+  err = client.call("0:next", response, next_deadline);
+  ASSERT_FALSE(err) << *err;
+  EXPECT_EQ("next", response);
+}
+
+/**
+ * Test that pending calls fail when the server goes away.
+ */
+TEST_F(RpcTest, DisconnectTest)
+{
+  pdnnet::rpc_client client{socket_};
+  std::uint64_t id;
+  ASSERT_FALSE(client.start("100:gone", id));
+  // closing the server side fails the pending call
+  pdnnet::shutdown(server_socket_, pdnnet::shutdown_type::read_write);
+  pdnnet::deadline deadline{std::chrono::milliseconds{2000}};
+  std::string response;
+  auto err = client.wait(id, response, deadline);
+  ASSERT_TRUE(err);
+  EXPECT_TRUE(client.error());
+  EXPECT_TRUE(client.start("0:after", id));
+}
+
+}  // namespace
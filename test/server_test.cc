@@ -0,0 +1,242 @@
+/**
+ * @file server_test.cc
+ * @author Derek Huang
+ * @brief server.hh unit tests
+ * @copyright MIT License
+ */
+
+#include "pdnnet/server.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "pdnnet/platform.h"
+#include "pdnnet/process.hh"
+#include "pdnnet/socket.hh"
+
+#ifdef PDNNET_LINUX
+#include <pthread.h>
+#include <sched.h>
+#endif  // PDNNET_LINUX
+
+namespace {
+
+/**
+ * Return a listener handler that writes a reply and closes the connection.
+ *
+ * @param reply Reply to write
+ */
+auto reply_handler(std::string reply)
+{
+  return [reply](pdnnet::unique_socket& cli_socket)
+  {
+    return !pdnnet::socket_writer{cli_socket}(reply);
+  };
+}
+
+/**
+ * Connect to a loopback port and read until the peer closes.
+ *
+ * @param port Port number in host byte order
+ */
+auto fetch(pdnnet::inet_port_type port)
+{
+  pdnnet::unique_socket socket{AF_INET, SOCK_STREAM};
+  auto addr = pdnnet::make_sockaddr_in(INADDR_LOOPBACK, port);
+  if (!pdnnet::connect(socket, addr))
+    throw std::runtime_error{pdnnet::socket_error("Could not connect")};
+  return pdnnet::read(socket, std::chrono::milliseconds{1000});
+}
+
+/**
+ * Server whose data plane blocks serving a client until released.
+ */
+class stalled_server : public pdnnet::ipv4_server {
+public:
+  /**
+   * Return number of clients currently being served.
+   */
+  auto n_serving() const noexcept { return n_serving_.load(); }
+
+  /**
+   * Let the stalled client finish.
+   */
+  void release() noexcept { released_ = true; }
+
+protected:
+  bool serve(pdnnet::unique_socket& /*cli_socket*/) override
+  {
+    n_serving_++;
+    while (!released_ && running())
+      std::this_thread::sleep_for(std::chrono::milliseconds{1});
+    n_serving_--;
+    return true;
+  }
+
+private:
+  std::atomic<unsigned int> n_serving_{};
+  std::atomic<bool> released_{};
+};
+
+/**
+ * Test that an isolated listener answers while the data plane is stalled.
+ */
+TEST(ServerTest, IsolatedListenerTest)
+{
+  stalled_server server;
+  server.start(
+    pdnnet::server_params{}
+      .max_pending(1U)
+      .listener("health", 0, reply_handler("ok"))
+      .listener("admin", 0, [](pdnnet::unique_socket&) { return false; }),
+    true
+  );
+  while (!server.running())
+    std::this_thread::yield();
+  const auto& listeners = server.isolated_listeners();
+  ASSERT_EQ(2U, listeners.size());
+  EXPECT_EQ("health", listeners[0]->name());
+  EXPECT_NE(0U, listeners[0]->port());
+  EXPECT_NE(server.port(), listeners[0]->port());
+  // saturate the data plane
+  pdnnet::unique_socket client{AF_INET, SOCK_STREAM};
+  ASSERT_TRUE(
+    pdnnet::connect(client, pdnnet::make_sockaddr_in(INADDR_LOOPBACK, server.port()))
+  ) << pdnnet::socket_error();
+  while (!server.n_serving())
+    std::this_thread::yield();
+  // health checks are still answered
+  for (int i = 0; i < 3; i++)
+    EXPECT_EQ("ok", fetch(listeners[0]->port()));
+  EXPECT_EQ(3U, listeners[0]->n_served());
+  // handler errors are counted without stopping the listener
+  EXPECT_EQ("", fetch(listeners[1]->port()));
+  EXPECT_EQ("", fetch(listeners[1]->port()));
+  EXPECT_EQ(0U, listeners[1]->n_served());
+  EXPECT_EQ(2U, listeners[1]->n_errors());
+  server.release();
+  server.stop();
+  server.join();
+  EXPECT_TRUE(server.isolated_listeners().empty());
+}
+
+/**
+ * Server with per-CPU listeners that replies with its worker index.
+ */
+class worker_server : public pdnnet::reuseport_server {
+protected:
+  bool serve(pdnnet::unique_socket& cli_socket, unsigned int worker) override
+  {
+    return !pdnnet::socket_writer{cli_socket}(std::to_string(worker));
+  }
+};
+
+/**
+ * Test that a reuseport server also starts its isolated listeners.
+ */
+TEST(ServerTest, ReuseportListenerTest)
+{
+  worker_server server;
+  server.start(
+    pdnnet::server_params{}
+      .max_concurrency(2U)
+      .listener("health", 0, reply_handler("ok")),
+    true
+  );
+  while (!server.running())
+    std::this_thread::yield();
+  ASSERT_EQ(1U, server.isolated_listeners().size());
+  EXPECT_EQ("ok", fetch(server.isolated_listeners()[0]->port()));
+  auto worker = fetch(server.port());
+  EXPECT_TRUE(worker == "0" || worker == "1") << worker;
+  server.stop();
+  server.join();
+}
+
+/**
+ * Test that a reuseport server steering by CPU serves every connection.
+ */
+TEST(ServerTest, ReuseportAffinityTest)
+{
+#if defined(PDNNET_LINUX)
+  // one worker per CPU, each pinned to its CPU
+  auto n_workers = (std::max)(1U, (std::min)(std::thread::hardware_concurrency(), 4U));
+  worker_server server;
+  server.start(
+    pdnnet::server_params{}.max_concurrency(n_workers).cpu_affinity(true), true
+  );
+  while (!server.running())
+    std::this_thread::yield();
+  EXPECT_TRUE(server.cpu_affinity());
+  EXPECT_EQ(n_workers, server.n_workers());
+  for (int i = 0; i < 8; i++) {
+    auto worker = fetch(server.port());
+    ASSERT_FALSE(worker.empty());
+    EXPECT_LT(std::stoul(worker), n_workers) << worker;
+  }
+  server.stop();
+  server.join();
+  EXPECT_EQ(8U, server.n_accepted());
+  EXPECT_LE(server.n_cpu_mismatch(), server.n_accepted());
+#else
+  GTEST_SKIP() << "CPU affinity is only supported on Linux";
+#endif  // !defined(PDNNET_LINUX)
+}
+
+/**
+ * Test that the reuseport CPU filter attaches only where it is supported.
+ */
+TEST(ServerTest, ReuseportFilterTest)
+{
+  pdnnet::unique_socket listener{AF_INET, SOCK_STREAM};
+  auto reuseport = pdnnet::set_reuseport(listener, true);
+  auto addr = pdnnet::make_sockaddr_in(INADDR_LOOPBACK, 0);
+  ASSERT_TRUE(pdnnet::bind(listener, addr)) << pdnnet::socket_error();
+  ASSERT_TRUE(pdnnet::listen(listener, 1U)) << pdnnet::socket_error();
+  // an empty group is always rejected
+  EXPECT_FALSE(pdnnet::attach_reuseport_cpu_filter(listener, 0U));
+#if defined(PDNNET_LINUX)
+  ASSERT_TRUE(reuseport) << pdnnet::socket_error();
+  EXPECT_TRUE(pdnnet::attach_reuseport_cpu_filter(listener, 2U))
+    << pdnnet::socket_error();
+#else
+  (void) reuseport;
+  EXPECT_FALSE(pdnnet::attach_reuseport_cpu_filter(listener, 2U));
+#endif  // !defined(PDNNET_LINUX)
+}
+
+/**
+ * Test that a thread can be pinned to CPU 0.
+ */
+TEST(ServerTest, PinThreadTest)
+{
+  // pin a separate thread so the test runner's affinity is untouched
+  std::thread thread{
+    []
+    {
+      auto err = pdnnet::pin_thread(0U);
+#if defined(PDNNET_LINUX) || defined(_WIN32)
+      ASSERT_FALSE(err) << *err;
+#if defined(PDNNET_LINUX)
+      cpu_set_t cpus;
+      CPU_ZERO(&cpus);
+      ASSERT_FALSE(pthread_getaffinity_np(pthread_self(), sizeof cpus, &cpus));
+      EXPECT_EQ(1, CPU_COUNT(&cpus));
+      EXPECT_TRUE(CPU_ISSET(0, &cpus));
+      EXPECT_EQ(0, sched_getcpu());
+      EXPECT_TRUE(pdnnet::pin_thread(CPU_SETSIZE));
+#endif  // defined(PDNNET_LINUX)
+#else
+      EXPECT_TRUE(err);
+#endif  // !defined(PDNNET_LINUX) && !defined(_WIN32)
+    }
+  };
+  thread.join();
+}
+
+}  // namespace
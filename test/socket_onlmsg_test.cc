@@ -0,0 +1,185 @@
+/**
+ * @file socket_onlmsg_test.cc
+ * @author Derek Huang
+ * @brief pdnnet_socket_onlmsg unit tests
+ * @copyright MIT License
+ */
+
+#include "pdnnet/socket.h"
+
+#include <cerrno>
+#include <cstddef>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "pdnnet/socket.hh"
+
+#include "loopback.hh"
+
+namespace {
+
+/**
+ * Messages and read buffer sizes seen by `collect_msg`.
+ */
+struct collected {
+  std::vector<std::string> msgs;
+  std::size_t max_buf_size = 0;
+};
+
+/**
+ * Message action appending each message to a `collected`.
+ */
+PDNNET_SOCKET_ONLMSG_FUNC(collect_msg) noexcept
+{
+  auto out = static_cast<collected*>(data);
+  auto msg = static_cast<const char*>(state->msg);
+  // message is always null-terminated
+  if (msg[state->msg_size] != '\0')
+    return -EINVAL;
+  out->msgs.emplace_back(msg, state->msg_size);
+  if (state->buf_size > out->max_buf_size)
+    out->max_buf_size = state->buf_size;
+  return 0;
+}
+
+/**
+ * Message action that fails on the second message.
+ */
+PDNNET_SOCKET_ONLMSG_FUNC(fail_second_msg) noexcept
+{
+  (void) data;
+  return (state->n_msgs == 2) ? -ECANCELED : 0;
+}
+
+/**
+ * `pdnnet_socket_onlmsg` testing fixture.
+ *
+ * Creates a connected pair of loopback TCP sockets for each test.
+ */
+class SocketOnlmsgTest : public ::testing::Test {
+protected:
+  /**
+   * Connect the loopback socket pair.
+   */
+  void SetUp() override
+  {
+    std::tie(writer_socket_, reader_socket_) = pdnnet::test::loopback_pair();
+  }
+
+  /**
+   * Write bytes and signal end of transmission.
+   *
+   * @param data Bytes to write
+   */
+  void send(const std::string& data)
+  {
+    pdnnet::socket_writer{writer_socket_, true}(data).throw_on_error();
+  }
+
+  /**
+   * Return a message with a 4-byte big-endian length prefix.
+   *
+   * @param msg Message
+   */
+  static std::string prefixed(const std::string& msg)
+  {
+    auto size = msg.size();
+    std::string out{
+      static_cast<char>(size >> 24),
+      static_cast<char>(size >> 16),
+      static_cast<char>(size >> 8),
+      static_cast<char>(size)
+    };
+    return out + msg;
+  }
+
+  pdnnet::unique_socket writer_socket_;
+  pdnnet::unique_socket reader_socket_;
+};
+
+/**
+ * Test that delimited messages are delivered whole across read boundaries.
+ */
+TEST_F(SocketOnlmsgTest, DelimTest)
+{
+  std::string long_line(40U, 'x');
+  send("ab\ncdef\n\n" + long_line + "\nghi\ntail");
+  pdnnet_socket_msg_format format{PDNNET_SOCKET_MSG_DELIM, '\n', 0};
+  collected out;
+  ASSERT_EQ(0, pdnnet_socket_onlmsg(reader_socket_, 8U, &format, collect_msg, &out));
+  std::vector<std::string> expected{"ab", "cdef", "", long_line, "ghi", "tail"};
+  EXPECT_EQ(expected, out.msgs);
+  // buffer only grew to fit the one long message
+  EXPECT_GE(out.max_buf_size, long_line.size() + 1U);
+  EXPECT_LT(out.max_buf_size, 2U * (long_line.size() + 1U));
+}
+
+/**
+ * Test that length-prefixed messages are delivered without growing the buffer.
+ */
+TEST_F(SocketOnlmsgTest, PrefixTest)
+{
+  std::string binary{"binary\n\0data", 12U};
+  send(prefixed("hello") + prefixed("") + prefixed(binary));
+  pdnnet_socket_msg_format format{PDNNET_SOCKET_MSG_PREFIX, 0, 0};
+  collected out;
+  ASSERT_EQ(0, pdnnet_socket_onlmsg(reader_socket_, 16U, &format, collect_msg, &out));
+  std::vector<std::string> expected{"hello", "", binary};
+  EXPECT_EQ(expected, out.msgs);
+  EXPECT_EQ(16U, out.max_buf_size);
+}
+
+/**
+ * Test that a length-prefixed message cut off by end of transmission fails.
+ */
+TEST_F(SocketOnlmsgTest, TruncatedTest)
+{
+  send(prefixed("complete") + prefixed("partial").substr(0U, 6U));
+  pdnnet_socket_msg_format format{PDNNET_SOCKET_MSG_PREFIX, 0, 0};
+  collected out;
+  EXPECT_EQ(
+    -EBADMSG,
+    pdnnet_socket_onlmsg(reader_socket_, 4U, &format, collect_msg, &out)
+  );
+  ASSERT_EQ(1U, out.msgs.size());
+  EXPECT_EQ("complete", out.msgs[0]);
+}
+
+/**
+ * Test that messages over the max message size are rejected.
+ */
+TEST_F(SocketOnlmsgTest, MaxSizeTest)
+{
+  send("ok\n" + std::string(100U, 'y') + "\n");
+  pdnnet_socket_msg_format format{PDNNET_SOCKET_MSG_DELIM, '\n', 32U};
+  collected out;
+  EXPECT_EQ(
+    -EMSGSIZE,
+    pdnnet_socket_onlmsg(reader_socket_, 8U, &format, collect_msg, &out)
+  );
+  ASSERT_EQ(1U, out.msgs.size());
+  EXPECT_EQ("ok", out.msgs[0]);
+}
+
+/**
+ * Test that action errors stop the read and are returned.
+ */
+TEST_F(SocketOnlmsgTest, ActionErrorTest)
+{
+  send("a\nb\nc\n");
+  pdnnet_socket_msg_format format{PDNNET_SOCKET_MSG_DELIM, '\n', 0};
+  EXPECT_EQ(
+    -ECANCELED,
+    pdnnet_socket_onlmsg(reader_socket_, 64U, &format, fail_second_msg, nullptr)
+  );
+  // missing format
+  EXPECT_EQ(
+    -EINVAL,
+    pdnnet_socket_onlmsg(reader_socket_, 64U, nullptr, nullptr, nullptr)
+  );
+}
+
+}  // namespace
@@ -0,0 +1,221 @@
+/**
+ * @file source_address_test.cc
+ * @author Derek Huang
+ * @brief source_address.hh unit tests
+ * @copyright MIT License
+ */
+
+#include "pdnnet/source_address.hh"
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "pdnnet/client.hh"
+#include "pdnnet/deadline.hh"
+#include "pdnnet/platform.h"
+#include "pdnnet/socket.hh"
+
+#include "loopback.hh"
+
+namespace {
+
+/**
+ * Source address testing fixture.
+ *
+ * Provides a loopback listener and a temporary directory for `/proc` files.
+ */
+class SourceAddressTest : public ::testing::Test {
+protected:
+  /**
+   * Start the listener and create the temporary directory.
+   */
+  void SetUp() override
+  {
+    listener_ = pdnnet::test::loopback_listener(addr_, 16U, INADDR_ANY);
+    addr_.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    dir_ = std::filesystem::temp_directory_path() /
+      ("pdnnet_source_address_test_" + std::to_string(ntohs(addr_.sin_port)));
+    std::filesystem::create_directories(dir_);
+  }
+
+  /**
+   * Remove the temporary directory.
+   */
+  void TearDown() override { std::filesystem::remove_all(dir_); }
+
+  /**
+   * Write a file in the temporary directory, returning its path.
+   *
+   * @param name File name
+   * @param text File contents
+   */
+  std::string write_file(const std::string& name, const std::string& text)
+  {
+    auto path = (dir_ / name).string();
+    std::ofstream{path} << text;
+    return path;
+  }
+
+  /**
+   * Return the local address a socket is bound to.
+   *
+   * @param handle Socket handle
+   */
+  static auto local_addr(pdnnet::socket_handle handle)
+  {
+    sockaddr_in addr{};
+    EXPECT_TRUE(pdnnet::getsockname(handle, addr)) << pdnnet::socket_error();
+    return addr;
+  }
+
+  pdnnet::unique_socket listener_;
+  sockaddr_in addr_;
+  std::filesystem::path dir_;
+};
+
+/**
+ * Test parsing of sockstat and port range files.
+ */
+TEST_F(SourceAddressTest, ParseTest)
+{
+  auto sockstat = write_file(
+    "sockstat",
+    "sockets: used 27\n"
+    "TCP: inuse 13 orphan 1 tw 28000 alloc 15 mem 16\n"
+    "UDP: inuse 0 mem 0\n"
+  );
+  pdnnet::tcp_sockstat stats;
+  auto err = pdnnet::read_tcp_sockstat(sockstat, stats);
+  ASSERT_FALSE(err) << *err;
+  EXPECT_EQ(13U, stats.inuse);
+  EXPECT_EQ(1U, stats.orphan);
+  EXPECT_EQ(28000U, stats.tw);
+  EXPECT_EQ(15U, stats.alloc);
+  EXPECT_EQ(16U, stats.mem);
+  EXPECT_TRUE(pdnnet::read_tcp_sockstat(write_file("bad", "UDP: inuse 0\n"), stats));
+  auto range_file = write_file("ip_local_port_range", "32768\t60999\n");
+  pdnnet::port_range range;
+  err = pdnnet::read_local_port_range(range_file, range);
+  ASSERT_FALSE(err) << *err;
+  EXPECT_EQ(32768U, range.first);
+  EXPECT_EQ(60999U, range.last);
+  EXPECT_EQ(28232U, range.size());
+  EXPECT_TRUE(
+    pdnnet::read_local_port_range(write_file("bad_range", "60999 32768"), range)
+  );
+  pdnnet::source_metrics metrics;
+  metrics.time_wait = stats.tw;
+  metrics.in_use = stats.inuse;
+  metrics.port_capacity = range.size();
+  EXPECT_NEAR(28013. / 28232., metrics.port_usage(), 1e-9);
+  std::stringstream ss;
+  ss << metrics;
+  EXPECT_NE(std::string::npos, ss.str().find("time_wait=28000")) << ss.str();
+}
+
+#ifdef PDNNET_LINUX
+/**
+ * Test that connections are spread across the source addresses.
+ */
+TEST_F(SourceAddressTest, RotateTest)
+{
+  pdnnet::source_address_pool sources;
+  ASSERT_FALSE(sources.add("127.0.0.2"));
+  ASSERT_FALSE(sources.add("127.0.0.3"));
+  EXPECT_TRUE(sources.add("localhost"));
+  EXPECT_EQ(2U, sources.n_addresses());
+  pdnnet::deadline deadline{std::chrono::milliseconds{1000}};
+  std::vector<pdnnet::unique_socket> sockets;
+  for (auto expected : {"127.0.0.2", "127.0.0.3", "127.0.0.2"}) {
+    auto& socket = sockets.emplace_back(AF_INET, SOCK_STREAM);
+    auto err = sources.connect(socket, addr_, deadline);
+    ASSERT_FALSE(err) << *err;
+    char name[INET_ADDRSTRLEN];
+    auto local = local_addr(socket);
+    ASSERT_TRUE(::inet_ntop(AF_INET, &local.sin_addr, name, sizeof name));
+    EXPECT_EQ(expected, std::string{name});
+    EXPECT_NE(0U, ntohs(local.sin_port));
+  }
+  EXPECT_EQ(3U, sources.n_binds());
+  EXPECT_EQ(0U, sources.n_exhausted());
+  auto metrics = sources.metrics();
+  EXPECT_EQ(3U, metrics.n_binds);
+  EXPECT_LT(0U, metrics.port_capacity);
+}
+
+/**
+ * Test that an explicit port range is used and its exhaustion is counted.
+ */
+TEST_F(SourceAddressTest, PortRangeTest)
+{
+  // find two free ports by letting the kernel pick them
+  pdnnet::inet_port_type ports[2];
+  for (auto& port : ports) {
+    pdnnet::unique_socket probe{AF_INET, SOCK_STREAM};
+    ASSERT_TRUE(pdnnet::bind(probe, pdnnet::make_sockaddr_in(INADDR_LOOPBACK, 0)));
+    port = ntohs(local_addr(probe).sin_port);
+  }
+  // with a single port only one connection to the listener is possible
+  pdnnet::source_address_pool sources;
+  sources.add(INADDR_LOOPBACK);
+  sources.ports({ports[0], ports[0]});
+  pdnnet::deadline deadline{std::chrono::milliseconds{1000}};
+  pdnnet::unique_socket first{AF_INET, SOCK_STREAM};
+  auto err = sources.connect(first, addr_, deadline);
+  ASSERT_FALSE(err) << *err;
+  EXPECT_EQ(ports[0], ntohs(local_addr(first).sin_port));
+  pdnnet::unique_socket second{AF_INET, SOCK_STREAM};
+  EXPECT_TRUE(sources.connect(second, addr_, deadline));
+  EXPECT_EQ(2U, sources.n_binds());
+  EXPECT_EQ(1U, sources.n_exhausted());
+  EXPECT_EQ(1U, sources.metrics().port_capacity);
+  // the port is still free for other destinations
+  pdnnet::unique_socket other_listener{AF_INET, SOCK_STREAM};
+  auto other_addr = pdnnet::make_sockaddr_in(INADDR_LOOPBACK, ports[1]);
+  ASSERT_TRUE(pdnnet::bind(other_listener, other_addr)) << pdnnet::socket_error();
+  ASSERT_TRUE(pdnnet::listen(other_listener, 1U)) << pdnnet::socket_error();
+  pdnnet::unique_socket third{AF_INET, SOCK_STREAM};
+  err = sources.connect(third, other_addr, deadline);
+  ASSERT_FALSE(err) << *err;
+  EXPECT_EQ(ports[0], ntohs(local_addr(third).sin_port));
+}
+
+/**
+ * Test that abortive close does not leave the client in `TIME_WAIT`.
+ */
+TEST_F(SourceAddressTest, AbortiveCloseTest)
+{
+  pdnnet::source_address_pool sources;
+  sources.add(INADDR_LOOPBACK);
+  sources.abortive_close(true);
+  pdnnet::connection_pool pool;
+  pool.sources(&sources);
+  ASSERT_FALSE(pool.add("127.0.0.1", ntohs(addr_.sin_port)));
+  pdnnet::deadline deadline{std::chrono::milliseconds{1000}};
+  pdnnet::unique_socket socket;
+  auto err = pool.acquire(0U, socket, deadline);
+  ASSERT_FALSE(err) << *err;
+  linger value{};
+  socklen_t len = sizeof value;
+  ASSERT_EQ(0, ::getsockopt(socket, SOL_SOCKET, SO_LINGER, &value, &len));
+  EXPECT_TRUE(value.l_onoff);
+  EXPECT_EQ(0, value.l_linger);
+  // client closes first, so it would normally hold the port in TIME_WAIT
+  auto local = local_addr(socket);
+  auto server = pdnnet::accept(listener_);
+  socket = {};
+  std::string buf;
+  EXPECT_TRUE(pdnnet::read(server, buf, deadline));
+  // the same source port can be bound again right away without SO_REUSEADDR
+  pdnnet::unique_socket rebind{AF_INET, SOCK_STREAM};
+  EXPECT_TRUE(pdnnet::bind(rebind, local)) << pdnnet::socket_error();
+}
+#endif  // PDNNET_LINUX
+
+}  // namespace
@@ -0,0 +1,91 @@
+/**
+ * @file tsc_clock_test.cc
+ * @author Derek Huang
+ * @brief tsc_clock.hh unit tests
+ * @copyright MIT License
+ */
+
+#include "pdnnet/tsc_clock.hh"
+
+#include <chrono>
+#include <cstdint>
+#include <thread>
+#include <type_traits>
+
+#include <gtest/gtest.h>
+
+namespace {
+
+/**
+ * TSC clock testing fixture.
+ *
+ * Calibrates the clock up front so no test pays for it.
+ */
+class TscClockTest : public ::testing::Test {
+protected:
+  static void SetUpTestSuite()
+  {
+    pdnnet::tsc_clock::calibrate();
+  }
+};
+
+/**
+ * Test that the clock meets the standard clock requirements.
+ */
+TEST_F(TscClockTest, TraitsTest)
+{
+  static_assert(
+    std::is_same_v<
+      std::chrono::time_point<pdnnet::tsc_clock>, pdnnet::tsc_clock::time_point
+    >
+  );
+  static_assert(pdnnet::tsc_clock::is_steady);
+  static_assert(
+    std::is_same_v<std::chrono::nanoseconds, pdnnet::tsc_clock::duration>
+  );
+  // frequency is only known when the TSC is used
+  if (pdnnet::tsc_clock::tsc())
+    EXPECT_GT(pdnnet::tsc_clock::frequency(), 1e8);
+  else
+    EXPECT_EQ(0., pdnnet::tsc_clock::frequency());
+}
+
+/**
+ * Test that readings never go backwards.
+ */
+TEST_F(TscClockTest, MonotonicTest)
+{
+  auto last = pdnnet::tsc_clock::now();
+  for (int i = 0; i < 100000; i++) {
+    auto now = (i % 2) ? pdnnet::tsc_clock::now() : pdnnet::tsc_clock::now_ordered();
+    ASSERT_GE(now, last);
+    last = now;
+  }
+}
+
+/**
+ * Test that the clock agrees with the steady clock.
+ */
+TEST_F(TscClockTest, SteadyTest)
+{
+  using std::chrono::milliseconds;
+  using std::chrono::steady_clock;
+  // same epoch, allowing for calibration error and preemption
+  auto steady = steady_clock::now();
+  auto tsc = pdnnet::tsc_clock::now();
+  auto offset = pdnnet::tsc_clock::to_steady(tsc) - steady;
+  EXPECT_LT(std::chrono::abs(offset), milliseconds{5});
+  EXPECT_EQ(
+    tsc, pdnnet::tsc_clock::from_steady(pdnnet::tsc_clock::to_steady(tsc))
+  );
+  // same rate over an interval
+  auto steady_start = steady_clock::now();
+  auto tsc_start = pdnnet::tsc_clock::now();
+  std::this_thread::sleep_for(milliseconds{100});
+  auto tsc_elapsed = pdnnet::tsc_clock::now() - tsc_start;
+  auto steady_elapsed = steady_clock::now() - steady_start;
+  EXPECT_LT(std::chrono::abs(tsc_elapsed - steady_elapsed), milliseconds{2});
+  EXPECT_GE(tsc_elapsed, milliseconds{100});
+}
+
+}  // namespace
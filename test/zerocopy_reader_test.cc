@@ -0,0 +1,140 @@
+/**
+ * @file zerocopy_reader_test.cc
+ * @author Derek Huang
+ * @brief zerocopy_reader.hh unit tests
+ * @copyright MIT License
+ */
+
+#include "pdnnet/zerocopy_reader.hh"
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include <thread>
+#include <tuple>
+
+#include <gtest/gtest.h>
+
+#include "pdnnet/memory.hh"
+#include "pdnnet/socket.hh"
+
+#include "loopback.hh"
+
+namespace {
+
+/**
+ * Zero-copy reader testing fixture.
+ *
+ * Creates a connected pair of loopback TCP sockets for each test. Loopback
+ * segments are rarely page-aligned, so most bytes take the copying path.
+ */
+class ZerocopyReaderTest : public ::testing::Test {
+protected:
+  /**
+   * Connect the loopback socket pair.
+   */
+  void SetUp() override
+  {
+    std::tie(writer_socket_, reader_socket_) = pdnnet::test::loopback_pair();
+  }
+
+  /**
+   * Return test data with a pattern that catches reordered or dropped pages.
+   *
+   * @param size Number of bytes
+   */
+  static auto make_data(std::size_t size)
+  {
+    std::string data;
+    for (std::size_t i = 0; data.size() < size; i++)
+      data += std::to_string(i) + ' ';
+    data.resize(size);
+    return data;
+  }
+
+  /**
+   * Read all spans until end of transmission.
+   *
+   * @param reader Reader to read from
+   * @param out String to append bytes to
+   */
+  static void read_all(pdnnet::zerocopy_reader& reader, std::string& out)
+  {
+    pdnnet::byte_span span;
+    do {
+      auto err = reader.next(span);
+      ASSERT_FALSE(err) << *err;
+      out += span.view();
+    }
+    while (!reader.eof());
+  }
+
+  pdnnet::unique_socket writer_socket_;
+  pdnnet::unique_socket reader_socket_;
+};
+
+/**
+ * Test that a bulk transfer is received intact.
+ */
+TEST_F(ZerocopyReaderTest, BulkTest)
+{
+  auto data = make_data(8U << 20);
+  std::thread writer{
+    [this, &data]
+    {
+      EXPECT_FALSE((pdnnet::socket_writer{writer_socket_, true}(data)));
+    }
+  };
+  std::string received;
+  {
+    pdnnet::zerocopy_reader reader{reader_socket_};
+    read_all(reader, received);
+    EXPECT_EQ(data.size(), reader.n_mapped() + reader.n_copied());
+    if (reader.zerocopy()) {
+      EXPECT_EQ(0U, reader.map_size() % 4096U);
+    }
+  }
+  writer.join();
+  EXPECT_EQ(data, received);
+}
+
+/**
+ * Test that disabling mapping copies every byte.
+ */
+TEST_F(ZerocopyReaderTest, CopyTest)
+{
+  auto data = make_data(1U << 20);
+  std::thread writer{
+    [this, &data]
+    {
+      EXPECT_FALSE((pdnnet::socket_writer{writer_socket_, true}(data)));
+    }
+  };
+  std::string received;
+  pdnnet::zerocopy_reader reader{reader_socket_, 0U};
+  EXPECT_FALSE(reader.zerocopy());
+  read_all(reader, received);
+  writer.join();
+  EXPECT_EQ(data, received);
+  EXPECT_EQ(0U, reader.n_mapped());
+  EXPECT_EQ(data.size(), reader.n_copied());
+}
+
+/**
+ * Test that a poll timeout returns an empty span without ending input.
+ */
+TEST_F(ZerocopyReaderTest, TimeoutTest)
+{
+  pdnnet::zerocopy_reader reader{
+    reader_socket_, pdnnet::zerocopy_map_size, std::chrono::milliseconds{10}
+  };
+  pdnnet::byte_span span;
+  ASSERT_FALSE(reader.next(span));
+  EXPECT_TRUE(span.empty());
+  EXPECT_FALSE(reader.eof());
+  ASSERT_FALSE(pdnnet::socket_writer{writer_socket_}("hello"));
+  ASSERT_FALSE(reader.next(span));
+  EXPECT_EQ("hello", span.view());
+}
+
+}  // namespace